@@ -52,6 +52,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <gmssl/ghash.h>
 
 #define AES128_KEY_BITS		128
 #define AES192_KEY_BITS		192
@@ -107,6 +108,22 @@ int aes_gcm_decrypt(const AES_KEY *key, const uint8_t *iv, size_t ivlen,
 	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
 	const uint8_t *tag, size_t taglen, uint8_t *out);
 
+// AES-GCM with a prepared key, as SM4_GCM_KEY in sm4.h
+typedef struct {
+	AES_KEY aes_key;
+	GHASH_KEY ghash_key;
+} AES_GCM_KEY;
+
+int aes_gcm_set_key(AES_GCM_KEY *key, const uint8_t *raw_key, size_t raw_keylen);
+
+int aes_gcm_encrypt_with_key(const AES_GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	uint8_t *out, size_t taglen, uint8_t *tag);
+
+int aes_gcm_decrypt_with_key(const AES_GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	const uint8_t *tag, size_t taglen, uint8_t *out);
+
 
 #ifdef  __cplusplus
 }
@@ -127,6 +127,30 @@ void digest_ctx_cleanup(DIGEST_CTX *ctx);
 int digest(const DIGEST *digest, const unsigned char *data, size_t datalen,
 	unsigned char *dgst, size_t *dgstlen);
 
+/*
+ * Checkpoint an unfinished SM3 or SHA-2 context in a versioned, big-endian
+ * format, e.g. to resume hashing after a restart without replaying input.
+ * Like the *_to_der() functions, serialize adds the length to *outlen and
+ * writes to *out only if out and *out are not NULL. deserialize consumes
+ * one context from *in and leaves ctx untouched on error.
+ */
+#define DIGEST_CTX_SERIALIZE_VERSION	1
+
+enum {
+	DIGEST_CTX_SERIALIZE_SM3 = 1,
+	DIGEST_CTX_SERIALIZE_SHA224 = 2,
+	DIGEST_CTX_SERIALIZE_SHA256 = 3,
+	DIGEST_CTX_SERIALIZE_SHA384 = 4,
+	DIGEST_CTX_SERIALIZE_SHA512 = 5,
+	DIGEST_CTX_SERIALIZE_SHA512_224 = 6,
+	DIGEST_CTX_SERIALIZE_SHA512_256 = 7,
+};
+
+#define DIGEST_CTX_SERIALIZE_MAX_SIZE	(2 + 8 * 8 + 8 + 1 + DIGEST_MAX_BLOCK_SIZE - 1)
+
+int digest_ctx_serialize(const DIGEST_CTX *ctx, uint8_t **out, size_t *outlen);
+int digest_ctx_deserialize(DIGEST_CTX *ctx, const uint8_t **in, size_t *inlen);
+
 const char *digest_algor_name(int oid);
 int digest_algor_to_der(int oid, uint8_t **out, size_t *outlen);
 int digest_algor_from_der(int *oid, uint32_t *nodes, size_t *nodes_count,
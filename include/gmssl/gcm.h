@@ -54,6 +54,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <gmssl/gf128.h>
+#include <gmssl/ghash.h>
 #include <gmssl/block_cipher.h>
 
 
@@ -93,6 +94,25 @@ int gcm_decrypt(const BLOCK_CIPHER_KEY *key, const uint8_t *iv, size_t ivlen,
 	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
 	const uint8_t *tag, size_t taglen, uint8_t *out);
 
+// GCM key prepared once (cipher round keys and GHASH table)
+typedef struct {
+	union {
+		SM4_GCM_KEY sm4_gcm_key;
+		AES_GCM_KEY aes_gcm_key;
+	} u;
+	const BLOCK_CIPHER *cipher;
+} GCM_KEY;
+
+int gcm_set_key(GCM_KEY *key, const BLOCK_CIPHER *cipher, const uint8_t *raw_key);
+
+int gcm_encrypt_with_key(const GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	uint8_t *out, size_t taglen, uint8_t *tag);
+
+int gcm_decrypt_with_key(const GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	const uint8_t *tag, size_t taglen, uint8_t *out);
+
 
 
 
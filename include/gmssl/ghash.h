@@ -0,0 +1,110 @@
+﻿/*
+ * Copyright (c) 2014 - 2020 The GmSSL Project.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgment:
+ *    "This product includes software developed by the GmSSL Project.
+ *    (http://gmssl.org/)"
+ *
+ * 4. The name "GmSSL Project" must not be used to endorse or promote
+ *    products derived from this software without prior written
+ *    permission. For written permission, please contact
+ *    guanzhi1980@gmail.com.
+ *
+ * 5. Products derived from this software may not be called "GmSSL"
+ *    nor may "GmSSL" appear in their names without prior written
+ *    permission of the GmSSL Project.
+ *
+ * 6. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by the GmSSL Project
+ *    (http://gmssl.org/)"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE GmSSL PROJECT ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE GmSSL PROJECT OR
+ * ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GMSSL_GHASH_H
+#define GMSSL_GHASH_H
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * GHASH keyed once with H = E_K(0^128). htable holds the 16 multiples
+ * i * H for the portable 4-bit (Shoup) multiplication, hpow holds
+ * H^1..H^8 for the PCLMULQDQ backend so that 8 blocks share one
+ * reduction. Building with GHASH_CONST_TIME replaces the 4-bit table
+ * loads by masked XORs, for targets where secret-indexed loads matter.
+ */
+typedef struct {
+	uint64_t htable[16][2];
+	uint64_t hpow[8][2];
+} GHASH_KEY;
+
+void ghash_set_key(GHASH_KEY *key, const uint8_t h[16]);
+
+// X = (X xor B_i) * H for each 16-byte block B_i of in
+void ghash_blocks(const GHASH_KEY *key, uint8_t X[16], const uint8_t *in, size_t nblocks);
+
+// as ghash_blocks(), the last partial block is padded with zeros
+void ghash_blocks_padded(const GHASH_KEY *key, uint8_t X[16], const uint8_t *in, size_t inlen);
+
+// GHASH(H, A, C) of gcm.h ghash() with a prepared key
+void ghash_with_key(const GHASH_KEY *key, const uint8_t *aad, size_t aadlen,
+	const uint8_t *c, size_t clen, uint8_t out[16]);
+
+/*
+ * Streaming GHASH(H, A, C): any number of ghash_update_aad() calls, then
+ * any number of ghash_update() calls on the ciphertext. AAD after the
+ * first ghash_update() is an error.
+ */
+typedef struct {
+	GHASH_KEY key;
+	uint8_t X[16];
+	uint8_t block[16];
+	size_t num;
+	uint64_t aadlen;
+	uint64_t clen;
+	int aad_done;
+} GHASH_CTX;
+
+void ghash_init(GHASH_CTX *ctx, const uint8_t h[16]);
+void ghash_init_with_key(GHASH_CTX *ctx, const GHASH_KEY *key);
+int ghash_update_aad(GHASH_CTX *ctx, const uint8_t *aad, size_t aadlen);
+void ghash_update(GHASH_CTX *ctx, const uint8_t *c, size_t clen);
+void ghash_finish(GHASH_CTX *ctx, uint8_t out[16]);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -60,17 +60,38 @@ extern "C" {
 #define HMAC_MAX_SIZE	(DIGEST_MAX_SIZE)
 
 
-typedef struct hmac_ctx_st {
+/*
+ * HMAC key schedule: the digest states after (K ^ ipad) and (K ^ opad).
+ * Set it once with hmac_set_key() and start every message from it with
+ * hmac_init_with_key(), which neither hashes nor pads the key again. The
+ * key must outlive the contexts initialized from it.
+ */
+typedef struct {
 	const DIGEST *digest;
-	DIGEST_CTX digest_ctx;
 	DIGEST_CTX i_ctx;
 	DIGEST_CTX o_ctx;
+} HMAC_KEY;
+
+/*
+ * ctx->key points either to an external HMAC_KEY or to ctx->key_buf, so an
+ * HMAC_CTX must be copied with hmac_ctx_clone(), not memcpy().
+ */
+typedef struct hmac_ctx_st {
+	const DIGEST *digest;
+	DIGEST_CTX digest_ctx;
+	const HMAC_KEY *key;
+	HMAC_KEY key_buf;
 } HMAC_CTX;
 
 
 size_t hmac_size(const HMAC_CTX *ctx);
 
+int hmac_set_key(HMAC_KEY *hmac_key, const DIGEST *digest, const unsigned char *key, size_t keylen);
+void hmac_key_cleanup(HMAC_KEY *hmac_key);
+
 int hmac_init(HMAC_CTX *ctx, const DIGEST *digest, const unsigned char *key, size_t keylen);
+int hmac_init_with_key(HMAC_CTX *ctx, const HMAC_KEY *hmac_key);
+int hmac_ctx_clone(HMAC_CTX *dst, const HMAC_CTX *src);
 int hmac_update(HMAC_CTX *ctx, const unsigned char *data, size_t datalen);
 int hmac_finish(HMAC_CTX *ctx, unsigned char *mac, size_t *maclen);
 
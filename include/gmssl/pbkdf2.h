@@ -70,6 +70,37 @@ int pbkdf2_genkey(const DIGEST *digest,
 	const uint8_t *salt, size_t saltlen,
 	size_t count, size_t outlen, uint8_t *out);
 
+/*
+ * The T_i blocks of one derivation are independent, pbkdf2_genkey_mt()
+ * computes them on up to num_threads threads. Only outputs longer than one
+ * digest benefit.
+ */
+int pbkdf2_genkey_mt(const DIGEST *digest,
+	const char *pass, size_t passlen,
+	const uint8_t *salt, size_t saltlen,
+	size_t count, size_t outlen, uint8_t *out,
+	int num_threads);
+
+typedef struct {
+	const char *pass;
+	size_t passlen;
+	const uint8_t *salt;
+	size_t saltlen;
+	size_t count;
+	size_t outlen;
+	uint8_t *out;
+} PBKDF2_JOB;
+
+/*
+ * Derive the keys of n independent jobs, e.g. a directory of encrypted
+ * PKCS #8 keys. With DIGEST_sm3() the jobs share the multi-buffer SM3
+ * lanes when AVX2 is available, other digests run one job at a time.
+ * All jobs are checked first; an empty password fails with every digest,
+ * as in hmac_set_key().
+ */
+int pbkdf2_genkey_batch(const DIGEST *digest, const PBKDF2_JOB *jobs, size_t n);
+int pbkdf2_genkey_batch_mt(const DIGEST *digest, const PBKDF2_JOB *jobs, size_t n, int num_threads);
+
 
 #ifdef __cplusplus
 }
@@ -89,6 +89,13 @@ typedef struct {
 } SM2_KEY;
 
 int sm2_keygen(SM2_KEY *key);
+/*
+ * Generate n key pairs with one field inversion per batch of public keys.
+ * sm2_keygen_batch_mt splits the keys over num_threads threads when built
+ * with pthread support.
+ */
+int sm2_keygen_batch(SM2_KEY *keys, size_t n);
+int sm2_keygen_batch_mt(SM2_KEY *keys, size_t n, int num_threads);
 int sm2_set_private_key(SM2_KEY *key, const uint8_t private_key[32]);
 int sm2_set_public_key(SM2_KEY *key, const uint8_t public_key[64]); // FIXME: 这里是否应该用octets呢？这算是椭圆曲线点的一个公开格式了
 int sm2_key_print(FILE *fp, const SM2_KEY *key, int format, int indent);
@@ -129,6 +136,18 @@ int sm2_do_sign(const SM2_KEY *key, const uint8_t dgst[32], SM2_SIGNATURE *sig);
 int sm2_do_verify(const SM2_KEY *key, const uint8_t dgst[32], const SM2_SIGNATURE *sig);
 int sm2_print_signature(FILE *fp, const uint8_t *sig, size_t siglen, int format, int indent);
 
+/*
+ * Verify n signatures, results[i] is 1 if sigs[i] is valid for dgsts[i] under
+ * keys[i], 0 if invalid and -1 if malformed. Returns 1 if all signatures are
+ * valid, 0 if any is not and -1 on error. Repeated keys share precomputation.
+ * sm2_verify_batch_mt splits the batch over num_threads threads when built
+ * with pthread support.
+ */
+int sm2_verify_batch(const SM2_KEY *keys, const uint8_t (*dgsts)[32],
+	const SM2_SIGNATURE *sigs, size_t n, int *results);
+int sm2_verify_batch_mt(const SM2_KEY *keys, const uint8_t (*dgsts)[32],
+	const SM2_SIGNATURE *sigs, size_t n, int *results, int num_threads);
+
 #define SM2_MAX_SIGNATURE_SIZE 72
 
 int sm2_sign(const SM2_KEY *key, const uint8_t dgst[32], uint8_t *sig, size_t *siglen);
@@ -145,19 +164,95 @@ int sm2_verify(const SM2_KEY *key, const uint8_t dgst[32], const uint8_t *sig, s
 #define SM2_DEFAULT_ID_DIGEST_LENGTH		SM3_DIGEST_LENGTH
 
 
+/*
+ * Signing key for repeated signing with one key and ID: holds the public
+ * key, (1 + d)^-1 mod n (in Montgomery form) and the SM3 state after Z, so
+ * that neither is derived again for each message. The private scalar d is
+ * not kept.
+ */
+typedef struct {
+	SM2_POINT public_key;
+	uint8_t d_inv[32];
+	SM3_CTX sm3_ctx;
+} SM2_SIGN_KEY;
+
+int sm2_sign_key_init(SM2_SIGN_KEY *sk, const SM2_KEY *key, const char *id);
+int sm2_do_sign_with_key(const SM2_SIGN_KEY *sk, const uint8_t dgst[32], SM2_SIGNATURE *sig);
+void sm2_sign_key_cleanup(SM2_SIGN_KEY *sk);
+
+/*
+ * Presignature pool: (k, x1 mod n) pairs with (x1, y1) = k * G, made ahead of
+ * time by sm2_presign_fill() so that sm2_do_sign_with_pool() only needs a
+ * few scalar operations. The pool is a bounded lock-free ring, safe for
+ * concurrent fill and sign threads, and each pair is wiped when taken.
+ * sm2_presign_fill() adds up to max pairs (0 for as many as fit) and
+ * returns how many were added. sm2_presign_needs_refill() is true when no
+ * more than low_water pairs are left. When the pool is empty signing falls
+ * back to computing k * G online.
+ */
+#define SM2_PRESIGN_POOL_SIZE		64 // power of 2
+
+typedef struct {
+	uint8_t k[32];
+	uint8_t x1[32];
+	size_t seq;
+} SM2_PRESIGN;
+
+typedef struct {
+	SM2_PRESIGN slots[SM2_PRESIGN_POOL_SIZE];
+	size_t head;
+	size_t tail;
+	size_t low_water;
+} SM2_PRESIGN_POOL;
+
+int sm2_presign_pool_init(SM2_PRESIGN_POOL *pool, size_t low_water);
+int sm2_presign_fill(SM2_PRESIGN_POOL *pool, size_t max);
+size_t sm2_presign_count(const SM2_PRESIGN_POOL *pool);
+int sm2_presign_needs_refill(const SM2_PRESIGN_POOL *pool);
+int sm2_do_sign_with_pool(const SM2_SIGN_KEY *sk, SM2_PRESIGN_POOL *pool, const uint8_t dgst[32], SM2_SIGNATURE *sig);
+void sm2_presign_pool_cleanup(SM2_PRESIGN_POOL *pool);
+
 typedef struct {
 	SM2_KEY key;
 	SM3_CTX sm3_ctx;
 	int flags;
+	SM3_CTX z_ctx; // state after Z, restored by sm2_sign_reset
+	const SM2_SIGN_KEY *sign_key;
 } SM2_SIGN_CTX;
 
 int sm2_sign_init(SM2_SIGN_CTX *ctx, const SM2_KEY *key, const char *id);
 int sm2_sign_update(SM2_SIGN_CTX *ctx, const uint8_t *data, size_t datalen);
 int sm2_sign_finish(SM2_SIGN_CTX *ctx, uint8_t *sig, size_t *siglen);
+// sign_key must outlive the ctx
+int sm2_sign_init_with_key(SM2_SIGN_CTX *ctx, const SM2_SIGN_KEY *sign_key);
+// start a new message after a sign or verify finish, with the same key and ID
+int sm2_sign_reset(SM2_SIGN_CTX *ctx);
 int sm2_verify_init(SM2_SIGN_CTX *ctx, const SM2_KEY *key, const char *id);
 int sm2_verify_update(SM2_SIGN_CTX *ctx, const uint8_t *data, size_t datalen);
 int sm2_verify_finish(SM2_SIGN_CTX *ctx, const uint8_t *sig, size_t siglen);
 
+/*
+ * Verification key for repeated use of one public key and ID: holds the
+ * decoded public key, Z and the SM3 state after Z, and a fixed-base comb
+ * table of the public key (about 16 KB), so that s * G + t * P needs no
+ * per-call precomputation and few doublings.
+ */
+#define SM2_VERIFY_KEY_COMB_TEETH	6
+#define SM2_VERIFY_KEY_COMB_BLOCKS	4
+#define SM2_VERIFY_KEY_COMB_POINTS	((1 << SM2_VERIFY_KEY_COMB_TEETH) - 1)
+
+typedef struct {
+	SM2_POINT public_key;
+	uint8_t z[32];
+	SM3_CTX sm3_ctx;
+	uint64_t comb[SM2_VERIFY_KEY_COMB_BLOCKS][SM2_VERIFY_KEY_COMB_POINTS][8];
+} SM2_VERIFY_KEY;
+
+int sm2_verify_key_init(SM2_VERIFY_KEY *vk, const SM2_KEY *key, const char *id);
+int sm2_do_verify_with_key(const SM2_VERIFY_KEY *vk, const uint8_t dgst[32], const SM2_SIGNATURE *sig);
+int sm2_verify_with_key(const SM2_VERIFY_KEY *vk, const uint8_t *msg, size_t msglen, const uint8_t *sig, size_t siglen);
+void sm2_verify_key_cleanup(SM2_VERIFY_KEY *vk);
+
 
 typedef struct {
 	SM2_POINT point;
@@ -185,8 +280,62 @@ int sm2_encrypt(const SM2_KEY *key, const uint8_t *in, size_t inlen, uint8_t *ou
 int sm2_decrypt(const SM2_KEY *key, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
 int sm2_print_ciphertext(FILE *fp, const uint8_t *c, size_t clen, int format, int indent);
 
+/*
+ * Streaming encryption into the SM2Cipher DER of a plaintext of inlen bytes,
+ * with no SM2_MAX_PLAINTEXT limit. SM2_C1C3C2 is the GM/T 0009 field order
+ * (x, y, hash, ciphertext) and SM2_C1C2C3 the older one with the hash last.
+ *
+ * The DER is the prefix (everything before the C2 bytes), the C2 bytes from
+ * sm2_encrypt_update() and, for SM2_C1C2C3, the C3 OCTET STRING. For
+ * SM2_C1C2C3 the prefix is output by the first sm2_encrypt_update() and C3 by
+ * sm2_encrypt_finish(), so the output can be written out as it comes. For
+ * SM2_C1C3C2 the prefix holds C3 and is only output by sm2_encrypt_finish();
+ * the caller puts it in front of the C2 bytes, its size is known from
+ * sm2_encrypt_init(). An update output needs inlen + SM2_ENC_PREFIX_MAX_SIZE
+ * bytes, a finish output SM2_ENC_PREFIX_MAX_SIZE.
+ *
+ * sm2_decrypt_update() takes the DER in pieces of any size and outputs the
+ * plaintext as C2 arrives. It is not authenticated until sm2_decrypt_finish()
+ * returns 1, which it only does when the whole DER is consumed and C3 matches.
+ */
+#define SM2_C1C3C2		0
+#define SM2_C1C2C3		1
+
+// SEQUENCE header, INTEGER x, INTEGER y, OCTET STRING hash, OCTET STRING header
+#define SM2_ENC_PREFIX_MAX_SIZE	(6 + 35 + 35 + 34 + 6)
+
+typedef struct {
+	SM3_KDF_CTX kdf_ctx; // KDF of x2 || y2
+	SM3_CTX sm3_ctx; // C3 state after x2 || M
+	uint8_t y2[32];
+	int order;
+	int state;
+	size_t c2_len;
+	size_t c2_done;
+	uint8_t buf[SM2_ENC_PREFIX_MAX_SIZE];
+	size_t buf_len;
+	uint8_t hash[32]; // C3 read by sm2_decrypt_update()
+	const SM2_KEY *key;
+} SM2_ENC_CTX;
+
+int sm2_encrypt_init(SM2_ENC_CTX *ctx, const SM2_KEY *key, size_t inlen, int order, size_t *prefixlen);
+int sm2_encrypt_update(SM2_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
+int sm2_encrypt_finish(SM2_ENC_CTX *ctx, uint8_t *out, size_t *outlen);
+int sm2_decrypt_init(SM2_ENC_CTX *ctx, const SM2_KEY *key, int order);
+int sm2_decrypt_update(SM2_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
+int sm2_decrypt_finish(SM2_ENC_CTX *ctx);
+
 int sm2_ecdh(const SM2_KEY *key, const SM2_POINT *peer_public, SM2_POINT *out);
 
+/*
+ * Multi-buffer signing and ECDH over n independent inputs, keys are made in
+ * bulk by sm2_keygen_batch(). Groups of 4 run in parallel on the AVX2 backend
+ * when the CPU has it, and one by one otherwise; the results are the same as
+ * from the single versions.
+ */
+int sm2_do_sign_mb(const SM2_KEY *keys, const uint8_t (*dgsts)[32], SM2_SIGNATURE *sigs, size_t n);
+int sm2_ecdh_mb(const SM2_KEY *keys, const SM2_POINT *peers, SM2_POINT *outs, size_t n);
+
 
 int sm2_algo_selftest(void);
 
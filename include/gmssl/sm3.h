@@ -50,6 +50,7 @@
 #define GMSSL_SM3_H
 
 #include <string.h>
+#include <stdio.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -77,13 +78,34 @@ void sm3_update(SM3_CTX *ctx, const uint8_t *data, size_t datalen);
 void sm3_finish(SM3_CTX *ctx, uint8_t dgst[SM3_DIGEST_SIZE]);
 void sm3_digest(const uint8_t *data, size_t datalen, uint8_t dgst[SM3_DIGEST_SIZE]);
 
+/*
+ * dgsts[i] = SM3(msgs[i]) for n independent messages, 8 at a time on AVX2
+ * when the CPU has it and one by one otherwise.
+ */
+void sm3_digest_multi(const uint8_t **msgs, const size_t *lens, size_t n,
+	uint8_t (*dgsts)[SM3_DIGEST_SIZE]);
+
+
+/*
+ * An expanded HMAC-SM3 key: the SM3 states after compressing K ^ ipad and
+ * K ^ opad. A MAC under it costs the message blocks plus one outer block.
+ * sm3_hmac_finish() keeps the key in the context, so sm3_hmac_reset()
+ * starts the next message without going through the key again.
+ */
+typedef struct {
+	uint32_t ipad_digest[SM3_STATE_WORDS];
+	uint32_t opad_digest[SM3_STATE_WORDS];
+} SM3_HMAC_KEY;
 
 typedef struct {
 	SM3_CTX sm3_ctx;
-	unsigned char key[SM3_BLOCK_SIZE];
+	SM3_HMAC_KEY key;
 } SM3_HMAC_CTX;
 
+void sm3_hmac_set_key(SM3_HMAC_KEY *hmac_key, const uint8_t *key, size_t keylen);
 void sm3_hmac_init(SM3_HMAC_CTX *ctx, const uint8_t *key, size_t keylen);
+void sm3_hmac_init_with_key(SM3_HMAC_CTX *ctx, const SM3_HMAC_KEY *hmac_key);
+void sm3_hmac_reset(SM3_HMAC_CTX *ctx);
 void sm3_hmac_update(SM3_HMAC_CTX *ctx, const uint8_t *data, size_t datalen);
 void sm3_hmac_finish(SM3_HMAC_CTX *ctx, uint8_t mac[SM3_HMAC_SIZE]);
 void sm3_hmac(const uint8_t *key, size_t keylen,
@@ -91,6 +113,62 @@ void sm3_hmac(const uint8_t *key, size_t keylen,
 	uint8_t mac[SM3_HMAC_SIZE]);
 
 
+/*
+ * SM3 KDF of GB/T 32918: SM3(Z || 1) || SM3(Z || 2) || ... The shared input Z
+ * is given with sm3_kdf_update() and hashed once, then sm3_kdf_generate() can
+ * be called any number of times for the next outlen bytes of the output. The
+ * first sm3_kdf_generate() fixes Z, sm3_kdf_update() must not be called after
+ * it.
+ */
+typedef struct {
+	SM3_CTX sm3_ctx; // state after Z
+	uint8_t tail[SM3_BLOCK_SIZE * 2];
+	size_t tail_blocks;
+	uint32_t counter;
+	uint8_t out[SM3_DIGEST_SIZE];
+	size_t out_used;
+} SM3_KDF_CTX;
+
+void sm3_kdf_init(SM3_KDF_CTX *ctx);
+void sm3_kdf_update(SM3_KDF_CTX *ctx, const uint8_t *data, size_t datalen);
+void sm3_kdf_generate(SM3_KDF_CTX *ctx, uint8_t *out, size_t outlen);
+void sm3_kdf_cleanup(SM3_KDF_CTX *ctx);
+void sm3_kdf(const uint8_t *in, size_t inlen, size_t outlen, uint8_t *out);
+
+
+/*
+ * SM3 tree hash, version 1, for very large inputs. The input is cut into
+ * leaf_size byte leaves, the last one may be shorter and an empty input is
+ * one empty leaf. Every leaf is hashed with SM3 and the root is
+ *
+ *   SM3(0x01 || version || leaf_size || L_1 || ... || L_n || n || inlen)
+ *
+ * where version is one byte and leaf_size, n and inlen are 64-bit big
+ * endian. The result depends on leaf_size but not on the number of threads,
+ * and is not SM3(input). sm3_tree_update() hashes the leaves in order,
+ * sm3_tree_digest() hashes them on num_threads threads and
+ * sm3_tree_digest_file() maps the file into memory when it can.
+ */
+#define SM3_TREE_VERSION		1
+#define SM3_TREE_DEFAULT_LEAF_SIZE	(1024 * 1024)
+
+typedef struct {
+	SM3_CTX root_ctx;
+	SM3_CTX leaf_ctx;
+	uint64_t leaf_size;
+	uint64_t leaf_used;
+	uint64_t nleaves;
+	uint64_t inlen;
+} SM3_TREE_CTX;
+
+int sm3_tree_init(SM3_TREE_CTX *ctx, size_t leaf_size); // leaf_size: non-zero multiple of SM3_BLOCK_SIZE
+int sm3_tree_update(SM3_TREE_CTX *ctx, const uint8_t *data, size_t datalen);
+int sm3_tree_finish(SM3_TREE_CTX *ctx, uint8_t dgst[SM3_DIGEST_SIZE]);
+int sm3_tree_digest(const uint8_t *data, size_t datalen, size_t leaf_size, int num_threads,
+	uint8_t dgst[SM3_DIGEST_SIZE]);
+int sm3_tree_digest_file(FILE *fp, size_t leaf_size, int num_threads, uint8_t dgst[SM3_DIGEST_SIZE]);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -53,6 +53,7 @@
 #include <sys/types.h>
 #include <stdint.h>
 #include <string.h>
+#include <gmssl/ghash.h>
 
 
 #ifdef __cplusplus
@@ -74,10 +75,19 @@ void sm4_set_encrypt_key(SM4_KEY *sm4_key, const uint8_t key[16]);
 void sm4_set_decrypt_key(SM4_KEY *sm4_key, const uint8_t key[16]);
 void sm4_encrypt(const SM4_KEY *sm4_key, const uint8_t in[16], uint8_t out[16]);
 
+/*
+ * ECB on nblocks blocks, in and out may be the same buffer. Decryption is
+ * the same call with a key from sm4_set_decrypt_key(). On x86 CPUs with
+ * AES-NI and AVX2 it runs a constant-time kernel 8 or 16 blocks at a time,
+ * the modes below are built on it.
+ */
+void sm4_encrypt_blocks(const SM4_KEY *key, const uint8_t *in, uint8_t *out, size_t nblocks);
+
 
 void sm4_cbc_encrypt(const SM4_KEY *key, const uint8_t iv[16],
 	const uint8_t *in, size_t nblocks, uint8_t *out);
 
+// out may be in, or start before in
 void sm4_cbc_decrypt(const SM4_KEY *key, const uint8_t iv[16],
 	const uint8_t *in, size_t nblocks, uint8_t *out);
 
@@ -89,8 +99,14 @@ int sm4_cbc_padding_decrypt(const SM4_KEY *key, const uint8_t iv[16],
 	const uint8_t *in, size_t inlen,
 	uint8_t *out, size_t *outlen);
 
+/*
+ * ctr is updated for a following call. sm4_ctr_encrypt() increments all
+ * 128 bits, sm4_ctr32_encrypt() only the last 32 bits, as GCM does.
+ */
 void sm4_ctr_encrypt(const SM4_KEY *key, uint8_t ctr[16],
 	const uint8_t *in, size_t inlen, uint8_t *out);
+void sm4_ctr32_encrypt(const SM4_KEY *key, uint8_t ctr[16],
+	const uint8_t *in, size_t inlen, uint8_t *out);
 
 int sm4_gcm_encrypt(const SM4_KEY *key, const uint8_t *iv, size_t ivlen,
 	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
@@ -100,6 +116,27 @@ int sm4_gcm_decrypt(const SM4_KEY *key, const uint8_t *iv, size_t ivlen,
 	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
 	const uint8_t *tag, size_t taglen, uint8_t *out);
 
+/*
+ * SM4-GCM with the round keys and the GHASH table prepared once, for a
+ * key used on many messages (TLS records). The data is processed in one
+ * pass, each chunk of counter blocks is hashed while still in cache.
+ * On a tag mismatch sm4_gcm_decrypt_with_key() zeroes out.
+ */
+typedef struct {
+	SM4_KEY sm4_key;
+	GHASH_KEY ghash_key;
+} SM4_GCM_KEY;
+
+void sm4_gcm_set_key(SM4_GCM_KEY *key, const uint8_t raw_key[16]);
+
+int sm4_gcm_encrypt_with_key(const SM4_GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	uint8_t *out, size_t taglen, uint8_t *tag);
+
+int sm4_gcm_decrypt_with_key(const SM4_GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	const uint8_t *tag, size_t taglen, uint8_t *out);
+
 
 #ifdef __cplusplus
 }
@@ -57,6 +57,7 @@
 #include <gmssl/sm4.h>
 #include <gmssl/digest.h>
 #include <gmssl/block_cipher.h>
+#include <gmssl/gcm.h>
 
 
 #ifdef __cplusplus
@@ -402,8 +403,8 @@ typedef struct {
 	uint8_t client_certs[TLS_MAX_CERTIFICATES_SIZE];
 	size_t client_certs_len;
 
-	SM3_HMAC_CTX client_write_mac_ctx;
-	SM3_HMAC_CTX server_write_mac_ctx;
+	SM3_HMAC_KEY client_write_mac_key;
+	SM3_HMAC_KEY server_write_mac_key;
 	SM4_KEY client_write_enc_key;
 	SM4_KEY server_write_enc_key;
 	uint8_t client_seq_num[8];
@@ -418,8 +419,8 @@ typedef struct {
 
 
 
-	BLOCK_CIPHER_KEY client_write_key;
-	BLOCK_CIPHER_KEY server_write_key;
+	GCM_KEY client_write_key;
+	GCM_KEY server_write_key;
 
 } TLS_CONNECT;
 
@@ -464,11 +465,11 @@ int tls_prf(const uint8_t *secret, size_t secretlen, const char *label,
 	const uint8_t *more, size_t morelen,
 	size_t outlen, uint8_t *out);
 
-int tls_cbc_encrypt(const SM3_HMAC_CTX *hmac_ctx, const SM4_KEY *enc_key,
+int tls_cbc_encrypt(const SM3_HMAC_KEY *hmac_key, const SM4_KEY *enc_key,
 	const uint8_t seq_num[8], const uint8_t header[5],
 	const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
 
-int tls_cbc_decrypt(const SM3_HMAC_CTX *hmac_ctx, const SM4_KEY *dec_key,
+int tls_cbc_decrypt(const SM3_HMAC_KEY *hmac_key, const SM4_KEY *dec_key,
 	const uint8_t seq_num[8], const uint8_t header[5],
 	const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
 
@@ -482,10 +483,10 @@ const char *tls_version_text(int version);
 int tls_record_set_version(uint8_t *record, int version);
 
 
-int tls_record_encrypt(const SM3_HMAC_CTX *hmac_ctx, const SM4_KEY *cbc_key,
+int tls_record_encrypt(const SM3_HMAC_KEY *hmac_key, const SM4_KEY *cbc_key,
 	const uint8_t seq_num[8], const uint8_t *in, size_t inlen,
 	uint8_t *out, size_t *outlen);
-int tls_record_decrypt(const SM3_HMAC_CTX *hmac_ctx, const SM4_KEY *cbc_key,
+int tls_record_decrypt(const SM3_HMAC_KEY *hmac_key, const SM4_KEY *cbc_key,
 	const uint8_t seq_num[8], const uint8_t *in, size_t inlen,
 	uint8_t *out, size_t *outlen);
 
@@ -54,6 +54,7 @@
 #include <gmssl/gcm.h>
 #include <gmssl/error.h>
 #include "mem.h"
+#include "endian.h"
 
 
 void aes_cbc_encrypt(const AES_KEY *key, const uint8_t iv[16],
@@ -159,83 +160,165 @@ void aes_ctr_encrypt(const AES_KEY *key, uint8_t ctr[16], const uint8_t *in, siz
 	}
 }
 
-int aes_gcm_encrypt(const AES_KEY *key, const uint8_t *iv, size_t ivlen,
-	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
-	uint8_t *out, const size_t taglen, uint8_t *tag)
+#define AES_GCM_CHUNK_BLOCKS	16
+
+int aes_gcm_set_key(AES_GCM_KEY *key, const uint8_t *raw_key, size_t raw_keylen)
 {
-	const uint8_t *pin = in;
-	uint8_t *pout = out;
-	size_t left = inlen;
 	uint8_t H[16] = {0};
-	uint8_t Y[16];
-	uint8_t T[16];
 
-	aes_encrypt(key, H, H);
+	if (aes_set_encrypt_key(&key->aes_key, raw_key, raw_keylen) != 1) {
+		error_print();
+		return -1;
+	}
+	aes_encrypt(&key->aes_key, H, H);
+	ghash_set_key(&key->ghash_key, H);
+	memset(H, 0, sizeof(H));
+	return 1;
+}
+
+// J0 in Y, E_K(J0) in T, Y left at inc32(J0)
+static void aes_gcm_init_counter(const AES_GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	uint8_t Y[16], uint8_t T[16])
+{
+	uint32_t ctr32;
 
 	if (ivlen == 12) {
 		memcpy(Y, iv, 12);
 		Y[12] = Y[13] = Y[14] = 0;
 		Y[15] = 1;
 	} else {
-		ghash(H, NULL, 0, iv, ivlen, Y);
+		ghash_with_key(&key->ghash_key, NULL, 0, iv, ivlen, Y);
 	}
+	aes_encrypt(&key->aes_key, Y, T);
+	ctr32 = GETU32(Y + 12) + 1;
+	PUTU32(Y + 12, ctr32);
+}
 
-	aes_encrypt(key, Y, T);
+// CTR with the GCM inc32 counter, ctr is updated
+static void aes_ctr32_encrypt(const AES_KEY *key, uint8_t ctr[16],
+	const uint8_t *in, size_t inlen, uint8_t *out)
+{
+	uint8_t block[16];
+	uint32_t ctr32;
+	size_t len;
 
-	while (left) {
-		uint8_t block[16];
-		size_t len = left < 16 ? left : 16;
-		ctr_incr(Y);
-		aes_encrypt(key, Y, block);
-		gmssl_memxor(pout, pin, block, len);
-		pin += len;
-		pout += len;
-		left -= len;
+	while (inlen) {
+		len = inlen < 16 ? inlen : 16;
+		aes_encrypt(key, ctr, block);
+		gmssl_memxor(out, in, block, len);
+		ctr32 = GETU32(ctr + 12) + 1;
+		PUTU32(ctr + 12, ctr32);
+		in += len;
+		out += len;
+		inlen -= len;
 	}
-
-	ghash(H, aad, aadlen, out, inlen, H);
-	gmssl_memxor(tag, T, H, taglen);
-	return 1;
+	memset(block, 0, sizeof(block));
 }
 
-int aes_gcm_decrypt(const AES_KEY *key, const uint8_t *iv, size_t ivlen,
+// one pass, as sm4_gcm_encrypt_with_key()
+int aes_gcm_encrypt_with_key(const AES_GCM_KEY *key, const uint8_t *iv, size_t ivlen,
 	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
-	const uint8_t *tag, size_t taglen, uint8_t *out)
+	uint8_t *out, size_t taglen, uint8_t *tag)
 {
-	const uint8_t *pin = in;
-	uint8_t *pout = out;
-	size_t left = inlen;
-	uint8_t H[16] = {0};
 	uint8_t Y[16];
 	uint8_t T[16];
+	uint8_t X[16] = {0};
+	uint8_t L[16];
+	size_t len;
 
-	aes_encrypt(key, H, H);
+	if (taglen > 16) {
+		error_print();
+		return -1;
+	}
+	PUTU64(L, (uint64_t)aadlen << 3);
+	PUTU64(L + 8, (uint64_t)inlen << 3);
 
-	if (ivlen == 12) {
-		memcpy(Y, iv, 12);
-		Y[12] = Y[13] = Y[14] = 0;
-		Y[15] = 1;
-	} else {
-		ghash(H, NULL, 0, iv, ivlen, Y);
+	aes_gcm_init_counter(key, iv, ivlen, Y, T);
+	ghash_blocks_padded(&key->ghash_key, X, aad, aadlen);
+
+	while (inlen) {
+		len = inlen < 16 * AES_GCM_CHUNK_BLOCKS ? inlen : 16 * AES_GCM_CHUNK_BLOCKS;
+		aes_ctr32_encrypt(&key->aes_key, Y, in, len, out);
+		ghash_blocks_padded(&key->ghash_key, X, out, len);
+		in += len;
+		out += len;
+		inlen -= len;
 	}
 
-	ghash(H, aad, aadlen, in, inlen, H);
-	aes_encrypt(key, Y, T);
-	gmssl_memxor(T, T, H, taglen);
-	if (memcmp(T, tag, taglen) != 0) {
+	ghash_blocks(&key->ghash_key, X, L, 1);
+	gmssl_memxor(tag, T, X, taglen);
+	return 1;
+}
+
+int aes_gcm_decrypt_with_key(const AES_GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	const uint8_t *tag, size_t taglen, uint8_t *out)
+{
+	uint8_t Y[16];
+	uint8_t T[16];
+	uint8_t X[16] = {0};
+	uint8_t L[16];
+	uint8_t *p = out;
+	size_t left = inlen;
+	size_t len;
+
+	if (taglen > 16) {
 		error_print();
 		return -1;
 	}
+	PUTU64(L, (uint64_t)aadlen << 3);
+	PUTU64(L + 8, (uint64_t)inlen << 3);
+
+	aes_gcm_init_counter(key, iv, ivlen, Y, T);
+	ghash_blocks_padded(&key->ghash_key, X, aad, aadlen);
 
 	while (left) {
-		uint8_t block[16];
-		size_t len = left < 16 ? left : 16;
-		ctr_incr(Y);
-		aes_encrypt(key, Y, block);
-		gmssl_memxor(pout, pin, block, len);
-		pin += len;
-		pout += len;
+		len = left < 16 * AES_GCM_CHUNK_BLOCKS ? left : 16 * AES_GCM_CHUNK_BLOCKS;
+		ghash_blocks_padded(&key->ghash_key, X, in, len);
+		aes_ctr32_encrypt(&key->aes_key, Y, in, len, p);
+		in += len;
+		p += len;
 		left -= len;
 	}
+
+	ghash_blocks(&key->ghash_key, X, L, 1);
+	gmssl_memxor(T, T, X, taglen);
+	if (gmssl_memcmp(T, tag, taglen) != 0) {
+		memset(out, 0, inlen);
+		error_print();
+		return -1;
+	}
 	return 1;
 }
+
+int aes_gcm_encrypt(const AES_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	uint8_t *out, const size_t taglen, uint8_t *tag)
+{
+	AES_GCM_KEY gcm_key;
+	uint8_t H[16] = {0};
+	int ret;
+
+	gcm_key.aes_key = *key;
+	aes_encrypt(key, H, H);
+	ghash_set_key(&gcm_key.ghash_key, H);
+	ret = aes_gcm_encrypt_with_key(&gcm_key, iv, ivlen, aad, aadlen, in, inlen, out, taglen, tag);
+	memset(&gcm_key, 0, sizeof(gcm_key));
+	return ret;
+}
+
+int aes_gcm_decrypt(const AES_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	const uint8_t *tag, size_t taglen, uint8_t *out)
+{
+	AES_GCM_KEY gcm_key;
+	uint8_t H[16] = {0};
+	int ret;
+
+	gcm_key.aes_key = *key;
+	aes_encrypt(key, H, H);
+	ghash_set_key(&gcm_key.ghash_key, H);
+	ret = aes_gcm_decrypt_with_key(&gcm_key, iv, ivlen, aad, aadlen, in, inlen, tag, taglen, out);
+	memset(&gcm_key, 0, sizeof(gcm_key));
+	return ret;
+}
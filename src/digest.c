@@ -51,6 +51,8 @@
 #include <gmssl/sm3.h>
 #include <gmssl/oid.h>
 #include <gmssl/digest.h>
+#include <gmssl/error.h>
+#include "endian.h"
 
 
 int digest_nid(const DIGEST *digest)
@@ -525,3 +527,222 @@ const DIGEST *DIGEST_sha512_256(void)
 {
         return &sha512_256_digest_object;
 }
+
+
+/*
+ * Serialized DIGEST_CTX, all integers big-endian:
+ *
+ *	version		1 byte, DIGEST_CTX_SERIALIZE_VERSION
+ *	algor		1 byte, DIGEST_CTX_SERIALIZE_SM3 ...
+ *	state		8 words, 4 bytes each (SM3, SHA-224/256) or 8 bytes (SHA-384/512)
+ *	nblocks		8 bytes, compressed blocks
+ *	num		1 byte, buffered bytes, less than the block size
+ *	block		num bytes
+ *
+ * The algor byte is fixed by this format, not by the OID enum, so a
+ * checkpoint stays valid across library versions and hosts.
+ */
+
+typedef struct {
+	uint32_t *state32;
+	uint64_t *state64;
+	uint64_t *nblocks;
+	uint8_t *block;
+	size_t block_size;
+} DIGEST_CTX_FIELDS;
+
+static const struct {
+	int algor;
+	const DIGEST *(*digest)(void);
+} digest_serialize_table[] = {
+	{ DIGEST_CTX_SERIALIZE_SM3, DIGEST_sm3 },
+	{ DIGEST_CTX_SERIALIZE_SHA224, DIGEST_sha224 },
+	{ DIGEST_CTX_SERIALIZE_SHA256, DIGEST_sha256 },
+	{ DIGEST_CTX_SERIALIZE_SHA384, DIGEST_sha384 },
+	{ DIGEST_CTX_SERIALIZE_SHA512, DIGEST_sha512 },
+	{ DIGEST_CTX_SERIALIZE_SHA512_224, DIGEST_sha512_224 },
+	{ DIGEST_CTX_SERIALIZE_SHA512_256, DIGEST_sha512_256 },
+};
+
+static void digest_ctx_fields(DIGEST_CTX *ctx, int algor, DIGEST_CTX_FIELDS *f)
+{
+	memset(f, 0, sizeof(*f));
+	switch (algor) {
+	case DIGEST_CTX_SERIALIZE_SM3:
+		f->state32 = ctx->u.sm3_ctx.digest;
+		f->nblocks = &ctx->u.sm3_ctx.nblocks;
+		f->block = ctx->u.sm3_ctx.block;
+		f->block_size = SM3_BLOCK_SIZE;
+		break;
+	case DIGEST_CTX_SERIALIZE_SHA224:
+		f->state32 = ctx->u.sha224_ctx.state;
+		f->nblocks = &ctx->u.sha224_ctx.nblocks;
+		f->block = ctx->u.sha224_ctx.block;
+		f->block_size = SHA224_BLOCK_SIZE;
+		break;
+	case DIGEST_CTX_SERIALIZE_SHA256:
+		f->state32 = ctx->u.sha256_ctx.state;
+		f->nblocks = &ctx->u.sha256_ctx.nblocks;
+		f->block = ctx->u.sha256_ctx.block;
+		f->block_size = SHA256_BLOCK_SIZE;
+		break;
+	case DIGEST_CTX_SERIALIZE_SHA384:
+		f->state64 = ctx->u.sha384_ctx.state;
+		f->nblocks = &ctx->u.sha384_ctx.nblocks;
+		f->block = ctx->u.sha384_ctx.block;
+		f->block_size = SHA384_BLOCK_SIZE;
+		break;
+	default:
+		f->state64 = ctx->u.sha512_ctx.state;
+		f->nblocks = &ctx->u.sha512_ctx.nblocks;
+		f->block = ctx->u.sha512_ctx.block;
+		f->block_size = SHA512_BLOCK_SIZE;
+	}
+}
+
+static size_t digest_ctx_get_num(const DIGEST_CTX *ctx, int algor)
+{
+	switch (algor) {
+	case DIGEST_CTX_SERIALIZE_SM3: return ctx->u.sm3_ctx.num;
+	case DIGEST_CTX_SERIALIZE_SHA224: return (size_t)ctx->u.sha224_ctx.num;
+	case DIGEST_CTX_SERIALIZE_SHA256: return (size_t)ctx->u.sha256_ctx.num;
+	case DIGEST_CTX_SERIALIZE_SHA384: return (size_t)ctx->u.sha384_ctx.num;
+	}
+	return (size_t)ctx->u.sha512_ctx.num;
+}
+
+static void digest_ctx_set_num(DIGEST_CTX *ctx, int algor, size_t num)
+{
+	switch (algor) {
+	case DIGEST_CTX_SERIALIZE_SM3: ctx->u.sm3_ctx.num = num; break;
+	case DIGEST_CTX_SERIALIZE_SHA224: ctx->u.sha224_ctx.num = (int)num; break;
+	case DIGEST_CTX_SERIALIZE_SHA256: ctx->u.sha256_ctx.num = (int)num; break;
+	case DIGEST_CTX_SERIALIZE_SHA384: ctx->u.sha384_ctx.num = (int)num; break;
+	default: ctx->u.sha512_ctx.num = (int)num;
+	}
+}
+
+int digest_ctx_serialize(const DIGEST_CTX *ctx, uint8_t **out, size_t *outlen)
+{
+	DIGEST_CTX_FIELDS f;
+	int algor = 0;
+	size_t num, len;
+	size_t i;
+
+	if (!ctx || !ctx->digest || !outlen) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < sizeof(digest_serialize_table)/sizeof(digest_serialize_table[0]); i++) {
+		if (ctx->digest == digest_serialize_table[i].digest()) {
+			algor = digest_serialize_table[i].algor;
+			break;
+		}
+	}
+	if (!algor) {
+		error_print();
+		return -1;
+	}
+	digest_ctx_fields((DIGEST_CTX *)ctx, algor, &f);
+	num = digest_ctx_get_num(ctx, algor);
+	if (num >= f.block_size) {
+		error_print();
+		return -1;
+	}
+
+	len = 2 + (f.state32 ? 4 : 8) * 8 + 8 + 1 + num;
+	if (out && *out) {
+		uint8_t *p = *out;
+		*p++ = DIGEST_CTX_SERIALIZE_VERSION;
+		*p++ = (uint8_t)algor;
+		for (i = 0; i < 8; i++) {
+			if (f.state32) {
+				PUTU32(p, f.state32[i]);
+				p += 4;
+			} else {
+				PUTU64(p, f.state64[i]);
+				p += 8;
+			}
+		}
+		PUTU64(p, *f.nblocks);
+		p += 8;
+		*p++ = (uint8_t)num;
+		memcpy(p, f.block, num);
+		*out += len;
+	}
+	*outlen += len;
+	return 1;
+}
+
+int digest_ctx_deserialize(DIGEST_CTX *ctx, const uint8_t **in, size_t *inlen)
+{
+	const DIGEST *digest = NULL;
+	DIGEST_CTX tmp;
+	DIGEST_CTX_FIELDS f;
+	const uint8_t *p;
+	size_t len, num;
+	int algor;
+	size_t i;
+
+	if (!ctx || !in || !(*in) || !inlen) {
+		error_print();
+		return -1;
+	}
+	p = *in;
+	if (*inlen < 2) {
+		error_print();
+		return -1;
+	}
+	if (p[0] != DIGEST_CTX_SERIALIZE_VERSION) {
+		error_print();
+		return -1;
+	}
+	algor = p[1];
+	for (i = 0; i < sizeof(digest_serialize_table)/sizeof(digest_serialize_table[0]); i++) {
+		if (algor == digest_serialize_table[i].algor) {
+			digest = digest_serialize_table[i].digest();
+			break;
+		}
+	}
+	if (!digest) {
+		error_print();
+		return -1;
+	}
+
+	// ctx is only written once the whole input is checked
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.digest = digest;
+	digest_ctx_fields(&tmp, algor, &f);
+
+	len = 2 + (f.state32 ? 4 : 8) * 8 + 8 + 1;
+	if (*inlen < len) {
+		error_print();
+		return -1;
+	}
+	num = p[len - 1];
+	if (num >= f.block_size || *inlen - len < num) {
+		error_print();
+		return -1;
+	}
+
+	p += 2;
+	for (i = 0; i < 8; i++) {
+		if (f.state32) {
+			f.state32[i] = GETU32(p);
+			p += 4;
+		} else {
+			f.state64[i] = GETU64(p);
+			p += 8;
+		}
+	}
+	*f.nblocks = GETU64(p);
+	p += 8 + 1;
+	memcpy(f.block, p, num);
+	digest_ctx_set_num(&tmp, algor, num);
+	*ctx = tmp;
+	memset(&tmp, 0, sizeof(tmp));
+
+	*in += len + num;
+	*inlen -= len + num;
+	return 1;
+}
@@ -71,49 +71,11 @@
  */
 void ghash(const uint8_t h[16], const uint8_t *aad, size_t aadlen, const uint8_t *c, size_t clen, uint8_t out[16])
 {
-	gf128_t H = gf128_from_bytes(h);
-	gf128_t X = gf128_zero();
-	gf128_t L;
+	GHASH_KEY key;
 
-	PUTU64(out, (uint64_t)aadlen << 3);
-	PUTU64(out + 8, (uint64_t)clen << 3);
-	L = gf128_from_bytes(out);
-
-	while (aadlen) {
-		gf128_t A;
-		if (aadlen >= 16) {
-			A = gf128_from_bytes(aad);
-			aad += 16;
-			aadlen -= 16;
-		} else {
-			memset(out, 0, 16);
-			memcpy(out, aad, aadlen);
-			A = gf128_from_bytes(out);
-			aadlen = 0;
-		}
-		X = gf128_add(X, A);
-		X = gf128_mul(X, H);
-	}
-
-	while (clen) {
-		gf128_t C;
-		if (clen >= 16) {
-			C = gf128_from_bytes(c);
-			c += 16;
-			clen -= 16;
-		} else {
-			memset(out, 0, 16);
-			memcpy(out, c, clen);
-			C = gf128_from_bytes(out);
-			clen = 0;
-		}
-		X = gf128_add(X, C);
-		X = gf128_mul(X, H);
-	}
-
-	X = gf128_add(X, L);
-	H = gf128_mul(X, H);
-	gf128_to_bytes(H, out);
+	ghash_set_key(&key, h);
+	ghash_with_key(&key, aad, aadlen, c, clen, out);
+	memset(&key, 0, sizeof(key));
 }
 
 int gcm_encrypt(const BLOCK_CIPHER_KEY *key, const uint8_t *iv, size_t ivlen,
@@ -136,9 +98,53 @@ int gcm_decrypt(const BLOCK_CIPHER_KEY *key, const uint8_t *iv, size_t ivlen,
 	const uint8_t *tag, size_t taglen, uint8_t *out)
 {
 	if (key->cipher == BLOCK_CIPHER_sm4()) {
-		sm4_gcm_decrypt(&(key->u.sm4_key), iv, ivlen, aad, aadlen,  in, inlen, tag, taglen, out);
+		return sm4_gcm_decrypt(&(key->u.sm4_key), iv, ivlen, aad, aadlen,  in, inlen, tag, taglen, out);
+	} else if (key->cipher == BLOCK_CIPHER_aes128()) {
+		return aes_gcm_decrypt(&(key->u.aes_key), iv, ivlen, aad, aadlen,  in, inlen, tag, taglen, out);
+	}
+	error_print();
+	return -1;
+}
+
+int gcm_set_key(GCM_KEY *key, const BLOCK_CIPHER *cipher, const uint8_t *raw_key)
+{
+	memset(key, 0, sizeof(GCM_KEY));
+	if (cipher == BLOCK_CIPHER_sm4()) {
+		sm4_gcm_set_key(&(key->u.sm4_gcm_key), raw_key);
+	} else if (cipher == BLOCK_CIPHER_aes128()) {
+		if (aes_gcm_set_key(&(key->u.aes_gcm_key), raw_key, AES128_KEY_SIZE) != 1) {
+			error_print();
+			return -1;
+		}
+	} else {
+		error_print();
+		return -1;
+	}
+	key->cipher = cipher;
+	return 1;
+}
+
+int gcm_encrypt_with_key(const GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	uint8_t *out, size_t taglen, uint8_t *tag)
+{
+	if (key->cipher == BLOCK_CIPHER_sm4()) {
+		return sm4_gcm_encrypt_with_key(&(key->u.sm4_gcm_key), iv, ivlen, aad, aadlen, in, inlen, out, taglen, tag);
+	} else if (key->cipher == BLOCK_CIPHER_aes128()) {
+		return aes_gcm_encrypt_with_key(&(key->u.aes_gcm_key), iv, ivlen, aad, aadlen, in, inlen, out, taglen, tag);
+	}
+	error_print();
+	return -1;
+}
+
+int gcm_decrypt_with_key(const GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	const uint8_t *tag, size_t taglen, uint8_t *out)
+{
+	if (key->cipher == BLOCK_CIPHER_sm4()) {
+		return sm4_gcm_decrypt_with_key(&(key->u.sm4_gcm_key), iv, ivlen, aad, aadlen, in, inlen, tag, taglen, out);
 	} else if (key->cipher == BLOCK_CIPHER_aes128()) {
-		aes_gcm_decrypt(&(key->u.aes_key), iv, ivlen, aad, aadlen,  in, inlen, tag, taglen, out);
+		return aes_gcm_decrypt_with_key(&(key->u.aes_gcm_key), iv, ivlen, aad, aadlen, in, inlen, tag, taglen, out);
 	}
 	error_print();
 	return -1;
@@ -0,0 +1,327 @@
+﻿/*
+ * Copyright (c) 2014 - 2020 The GmSSL Project.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgment:
+ *    "This product includes software developed by the GmSSL Project.
+ *    (http://gmssl.org/)"
+ *
+ * 4. The name "GmSSL Project" must not be used to endorse or promote
+ *    products derived from this software without prior written
+ *    permission. For written permission, please contact
+ *    guanzhi1980@gmail.com.
+ *
+ * 5. Products derived from this software may not be called "GmSSL"
+ *    nor may "GmSSL" appear in their names without prior written
+ *    permission of the GmSSL Project.
+ *
+ * 6. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by the GmSSL Project
+ *    (http://gmssl.org/)"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE GmSSL PROJECT ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE GmSSL PROJECT OR
+ * ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <string.h>
+#include <gmssl/ghash.h>
+#include <gmssl/error.h>
+#include "cpu.h"
+#include "endian.h"
+
+
+/*
+ * Portable GHASH with 4-bit tables (Shoup's method, as in the GCM spec
+ * and OpenSSL gcm_gmult_4bit). Elements are two 64-bit words in GCM
+ * byte order, bit 0 of the spec is the top bit of hi. X * H is built
+ * from the last nibble of X backwards: Z = Z * x^4 + htable[nibble],
+ * where the 4 bits shifted out of Z are folded back with rem_4bit.
+ *
+ * Both tables are linear in their index: htable[n] is the XOR of the
+ * htable[1 << i] for the bits of n, and the same holds for rem_4bit. The
+ * constant-time build computes them that way with masks instead of
+ * indexing memory with secret nibbles.
+ */
+
+#define GHASH_R		0xe100000000000000ULL
+
+#ifndef GHASH_CONST_TIME
+static const uint64_t rem_4bit[16] = {
+	0x0000ULL << 48, 0x1c20ULL << 48, 0x3840ULL << 48, 0x2460ULL << 48,
+	0x7080ULL << 48, 0x6ca0ULL << 48, 0x48c0ULL << 48, 0x54e0ULL << 48,
+	0xe100ULL << 48, 0xfd20ULL << 48, 0xd940ULL << 48, 0xc560ULL << 48,
+	0x9180ULL << 48, 0x8da0ULL << 48, 0xa9c0ULL << 48, 0xb5e0ULL << 48,
+};
+#endif
+
+static inline uint64_t ghash_rem(uint64_t r)
+{
+#ifdef GHASH_CONST_TIME
+	return ((0 - (r & 1)) & (0x1c20ULL << 48))
+		^ ((0 - ((r >> 1) & 1)) & (0x3840ULL << 48))
+		^ ((0 - ((r >> 2) & 1)) & (0x7080ULL << 48))
+		^ ((0 - ((r >> 3) & 1)) & (0xe100ULL << 48));
+#else
+	return rem_4bit[r];
+#endif
+}
+
+static inline void ghash_lookup(const uint64_t htable[16][2], unsigned int n, uint64_t *hi, uint64_t *lo)
+{
+#ifdef GHASH_CONST_TIME
+	uint64_t mask;
+	int i;
+
+	*hi = *lo = 0;
+	for (i = 0; i < 4; i++) {
+		mask = 0 - (uint64_t)((n >> i) & 1);
+		*hi ^= htable[1 << i][0] & mask;
+		*lo ^= htable[1 << i][1] & mask;
+	}
+#else
+	*hi = htable[n][0];
+	*lo = htable[n][1];
+#endif
+}
+
+static void ghash_set_key_4bit(GHASH_KEY *key, const uint8_t h[16])
+{
+	uint64_t hi = GETU64(h);
+	uint64_t lo = GETU64(h + 8);
+	uint64_t t;
+	int i, j;
+
+	// htable[8] = H, htable[4] = H * x, htable[2] = H * x^2, htable[1] = H * x^3
+	key->htable[0][0] = key->htable[0][1] = 0;
+	for (i = 8; i > 0; i >>= 1) {
+		key->htable[i][0] = hi;
+		key->htable[i][1] = lo;
+		t = GHASH_R & (0 - (lo & 1));
+		lo = (hi << 63) | (lo >> 1);
+		hi = (hi >> 1) ^ t;
+	}
+	for (i = 2; i < 16; i <<= 1) {
+		for (j = 1; j < i; j++) {
+			key->htable[i + j][0] = key->htable[i][0] ^ key->htable[j][0];
+			key->htable[i + j][1] = key->htable[i][1] ^ key->htable[j][1];
+		}
+	}
+}
+
+static void ghash_blocks_4bit(const GHASH_KEY *key, uint8_t X[16], const uint8_t *in, size_t nblocks)
+{
+	uint64_t xhi = GETU64(X);
+	uint64_t xlo = GETU64(X + 8);
+	uint64_t zhi, zlo, thi, tlo;
+	uint8_t x[16];
+	unsigned int n;
+	int i;
+
+	while (nblocks--) {
+		PUTU64(x, xhi ^ GETU64(in));
+		PUTU64(x + 8, xlo ^ GETU64(in + 8));
+
+		ghash_lookup(key->htable, x[15] & 0xf, &zhi, &zlo);
+		n = x[15] >> 4;
+		for (i = 15; ; ) {
+			thi = ghash_rem(zlo & 0xf);
+			zlo = (zhi << 60) | (zlo >> 4);
+			zhi = (zhi >> 4) ^ thi;
+			ghash_lookup(key->htable, n, &thi, &tlo);
+			zhi ^= thi;
+			zlo ^= tlo;
+			if (--i < 0) {
+				break;
+			}
+
+			thi = ghash_rem(zlo & 0xf);
+			zlo = (zhi << 60) | (zlo >> 4);
+			zhi = (zhi >> 4) ^ thi;
+			ghash_lookup(key->htable, x[i] & 0xf, &thi, &tlo);
+			zhi ^= thi;
+			zlo ^= tlo;
+			n = x[i] >> 4;
+		}
+		xhi = zhi;
+		xlo = zlo;
+		in += 16;
+	}
+	PUTU64(X, xhi);
+	PUTU64(X + 8, xlo);
+	memset(x, 0, sizeof(x));
+}
+
+#ifdef HAVE_PCLMUL
+void ghash_pclmul_set_key(GHASH_KEY *key, const uint8_t h[16]);
+void ghash_pclmul_blocks(const GHASH_KEY *key, uint8_t X[16], const uint8_t *in, size_t nblocks);
+#endif
+
+void ghash_set_key(GHASH_KEY *key, const uint8_t h[16])
+{
+	memset(key, 0, sizeof(GHASH_KEY));
+	ghash_set_key_4bit(key, h);
+#ifdef HAVE_PCLMUL
+	if (cpu_has_pclmul()) {
+		ghash_pclmul_set_key(key, h);
+	}
+#endif
+}
+
+static void ghash_blocks_init(const GHASH_KEY *key, uint8_t X[16], const uint8_t *in, size_t nblocks);
+
+static void (*ghash_blocks_func)(const GHASH_KEY *key, uint8_t X[16], const uint8_t *in, size_t nblocks)
+	= ghash_blocks_init;
+
+// same choice as ghash_set_key(), so the key always has the table the backend reads
+static void ghash_blocks_init(const GHASH_KEY *key, uint8_t X[16], const uint8_t *in, size_t nblocks)
+{
+	void (*func)(const GHASH_KEY *key, uint8_t X[16], const uint8_t *in, size_t nblocks) = ghash_blocks_4bit;
+#ifdef HAVE_PCLMUL
+	if (cpu_has_pclmul()) {
+		func = ghash_pclmul_blocks;
+	}
+#endif
+	cpu_func_store(&ghash_blocks_func, func);
+	func(key, X, in, nblocks);
+}
+
+void ghash_blocks(const GHASH_KEY *key, uint8_t X[16], const uint8_t *in, size_t nblocks)
+{
+	cpu_func_load(&ghash_blocks_func)(key, X, in, nblocks);
+}
+
+void ghash_blocks_padded(const GHASH_KEY *key, uint8_t X[16], const uint8_t *in, size_t inlen)
+{
+	uint8_t block[16] = {0};
+
+	if (inlen >= 16) {
+		ghash_blocks(key, X, in, inlen / 16);
+		in += inlen - inlen % 16;
+		inlen %= 16;
+	}
+	if (inlen) {
+		memcpy(block, in, inlen);
+		ghash_blocks(key, X, block, 1);
+	}
+}
+
+void ghash_with_key(const GHASH_KEY *key, const uint8_t *aad, size_t aadlen,
+	const uint8_t *c, size_t clen, uint8_t out[16])
+{
+	uint8_t L[16];
+
+	PUTU64(L, (uint64_t)aadlen << 3);
+	PUTU64(L + 8, (uint64_t)clen << 3);
+
+	memset(out, 0, 16);
+	ghash_blocks_padded(key, out, aad, aadlen);
+	ghash_blocks_padded(key, out, c, clen);
+	ghash_blocks(key, out, L, 1);
+}
+
+void ghash_init(GHASH_CTX *ctx, const uint8_t h[16])
+{
+	memset(ctx, 0, sizeof(GHASH_CTX));
+	ghash_set_key(&ctx->key, h);
+}
+
+void ghash_init_with_key(GHASH_CTX *ctx, const GHASH_KEY *key)
+{
+	memset(ctx, 0, sizeof(GHASH_CTX));
+	ctx->key = *key;
+}
+
+// absorb data into the block buffer, the caller pads a partial block
+static void ghash_absorb(GHASH_CTX *ctx, const uint8_t *in, size_t inlen)
+{
+	size_t len;
+
+	if (!inlen) {
+		return;
+	}
+	if (ctx->num) {
+		len = 16 - ctx->num;
+		if (inlen < len) {
+			memcpy(ctx->block + ctx->num, in, inlen);
+			ctx->num += inlen;
+			return;
+		}
+		memcpy(ctx->block + ctx->num, in, len);
+		ghash_blocks(&ctx->key, ctx->X, ctx->block, 1);
+		in += len;
+		inlen -= len;
+	}
+	if (inlen >= 16) {
+		ghash_blocks(&ctx->key, ctx->X, in, inlen / 16);
+		in += inlen - inlen % 16;
+		inlen %= 16;
+	}
+	memcpy(ctx->block, in, inlen);
+	ctx->num = inlen;
+}
+
+static void ghash_flush(GHASH_CTX *ctx)
+{
+	if (ctx->num) {
+		memset(ctx->block + ctx->num, 0, 16 - ctx->num);
+		ghash_blocks(&ctx->key, ctx->X, ctx->block, 1);
+		ctx->num = 0;
+	}
+}
+
+int ghash_update_aad(GHASH_CTX *ctx, const uint8_t *aad, size_t aadlen)
+{
+	if (ctx->aad_done) {
+		error_print();
+		return -1;
+	}
+	ghash_absorb(ctx, aad, aadlen);
+	ctx->aadlen += aadlen;
+	return 1;
+}
+
+void ghash_update(GHASH_CTX *ctx, const uint8_t *c, size_t clen)
+{
+	if (!ctx->aad_done) {
+		ghash_flush(ctx);
+		ctx->aad_done = 1;
+	}
+	ghash_absorb(ctx, c, clen);
+	ctx->clen += clen;
+}
+
+void ghash_finish(GHASH_CTX *ctx, uint8_t out[16])
+{
+	uint8_t L[16];
+
+	ghash_flush(ctx);
+	PUTU64(L, ctx->aadlen << 3);
+	PUTU64(L + 8, ctx->clen << 3);
+	ghash_blocks(&ctx->key, ctx->X, L, 1);
+	memcpy(out, ctx->X, 16);
+	memset(ctx, 0, sizeof(GHASH_CTX));
+}
@@ -0,0 +1,168 @@
+﻿/*
+ * Copyright (c) 2014 - 2020 The GmSSL Project.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgment:
+ *    "This product includes software developed by the GmSSL Project.
+ *    (http://gmssl.org/)"
+ *
+ * 4. The name "GmSSL Project" must not be used to endorse or promote
+ *    products derived from this software without prior written
+ *    permission. For written permission, please contact
+ *    guanzhi1980@gmail.com.
+ *
+ * 5. Products derived from this software may not be called "GmSSL"
+ *    nor may "GmSSL" appear in their names without prior written
+ *    permission of the GmSSL Project.
+ *
+ * 6. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by the GmSSL Project
+ *    (http://gmssl.org/)"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE GmSSL PROJECT ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE GmSSL PROJECT OR
+ * ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * GHASH with PCLMULQDQ, after the Intel white paper "Intel Carry-Less
+ * Multiplication Instruction and its Usage for Computing the GCM Mode".
+ *
+ * Blocks are byte-reversed on load, so each bit-reflected GCM element is
+ * a plain 128-bit polynomial with one bit of shift lost in the product:
+ * the 256-bit product is shifted left by one before the reduction. Both
+ * steps are linear, so 8 blocks are multiplied by H^8..H^1, summed and
+ * reduced once:
+ *
+ *   X' = (X + B_1) * H^8 + B_2 * H^7 + ... + B_8 * H
+ */
+
+#include <immintrin.h>
+#include <gmssl/ghash.h>
+
+
+#define BSWAP128	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+
+
+static inline __m128i load_be(const uint8_t in[16])
+{
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in), _mm_setr_epi8(BSWAP128));
+}
+
+static inline void store_be(__m128i a, uint8_t out[16])
+{
+	_mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(a, _mm_setr_epi8(BSWAP128)));
+}
+
+// (hi, mid, lo) += a * b, the middle 128 bits are folded in by reduce()
+static inline void clmul_acc(__m128i a, __m128i b, __m128i *lo, __m128i *mid, __m128i *hi)
+{
+	*lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+	*hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x01));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x10));
+}
+
+// (hi, mid, lo) << 1 mod x^128 + x^7 + x^2 + x + 1
+static inline __m128i reduce(__m128i lo, __m128i mid, __m128i hi)
+{
+	__m128i t, u, v;
+
+	lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+	hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+	// 256-bit shift left by one
+	t = _mm_srli_epi32(lo, 31);
+	u = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	v = _mm_srli_si128(t, 12);
+	u = _mm_slli_si128(u, 4);
+	t = _mm_slli_si128(t, 4);
+	lo = _mm_or_si128(lo, t);
+	hi = _mm_or_si128(_mm_or_si128(hi, u), v);
+
+	// first phase
+	t = _mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30));
+	t = _mm_xor_si128(t, _mm_slli_epi32(lo, 25));
+	u = _mm_srli_si128(t, 4);
+	lo = _mm_xor_si128(lo, _mm_slli_si128(t, 12));
+
+	// second phase
+	t = _mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2));
+	t = _mm_xor_si128(t, _mm_srli_epi32(lo, 7));
+	t = _mm_xor_si128(t, u);
+	lo = _mm_xor_si128(lo, t);
+	return _mm_xor_si128(hi, lo);
+}
+
+static inline __m128i gfmul(__m128i a, __m128i b)
+{
+	__m128i lo = _mm_setzero_si128();
+	__m128i mid = _mm_setzero_si128();
+	__m128i hi = _mm_setzero_si128();
+
+	clmul_acc(a, b, &lo, &mid, &hi);
+	return reduce(lo, mid, hi);
+}
+
+// hpow[i] = H^(i+1)
+void ghash_pclmul_set_key(GHASH_KEY *key, const uint8_t h[16])
+{
+	__m128i H = load_be(h);
+	__m128i P = H;
+	int i;
+
+	_mm_storeu_si128((__m128i *)key->hpow[0], H);
+	for (i = 1; i < 8; i++) {
+		P = gfmul(P, H);
+		_mm_storeu_si128((__m128i *)key->hpow[i], P);
+	}
+}
+
+void ghash_pclmul_blocks(const GHASH_KEY *key, uint8_t X[16], const uint8_t *in, size_t nblocks)
+{
+	__m128i Y = load_be(X);
+	__m128i H = _mm_loadu_si128((const __m128i *)key->hpow[0]);
+	__m128i lo, mid, hi;
+	int i;
+
+	for (; nblocks >= 8; nblocks -= 8) {
+		lo = mid = hi = _mm_setzero_si128();
+		clmul_acc(_mm_xor_si128(Y, load_be(in)),
+			_mm_loadu_si128((const __m128i *)key->hpow[7]), &lo, &mid, &hi);
+		for (i = 1; i < 8; i++) {
+			clmul_acc(load_be(in + 16 * i),
+				_mm_loadu_si128((const __m128i *)key->hpow[7 - i]), &lo, &mid, &hi);
+		}
+		Y = reduce(lo, mid, hi);
+		in += 16 * 8;
+	}
+	while (nblocks--) {
+		Y = gfmul(_mm_xor_si128(Y, load_be(in)), H);
+		in += 16;
+	}
+	store_be(Y, X);
+}
@@ -171,32 +171,55 @@ int hex_to_bytes(const char *in, size_t inlen, uint8_t *out, size_t *outlen)
 }
 
 
+// 64-bit words through memcpy, so any alignment is fine
 void memxor(void *r, const void *a, size_t len)
 {
 	uint8_t *pr = r;
 	const uint8_t *pa = a;
+	uint64_t x, y;
 	size_t i;
-	for (i = 0; i < len; i++) {
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&x, pr + i, 8);
+		memcpy(&y, pa + i, 8);
+		x ^= y;
+		memcpy(pr + i, &x, 8);
+	}
+	for (; i < len; i++) {
 		pr[i] ^= pa[i];
 	}
-
 }
 
-
 void gmssl_memxor(void *r, const void *a, const void *b, size_t len)
 {
 	uint8_t *pr = r;
 	const uint8_t *pa = a;
 	const uint8_t *pb = b;
+	uint64_t x, y;
 	size_t i;
-	for (i = 0; i < len; i++) {
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&x, pa + i, 8);
+		memcpy(&y, pb + i, 8);
+		x ^= y;
+		memcpy(pr + i, &x, 8);
+	}
+	for (; i < len; i++) {
 		pr[i] = pa[i] ^ pb[i];
 	}
 }
 
+// constant time, only tells equal (0) from not equal
 int gmssl_memcmp(const void *s1, const void *s2, size_t n)
 {
-	return memcmp(s1, s2, n);
+	const unsigned char *a = s1;
+	const unsigned char *b = s2;
+	unsigned char r = 0;
+
+	while (n--) {
+		r |= *a++ ^ *b++;
+	}
+	return r;
 }
 
 
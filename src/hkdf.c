@@ -116,18 +116,26 @@ int hkdf_expand(const DIGEST *digest, const uint8_t *prk, size_t prklen,
 	const uint8_t *info, size_t infolen,
 	size_t L, uint8_t *okm)
 {
+	HMAC_KEY hmac_key;
 	HMAC_CTX hmac_ctx;
 	uint8_t T[HMAC_MAX_SIZE];
 	uint8_t counter = 0x01;
 	size_t len;
+	int ret = -1;
+
+	// PRK is padded and hashed once, not once per block
+	if (hmac_set_key(&hmac_key, digest, prk, prklen) != 1) {
+		error_print();
+		return -1;
+	}
 
 	if (L > 0) {
-		if (hmac_init(&hmac_ctx, digest, prk, prklen) != 1
+		if (hmac_init_with_key(&hmac_ctx, &hmac_key) != 1
 			|| hmac_update(&hmac_ctx, info, infolen) != 1
 			|| hmac_update(&hmac_ctx, &counter, 1) != 1
 			|| hmac_finish(&hmac_ctx, T, &len) != 1) {
 			error_print();
-			return -1;
+			goto end;
 		}
 		counter++;
 		if (len > L) {
@@ -140,15 +148,15 @@ int hkdf_expand(const DIGEST *digest, const uint8_t *prk, size_t prklen,
 	while (L > 0) {
 		if (counter == 0) {
 			error_print();
-			return -1;
+			goto end;
 		}
-		if (hmac_init(&hmac_ctx, digest, prk, prklen) != 1
+		if (hmac_init_with_key(&hmac_ctx, &hmac_key) != 1
 			|| hmac_update(&hmac_ctx, T, len) != 1
 			|| hmac_update(&hmac_ctx, info, infolen) != 1
 			|| hmac_update(&hmac_ctx, &counter, 1) != 1
 			|| hmac_finish(&hmac_ctx, T, &len) != 1) {
 			error_print();
-			return -1;
+			goto end;
 		}
 		counter++;
 		if (len > L) {
@@ -158,5 +166,10 @@ int hkdf_expand(const DIGEST *digest, const uint8_t *prk, size_t prklen,
 		okm += len;
 		L -= len;
 	}
-	return 1;
+	ret = 1;
+end:
+	hmac_key_cleanup(&hmac_key);
+	memset(&hmac_ctx, 0, sizeof(hmac_ctx));
+	memset(T, 0, sizeof(T));
+	return ret;
 }
@@ -55,28 +55,35 @@
 #define OPAD	0x5C
 
 
-int hmac_init(HMAC_CTX *ctx, const DIGEST *digest, const unsigned char *key, size_t keylen)
+// copies only the state of the digest in use, not the whole union
+static void hmac_digest_ctx_copy(DIGEST_CTX *dst, const DIGEST_CTX *src)
+{
+	dst->digest = src->digest;
+	memcpy(&dst->u, &src->u, src->digest->ctx_size);
+}
+
+int hmac_set_key(HMAC_KEY *hmac_key, const DIGEST *digest, const unsigned char *key, size_t keylen)
 {
 	uint8_t i_key[DIGEST_MAX_BLOCK_SIZE] = {0};
 	uint8_t o_key[DIGEST_MAX_BLOCK_SIZE] = {0};
 	size_t blocksize;
 	int i;
 
-	if (!ctx || !digest || !key || !keylen) {
+	if (!hmac_key || !digest || !key || !keylen) {
 		error_print();
 		return -1;
 	}
 
-	ctx->digest = digest;
+	hmac_key->digest = digest;
 
 	blocksize = digest_block_size(digest);
 	if (keylen <= blocksize) {
 		memcpy(i_key, key, keylen);
 		memcpy(o_key, key, keylen);
 	} else {
-		digest_init(&ctx->digest_ctx, digest);
-		digest_update(&ctx->digest_ctx, key, keylen);
-		digest_finish(&ctx->digest_ctx, i_key, &keylen);
+		digest_init(&hmac_key->i_ctx, digest);
+		digest_update(&hmac_key->i_ctx, key, keylen);
+		digest_finish(&hmac_key->i_ctx, i_key, &keylen);
 		memcpy(o_key, i_key, keylen);
 	}
 	for (i = 0; i < blocksize; i++) {
@@ -84,17 +91,70 @@ int hmac_init(HMAC_CTX *ctx, const DIGEST *digest, const unsigned char *key, siz
 		o_key[i] ^= OPAD;
 	}
 
-	digest_init(&ctx->i_ctx, digest);
-	digest_update(&ctx->i_ctx, i_key, blocksize);
-	digest_init(&ctx->o_ctx, digest);
-	digest_update(&ctx->o_ctx, o_key, blocksize);
-	memcpy(&ctx->digest_ctx, &ctx->i_ctx, sizeof(DIGEST_CTX));
+	digest_init(&hmac_key->i_ctx, digest);
+	digest_update(&hmac_key->i_ctx, i_key, blocksize);
+	digest_init(&hmac_key->o_ctx, digest);
+	digest_update(&hmac_key->o_ctx, o_key, blocksize);
 
 	memset(i_key, 0, sizeof(i_key));
 	memset(o_key, 0, sizeof(o_key));
 	return 1;
 }
 
+void hmac_key_cleanup(HMAC_KEY *hmac_key)
+{
+	if (hmac_key) {
+		memset(hmac_key, 0, sizeof(HMAC_KEY));
+	}
+}
+
+int hmac_init(HMAC_CTX *ctx, const DIGEST *digest, const unsigned char *key, size_t keylen)
+{
+	if (!ctx) {
+		error_print();
+		return -1;
+	}
+	if (hmac_set_key(&ctx->key_buf, digest, key, keylen) != 1) {
+		error_print();
+		return -1;
+	}
+	ctx->digest = digest;
+	ctx->key = &ctx->key_buf;
+	hmac_digest_ctx_copy(&ctx->digest_ctx, &ctx->key->i_ctx);
+	return 1;
+}
+
+int hmac_init_with_key(HMAC_CTX *ctx, const HMAC_KEY *hmac_key)
+{
+	if (!ctx || !hmac_key || !hmac_key->digest) {
+		error_print();
+		return -1;
+	}
+	ctx->digest = hmac_key->digest;
+	ctx->key = hmac_key;
+	hmac_digest_ctx_copy(&ctx->digest_ctx, &hmac_key->i_ctx);
+	return 1;
+}
+
+int hmac_ctx_clone(HMAC_CTX *dst, const HMAC_CTX *src)
+{
+	if (!dst || !src || !src->key) {
+		error_print();
+		return -1;
+	}
+	dst->digest = src->digest;
+	hmac_digest_ctx_copy(&dst->digest_ctx, &src->digest_ctx);
+	if (src->key == &src->key_buf) {
+		dst->key_buf.digest = src->key_buf.digest;
+		hmac_digest_ctx_copy(&dst->key_buf.i_ctx, &src->key_buf.i_ctx);
+		hmac_digest_ctx_copy(&dst->key_buf.o_ctx, &src->key_buf.o_ctx);
+		dst->key = &dst->key_buf;
+	} else {
+		dst->key = src->key;
+	}
+	return 1;
+}
+
 int hmac_update(HMAC_CTX *ctx, const unsigned char *data, size_t datalen)
 {
 	if (!ctx || (!data &&  datalen != 0)) {
@@ -114,7 +174,7 @@ int hmac_finish(HMAC_CTX *ctx, unsigned char *mac, size_t *maclen)
 		error_print();
 		return -1;
 	}
-	memcpy(&ctx->digest_ctx, &ctx->o_ctx, sizeof(DIGEST_CTX));
+	hmac_digest_ctx_copy(&ctx->digest_ctx, &ctx->key->o_ctx);
 	if (digest_update(&ctx->digest_ctx, mac, *maclen) != 1
 		|| digest_finish(&ctx->digest_ctx, mac, maclen) != 1) {
 		error_print();
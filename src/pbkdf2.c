@@ -120,38 +120,41 @@
 #include <gmssl/digest.h>
 #include <gmssl/error.h>
 #include <gmssl/oid.h>
+#include <gmssl/pbkdf2.h>
 #include "endian.h"
 #include "mem.h"
+#include "cpu.h"
 
-int pbkdf2_genkey(const DIGEST *digest,
-	const char *pass, size_t passlen,
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+// T_first .. T_(first + nblocks - 1), outlen bytes of them
+static void pbkdf2_blocks(const HMAC_KEY *hmac_key,
 	const uint8_t *salt, size_t saltlen, size_t count,
-	size_t outlen, uint8_t *out)
+	uint32_t first, size_t outlen, uint8_t *out)
 {
 	HMAC_CTX ctx;
-	HMAC_CTX ctx_tmpl;
-	uint32_t iter = 1;
+	uint32_t iter = first;
 	uint8_t iter_be[4];
 	uint8_t tmp_block[64];
 	uint8_t key_block[64];
 	size_t len;
 
-	hmac_init(&ctx_tmpl, digest, (uint8_t *)pass, passlen);
-
 	while (outlen > 0) {
 		size_t i;
 
 		PUTU32(iter_be, iter);
 		iter++;
 
-		ctx = ctx_tmpl;
+		hmac_init_with_key(&ctx, hmac_key);
 		hmac_update(&ctx, salt, saltlen);
 		hmac_update(&ctx, iter_be, sizeof(iter_be));
 		hmac_finish(&ctx, tmp_block, &len);
 		memcpy(key_block, tmp_block, len);
 
 		for (i = 1; i < count; i++) {
-			ctx = ctx_tmpl;
+			hmac_init_with_key(&ctx, hmac_key);
 			hmac_update(&ctx, tmp_block, len);
 			hmac_finish(&ctx, tmp_block, &len);
 			memxor(key_block, tmp_block, len);
@@ -171,5 +174,398 @@ int pbkdf2_genkey(const DIGEST *digest,
 	memset(&ctx, 0, sizeof(ctx));
 	memset(key_block, 0, sizeof(key_block));
 	memset(tmp_block, 0, sizeof(key_block));
+}
+
+
+/*
+ * PBKDF2 with HMAC-SM3 on raw compressions. Every (password, block index)
+ * pair is a lane: U_1 is computed with SM3_HMAC, then each of the other
+ * count - 1 iterations is exactly two compressions of a pre-padded block,
+ * from the ipad and from the opad state. With AVX2, 8 lanes run through
+ * sm3_avx2_compress_x8() and a lane is refilled from the next job as soon
+ * as it is done, so jobs with different counts and lengths mix freely.
+ */
+
+extern void sm3_compress_blocks(uint32_t digest[8], const uint8_t *data, size_t blocks);
+
+typedef struct {
+	SM3_HMAC_KEY key;
+	uint32_t U[8];
+	uint32_t T[8];
+	size_t left;
+	uint8_t *out;
+	size_t outlen;
+} PBKDF2_SM3_LANE;
+
+// walks the (job, block index) pairs of a batch in order
+typedef struct {
+	const PBKDF2_JOB *jobs;
+	size_t n;
+	size_t job;
+	size_t offset;
+} PBKDF2_SM3_CURSOR;
+
+// U || 0x80 || 0 .. || bitlen(ipad block || U), with U at offset 0
+static void pbkdf2_sm3_block_init(uint8_t block[SM3_BLOCK_SIZE])
+{
+	memset(block, 0, SM3_BLOCK_SIZE);
+	block[SM3_DIGEST_SIZE] = 0x80;
+	PUTU32(block + SM3_BLOCK_SIZE - 4, (SM3_BLOCK_SIZE + SM3_DIGEST_SIZE) * 8);
+}
+
+static int pbkdf2_sm3_lane_load(PBKDF2_SM3_LANE *lane, PBKDF2_SM3_CURSOR *cur)
+{
+	const PBKDF2_JOB *job;
+	SM3_HMAC_CTX ctx;
+	uint8_t iter_be[4];
+	uint8_t U[SM3_DIGEST_SIZE];
+	int j;
+
+	while (cur->job < cur->n && cur->offset >= cur->jobs[cur->job].outlen) {
+		cur->job++;
+		cur->offset = 0;
+	}
+	if (cur->job >= cur->n) {
+		return 0;
+	}
+	job = &cur->jobs[cur->job];
+
+	sm3_hmac_set_key(&lane->key, (const uint8_t *)job->pass, job->passlen);
+	PUTU32(iter_be, (uint32_t)(cur->offset / SM3_DIGEST_SIZE + 1));
+
+	sm3_hmac_init_with_key(&ctx, &lane->key);
+	sm3_hmac_update(&ctx, job->salt, job->saltlen);
+	sm3_hmac_update(&ctx, iter_be, sizeof(iter_be));
+	sm3_hmac_finish(&ctx, U);
+	for (j = 0; j < 8; j++) {
+		lane->U[j] = lane->T[j] = GETU32(U + j * 4);
+	}
+	lane->left = job->count - 1;
+	lane->out = job->out + cur->offset;
+	lane->outlen = job->outlen - cur->offset < SM3_DIGEST_SIZE ? job->outlen - cur->offset : SM3_DIGEST_SIZE;
+	cur->offset += SM3_DIGEST_SIZE;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(U, 0, sizeof(U));
+	return 1;
+}
+
+static void pbkdf2_sm3_lane_store(PBKDF2_SM3_LANE *lane)
+{
+	uint8_t T[SM3_DIGEST_SIZE];
+	int j;
+
+	for (j = 0; j < 8; j++) {
+		PUTU32(T + j * 4, lane->T[j]);
+	}
+	memcpy(lane->out, T, lane->outlen);
+	memset(T, 0, sizeof(T));
+	memset(lane, 0, sizeof(PBKDF2_SM3_LANE));
+}
+
+// the remaining iterations of one lane
+static void pbkdf2_sm3_lane_finish(PBKDF2_SM3_LANE *lane)
+{
+	uint8_t block[SM3_BLOCK_SIZE];
+	uint32_t digest[8];
+	int j;
+
+	pbkdf2_sm3_block_init(block);
+	for (; lane->left; lane->left--) {
+		for (j = 0; j < 8; j++) {
+			PUTU32(block + j * 4, lane->U[j]);
+		}
+		memcpy(digest, lane->key.ipad_digest, sizeof(digest));
+		sm3_compress_blocks(digest, block, 1);
+		for (j = 0; j < 8; j++) {
+			PUTU32(block + j * 4, digest[j]);
+		}
+		memcpy(lane->U, lane->key.opad_digest, sizeof(lane->U));
+		sm3_compress_blocks(lane->U, block, 1);
+		for (j = 0; j < 8; j++) {
+			lane->T[j] ^= lane->U[j];
+		}
+	}
+	pbkdf2_sm3_lane_store(lane);
+	memset(block, 0, sizeof(block));
+	memset(digest, 0, sizeof(digest));
+}
+
+#ifdef HAVE_AVX2
+void sm3_avx2_compress_x8(uint32_t state[8][8], const uint8_t *blocks[8]);
+
+// 8 lanes in lockstep while at least 3 of them have work
+static void pbkdf2_sm3_lanes_x8(PBKDF2_SM3_LANE lanes[8], PBKDF2_SM3_CURSOR *cur)
+{
+	uint8_t blocks[8][SM3_BLOCK_SIZE];
+	const uint8_t *ptrs[8];
+	uint32_t state[8][8];
+	int active[8];
+	int nactive = 0;
+	int j, l;
+
+	for (l = 0; l < 8; l++) {
+		pbkdf2_sm3_block_init(blocks[l]);
+		ptrs[l] = blocks[l];
+		active[l] = pbkdf2_sm3_lane_load(&lanes[l], cur);
+		nactive += active[l];
+	}
+
+	while (nactive >= 3) {
+		for (l = 0; l < 8; l++) {
+			for (j = 0; j < 8; j++) {
+				PUTU32(blocks[l] + j * 4, lanes[l].U[j]);
+				state[j][l] = lanes[l].key.ipad_digest[j];
+			}
+		}
+		sm3_avx2_compress_x8(state, ptrs);
+		for (l = 0; l < 8; l++) {
+			for (j = 0; j < 8; j++) {
+				PUTU32(blocks[l] + j * 4, state[j][l]);
+				state[j][l] = lanes[l].key.opad_digest[j];
+			}
+		}
+		sm3_avx2_compress_x8(state, ptrs);
+
+		for (l = 0; l < 8; l++) {
+			if (!active[l]) {
+				continue;
+			}
+			// a lane loaded with count == 1 has no iteration to apply
+			if (lanes[l].left) {
+				for (j = 0; j < 8; j++) {
+					lanes[l].U[j] = state[j][l];
+					lanes[l].T[j] ^= state[j][l];
+				}
+				lanes[l].left--;
+			}
+			while (active[l] && !lanes[l].left) {
+				pbkdf2_sm3_lane_store(&lanes[l]);
+				if (!(active[l] = pbkdf2_sm3_lane_load(&lanes[l], cur))) {
+					nactive--;
+				}
+			}
+		}
+	}
+
+	// the last few lanes are cheaper one by one
+	for (l = 0; l < 8; l++) {
+		if (active[l]) {
+			pbkdf2_sm3_lane_finish(&lanes[l]);
+		}
+	}
+	memset(blocks, 0, sizeof(blocks));
+	memset(state, 0, sizeof(state));
+}
+#endif
+
+static void pbkdf2_sm3_batch(const PBKDF2_JOB *jobs, size_t n)
+{
+	PBKDF2_SM3_CURSOR cur = { jobs, n, 0, 0 };
+	PBKDF2_SM3_LANE lanes[8];
+
+#ifdef HAVE_AVX2
+	if (cpu_has_avx2()) {
+		pbkdf2_sm3_lanes_x8(lanes, &cur);
+	}
+#endif
+	while (pbkdf2_sm3_lane_load(&lanes[0], &cur)) {
+		pbkdf2_sm3_lane_finish(&lanes[0]);
+	}
+}
+
+int pbkdf2_genkey(const DIGEST *digest,
+	const char *pass, size_t passlen,
+	const uint8_t *salt, size_t saltlen, size_t count,
+	size_t outlen, uint8_t *out)
+{
+	HMAC_KEY hmac_key;
+
+	if (!digest || !pass || !passlen || (!salt && saltlen) || !count || (!out && outlen)) {
+		error_print();
+		return -1;
+	}
+	if (digest == DIGEST_sm3()) {
+		PBKDF2_JOB job = { pass, passlen, salt, saltlen, count, outlen, out };
+		pbkdf2_sm3_batch(&job, 1);
+		return 1;
+	}
+
+	if (hmac_set_key(&hmac_key, digest, (uint8_t *)pass, passlen) != 1) {
+		error_print();
+		return -1;
+	}
+	pbkdf2_blocks(&hmac_key, salt, saltlen, count, 1, outlen, out);
+	hmac_key_cleanup(&hmac_key);
+	return 1;
+}
+
+#define PBKDF2_MAX_THREADS	16
+
+#ifdef HAVE_PTHREAD
+typedef struct {
+	const HMAC_KEY *hmac_key;
+	const uint8_t *salt;
+	size_t saltlen;
+	size_t count;
+	uint32_t first;
+	size_t outlen;
+	uint8_t *out;
+} PBKDF2_BLOCKS_JOB;
+
+static void *pbkdf2_blocks_thread(void *arg)
+{
+	PBKDF2_BLOCKS_JOB *job = (PBKDF2_BLOCKS_JOB *)arg;
+	pbkdf2_blocks(job->hmac_key, job->salt, job->saltlen, job->count, job->first, job->outlen, job->out);
+	return NULL;
+}
+#endif
+
+int pbkdf2_genkey_mt(const DIGEST *digest,
+	const char *pass, size_t passlen,
+	const uint8_t *salt, size_t saltlen, size_t count,
+	size_t outlen, uint8_t *out, int num_threads)
+{
+#ifdef HAVE_PTHREAD
+	PBKDF2_BLOCKS_JOB jobs[PBKDF2_MAX_THREADS];
+	pthread_t threads[PBKDF2_MAX_THREADS];
+	HMAC_KEY hmac_key;
+	size_t hlen, nblocks, per_thread;
+	size_t off = 0;
+	int started = 0;
+	int i;
+
+	if (!digest || !pass || !passlen || (!salt && saltlen) || !count || (!out && outlen)) {
+		error_print();
+		return -1;
+	}
+	hlen = digest_size(digest);
+	nblocks = (outlen + hlen - 1) / hlen;
+	if (num_threads > PBKDF2_MAX_THREADS) {
+		num_threads = PBKDF2_MAX_THREADS;
+	}
+	if (num_threads <= 1 || nblocks < 2) {
+		return pbkdf2_genkey(digest, pass, passlen, salt, saltlen, count, outlen, out);
+	}
+	if (hmac_set_key(&hmac_key, digest, (uint8_t *)pass, passlen) != 1) {
+		error_print();
+		return -1;
+	}
+
+	// whole blocks per thread, the calling thread takes the last share
+	per_thread = (nblocks + num_threads - 1) / num_threads * hlen;
+	for (i = 0; i < num_threads - 1 && off + per_thread < outlen; i++) {
+		jobs[i].hmac_key = &hmac_key;
+		jobs[i].salt = salt;
+		jobs[i].saltlen = saltlen;
+		jobs[i].count = count;
+		jobs[i].first = (uint32_t)(off / hlen + 1);
+		jobs[i].outlen = per_thread;
+		jobs[i].out = out + off;
+		if (pthread_create(&threads[i], NULL, pbkdf2_blocks_thread, &jobs[i]) != 0) {
+			break;
+		}
+		off += per_thread;
+		started++;
+	}
+	pbkdf2_blocks(&hmac_key, salt, saltlen, count, (uint32_t)(off / hlen + 1), outlen - off, out + off);
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	hmac_key_cleanup(&hmac_key);
+	return 1;
+#else
+	(void)num_threads;
+	return pbkdf2_genkey(digest, pass, passlen, salt, saltlen, count, outlen, out);
+#endif
+}
+
+int pbkdf2_genkey_batch(const DIGEST *digest, const PBKDF2_JOB *jobs, size_t n)
+{
+	size_t i;
+
+	if (!digest || (!jobs && n)) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (!jobs[i].pass || !jobs[i].passlen || (!jobs[i].salt && jobs[i].saltlen)
+			|| !jobs[i].count || (!jobs[i].out && jobs[i].outlen)) {
+			error_print();
+			return -1;
+		}
+	}
+	if (digest == DIGEST_sm3()) {
+		pbkdf2_sm3_batch(jobs, n);
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		if (pbkdf2_genkey(digest, jobs[i].pass, jobs[i].passlen, jobs[i].salt, jobs[i].saltlen,
+			jobs[i].count, jobs[i].outlen, jobs[i].out) != 1) {
+			error_print();
+			return -1;
+		}
+	}
 	return 1;
 }
+
+#ifdef HAVE_PTHREAD
+typedef struct {
+	const DIGEST *digest;
+	const PBKDF2_JOB *jobs;
+	size_t n;
+	int ret;
+} PBKDF2_BATCH_JOB;
+
+static void *pbkdf2_batch_thread(void *arg)
+{
+	PBKDF2_BATCH_JOB *job = (PBKDF2_BATCH_JOB *)arg;
+	job->ret = pbkdf2_genkey_batch(job->digest, job->jobs, job->n);
+	return NULL;
+}
+#endif
+
+int pbkdf2_genkey_batch_mt(const DIGEST *digest, const PBKDF2_JOB *jobs, size_t n, int num_threads)
+{
+#ifdef HAVE_PTHREAD
+	PBKDF2_BATCH_JOB batch[PBKDF2_MAX_THREADS];
+	pthread_t threads[PBKDF2_MAX_THREADS];
+	size_t per_thread;
+	size_t off = 0;
+	int started = 0;
+	int ret = 1;
+	int i;
+
+	if (num_threads > PBKDF2_MAX_THREADS) {
+		num_threads = PBKDF2_MAX_THREADS;
+	}
+	if (num_threads <= 1 || n < 2) {
+		return pbkdf2_genkey_batch(digest, jobs, n);
+	}
+
+	// the calling thread takes the last slice
+	per_thread = (n + num_threads - 1) / num_threads;
+	for (i = 0; i < num_threads - 1 && off + per_thread < n; i++) {
+		batch[i].digest = digest;
+		batch[i].jobs = jobs + off;
+		batch[i].n = per_thread;
+		if (pthread_create(&threads[i], NULL, pbkdf2_batch_thread, &batch[i]) != 0) {
+			break;
+		}
+		off += per_thread;
+		started++;
+	}
+	if (pbkdf2_genkey_batch(digest, jobs + off, n - off) != 1) {
+		ret = -1;
+	}
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+		if (batch[i].ret != 1)
+			ret = -1;
+	}
+	return ret;
+#else
+	(void)num_threads;
+	return pbkdf2_genkey_batch(digest, jobs, n);
+#endif
+}
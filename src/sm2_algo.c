@@ -53,9 +53,16 @@
 #include <gmssl/sm2.h>
 #include <gmssl/error.h>
 #include "endian.h"
+#include "cpu.h"
 
 
-typedef uint64_t bignum_t[8];
+/*
+ * Elements of F_p and Z_n are held in four 64-bit little-endian limbs.
+ * fp_mul uses the Solinas reduction specific to the SM2 prime and fn_mul
+ * uses Montgomery multiplication mod n. Modular add/sub/neg finish with a
+ * masked subtraction instead of a comparison, so they run in constant time.
+ */
+typedef uint64_t bignum_t[4];
 
 typedef struct {
 	bignum_t X;
@@ -63,71 +70,90 @@ typedef struct {
 	bignum_t Z;
 } point_t;
 
+typedef struct {
+	bignum_t x;
+	bignum_t y;
+} affine_point_t;
+
 
 static const bignum_t SM2_P = {
-	0xffffffff, 0xffffffff, 0x00000000, 0xffffffff,
-	0xffffffff, 0xffffffff, 0xffffffff, 0xfffffffe,
+	0xffffffffffffffff, 0xffffffff00000000, 0xffffffffffffffff, 0xfffffffeffffffff,
 };
 
 static const bignum_t SM2_B = {
-	0x4d940e93, 0xddbcbd41, 0x15ab8f92, 0xf39789f5,
-	0xcf6509a7, 0x4d5a9e4b, 0x9d9f5e34, 0x28e9fa9e,
+	0xddbcbd414d940e93, 0xf39789f515ab8f92, 0x4d5a9e4bcf6509a7, 0x28e9fa9e9d9f5e34,
 };
 
 static const point_t _SM2_G = {
 	{
-	0x334c74c7, 0x715a4589, 0xf2660be1, 0x8fe30bbf,
-	0x6a39c994, 0x5f990446, 0x1f198119, 0x32c4ae2c,
+	0x715a4589334c74c7, 0x8fe30bbff2660be1, 0x5f9904466a39c994, 0x32c4ae2c1f198119,
 	},
 	{
-	0x2139f0a0, 0x02df32e5, 0xc62a4740, 0xd0a9877c,
-	0x6b692153, 0x59bdcee3, 0xf4f6779c, 0xbc3736a2,
+	0x02df32e52139f0a0, 0xd0a9877cc62a4740, 0x59bdcee36b692153, 0xbc3736a2f4f6779c,
 	},
 	{
-	1, 0, 0, 0, 0, 0, 0, 0,
+	1, 0, 0, 0,
 	},
 };
 static const point_t *SM2_G = &_SM2_G;
 
 static const bignum_t SM2_N = {
-	0x39d54123, 0x53bbf409, 0x21c6052b, 0x7203df6b,
-	0xffffffff, 0xffffffff, 0xffffffff, 0xfffffffe,
+	0x53bbf40939d54123, 0x7203df6b21c6052b, 0xffffffffffffffff, 0xfffffffeffffffff,
+};
+
+// -n^-1 mod 2^64
+static const uint64_t SM2_N_NEG_INV = 0x327f9e8872350975;
+
+// 2^256 mod n, Montgomery form of 1
+static const bignum_t SM2_N_R = {
+	0xac440bf6c62abedd, 0x8dfc2094de39fad4, 0x0000000000000000, 0x0000000100000000,
+};
+
+// 2^512 mod n
+static const bignum_t SM2_N_R2 = {
+	0x901192af7c114f20, 0x3464504ade6fa2fa, 0x620fc84c3affe0d4, 0x1eb5e412a22b3d3b,
 };
 
 // u = (p - 1)/4, u + 1 = (p + 1)/4
 static const bignum_t SM2_U_PLUS_ONE = {
-	0x00000000, 0x40000000, 0xc0000000, 0xffffffff,
-	0xffffffff, 0xffffffff, 0xbfffffff, 0x3fffffff,
+	0x4000000000000000, 0xffffffffc0000000, 0xffffffffffffffff, 0x3fffffffbfffffff,
 };
 
-static const bignum_t ONE = {1,0,0,0,0,0,0,0};
-static const bignum_t TWO = {2,0,0,0,0,0,0,0};
-static const bignum_t THREE = {3,0,0,0,0,0,0,0};
+static const bignum_t ZERO = {0,0,0,0};
+static const bignum_t ONE = {1,0,0,0};
+static const bignum_t TWO = {2,0,0,0};
+static const bignum_t THREE = {3,0,0,0};
 
 #define bn_init(r) memset((r), 0, sizeof(bignum_t))
 #define bn_set_zero(r) memset((r), 0, sizeof(bignum_t))
 #define bn_copy(r, a) memcpy((r), (a), sizeof(bignum_t))
 #define bn_clean(r) memset((r), 0, sizeof(bignum_t))
 
-static int bn_check(const bignum_t a)
-{
-	int err = 0;
-	int i;
-	for (i = 0; i < 8; i++) {
-		if (a[i] > 0xffffffff) {
-			fprintf(stderr, "%s %d: error\n", __FILE__, __LINE__);
-			err++;
-		}
-	}
-	if (err)
-		return -1;
-	else	return 1;
+/* returns hi, (hi, *r) = a * b + *r + c */
+static inline uint64_t u64_mac(uint64_t *r, uint64_t a, uint64_t b, uint64_t c)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 t = (unsigned __int128)a * b + *r + c;
+	*r = (uint64_t)t;
+	return (uint64_t)(t >> 64);
+#else
+	uint64_t a0 = a & 0xffffffff, a1 = a >> 32;
+	uint64_t b0 = b & 0xffffffff, b1 = b >> 32;
+	uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+	uint64_t mid = (p00 >> 32) + (p01 & 0xffffffff) + (p10 & 0xffffffff);
+	uint64_t lo = (mid << 32) | (p00 & 0xffffffff);
+	uint64_t hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+	lo += *r; hi += (lo < *r);
+	lo += c; hi += (lo < c);
+	*r = lo;
+	return hi;
+#endif
 }
 
 static int bn_is_zero(const bignum_t a)
 {
 	int i;
-	for (i = 0; i < 8; i++) {
+	for (i = 0; i < 4; i++) {
 		if (a[i] != 0)
 			return 0;
 	}
@@ -139,7 +165,7 @@ static int bn_is_one(const bignum_t a)
 	int i;
 	if (a[0] != 1)
 		return 0;
-	for (i = 1; i < 8; i++) {
+	for (i = 1; i < 4; i++) {
 		if (a[i] != 0)
 			return 0;
 	}
@@ -149,36 +175,18 @@ static int bn_is_one(const bignum_t a)
 static void bn_to_bytes(const bignum_t a, uint8_t out[32])
 {
 	int i;
-	uint8_t *p = out;
-
-	/*
-	fprintf(stderr, "bn_to_bytes:\n");
-	for (i = 0; i < 8; i++) {
-		fprintf(stderr, "%016lx ", a[i]);
-	}
-	fprintf(stderr, "\n");
-	*/
-
-	for (i = 7; i >= 0; i--) {
-		uint32_t ai = (uint32_t)a[i];
-		PUTU32(out, ai);
-		out += sizeof(uint32_t);
+	for (i = 3; i >= 0; i--) {
+		PUTU64(out, a[i]);
+		out += sizeof(uint64_t);
 	}
-
-	/*
-	for (i = 0; i < 32; i++) {
-		fprintf(stderr, "%02X ", p[i]);
-	}
-	*/
-
 }
 
 static void bn_from_bytes(bignum_t r, const uint8_t in[32])
 {
 	int i;
-	for (i = 7; i >= 0; i--) {
-		r[i] = GETU32(in);
-		in += sizeof(uint32_t);
+	for (i = 3; i >= 0; i--) {
+		r[i] = GETU64(in);
+		in += sizeof(uint64_t);
 	}
 }
 
@@ -212,11 +220,11 @@ static int hex2bin(const char *in, size_t inlen, uint8_t *out)
 static void bn_to_hex(const bignum_t a, char hex[64])
 {
 	int i;
-	for (i = 7; i >= 0; i--) {
+	for (i = 3; i >= 0; i--) {
 		int len;
-		len = sprintf(hex, "%08x", (uint32_t)a[i]);
-		assert(len == 8);
-		hex += 8;
+		len = sprintf(hex, "%08x%08x", (uint32_t)(a[i] >> 32), (uint32_t)a[i]);
+		assert(len == 16);
+		hex += 16;
 	}
 }
 
@@ -232,33 +240,18 @@ static int bn_from_hex(bignum_t r, const char hex[64])
 static int bn_print(FILE *fp, const bignum_t a, int format, int indent)
 {
 	int ret = 0, i;
-	for (i = 7; i >= 0; i--) {
-		if (a[i] >= ((uint64_t)1 << 32)) {
-			printf("bn_print check failed\n");
-		}
-		ret += fprintf(fp, "%08x", (uint32_t)a[i]);
+	for (i = 3; i >= 0; i--) {
+		ret += fprintf(fp, "%08x%08x", (uint32_t)(a[i] >> 32), (uint32_t)a[i]);
 	}
 	ret += fprintf(fp, "\n");
 	return ret;
 }
 #define print_bn(a) bn_print(stdout,a,0,0)
 
-static void bn_to_bits(const bignum_t a, char bits[256])
-{
-	int i, j;
-	for (i = 7; i >= 0; i--) {
-		uint32_t w = a[i];
-		for (j = 0; j < 32; j++) {
-			*bits++ = (w & 0x80000000) ? '1' : '0';
-			w <<= 1;
-		}
-	}
-}
-
 static int bn_cmp(const bignum_t a, const bignum_t b)
 {
 	int i;
-	for (i = 7; i >= 0; i--) {
+	for (i = 3; i >= 0; i--) {
 		if (a[i] > b[i])
 			return 1;
 		if (a[i] < b[i])
@@ -270,13 +263,7 @@ static int bn_cmp(const bignum_t a, const bignum_t b)
 static int bn_equ_hex(const bignum_t a, const char *hex)
 {
 	char buf[65] = {0};
-	char *p = buf;
-	int i;
-
-	for (i = 7; i >= 0; i--) {
-		sprintf(p, "%08x", (uint32_t)a[i]);
-		p += 8;
-	}
+	bn_to_hex(a, buf);
 	return (strcmp(buf, hex) == 0);
 }
 
@@ -287,39 +274,62 @@ static int bn_is_odd(const bignum_t a)
 
 static void bn_set_word(bignum_t r, uint32_t a)
 {
-	int i;
 	r[0] = a;
-	for (i = 1; i < 8; i++) {
-		r[i] = 0;
-	}
+	r[1] = 0;
+	r[2] = 0;
+	r[3] = 0;
 }
 #define bn_set_one(r) bn_set_word((r), 1)
 
-static void bn_add(bignum_t r, const bignum_t a, const bignum_t b)
+/* returns the carry bit */
+static uint64_t bn_add(bignum_t r, const bignum_t a, const bignum_t b)
 {
+	uint64_t c = 0, t;
 	int i;
-	r[0] = a[0] + b[0];
-
-	for (i = 1; i < 8; i++) {
-		r[i] = a[i] + b[i] + (r[i-1] >> 32);
+	for (i = 0; i < 4; i++) {
+		t = a[i] + c;
+		c = (t < c);
+		r[i] = t + b[i];
+		c |= (r[i] < t);
 	}
-	for (i = 0; i < 7; i++) {
-		r[i] &= 0xffffffff;
+	return c;
+}
+
+/* returns the borrow bit */
+static uint64_t bn_sub(bignum_t r, const bignum_t a, const bignum_t b)
+{
+	uint64_t c = 0, t, u;
+	int i;
+	for (i = 0; i < 4; i++) {
+		t = a[i] - b[i];
+		u = (a[i] < b[i]) | (t < c);
+		r[i] = t - c;
+		c = u;
 	}
+	return c;
 }
 
-static void bn_sub(bignum_t ret, const bignum_t a, const bignum_t b)
+/* r = mask ? a : r, mask must be all zeros or all ones */
+static void bn_cond_copy(bignum_t r, const bignum_t a, uint64_t mask)
 {
 	int i;
-	bignum_t r;
-	r[0] = ((uint64_t)1 << 32) + a[0] - b[0];
-	for (i = 1; i < 7; i++) {
-		r[i] = 0xffffffff + a[i] - b[i] + (r[i - 1] >> 32);
-		r[i - 1] &= 0xffffffff;
+	for (i = 0; i < 4; i++) {
+		r[i] = (a[i] & mask) | (r[i] & ~mask);
 	}
-	r[i] = a[i] - b[i] + (r[i - 1] >> 32) - 1;
-	r[i - 1] &= 0xffffffff;
-	bn_copy(ret, r);
+}
+
+/* returns all ones if a == 0, else all zeros */
+static uint64_t bn_is_zero_mask(const bignum_t a)
+{
+	uint64_t z = a[0] | a[1] | a[2] | a[3];
+	return ((z | (0 - z)) >> 63) - 1;
+}
+
+/* returns all ones if a == b, else all zeros */
+static uint64_t u64_eq_mask(uint64_t a, uint64_t b)
+{
+	uint64_t d = a ^ b;
+	return ((d | (0 - d)) >> 63) - 1;
 }
 
 static void bn_rand_range(bignum_t r, const bignum_t range)
@@ -337,23 +347,71 @@ static void bn_rand_range(bignum_t r, const bignum_t range)
 	fclose(fp);
 }
 
-static void fp_add(bignum_t r, const bignum_t a, const bignum_t b)
+/* r = a + b (mod m), a, b in [0, m) */
+static void bn_mod_add(bignum_t r, const bignum_t a, const bignum_t b, const bignum_t m)
+{
+	bignum_t t;
+	uint64_t c, borrow;
+
+	c = bn_add(r, a, b);
+	borrow = bn_sub(t, r, m);
+	bn_cond_copy(r, t, 0 - (c | (borrow ^ 1)));
+}
+
+/* r = a - b (mod m), a, b in [0, m) */
+static void bn_mod_sub(bignum_t r, const bignum_t a, const bignum_t b, const bignum_t m)
 {
-	bn_add(r, a, b);
-	if (bn_cmp(r, SM2_P) >= 0) {
-		bn_sub(r, r, SM2_P);
+	bignum_t t;
+	uint64_t mask;
+	int i;
+
+	mask = 0 - bn_sub(r, a, b);
+	for (i = 0; i < 4; i++) {
+		t[i] = m[i] & mask;
 	}
+	bn_add(r, r, t);
+}
+
+/* r[0..7] = a * b, unrolled as compilers keep the loop form at -O2 */
+static void bn_mul(uint64_t r[8], const bignum_t a, const bignum_t b)
+{
+	uint64_t c;
+
+	r[0] = r[1] = r[2] = r[3] = 0;
+
+	c = u64_mac(&r[0], a[0], b[0], 0);
+	c = u64_mac(&r[1], a[0], b[1], c);
+	c = u64_mac(&r[2], a[0], b[2], c);
+	c = u64_mac(&r[3], a[0], b[3], c);
+	r[4] = c;
+
+	c = u64_mac(&r[1], a[1], b[0], 0);
+	c = u64_mac(&r[2], a[1], b[1], c);
+	c = u64_mac(&r[3], a[1], b[2], c);
+	c = u64_mac(&r[4], a[1], b[3], c);
+	r[5] = c;
+
+	c = u64_mac(&r[2], a[2], b[0], 0);
+	c = u64_mac(&r[3], a[2], b[1], c);
+	c = u64_mac(&r[4], a[2], b[2], c);
+	c = u64_mac(&r[5], a[2], b[3], c);
+	r[6] = c;
+
+	c = u64_mac(&r[3], a[3], b[0], 0);
+	c = u64_mac(&r[4], a[3], b[1], c);
+	c = u64_mac(&r[5], a[3], b[2], c);
+	c = u64_mac(&r[6], a[3], b[3], c);
+	r[7] = c;
+}
+
+static void fp_add(bignum_t r, const bignum_t a, const bignum_t b)
+{
+	bn_mod_add(r, a, b, SM2_P);
 }
 
 static void fp_sub(bignum_t r, const bignum_t a, const bignum_t b)
 {
-	if (bn_cmp(a, b) >= 0) {
-		bn_sub(r, a, b);
-	} else {
-		bignum_t t;
-		bn_sub(t, SM2_P, b);
-		bn_add(r, t, a);
-	}
+	bn_mod_sub(r, a, b, SM2_P);
 }
 
 static void fp_dbl(bignum_t r, const bignum_t a)
@@ -370,67 +428,91 @@ static void fp_tri(bignum_t r, const bignum_t a)
 
 static void fp_div2(bignum_t r, const bignum_t a)
 {
+	bignum_t t;
+	uint64_t c, mask;
 	int i;
-	bn_copy(r, a);
-	if (r[0] & 0x01) {
-		bn_add(r, r, SM2_P);
+
+	mask = 0 - (a[0] & 0x01);
+	for (i = 0; i < 4; i++) {
+		t[i] = SM2_P[i] & mask;
 	}
-	for (i = 0; i < 7; i++) {
-		r[i] = (r[i] >> 1) | ((r[i + 1] & 0x01) << 31);
+	c = bn_add(r, a, t);
+	for (i = 0; i < 3; i++) {
+		r[i] = (r[i] >> 1) | (r[i + 1] << 63);
 	}
-	r[i] >>= 1;
+	r[3] = (r[3] >> 1) | (c << 63);
 }
 
 static void fp_neg(bignum_t r, const bignum_t a)
 {
-	if (bn_is_zero(a)) {
-		bn_copy(r, a);
-	} else {
-		bn_sub(r, SM2_P, a);
-	}
+	bn_mod_sub(r, ZERO, a, SM2_P);
 }
 
-static void fp_mul(bignum_t r, const bignum_t a, const bignum_t b)
+/*
+ * Solinas reduction of a 512-bit a by p = 2^256 - 2^224 - 2^96 + 2^64 - 1.
+ * With a split into 32-bit words s[0..15], a mod p is the signed sum below,
+ * which is positive and less than 16 * 2^256. The carry c out of 2^256 is
+ * folded back with 2^256 = 2^224 + 2^96 - 2^64 + 1 (mod p), that is adding
+ * (c << 224) + (c * 0xffffffff << 64) + c, at most twice. The result is then
+ * less than 2^256 and needs one final subtraction.
+ */
+static void fp_reduce(bignum_t r, const uint64_t a[8])
 {
-	int i, j;
-	uint64_t s[16] = {0};
-	bignum_t d = {0};
-	uint64_t u;
+	int64_t s[16];
+	int64_t t[8];
+	int64_t c;
+	bignum_t u;
+	uint64_t carry, borrow;
+	int i;
 
-	// s = a * b
 	for (i = 0; i < 8; i++) {
-		u = 0;
-		for (j = 0; j < 8; j++) {
-			u = s[i + j] + a[i] * b[j] + u;
-			s[i + j] = u & 0xffffffff;
-			u >>= 32;
-		}
-		s[i + 8] = u;
-	}
-
-	r[0] = s[0] + s[ 8] + s[ 9] + s[10] + s[11] + s[12] + ((s[13] + s[14] + s[15]) << 1);
-	r[1] = s[1] + s[ 9] + s[10] + s[11] + s[12] + s[13] + ((s[14] + s[15]) << 1);
-	r[2] = s[2];
-	r[3] = s[3] + s[ 8] + s[11] + s[12] + s[14] + s[15] + (s[13] << 1);
-	r[4] = s[4] + s[ 9] + s[12] + s[13] + s[15] + (s[14] << 1);
-	r[5] = s[5] + s[10] + s[13] + s[14] + (s[15] << 1);
-	r[6] = s[6] + s[11] + s[14] + s[15];
-	r[7] = s[7] + s[ 8] + s[ 9] + s[10] + s[11] + s[15] + ((s[12] + s[13] + s[14] + s[15]) << 1);
-
-	for (i = 1; i < 8; i++) {
-		r[i] += r[i - 1] >> 32;
-		r[i - 1] &= 0xffffffff;
-	}
-
-	d[2] = s[8] + s[9] + s[13] + s[14];
-	d[3] = d[2] >> 32;
-	d[2] &= 0xffffffff;
-	bn_sub(r, r, d);
+		s[2 * i] = (int64_t)(a[i] & 0xffffffff);
+		s[2 * i + 1] = (int64_t)(a[i] >> 32);
+	}
+
+	t[0] = s[0] + s[ 8] + s[ 9] + s[10] + s[11] + s[12] + ((s[13] + s[14] + s[15]) << 1);
+	t[1] = s[1] + s[ 9] + s[10] + s[11] + s[12] + s[13] + ((s[14] + s[15]) << 1);
+	t[2] = s[2] - (s[8] + s[9] + s[13] + s[14]);
+	t[3] = s[3] + s[ 8] + s[11] + s[12] + s[14] + s[15] + (s[13] << 1);
+	t[4] = s[4] + s[ 9] + s[12] + s[13] + s[15] + (s[14] << 1);
+	t[5] = s[5] + s[10] + s[13] + s[14] + (s[15] << 1);
+	t[6] = s[6] + s[11] + s[14] + s[15];
+	t[7] = s[7] + s[ 8] + s[ 9] + s[10] + s[11] + s[15] + ((s[12] + s[13] + s[14] + s[15]) << 1);
+
+	t[1] += t[0] >> 32;
+	t[2] += t[1] >> 32;
+	t[3] += t[2] >> 32;
+	t[4] += t[3] >> 32;
+	t[5] += t[4] >> 32;
+	t[6] += t[5] >> 32;
+	t[7] += t[6] >> 32;
+	c = t[7] >> 32;
+
+	r[0] = ((uint64_t)t[0] & 0xffffffff) | ((uint64_t)t[1] << 32);
+	r[1] = ((uint64_t)t[2] & 0xffffffff) | ((uint64_t)t[3] << 32);
+	r[2] = ((uint64_t)t[4] & 0xffffffff) | ((uint64_t)t[5] << 32);
+	r[3] = ((uint64_t)t[6] & 0xffffffff) | ((uint64_t)t[7] << 32);
+
+	u[0] = (uint64_t)c;
+	u[1] = (uint64_t)c * 0xffffffff;
+	u[2] = 0;
+	u[3] = (uint64_t)c << 32;
+	carry = bn_add(r, r, u);
+
+	u[0] = carry;
+	u[1] = carry * 0xffffffff;
+	u[3] = carry << 32;
+	bn_add(r, r, u);
+
+	borrow = bn_sub(u, r, SM2_P);
+	bn_cond_copy(r, u, borrow - 1);
+}
 
-	// max times ?
-	while (bn_cmp(r, SM2_P) >= 0) {
-		bn_sub(r, r, SM2_P);
-	}
+static void fp_mul(bignum_t r, const bignum_t a, const bignum_t b)
+{
+	uint64_t s[8];
+	bn_mul(s, a, b);
+	fp_reduce(r, s);
 }
 
 static void fp_sqr(bignum_t r, const bignum_t a)
@@ -441,15 +523,15 @@ static void fp_sqr(bignum_t r, const bignum_t a)
 static void fp_exp(bignum_t r, const bignum_t a, const bignum_t e)
 {
 	bignum_t t;
-	uint32_t w;
+	uint64_t w;
 	int i, j;
 
 	bn_set_one(t);
-	for (i = 7; i >= 0; i--) {
-		w = (uint32_t)e[i];
-		for (j = 0; j < 32; j++) {
+	for (i = 3; i >= 0; i--) {
+		w = e[i];
+		for (j = 0; j < 64; j++) {
 			fp_sqr(t, t);
-			if (w & 0x80000000)
+			if (w >> 63)
 				fp_mul(t, t, a);
 			w <<= 1;
 		}
@@ -457,8 +539,8 @@ static void fp_exp(bignum_t r, const bignum_t a, const bignum_t e)
 
 	bn_copy(r, t);
 }
-
-static void fp_inv(bignum_t r, const bignum_t a)
+/* a^-1 = a^(p - 2) (mod p) with a fixed addition chain */
+static void fp_inv_fermat(bignum_t r, const bignum_t a)
 {
 	bignum_t a1;
 	bignum_t a2;
@@ -539,212 +621,368 @@ static void fp_inv(bignum_t r, const bignum_t a)
 
 static void fn_add(bignum_t r, const bignum_t a, const bignum_t b)
 {
-	bn_add(r, a, b);
-	if (bn_cmp(r, SM2_N) >= 0) {
-		bn_sub(r, r, SM2_N);
-	}
+	bn_mod_add(r, a, b, SM2_N);
 }
 
 static void fn_sub(bignum_t r, const bignum_t a, const bignum_t b)
 {
-	if (bn_cmp(a, b) >= 0) {
-		bn_sub(r, a, b);
-	} else {
-		bignum_t t;
-		bn_add(t, a, SM2_N);
-		bn_sub(r, t, b);
-	}
+	bn_mod_sub(r, a, b, SM2_N);
 }
 
 static void fn_neg(bignum_t r, const bignum_t a)
 {
-	if (bn_is_zero(a)) {
-		bn_copy(r, a);
-	} else {
-		bn_sub(r, SM2_N, a);
-	}
+	bn_mod_sub(r, ZERO, a, SM2_N);
 }
 
-/* bn288 only used in barrett reduction */
-static int bn288_cmp(const uint64_t a[9], const uint64_t b[9])
+/* r = a * b * 2^-256 (mod n), CIOS Montgomery multiplication */
+static void fn_mont_mul(bignum_t r, const bignum_t a, const bignum_t b)
 {
-	int i;
-	for (i = 8; i >= 0; i--) {
-		if (a[i] > b[i])
-			return 1;
-		if (a[i] < b[i])
-			return -1;
+	uint64_t t[6] = {0};
+	uint64_t c, m, w;
+	bignum_t u;
+	uint64_t borrow;
+	int i, j;
+
+	for (i = 0; i < 4; i++) {
+		c = 0;
+		for (j = 0; j < 4; j++) {
+			c = u64_mac(&t[j], a[j], b[i], c);
+		}
+		t[4] += c;
+		t[5] = (t[4] < c);
+
+		m = t[0] * SM2_N_NEG_INV;
+		w = t[0];
+		c = u64_mac(&w, m, SM2_N[0], 0);
+		for (j = 1; j < 4; j++) {
+			w = t[j];
+			c = u64_mac(&w, m, SM2_N[j], c);
+			t[j - 1] = w;
+		}
+		t[3] = t[4] + c;
+		t[4] = t[5] + (t[3] < c);
 	}
-	return 0;
+
+	borrow = bn_sub(u, t, SM2_N);
+	bn_copy(r, t);
+	bn_cond_copy(r, u, 0 - (t[4] | (borrow ^ 1)));
 }
 
-static void bn288_add(uint64_t r[9], const uint64_t a[9], const uint64_t b[9])
+/* r = a * 2^256 (mod n), into the Montgomery domain */
+static void fn_to_mont(bignum_t r, const bignum_t a)
 {
-	int i;
-	r[0] = a[0] + b[0];
-	for (i = 1; i < 9; i++) {
-		r[i] = a[i] + b[i] + (r[i-1] >> 32);
-	}
-	for (i = 0; i < 8; i++) {
-		r[i] &= 0xffffffff;
-	}
+	fn_mont_mul(r, a, SM2_N_R2);
 }
 
-static void bn288_sub(uint64_t ret[9], const uint64_t a[9], const uint64_t b[9])
+/*
+ * Plain in, plain out, at the cost of two passes. The signing paths keep
+ * (1 + d)^-1 in Montgomery form instead, then fn_mont_mul() of it and a plain
+ * k + r is the plain product in one pass.
+ */
+static void fn_mul(bignum_t r, const bignum_t a, const bignum_t b)
 {
-	int i;
-	uint64_t r[9];
-
-	r[0] = ((uint64_t)1 << 32) + a[0] - b[0];
-	for (i = 1; i < 8; i++) {
-		r[i] = 0xffffffff + a[i] - b[i] + (r[i - 1] >> 32);
-		r[i - 1] &= 0xffffffff;
-	}
-	r[i] = a[i] - b[i] + (r[i - 1] >> 32) - 1;
-	r[i - 1] &= 0xffffffff;
-
-	for (i = 0; i < 9; i++) {
-		ret[i] = r[i];
-	}
+	bignum_t t;
+	fn_mont_mul(t, a, b);
+	fn_mont_mul(r, t, SM2_N_R2);
 }
 
-static void fn_mul(bignum_t r, const bignum_t a, const bignum_t b)
+static void fn_sqr(bignum_t r, const bignum_t a)
 {
-	static const uint64_t mu[8] = {
-		0xf15149a0, 0x12ac6361, 0xfa323c01, 0x8dfc2096,
-		1, 1, 1, 0x100000001,
-	};
+	fn_mul(r, a, a);
+}
 
-	uint64_t s[17];
-	uint64_t zh[9];
-	uint64_t zl[9];
-	uint64_t q[9];
+static void fn_exp(bignum_t r, const bignum_t a, const bignum_t e)
+{
+	bignum_t t;
+	bignum_t am;
 	uint64_t w;
 	int i, j;
 
-
-	/* z = a * b */
-	for (i = 0; i < 8; i++) {
-		s[i] = 0;
-	}
-	for (i = 0; i < 8; i++) {
-		w = 0;
-		for (j = 0; j < 8; j++) {
-			w += s[i + j] + a[i] * b[j];
-			s[i + j] = w & 0xffffffff;
-			w >>= 32;
+	// square-and-multiply in the Montgomery domain
+	fn_mont_mul(am, a, SM2_N_R2);
+	bn_copy(t, SM2_N_R);
+	for (i = 3; i >= 0; i--) {
+		w = e[i];
+		for (j = 0; j < 64; j++) {
+			fn_mont_mul(t, t, t);
+			if (w >> 63) {
+				fn_mont_mul(t, t, am);
+			}
+			w <<= 1;
 		}
-		s[i + 8] = w;
 	}
+	fn_mont_mul(r, t, ONE);
 
-	/* zl = z mod (2^32)^9 = z[0..8]
-	 * zh = z // (2^32)^7 = z[7..15] */
-	for (i = 0; i < 9; i++) {
-		zl[i] = s[i];
-		zh[i] = s[7 + i];
-	}
-	//printf("zl = "); for (i = 8; i >= 0; i--) printf("%08x", (uint32_t)zl[i]); printf("\n");
-	//printf("zh = "); for (i = 8; i >= 0; i--) printf("%08x", (uint32_t)zh[i]); printf("\n");
+	bn_clean(am);
+	bn_clean(t);
+}
 
-	/* q = zh * mu // (2^32)^9 */
-	for (i = 0; i < 9; i++) {
-		s[i] = 0;
-	}
-	for (i = 0; i < 9; i++) {
-		w = 0;
-		for (j = 0; j < 8; j++) {
-			w += s[i + j] + zh[i] * mu[j];
-			s[i + j] = w & 0xffffffff;
-			w >>= 32;
-		}
-		s[i + 8] = w;
-	}
-	for (i = 0; i < 8; i++) {
-		q[i] = s[9 + i];
-	}
-	//printf("q  = "); for (i = 7; i >= 0; i--) printf("%08x", (uint32_t)q[i]); printf("\n");
+static void fn_inv_fermat(bignum_t r, const bignum_t a)
+{
+	bignum_t e;
+	bn_sub(e, SM2_N, TWO);
+	fn_exp(r, a, e);
+}
 
+#ifdef __SIZEOF_INT128__
+/*
+ * Constant-time inversion by Bernstein-Yang safegcd ("Fast constant-time gcd
+ * computation and modular inversion", 2019), with 62-bit signed limbs and
+ * batches of 59 divsteps as in libsecp256k1. 10 batches are enough for
+ * 256-bit moduli. The inverse of 0 is 0, as with the Fermat versions.
+ */
+typedef __int128 int128_t;
 
-	/* q = q * n mod (2^32)^9 */
-	for (i = 0; i < 8; i++) {
-		s[i] = 0;
-	}
-	for (i = 0; i < 8; i++) {
-		w = 0;
-		for (j = 0; j < 8; j++) {
-			w += s[i + j] + q[i] * SM2_N[j];
-			s[i + j] = w & 0xffffffff;
-			w >>= 32;
-		}
-		s[i + 8] = w;
-	}
-	for (i = 0; i < 9; i++) {
-		q[i] = s[i];
-	}
-	//printf("qn = "); for (i = 8; i >= 0; i--) printf("%08x", (uint32_t)q[i]); printf("\n");
+typedef struct {
+	int64_t v[5];
+} bn62_t;
 
-	/* r = zl - q (mod (2^32)^9) */
+typedef struct {
+	bn62_t modulus;
+	uint64_t modulus_inv62; // modulus^-1 mod 2^62
+} bn62_modinfo_t;
 
-	if (bn288_cmp(zl, q)) {
-		bn288_sub(zl, zl, q);
-	} else {
-		uint64_t c[9] = {0,0,0,0,0,0,0,0,0x100000000};
-		bn288_sub(q, c, q);
-		bn288_add(zl, q, zl);
-		printf("******\n");
-		printf("******\n");
-		printf("******\n");
-		printf("******\n");
-		printf("******\n");
+typedef struct {
+	int64_t u, v, q, r;
+} bn62_trans_t;
 
-	}
+static const bn62_modinfo_t SM2_P_MODINFO = {
+	{{ 0x3fffffffffffffff, 0x3ffffffc00000003, 0x3fffffffffffffff, 0x3fffffbfffffffff, 0xff }},
+	0x3fffffffffffffff,
+};
 
-	//printf("r  = "); for (i = 8; i >= 0; i--) printf("%08x", (uint32_t)zl[i]); printf("\n");
+static const bn62_modinfo_t SM2_N_MODINFO = {
+	{{ 0x13bbf40939d54123, 0x080f7dac871814ad, 0x3ffffffffffffff7, 0x3fffffbfffffffff, 0xff }},
+	0x0d8061778dcaf68b,
+};
 
-	for (i = 0; i < 8; i++) {
-		r[i] = zl[i];
-	}
-	r[7] += zl[8] << 32;
+#define M62	(UINT64_MAX >> 2)
 
-	/* while r >= p do: r = r - n */
-	while (bn_cmp(r, SM2_N) >= 0) {
-		bn_sub(r, r, SM2_N);
-		//printf("r = r -n  = "); for (i = 8; i >= 0; i--) printf("%08x", (uint32_t)zl[i]); printf("\n");
-	}
+static void bn_to_bn62(bn62_t *r, const bignum_t a)
+{
+	r->v[0] = a[0] & M62;
+	r->v[1] = (a[0] >> 62 | a[1] << 2) & M62;
+	r->v[2] = (a[1] >> 60 | a[2] << 4) & M62;
+	r->v[3] = (a[2] >> 58 | a[3] << 6) & M62;
+	r->v[4] = a[3] >> 56;
 }
 
-static void fn_sqr(bignum_t r, const bignum_t a)
+static void bn_from_bn62(bignum_t r, const bn62_t *a)
 {
-	fn_mul(r, a, a);
+	const uint64_t v0 = a->v[0], v1 = a->v[1], v2 = a->v[2], v3 = a->v[3], v4 = a->v[4];
+	r[0] = v0 | v1 << 62;
+	r[1] = v1 >> 2 | v2 << 60;
+	r[2] = v2 >> 4 | v3 << 58;
+	r[3] = v3 >> 6 | v4 << 56;
 }
 
-static void fn_exp(bignum_t r, const bignum_t a, const bignum_t e)
+/*
+ * 59 branch-free divsteps on the low bits of f and g, zeta = -(delta + 1/2).
+ * The transition matrix t is scaled by 2^62.
+ */
+static int64_t bn62_divsteps_59(int64_t zeta, uint64_t f0, uint64_t g0, bn62_trans_t *t)
 {
-	bignum_t t;
-	uint32_t w;
-	int i, j;
+	uint64_t u = 8, v = 0, q = 0, r = 8;
+	volatile uint64_t c1, c2;
+	uint64_t mask1, mask2, f = f0, g = g0, x, y, z;
+	int i;
 
-	bn_set_one(t);
-	for (i = 7; i >= 0; i--) {
-		w = (uint32_t)e[i];
-		for (j = 0; j < 32; j++) {
-			fn_sqr(t, t);
-			if (w & 0x80000000) {
-				fn_mul(t, t, a);
-			}
-			w <<= 1;
-		}
+	for (i = 3; i < 62; i++) {
+		c1 = zeta >> 63;
+		mask1 = c1;
+		c2 = g & 1;
+		mask2 = -c2;
+		// if zeta < 0, negate f, u, v before adding them to g, q, r
+		x = (f ^ mask1) - mask1;
+		y = (u ^ mask1) - mask1;
+		z = (v ^ mask1) - mask1;
+		// add them if g is odd
+		g += x & mask2;
+		q += y & mask2;
+		r += z & mask2;
+		// if zeta < 0 and g odd, swap: (f, u, v) += (g, q, r), zeta = -zeta - 2
+		mask1 &= mask2;
+		zeta = (zeta ^ (int64_t)mask1) - 1;
+		f += g & mask1;
+		u += q & mask1;
+		v += r & mask1;
+		g >>= 1;
+		u <<= 1;
+		v <<= 1;
+	}
+	t->u = (int64_t)u;
+	t->v = (int64_t)v;
+	t->q = (int64_t)q;
+	t->r = (int64_t)r;
+	return zeta;
+}
+
+/* (d, e) = t * (d, e) / 2^62 (mod modulus), in the range (-2 * modulus, modulus) */
+static void bn62_update_de(bn62_t *d, bn62_t *e, const bn62_trans_t *t, const bn62_modinfo_t *mod)
+{
+	const int64_t d0 = d->v[0], d1 = d->v[1], d2 = d->v[2], d3 = d->v[3], d4 = d->v[4];
+	const int64_t e0 = e->v[0], e1 = e->v[1], e2 = e->v[2], e3 = e->v[3], e4 = e->v[4];
+	const int64_t u = t->u, v = t->v, q = t->q, r = t->r;
+	int64_t md, me, sd, se;
+	int128_t cd, ce;
+
+	// start md, me as u, q if d < 0 and v, r if e < 0, to keep the output in range
+	sd = d4 >> 63;
+	se = e4 >> 63;
+	md = (u & sd) + (v & se);
+	me = (q & sd) + (r & se);
+	cd = (int128_t)u * d0 + (int128_t)v * e0;
+	ce = (int128_t)q * d0 + (int128_t)r * e0;
+	// choose md, me so that the low 62 bits of t * (d, e) + modulus * (md, me) are 0
+	md -= (mod->modulus_inv62 * (uint64_t)cd + md) & M62;
+	me -= (mod->modulus_inv62 * (uint64_t)ce + me) & M62;
+	cd += (int128_t)mod->modulus.v[0] * md;
+	ce += (int128_t)mod->modulus.v[0] * me;
+	cd >>= 62;
+	ce >>= 62;
+
+	cd += (int128_t)u * d1 + (int128_t)v * e1 + (int128_t)mod->modulus.v[1] * md;
+	ce += (int128_t)q * d1 + (int128_t)r * e1 + (int128_t)mod->modulus.v[1] * me;
+	d->v[0] = (int64_t)cd & M62; cd >>= 62;
+	e->v[0] = (int64_t)ce & M62; ce >>= 62;
+
+	cd += (int128_t)u * d2 + (int128_t)v * e2 + (int128_t)mod->modulus.v[2] * md;
+	ce += (int128_t)q * d2 + (int128_t)r * e2 + (int128_t)mod->modulus.v[2] * me;
+	d->v[1] = (int64_t)cd & M62; cd >>= 62;
+	e->v[1] = (int64_t)ce & M62; ce >>= 62;
+
+	cd += (int128_t)u * d3 + (int128_t)v * e3 + (int128_t)mod->modulus.v[3] * md;
+	ce += (int128_t)q * d3 + (int128_t)r * e3 + (int128_t)mod->modulus.v[3] * me;
+	d->v[2] = (int64_t)cd & M62; cd >>= 62;
+	e->v[2] = (int64_t)ce & M62; ce >>= 62;
+
+	cd += (int128_t)u * d4 + (int128_t)v * e4 + (int128_t)mod->modulus.v[4] * md;
+	ce += (int128_t)q * d4 + (int128_t)r * e4 + (int128_t)mod->modulus.v[4] * me;
+	d->v[3] = (int64_t)cd & M62; cd >>= 62;
+	e->v[3] = (int64_t)ce & M62; ce >>= 62;
+
+	d->v[4] = (int64_t)cd;
+	e->v[4] = (int64_t)ce;
+}
+
+/* (f, g) = t * (f, g) / 2^62, exact */
+static void bn62_update_fg(bn62_t *f, bn62_t *g, const bn62_trans_t *t)
+{
+	const int64_t f0 = f->v[0], f1 = f->v[1], f2 = f->v[2], f3 = f->v[3], f4 = f->v[4];
+	const int64_t g0 = g->v[0], g1 = g->v[1], g2 = g->v[2], g3 = g->v[3], g4 = g->v[4];
+	const int64_t u = t->u, v = t->v, q = t->q, r = t->r;
+	int128_t cf, cg;
+
+	cf = (int128_t)u * f0 + (int128_t)v * g0;
+	cg = (int128_t)q * f0 + (int128_t)r * g0;
+	cf >>= 62;
+	cg >>= 62;
+
+	cf += (int128_t)u * f1 + (int128_t)v * g1;
+	cg += (int128_t)q * f1 + (int128_t)r * g1;
+	f->v[0] = (int64_t)cf & M62; cf >>= 62;
+	g->v[0] = (int64_t)cg & M62; cg >>= 62;
+
+	cf += (int128_t)u * f2 + (int128_t)v * g2;
+	cg += (int128_t)q * f2 + (int128_t)r * g2;
+	f->v[1] = (int64_t)cf & M62; cf >>= 62;
+	g->v[1] = (int64_t)cg & M62; cg >>= 62;
+
+	cf += (int128_t)u * f3 + (int128_t)v * g3;
+	cg += (int128_t)q * f3 + (int128_t)r * g3;
+	f->v[2] = (int64_t)cf & M62; cf >>= 62;
+	g->v[2] = (int64_t)cg & M62; cg >>= 62;
+
+	cf += (int128_t)u * f4 + (int128_t)v * g4;
+	cg += (int128_t)q * f4 + (int128_t)r * g4;
+	f->v[3] = (int64_t)cf & M62; cf >>= 62;
+	g->v[3] = (int64_t)cg & M62; cg >>= 62;
+
+	f->v[4] = (int64_t)cf;
+	g->v[4] = (int64_t)cg;
+}
+
+/* bring r from (-2 * modulus, modulus) to [0, modulus), negated if sign < 0 */
+static void bn62_normalize(bn62_t *r, int64_t sign, const bn62_modinfo_t *mod)
+{
+	const int64_t m62 = (int64_t)M62;
+	int64_t r0 = r->v[0], r1 = r->v[1], r2 = r->v[2], r3 = r->v[3], r4 = r->v[4];
+	volatile int64_t cond_add, cond_negate;
+
+	cond_add = r4 >> 63;
+	r0 += mod->modulus.v[0] & cond_add;
+	r1 += mod->modulus.v[1] & cond_add;
+	r2 += mod->modulus.v[2] & cond_add;
+	r3 += mod->modulus.v[3] & cond_add;
+	r4 += mod->modulus.v[4] & cond_add;
+	cond_negate = sign >> 63;
+	r0 = (r0 ^ cond_negate) - cond_negate;
+	r1 = (r1 ^ cond_negate) - cond_negate;
+	r2 = (r2 ^ cond_negate) - cond_negate;
+	r3 = (r3 ^ cond_negate) - cond_negate;
+	r4 = (r4 ^ cond_negate) - cond_negate;
+	r1 += r0 >> 62; r0 &= m62;
+	r2 += r1 >> 62; r1 &= m62;
+	r3 += r2 >> 62; r2 &= m62;
+	r4 += r3 >> 62; r3 &= m62;
+
+	cond_add = r4 >> 63;
+	r0 += mod->modulus.v[0] & cond_add;
+	r1 += mod->modulus.v[1] & cond_add;
+	r2 += mod->modulus.v[2] & cond_add;
+	r3 += mod->modulus.v[3] & cond_add;
+	r4 += mod->modulus.v[4] & cond_add;
+	r1 += r0 >> 62; r0 &= m62;
+	r2 += r1 >> 62; r1 &= m62;
+	r3 += r2 >> 62; r2 &= m62;
+	r4 += r3 >> 62; r3 &= m62;
+
+	r->v[0] = r0;
+	r->v[1] = r1;
+	r->v[2] = r2;
+	r->v[3] = r3;
+	r->v[4] = r4;
+}
+
+/* r = a^-1 (mod modulus), a < modulus */
+static void bn_inv_safegcd(bignum_t r, const bignum_t a, const bn62_modinfo_t *mod)
+{
+	bn62_t d = {{0, 0, 0, 0, 0}};
+	bn62_t e = {{1, 0, 0, 0, 0}};
+	bn62_t f = mod->modulus;
+	bn62_t g;
+	bn62_trans_t t;
+	int64_t zeta = -1;
+	int i;
+
+	bn_to_bn62(&g, a);
+	for (i = 0; i < 10; i++) {
+		zeta = bn62_divsteps_59(zeta, f.v[0], g.v[0], &t);
+		bn62_update_de(&d, &e, &t, mod);
+		bn62_update_fg(&f, &g, &t);
 	}
+	// now g = 0 and f = +-1, so d = +-a^-1
+	bn62_normalize(&d, f.v[4], mod);
+	bn_from_bn62(r, &d);
 
-	bn_copy(r, t);
+	memset(&e, 0, sizeof(e));
+	memset(&g, 0, sizeof(g));
+	memset(&t, 0, sizeof(t));
+}
+
+static void fp_inv(bignum_t r, const bignum_t a)
+{
+	bn_inv_safegcd(r, a, &SM2_P_MODINFO);
 }
 
 static void fn_inv(bignum_t r, const bignum_t a)
 {
-	bignum_t e;
-	bn_sub(e, SM2_N, TWO);
-	fn_exp(r, a, e);
+	bn_inv_safegcd(r, a, &SM2_N_MODINFO);
 }
+#else
+#define fp_inv(r, a)	fp_inv_fermat(r, a)
+#define fn_inv(r, a)	fn_inv_fermat(r, a)
+#endif
 
 static void fn_rand(bignum_t r)
 {
@@ -781,13 +1019,12 @@ static int bn_test(void)
 	bignum_t y;
 	bn_copy(x, SM2_G->X);
 	bn_copy(y, SM2_G->Y);
-	int ok, i = 1;
+	int err = 0, ok, i = 1, j;
 
 	char hex[65];
 
 	bignum_t v = {
-		0x6ccd59fb, 0x33da05e5, 0x22bb4201, 0x73b1984b,
-		0x34e6ca56, 0x0e1b32f8, 0x61be9736, 0xd3da0ef6,
+		0x33da05e56ccd59fb, 0x73b1984b22bb4201, 0x0e1b32f834e6ca56, 0xd3da0ef661be9736,
 	};
 
 	bignum_t t;
@@ -798,77 +1035,103 @@ static int bn_test(void)
 	// fp tests
 	fp_add(r, x, y);
 	ok = bn_equ_hex(r, hex_fp_add_x_y);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fp_sub(r, x, y);
 	ok = bn_equ_hex(r, hex_fp_sub_x_y);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fp_mul(r, x, y);
 	ok = bn_equ_hex(r, hex_fp_mul_x_y);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fp_exp(r, x, y);
 	ok = bn_equ_hex(r, hex_fp_exp_x_y);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fp_inv(r, x);
 	ok = bn_equ_hex(r, hex_fp_inv_x);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fp_neg(r, x);
 	ok = bn_equ_hex(r, hex_fp_neg_x);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	// fn tests
 	fn_add(r, x, y);
 	ok = bn_equ_hex(r, hex_fn_add_x_y);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fn_sub(r, x, y);
 	ok = bn_equ_hex(r, hex_fn_sub_x_y);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fn_sub(r, y, x);
 	ok = bn_equ_hex(r, hex_fn_sub_y_x);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fn_neg(r, x);
 	ok = bn_equ_hex(r, hex_fn_neg_x);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fn_mul(r, x, y);
 	ok = bn_equ_hex(r, hex_fn_mul_x_y);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fn_mul(r, x, v);
 	ok = bn_equ_hex(r, hex_fn_mul_x_v);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fn_sqr(r, x);
 	ok = bn_equ_hex(r, hex_fn_sqr_x);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fn_exp(r, x, y);
 	ok = bn_equ_hex(r, hex_fn_exp_x_y);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	fn_inv(r, x);
 	ok = bn_equ_hex(r, hex_fn_inv_x);
-	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed");
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	bignum_t tv = {
-		0x2b94b325, 0x5da17313, 0x28d356b1, 0xa4f7fa5e,
-		0x1cb182e0, 0x8470bf20, 0xb52dc19e, 0x2fbadf57,
+		0x5da173132b94b325, 0xa4f7fa5e28d356b1, 0x8470bf201cb182e0, 0x2fbadf57b52dc19e,
 	};
 	bn_from_hex(t, hex_t);
 	ok = (bn_cmp(t, tv) == 0);
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
 
 	bn_to_hex(t, hex);
-	bn_check(t);
+	ok = (memcmp(hex, hex_t, 64) == 0);
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
+
+	// inversion against the Fermat versions, including 1 and modulus - 1
+	ok = 1;
+	for (j = 0; j < 64; j++) {
+		bignum_t inv1, inv2;
+		if (j < 2) {
+			bn_copy(x, j ? ONE : SM2_P);
+			if (!j) bn_sub(x, x, ONE);
+		} else {
+			bn_rand_range(x, SM2_P);
+		}
+		fp_inv(inv1, x);
+		fp_inv_fermat(inv2, x);
+		ok &= (bn_cmp(inv1, inv2) == 0);
 
-	printf("end\n");
-	return 0;
+		if (j < 2) {
+			bn_copy(x, j ? ONE : SM2_N);
+			if (!j) bn_sub(x, x, ONE);
+		} else {
+			bn_rand_range(x, SM2_N);
+		}
+		fn_inv(inv1, x);
+		fn_inv_fermat(inv2, x);
+		ok &= (bn_cmp(inv1, inv2) == 0);
+	}
+	printf("sm2 bn test %d %s\n", i++, ok ? "ok" : "failed"); err += ok ^ 1;
+
+	return err;
 }
 
 static void point_init(point_t *R)
@@ -964,7 +1227,11 @@ static void point_neg(point_t *R, const point_t *P)
 	bn_copy(R->Z, P->Z);
 }
 
-static void point_dbl(point_t *R, const point_t *P)
+/*
+ * R = 2 * P without branching on P. The point at infinity needs no special
+ * case, Z3 = 2 * Y1 * Z1 is 0 whenever Z1 is.
+ */
+static void point_dbl_ct(point_t *R, const point_t *P)
 {
 	const uint64_t *X1 = P->X;
 	const uint64_t *Y1 = P->Y;
@@ -979,11 +1246,6 @@ static void point_dbl(point_t *R, const point_t *P)
 				//printf("Y1 = "); print_bn(Y1);
 				//printf("Z1 = "); print_bn(Z1);
 
-	if (point_is_at_infinity(P)) {
-		point_copy(R, P);
-		return;
-	}
-
 	fp_sqr(T1, Z1);		//printf("T1 = Z1^2    = "); print_bn(T1);
 	fp_sub(T2, X1, T1);	//printf("T2 = X1 - T1 = "); print_bn(T2);
 	fp_add(T1, X1, T1);	//printf("T1 = X1 + T1 = "); print_bn(T1);
@@ -1012,6 +1274,15 @@ static void point_dbl(point_t *R, const point_t *P)
 
 }
 
+static void point_dbl(point_t *R, const point_t *P)
+{
+	if (point_is_at_infinity(P)) {
+		point_copy(R, P);
+		return;
+	}
+	point_dbl_ct(R, P);
+}
+
 // FIXME: Q must be affine coordinate
 // change API!			
 static void point_add(point_t *R, const point_t *P, const point_t *Q)
@@ -1077,6 +1348,63 @@ static void point_add(point_t *R, const point_t *P, const point_t *Q)
 	bn_copy(R->Z, Z3);
 }
 
+/*
+ * R = P + (x2, y2) without branching on the operands. P may be the point at
+ * infinity and R = P when skip is all ones. Only P == (x2, y2) takes the
+ * point_dbl branch, which never happens with a random secret scalar.
+ */
+static void point_add_affine_ct(point_t *R, const point_t *P,
+	const bignum_t x2, const bignum_t y2, uint64_t skip)
+{
+	const uint64_t *X1 = P->X;
+	const uint64_t *Y1 = P->Y;
+	const uint64_t *Z1 = P->Z;
+	bignum_t T1;
+	bignum_t T2;
+	bignum_t T3;
+	bignum_t T4;
+	point_t _S, *S = &_S;
+	uint64_t p_is_inf;
+
+	p_is_inf = bn_is_zero_mask(Z1);
+
+	fp_sqr(T1, Z1);
+	fp_mul(T2, T1, Z1);
+	fp_mul(T1, T1, x2);
+	fp_mul(T2, T2, y2);
+	fp_sub(T1, T1, X1);
+	fp_sub(T2, T2, Y1);
+
+	if (bn_is_zero_mask(T1) & bn_is_zero_mask(T2) & ~p_is_inf & ~skip) {
+		point_set_xy(S, x2, y2);
+		point_dbl(R, S);
+		return;
+	}
+
+	fp_mul(S->Z, Z1, T1);
+	fp_sqr(T3, T1);
+	fp_mul(T4, T3, T1);
+	fp_mul(T3, T3, X1);
+	fp_dbl(T1, T3);
+	fp_sqr(S->X, T2);
+	fp_sub(S->X, S->X, T1);
+	fp_sub(S->X, S->X, T4);
+	fp_sub(T3, T3, S->X);
+	fp_mul(T3, T3, T2);
+	fp_mul(T4, T4, Y1);
+	fp_sub(S->Y, T3, T4);
+
+	bn_cond_copy(S->X, x2, p_is_inf);
+	bn_cond_copy(S->Y, y2, p_is_inf);
+	bn_cond_copy(S->Z, ONE, p_is_inf);
+
+	bn_cond_copy(S->X, X1, skip);
+	bn_cond_copy(S->Y, Y1, skip);
+	bn_cond_copy(S->Z, Z1, skip);
+
+	point_copy(R, S);
+}
+
 static void point_sub(point_t *R, const point_t *P, const point_t *Q)
 {
 	point_t _T, *T = &_T;
@@ -1084,31 +1412,263 @@ static void point_sub(point_t *R, const point_t *P, const point_t *Q)
 	point_add(R, P, T);
 }
 
-static void point_mul(point_t *R, const bignum_t k, const point_t *P)
+/* R = P + Q, both in Jacobian coordinates */
+static void point_add_jacobian(point_t *R, const point_t *P, const point_t *Q)
 {
-	char bits[257] = {0};
-	point_t _Q, *Q = &_Q;
-	point_t _T, *T = &_T;
-	int i;
+	bignum_t U1;
+	bignum_t U2;
+	bignum_t S1;
+	bignum_t S2;
+	bignum_t H;
+	bignum_t r;
+	bignum_t T;
 
-	// FIXME: point_add need affine, so we can not use point_add
-	if (!bn_is_one(P->Z)) {
-		bignum_t x;
-		bignum_t y;
-		point_get_xy(P, x, y);
-		point_set_xy(T, x, y);
-		P = T;
+	if (point_is_at_infinity(Q)) {
+		point_copy(R, P);
+		return;
 	}
-
+	if (point_is_at_infinity(P)) {
+		point_copy(R, Q);
+		return;
+	}
+
+	fp_sqr(T, Q->Z);
+	fp_mul(U1, P->X, T);
+	fp_mul(T, T, Q->Z);
+	fp_mul(S1, P->Y, T);
+	fp_sqr(T, P->Z);
+	fp_mul(U2, Q->X, T);
+	fp_mul(T, T, P->Z);
+	fp_mul(S2, Q->Y, T);
+	fp_sub(H, U2, U1);
+	fp_sub(r, S2, S1);
+	if (bn_is_zero(H)) {
+		if (bn_is_zero(r)) {
+			point_dbl(R, P);
+		} else {
+			point_set_infinity(R);
+		}
+		return;
+	}
+
+	fp_mul(R->Z, P->Z, Q->Z);
+	fp_mul(R->Z, R->Z, H);
+	fp_sqr(T, H);
+	fp_mul(U1, U1, T);	// U1 * H^2
+	fp_mul(T, T, H);	// H^3
+	fp_mul(S1, S1, T);	// S1 * H^3
+	fp_sqr(R->X, r);
+	fp_sub(R->X, R->X, T);
+	fp_sub(R->X, R->X, U1);
+	fp_sub(R->X, R->X, U1);
+	fp_sub(U1, U1, R->X);
+	fp_mul(U1, U1, r);
+	fp_sub(R->Y, U1, S1);
+}
+
+/*
+ * Convert n Jacobian points to affine with a single inversion (Montgomery's
+ * trick). Points at infinity are output as (0, 0).
+ */
+static void point_batch_to_affine(affine_point_t *r, const point_t *P, size_t n)
+{
+	bignum_t inv;
+	bignum_t z_inv;
+	bignum_t t;
+	size_t i;
+
+	if (!n)
+		return;
+
+	// r[i].x = Z_0 * ... * Z_i, skipping Z = 0
+	for (i = 0; i < n; i++) {
+		const uint64_t *Z = point_is_at_infinity(&P[i]) ? ONE : P[i].Z;
+		if (i == 0)
+			bn_copy(r[0].x, Z);
+		else	fp_mul(r[i].x, r[i - 1].x, Z);
+	}
+
+	fp_inv(inv, r[n - 1].x);
+
+	for (i = n - 1; ; i--) {
+		int inf = point_is_at_infinity(&P[i]);
+		if (i > 0) {
+			fp_mul(z_inv, inv, r[i - 1].x);
+			if (!inf)
+				fp_mul(inv, inv, P[i].Z);
+		} else {
+			bn_copy(z_inv, inv);
+		}
+		if (inf) {
+			bn_set_zero(r[i].x);
+			bn_set_zero(r[i].y);
+		} else {
+			fp_sqr(t, z_inv);
+			fp_mul(r[i].x, P[i].X, t);
+			fp_mul(t, t, z_inv);
+			fp_mul(r[i].y, P[i].Y, t);
+		}
+		if (i == 0)
+			break;
+	}
+
+	bn_clean(inv);
+	bn_clean(z_inv);
+}
+
+/* returns len bits of k starting at bit pos, bits above 255 read as 0 */
+static unsigned int bn_get_bits(const bignum_t k, int pos, int len)
+{
+	int i = pos / 64;
+	int s = pos % 64;
+	uint64_t w;
+
+	if (i >= 4)
+		return 0;
+	w = k[i] >> s;
+	if (s + len > 64 && i < 3)
+		w |= k[i + 1] << (64 - s);
+	return (unsigned int)(w & ((1 << len) - 1));
+}
+
+/*
+ * Constant-time R = k * P for secret k, with a signed fixed window
+ * (Booth recoding). Digits are in [-2^(w-1), 2^(w-1)], the table holds the
+ * affine points 1P .. 2^(w-1)P and every lookup reads all of it. While the
+ * leading digits are zero Q stays at infinity, which point_dbl_ct() and
+ * point_add_affine_ct() handle with masks instead of branches.
+ */
+#define SM2_MUL_WINDOW		5
+#define SM2_MUL_TABLE_SIZE	(1 << (SM2_MUL_WINDOW - 1))
+#define SM2_MUL_DIGITS		((256 + SM2_MUL_WINDOW) / SM2_MUL_WINDOW)
+
+/* bits [w*i - 1, w*i + w - 1] of k recoded to sign s (0 or ~0) and digit d */
+static void booth_digit(const bignum_t k, int i, unsigned int *s, unsigned int *d)
+{
+	unsigned int w;
+
+	if (i == 0)
+		w = bn_get_bits(k, 0, SM2_MUL_WINDOW) << 1;
+	else	w = bn_get_bits(k, SM2_MUL_WINDOW * i - 1, SM2_MUL_WINDOW + 1);
+	*s = 0 - (w >> SM2_MUL_WINDOW);
+	*d = (1 << (SM2_MUL_WINDOW + 1)) - w - 1;
+	*d = (*d & *s) | (w & ~*s);
+	*d = (*d >> 1) + (*d & 1);
+}
+
+static void point_mul(point_t *R, const bignum_t k, const point_t *P)
+{
+	point_t T[SM2_MUL_TABLE_SIZE];
+	affine_point_t table[SM2_MUL_TABLE_SIZE];
+	point_t _Q, *Q = &_Q;
+	bignum_t x;
+	bignum_t y;
+	bignum_t ny;
+	unsigned int s, d;
+	uint64_t mask;
+	int i, j;
+
+	// T[j] = (j + 1) * P
+	point_get_xy(P, x, y);
+	point_set_xy(&T[0], x, y);
+	point_dbl(&T[1], &T[0]);
+	for (j = 2; j < SM2_MUL_TABLE_SIZE; j++) {
+		point_add(&T[j], &T[j - 1], &T[0]);
+	}
+	point_batch_to_affine(table, T, SM2_MUL_TABLE_SIZE);
+
 	point_set_infinity(Q);
-	bn_to_bits(k, bits);
-	for (i = 0; i < 256; i++) {
-		point_dbl(Q, Q);
-		if (bits[i] == '1') {
-			point_add(Q, Q, P);
+	for (i = SM2_MUL_DIGITS - 1; i >= 0; i--) {
+		if (i < SM2_MUL_DIGITS - 1) {
+			for (j = 0; j < SM2_MUL_WINDOW; j++) {
+				point_dbl_ct(Q, Q);
+			}
+		}
+
+		booth_digit(k, i, &s, &d);
+
+		bn_set_zero(x);
+		bn_set_zero(y);
+		for (j = 0; j < SM2_MUL_TABLE_SIZE; j++) {
+			mask = u64_eq_mask(j + 1, d);
+			bn_cond_copy(x, table[j].x, mask);
+			bn_cond_copy(y, table[j].y, mask);
 		}
+		fp_neg(ny, y);
+		bn_cond_copy(y, ny, 0 - (uint64_t)(s & 1));
+
+		point_add_affine_ct(Q, Q, x, y, u64_eq_mask(d, 0));
 	}
 	point_copy(R, Q);
+
+	bn_clean(x);
+	bn_clean(y);
+	bn_clean(ny);
+	memset(T, 0, sizeof(T));
+	memset(table, 0, sizeof(table));
+}
+
+/* width-w NAF of k, returns the number of digits */
+static int bn_to_wnaf(const bignum_t k, int w, int8_t naf[257])
+{
+	bignum_t t;
+	bignum_t d;
+	int v, i, len = 0;
+
+	bn_copy(t, k);
+	while (!bn_is_zero(t)) {
+		v = 0;
+		if (t[0] & 1) {
+			v = (int)(t[0] & ((1 << w) - 1));
+			if (v >= (1 << (w - 1)))
+				v -= 1 << w;
+			bn_set_word(d, v < 0 ? -v : v);
+			if (v < 0)
+				bn_add(t, t, d);
+			else	bn_sub(t, t, d);
+		}
+		naf[len++] = (int8_t)v;
+		for (i = 0; i < 3; i++)
+			t[i] = (t[i] >> 1) | (t[i + 1] << 63);
+		t[3] >>= 1;
+	}
+	return len;
+}
+
+/*
+ * Variable-time width-w NAF, only for public scalars such as t in the
+ * t * P half of verification. Odd multiples P, 3P, .. are kept affine.
+ */
+#define SM2_WNAF_WINDOW		5
+#define SM2_WNAF_TABLE_SIZE	(1 << (SM2_WNAF_WINDOW - 2))
+
+/* table[i] = (2i + 1) * P */
+static void point_wnaf_table(affine_point_t table[SM2_WNAF_TABLE_SIZE], const point_t *P)
+{
+	point_t T[SM2_WNAF_TABLE_SIZE];
+	point_t _P2, *P2 = &_P2;
+	int i;
+
+	point_copy(&T[0], P);
+	point_dbl(P2, P);
+	for (i = 1; i < SM2_WNAF_TABLE_SIZE; i++) {
+		point_add_jacobian(&T[i], &T[i - 1], P2);
+	}
+	point_batch_to_affine(table, T, SM2_WNAF_TABLE_SIZE);
+}
+
+/* R = R + d * P for an odd wNAF digit d, table from point_wnaf_table */
+static void point_add_wnaf_digit(point_t *R, const affine_point_t *table, int d)
+{
+	point_t _A, *A = &_A;
+
+	if (d > 0) {
+		point_set_xy(A, table[d / 2].x, table[d / 2].y);
+		point_add(R, R, A);
+	} else if (d < 0) {
+		point_set_xy(A, table[-d / 2].x, table[-d / 2].y);
+		point_sub(R, R, A);
+	}
 }
 
 static void point_to_bytes(const point_t *P, uint8_t out[64])
@@ -1128,28 +1688,303 @@ static void point_from_bytes(point_t *P, const uint8_t in[64])
 	/* should we check if point_is_on_curve */
 }
 
-static void point_mul_generator(point_t *R, const bignum_t k)
+/*
+ * Fixed-base comb for G. The scalar bits are split into SM2_COMB_BLOCKS
+ * blocks of SM2_COMB_TEETH teeth, spaced SM2_COMB_SPACING bits apart, and
+ * SM2_COMB_TABLE[i][m - 1] holds the affine sum of 2^((i*TEETH + j)*SPACING) G
+ * over the set bits j of m. The table is generated at build time by
+ * sm2_comb_gen, which compiles this file with SM2_COMB_GEN. A larger table
+ * means fewer doublings and additions:
+ *	(SPACING - 1) doublings, BLOCKS * SPACING additions,
+ *	BLOCKS * (2^TEETH - 1) * 64 bytes of table.
+ */
+#ifndef SM2_COMB_TEETH
+#define SM2_COMB_TEETH		6
+#endif
+#ifndef SM2_COMB_BLOCKS
+#define SM2_COMB_BLOCKS		4
+#endif
+#define SM2_COMB_SPACING	((256 + SM2_COMB_TEETH * SM2_COMB_BLOCKS - 1)/(SM2_COMB_TEETH * SM2_COMB_BLOCKS))
+#define SM2_COMB_POINTS		((1 << SM2_COMB_TEETH) - 1)
+
+#ifndef SM2_COMB_GEN
+#include "sm2_comb_table.h"
+
+#if SM2_COMB_TABLE_TEETH != SM2_COMB_TEETH || SM2_COMB_TABLE_BLOCKS != SM2_COMB_BLOCKS
+#error "sm2_comb_table.h does not match SM2_COMB_TEETH/SM2_COMB_BLOCKS"
+#endif
+#else
+// filled in by sm2_comb_gen before any use
+static affine_point_t SM2_COMB_TABLE[SM2_COMB_BLOCKS][SM2_COMB_POINTS];
+#endif
+
+/*
+ * Comb table of P with the layout of SM2_COMB_TABLE, blocks * (2^teeth - 1)
+ * affine points, converted with one inversion per block. teeth <= 8.
+ */
+static void point_comb_table(affine_point_t *table, const point_t *P,
+	int teeth, int blocks, int spacing)
+{
+	point_t base[8];
+	point_t T[1 << teeth];
+	point_t _Q, *Q = &_Q;
+	int points = (1 << teeth) - 1;
+	int i, j, k, m;
+
+	// Q = 2^((i*teeth + j)*spacing) P
+	point_copy(Q, P);
+	for (i = 0; i < blocks; i++) {
+		for (j = 0; j < teeth; j++) {
+			point_copy(&base[j], Q);
+			for (k = 0; k < spacing; k++) {
+				point_dbl(Q, Q);
+			}
+		}
+
+		// T[m] = T[m - lowbit(m)] + base[log2(lowbit(m))]
+		point_set_infinity(&T[0]);
+		for (m = 1; m <= points; m++) {
+			for (j = 0; !(m & (1 << j)); j++)
+				;
+			point_add_jacobian(&T[m], &T[m & (m - 1)], &base[j]);
+		}
+		point_batch_to_affine(table + i * points, T + 1, points);
+	}
+}
+
+/* comb index of k for block i at bit offset p */
+static unsigned int comb_digit(const bignum_t k, int teeth, int spacing, int i, int p)
+{
+	unsigned int m = 0, bit;
+	int j;
+
+	for (j = 0; j < teeth; j++) {
+		bit = (i * teeth + j) * spacing + p;
+		if (bit < 256) {
+			m |= (unsigned int)((k[bit / 64] >> (bit % 64)) & 1) << j;
+		}
+	}
+	return m;
+}
+
+/* (x, y) = table[m - 1], or (0, 0) if m == 0, reading every entry */
+static void comb_table_select(bignum_t x, bignum_t y, const affine_point_t *table, unsigned int m)
 {
-	point_mul(R, k, SM2_G);
+	uint64_t mask;
+	int i;
+
+	bn_set_zero(x);
+	bn_set_zero(y);
+	for (i = 0; i < SM2_COMB_POINTS; i++) {
+		mask = u64_eq_mask(i + 1, m);
+		bn_cond_copy(x, table[i].x, mask);
+		bn_cond_copy(y, table[i].y, mask);
+	}
 }
 
-/* R = t * P + s * G */
-static void point_mul_sum(point_t *R, const bignum_t t, const point_t *P, const bignum_t s)
+static void point_mul_generator(point_t *R, const bignum_t k)
 {
-	point_t _sG, *sG = &_sG;
 	bignum_t x;
 	bignum_t y;
+	unsigned int m;
+	int i, p;
+
+	point_set_infinity(R);
+	for (p = SM2_COMB_SPACING - 1; p >= 0; p--) {
+		if (p < SM2_COMB_SPACING - 1) {
+			point_dbl_ct(R, R);
+		}
+		for (i = 0; i < SM2_COMB_BLOCKS; i++) {
+			m = comb_digit(k, SM2_COMB_TEETH, SM2_COMB_SPACING, i, p);
+			comb_table_select(x, y, SM2_COMB_TABLE[i], m);
+			point_add_affine_ct(R, R, x, y, u64_eq_mask(m, 0));
+		}
+	}
+
+	bn_clean(x);
+	bn_clean(y);
+}
 
-	/* T = s * G */
-	point_mul_generator(sG, s);
+#if defined(HAVE_AVX2) && !defined(SM2_COMB_GEN)
+// sm2_avx2.c, words are plain (not Montgomery) little-endian limbs
+int sm2_avx2_comb_x4(uint64_t R[4][12], const uint64_t *table, int points,
+	int blocks, int spacing, const uint8_t *digits);
+int sm2_avx2_mul_x4(uint64_t R[4][12], const uint64_t P[4][8],
+	const int8_t *digits, int ndigits, int window);
 
-	// R = t * P
-	point_mul(R, t, P);
-	point_get_xy(R, x, y);
-	point_set_xy(R, x, y);
+static void point_from_words_x4(point_t R[4], uint64_t words[4][12])
+{
+	int l;
 
-	// R = R + T
-	point_add(R, sG, R);
+	for (l = 0; l < 4; l++) {
+		bn_copy(R[l].X, words[l]);
+		bn_copy(R[l].Y, words[l] + 4);
+		bn_copy(R[l].Z, words[l] + 8);
+	}
+	memset(words, 0, sizeof(uint64_t) * 4 * 12);
+}
+#endif
+
+/*
+ * R[l] = k[l] * G for 4 lanes. With the AVX2 backend the lanes run together,
+ * otherwise, or if a lane hits an exceptional addition, one after another.
+ */
+static void point_mul_generator_x4(point_t R[4], const bignum_t k[4])
+{
+	int l;
+#if defined(HAVE_AVX2) && !defined(SM2_COMB_GEN)
+	uint8_t digits[SM2_COMB_SPACING * SM2_COMB_BLOCKS * 4];
+	uint64_t words[4][12];
+	int i, p, n = 0, ret;
+
+	if (cpu_has_avx2()) {
+		for (p = SM2_COMB_SPACING - 1; p >= 0; p--) {
+			for (i = 0; i < SM2_COMB_BLOCKS; i++) {
+				for (l = 0; l < 4; l++) {
+					digits[n++] = (uint8_t)comb_digit(k[l], SM2_COMB_TEETH, SM2_COMB_SPACING, i, p);
+				}
+			}
+		}
+		ret = sm2_avx2_comb_x4(words, SM2_COMB_TABLE[0][0].x, SM2_COMB_POINTS,
+			SM2_COMB_BLOCKS, SM2_COMB_SPACING, digits);
+		memset(digits, 0, sizeof(digits));
+		if (ret == 1) {
+			point_from_words_x4(R, words);
+			return;
+		}
+		memset(words, 0, sizeof(words));
+	}
+#endif
+	for (l = 0; l < 4; l++) {
+		point_mul_generator(&R[l], k[l]);
+	}
+}
+
+/* R[l] = k[l] * P[l] for 4 lanes, as point_mul_generator_x4 */
+static void point_mul_x4(point_t R[4], const bignum_t k[4], const point_t P[4])
+{
+	int l;
+#if defined(HAVE_AVX2) && !defined(SM2_COMB_GEN)
+	int8_t digits[SM2_MUL_DIGITS * 4];
+	uint64_t xy[4][8];
+	uint64_t words[4][12];
+	unsigned int s, d;
+	int i, n = 0, ret;
+
+	if (cpu_has_avx2()) {
+		for (i = SM2_MUL_DIGITS - 1; i >= 0; i--) {
+			for (l = 0; l < 4; l++) {
+				booth_digit(k[l], i, &s, &d);
+				digits[n++] = (int8_t)((d ^ s) - s);
+			}
+		}
+		for (l = 0; l < 4; l++) {
+			point_get_xy(&P[l], xy[l], xy[l] + 4);
+		}
+		ret = sm2_avx2_mul_x4(words, (const uint64_t (*)[8])xy, digits,
+			SM2_MUL_DIGITS, SM2_MUL_WINDOW);
+		memset(digits, 0, sizeof(digits));
+		if (ret == 1) {
+			point_from_words_x4(R, words);
+			return;
+		}
+		memset(words, 0, sizeof(words));
+	}
+#endif
+	for (l = 0; l < 4; l++) {
+		point_mul(&R[l], k[l], &P[l]);
+	}
+}
+
+/*
+ * R = t * P + s * G in variable time, for verification. t * P is a wNAF
+ * over one shared doubling chain, and the comb additions of s * G are made
+ * in its last SM2_COMB_SPACING steps, where the remaining doublings give
+ * them the same 2^p weight as in point_mul_generator. The odd multiples of
+ * P are given by the caller, as from point_wnaf_table.
+ */
+static void point_mul_sum_table(point_t *R, const bignum_t t,
+	const affine_point_t table[SM2_WNAF_TABLE_SIZE], const bignum_t s)
+{
+	point_t _Q, *Q = &_Q;
+	point_t _A, *A = &_A;
+	int8_t naf[257];
+	unsigned int m;
+	int len, i, j;
+
+	len = bn_to_wnaf(t, SM2_WNAF_WINDOW, naf);
+	if (len < SM2_COMB_SPACING) {
+		memset(naf + len, 0, SM2_COMB_SPACING - len);
+		len = SM2_COMB_SPACING;
+	}
+
+	point_set_infinity(Q);
+	for (i = len - 1; i >= 0; i--) {
+		point_dbl(Q, Q);
+		point_add_wnaf_digit(Q, table, naf[i]);
+		if (i < SM2_COMB_SPACING) {
+			for (j = 0; j < SM2_COMB_BLOCKS; j++) {
+				if ((m = comb_digit(s, SM2_COMB_TEETH, SM2_COMB_SPACING, j, i)) != 0) {
+					point_set_xy(A, SM2_COMB_TABLE[j][m - 1].x, SM2_COMB_TABLE[j][m - 1].y);
+					point_add(Q, Q, A);
+				}
+			}
+		}
+	}
+	point_copy(R, Q);
+}
+
+static void point_mul_sum(point_t *R, const bignum_t t, const point_t *P, const bignum_t s)
+{
+	affine_point_t table[SM2_WNAF_TABLE_SIZE];
+
+	point_wnaf_table(table, P);
+	point_mul_sum_table(R, t, table, s);
+}
+
+#define SM2_VERIFY_KEY_COMB_SPACING \
+	((256 + SM2_VERIFY_KEY_COMB_TEETH * SM2_VERIFY_KEY_COMB_BLOCKS - 1) \
+	/ (SM2_VERIFY_KEY_COMB_TEETH * SM2_VERIFY_KEY_COMB_BLOCKS))
+
+/*
+ * R = t * P + s * G in variable time with comb tables of both P and G, as
+ * cached in SM2_VERIFY_KEY. Both combs share the doubling chain, so only
+ * the larger spacing minus one doublings are needed.
+ */
+static void point_mul_sum_comb(point_t *R, const bignum_t t,
+	const affine_point_t *table, const bignum_t s)
+{
+	int spacing = SM2_COMB_SPACING > SM2_VERIFY_KEY_COMB_SPACING ?
+		SM2_COMB_SPACING : SM2_VERIFY_KEY_COMB_SPACING;
+	point_t _A, *A = &_A;
+	const affine_point_t *T;
+	unsigned int m;
+	int i, p;
+
+	point_set_infinity(R);
+	for (p = spacing - 1; p >= 0; p--) {
+		if (p < spacing - 1) {
+			point_dbl(R, R);
+		}
+		if (p < SM2_VERIFY_KEY_COMB_SPACING) {
+			for (i = 0; i < SM2_VERIFY_KEY_COMB_BLOCKS; i++) {
+				m = comb_digit(t, SM2_VERIFY_KEY_COMB_TEETH, SM2_VERIFY_KEY_COMB_SPACING, i, p);
+				if (m) {
+					T = &table[i * SM2_VERIFY_KEY_COMB_POINTS + m - 1];
+					point_set_xy(A, T->x, T->y);
+					point_add(R, R, A);
+				}
+			}
+		}
+		if (p < SM2_COMB_SPACING) {
+			for (i = 0; i < SM2_COMB_BLOCKS; i++) {
+				if ((m = comb_digit(s, SM2_COMB_TEETH, SM2_COMB_SPACING, i, p)) != 0) {
+					point_set_xy(A, SM2_COMB_TABLE[i][m - 1].x, SM2_COMB_TABLE[i][m - 1].y);
+					point_add(R, R, A);
+				}
+			}
+		}
+	}
 }
 
 static void point_from_hex(point_t *P, const char hex[64 * 2])
@@ -1253,8 +2088,10 @@ static int point_test(void)
 
 int sm2_algo_selftest(void)
 {
-	point_test();
-	return 0;
+	int err = 0;
+	err += bn_test();
+	err += point_test();
+	return err;
 }
 
 int sm2_keygen(SM2_KEY *key)
@@ -1387,22 +2224,19 @@ int sm2_point_mul_sum(SM2_POINT *R, const uint8_t k[32], const SM2_POINT *P, con
 #define hex_krd "f1077f9d7e8091993cdc5b4f0b0c8eda8a9fee73a952f9db27ae7f72d2310928"
 #define hex_s   "006bac5b8057ca829534dfde72a0d7883444a3b9bfe9bcdfb383fb90ed7d9486"
 
-int sm2_do_sign(const SM2_KEY *key, const uint8_t dgst[32], SM2_SIGNATURE *sig)
+/*
+ * s = ((1 + d)^-1 * (k - r * d)) mod n is computed as (1 + d)^-1 * (k + r) - r,
+ * which needs only (1 + d)^-1 and not d itself. d_inv is in Montgomery form.
+ */
+static void sm2_do_sign_with_inv(const bignum_t d_inv, const uint8_t dgst[32], SM2_SIGNATURE *sig)
 {
 	point_t _P, *P = &_P;
-	bignum_t d;
 	bignum_t e;
 	bignum_t k;
 	bignum_t x;
 	bignum_t r;
 	bignum_t s;
 
-	if (!key || !dgst || !sig) {
-		return -1;
-	}
-
-	bn_from_bytes(d, key->private_key);
-
 	// e = H(M)
 	bn_from_bytes(e, dgst);		//print_bn("e", e);
 
@@ -1431,21 +2265,250 @@ retry:
 		goto retry;
 	}
 
-	/* s = ((1 + d)^-1 * (k - r * d)) mod n */
+	/* s = ((1 + d)^-1 * (k + r) - r) mod n */
+	fn_add(k, k, r);
+	fn_mont_mul(s, d_inv, k);
+	fn_sub(s, s, r);		//print_bn("s = ((1 + d)^-1 * (k - r * d)) mod n", s);
 
-	fn_mul(e, r, d);		//print_bn("r*d", e);
-	fn_sub(k, k, e);		//print_bn("k-r*d", k);
-	fn_add(e, ONE, d);		//print_bn("1 +d", e);
-	fn_inv(e, e);			//printf("(1+d)^-1", e);
-	fn_mul(s, e, k);		//print_bn("s = ((1 + d)^-1 * (k - r * d)) mod n", s);
+	bn_to_bytes(r, sig->r);		//print_bn("r", r);
+	bn_to_bytes(s, sig->s);		//print_bn("s", s);
+
+	// x held r + k
+	bn_clean(k);
+	bn_clean(x);
+	bn_clean(r);
+	bn_clean(s);
+	bn_clean(e);
+	memset(P, 0, sizeof(point_t));
+}
+
+int sm2_do_sign(const SM2_KEY *key, const uint8_t dgst[32], SM2_SIGNATURE *sig)
+{
+	bignum_t d;
+
+	if (!key || !dgst || !sig) {
+		return -1;
+	}
+
+	bn_from_bytes(d, key->private_key);
+	fn_add(d, ONE, d);		//print_bn("1 +d", d);
+	fn_inv(d, d);			//printf("(1+d)^-1", d);
+	fn_to_mont(d, d);
+
+	sm2_do_sign_with_inv(d, dgst, sig);
 
 	bn_clean(d);
+	return 1;
+}
+
+int sm2_do_sign_with_key(const SM2_SIGN_KEY *sk, const uint8_t dgst[32], SM2_SIGNATURE *sig)
+{
+	bignum_t d_inv;
+
+	if (!sk || !dgst || !sig) {
+		error_print();
+		return -1;
+	}
+
+	bn_from_bytes(d_inv, sk->d_inv);
+	sm2_do_sign_with_inv(d_inv, dgst, sig);
+
+	bn_clean(d_inv);
+	return 1;
+}
+
+/*
+ * Presignature ring, a bounded MPMC queue where slot i is free for the
+ * producer at position pos when seq == pos and holds data for the consumer
+ * when seq == pos + 1 (D. Vyukov). Without GCC atomics the pool is only safe
+ * for use from one thread.
+ */
+#if defined(__GNUC__)
+#define presign_load(p)			__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define presign_store(p, v)		__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define presign_cas(p, old, new)	__atomic_compare_exchange_n(p, &(old), new, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+#define presign_load(p)			(*(p))
+#define presign_store(p, v)		(*(p) = (v))
+#define presign_cas(p, old, new)	(*(p) == (old) ? (*(p) = (new), 1) : ((old) = *(p), 0))
+#endif
+
+#define SM2_PRESIGN_MASK	(SM2_PRESIGN_POOL_SIZE - 1)
+
+int sm2_presign_pool_init(SM2_PRESIGN_POOL *pool, size_t low_water)
+{
+	size_t i;
+
+	if (!pool || low_water >= SM2_PRESIGN_POOL_SIZE) {
+		error_print();
+		return -1;
+	}
+	memset(pool, 0, sizeof(SM2_PRESIGN_POOL));
+	for (i = 0; i < SM2_PRESIGN_POOL_SIZE; i++) {
+		pool->slots[i].seq = i;
+	}
+	pool->low_water = low_water;
+	return 1;
+}
+
+static int sm2_presign_push(SM2_PRESIGN_POOL *pool, const bignum_t k, const bignum_t x1)
+{
+	SM2_PRESIGN *slot;
+	size_t pos = presign_load(&pool->tail);
+	intptr_t dif;
+
+	for (;;) {
+		slot = &pool->slots[pos & SM2_PRESIGN_MASK];
+		dif = (intptr_t)presign_load(&slot->seq) - (intptr_t)pos;
+		if (dif == 0) {
+			if (presign_cas(&pool->tail, pos, pos + 1))
+				break;
+		} else if (dif < 0) {
+			return 0;
+		} else {
+			pos = presign_load(&pool->tail);
+		}
+	}
+	bn_to_bytes(k, slot->k);
+	bn_to_bytes(x1, slot->x1);
+	presign_store(&slot->seq, pos + 1);
+	return 1;
+}
+
+static int sm2_presign_pop(SM2_PRESIGN_POOL *pool, bignum_t k, bignum_t x1)
+{
+	SM2_PRESIGN *slot;
+	size_t pos = presign_load(&pool->head);
+	intptr_t dif;
+
+	for (;;) {
+		slot = &pool->slots[pos & SM2_PRESIGN_MASK];
+		dif = (intptr_t)presign_load(&slot->seq) - (intptr_t)(pos + 1);
+		if (dif == 0) {
+			if (presign_cas(&pool->head, pos, pos + 1))
+				break;
+		} else if (dif < 0) {
+			return 0;
+		} else {
+			pos = presign_load(&pool->head);
+		}
+	}
+	bn_from_bytes(k, slot->k);
+	bn_from_bytes(x1, slot->x1);
+	memset(slot->k, 0, 32);
+	memset(slot->x1, 0, 32);
+	presign_store(&slot->seq, pos + SM2_PRESIGN_POOL_SIZE);
+	return 1;
+}
+
+size_t sm2_presign_count(const SM2_PRESIGN_POOL *pool)
+{
+	size_t head = presign_load(&pool->head);
+	size_t tail = presign_load(&pool->tail);
+	return tail - head <= SM2_PRESIGN_POOL_SIZE ? tail - head : 0;
+}
+
+int sm2_presign_needs_refill(const SM2_PRESIGN_POOL *pool)
+{
+	return sm2_presign_count(pool) <= pool->low_water;
+}
+
+int sm2_presign_fill(SM2_PRESIGN_POOL *pool, size_t max)
+{
+	point_t _P, *P = &_P;
+	bignum_t k;
+	bignum_t x;
+	size_t n = 0;
+
+	if (!pool) {
+		error_print();
+		return -1;
+	}
+	if (!max) {
+		max = SM2_PRESIGN_POOL_SIZE;
+	}
+
+	while (n < max && sm2_presign_count(pool) < SM2_PRESIGN_POOL_SIZE) {
+		do {
+			fn_rand(k);
+		} while (bn_is_zero(k));
+		point_mul_generator(P, k);
+		point_get_xy(P, x, NULL);
+		if (bn_cmp(x, SM2_N) >= 0) {
+			bn_sub(x, x, SM2_N);
+		}
+		if (!sm2_presign_push(pool, k, x)) {
+			break;
+		}
+		n++;
+	}
+
 	bn_clean(k);
-	bn_to_bytes(r, sig->r);		//print_bn("r", r);
-	bn_to_bytes(s, sig->s);		//print_bn("s", s);
+	bn_clean(x);
+	return (int)n;
+}
+
+int sm2_do_sign_with_pool(const SM2_SIGN_KEY *sk, SM2_PRESIGN_POOL *pool,
+	const uint8_t dgst[32], SM2_SIGNATURE *sig)
+{
+	bignum_t d_inv;
+	bignum_t e;
+	bignum_t k;
+	bignum_t x;
+	bignum_t r;
+	bignum_t s;
+
+	if (!sk || !pool || !dgst || !sig) {
+		error_print();
+		return -1;
+	}
+
+	bn_from_bytes(d_inv, sk->d_inv);
+	bn_from_bytes(e, dgst);
+
+	for (;;) {
+		if (!sm2_presign_pop(pool, k, x)) {
+			sm2_do_sign_with_inv(d_inv, dgst, sig);
+			break;
+		}
+
+		// r = e + x1 (mod n), take the next pair if r == 0 or r + k == n
+		fn_add(r, e, x);
+		if (bn_is_zero(r)) {
+			continue;
+		}
+		bn_add(x, r, k);
+		if (bn_cmp(x, SM2_N) == 0) {
+			continue;
+		}
+
+		// s = ((1 + d)^-1 * (k + r) - r) mod n
+		fn_add(k, k, r);
+		fn_mont_mul(s, d_inv, k);
+		fn_sub(s, s, r);
+
+		bn_to_bytes(r, sig->r);
+		bn_to_bytes(s, sig->s);
+		break;
+	}
+
+	// x held r + k
+	bn_clean(d_inv);
+	bn_clean(k);
+	bn_clean(x);
+	bn_clean(r);
+	bn_clean(s);
+	bn_clean(e);
 	return 1;
 }
 
+void sm2_presign_pool_cleanup(SM2_PRESIGN_POOL *pool)
+{
+	if (pool) {
+		memset(pool, 0, sizeof(SM2_PRESIGN_POOL));
+	}
+}
+
 int sm2_do_verify(const SM2_KEY *key, const uint8_t dgst[32], const SM2_SIGNATURE *sig)
 {
 	point_t _P, *P = &_P;
@@ -1502,41 +2565,230 @@ int sm2_do_verify(const SM2_KEY *key, const uint8_t dgst[32], const SM2_SIGNATUR
 	}
 }
 
-int sm2_point_from_signature(SM2_POINT *point, const SM2_SIGNATURE *sig)
+#define SM2_VERIFY_BATCH_SIZE	16
+
+/*
+ * Verifies up to SM2_VERIFY_BATCH_SIZE signatures. The wNAF table of a
+ * public key is built once per batch, and all the s * G + t * P results are
+ * normalized with a single inversion.
+ */
+static void sm2_verify_batch_chunk(const SM2_KEY *keys, const uint8_t (*dgsts)[32],
+	const SM2_SIGNATURE *sigs, size_t n, int *results)
+{
+	affine_point_t tables[SM2_VERIFY_BATCH_SIZE][SM2_WNAF_TABLE_SIZE];
+	const SM2_POINT *table_keys[SM2_VERIFY_BATCH_SIZE];
+	point_t R[SM2_VERIFY_BATCH_SIZE];
+	affine_point_t xy[SM2_VERIFY_BATCH_SIZE];
+	bignum_t r[SM2_VERIFY_BATCH_SIZE];
+	point_t _P, *P = &_P;
+	bignum_t s;
+	bignum_t t;
+	bignum_t e;
+	size_t ntables = 0;
+	size_t i, j;
+
+	for (i = 0; i < n; i++) {
+		point_set_infinity(&R[i]);
+		results[i] = 0;
+
+		bn_from_bytes(r[i], sigs[i].r);
+		bn_from_bytes(s, sigs[i].s);
+		if (bn_is_zero(r[i])
+			|| bn_cmp(r[i], SM2_N) >= 0
+			|| bn_is_zero(s)
+			|| bn_cmp(s, SM2_N) >= 0) {
+			results[i] = -1;
+			continue;
+		}
+		fn_add(t, r[i], s);
+		if (bn_is_zero(t)) {
+			results[i] = -1;
+			continue;
+		}
+
+		for (j = 0; j < ntables; j++) {
+			if (memcmp(table_keys[j], &keys[i].public_key, sizeof(SM2_POINT)) == 0)
+				break;
+		}
+		if (j == ntables) {
+			point_from_bytes(P, (const uint8_t *)&keys[i].public_key);
+			point_wnaf_table(tables[j], P);
+			table_keys[j] = &keys[i].public_key;
+			ntables++;
+		}
+
+		point_mul_sum_table(&R[i], t, tables[j], s);
+		results[i] = 1;
+	}
+
+	point_batch_to_affine(xy, R, n);
+
+	for (i = 0; i < n; i++) {
+		if (results[i] != 1) {
+			continue;
+		}
+		if (point_is_at_infinity(&R[i])) {
+			results[i] = 0;
+			continue;
+		}
+		// r' = e + x (mod n)
+		bn_from_bytes(e, dgsts[i]);
+		fn_add(e, e, xy[i].x);
+		if (bn_cmp(e, r[i]) != 0) {
+			results[i] = 0;
+		}
+	}
+}
+
+int sm2_verify_batch(const SM2_KEY *keys, const uint8_t (*dgsts)[32],
+	const SM2_SIGNATURE *sigs, size_t n, int *results)
 {
-	return -1;
+	int ret = 1;
+	size_t i;
+
+	if (!keys || !dgsts || !sigs || !results) {
+		error_print();
+		return -1;
+	}
+
+	for (i = 0; i < n; i += SM2_VERIFY_BATCH_SIZE) {
+		size_t len = n - i < SM2_VERIFY_BATCH_SIZE ? n - i : SM2_VERIFY_BATCH_SIZE;
+		sm2_verify_batch_chunk(keys + i, dgsts + i, sigs + i, len, results + i);
+	}
+	for (i = 0; i < n; i++) {
+		if (results[i] != 1)
+			ret = 0;
+	}
+	return ret;
 }
 
-int sm2_kdf(const uint8_t *in, size_t inlen, size_t outlen, uint8_t *out)
+#ifndef SM2_COMB_GEN // sm2_comb_gen is not linked with sm2_compute_z()
+int sm2_sign_key_init(SM2_SIGN_KEY *sk, const SM2_KEY *key, const char *id)
 {
-	SM3_CTX ctx;
-	uint8_t counter_be[4];
-	uint8_t dgst[SM3_DIGEST_SIZE];
-	uint32_t counter = 1;
-	size_t len;
+	uint8_t z[32];
+	bignum_t d;
 
-	/*
-	size_t i; fprintf(stderr, "kdf input : ");
-	for (i = 0; i < inlen; i++) fprintf(stderr, "%02x", in[i]); fprintf(stderr, "\n");
-	*/
+	if (!sk || !key || !id || strlen(id) > SM2_MAX_ID_SIZE) {
+		error_print();
+		return -1;
+	}
+
+	// (1 + d)^-1 (mod n), d in [1, n - 2]
+	bn_from_bytes(d, key->private_key);
+	if (bn_is_zero(d) || bn_cmp(d, SM2_N) >= 0) {
+		bn_clean(d);
+		error_print();
+		return -1;
+	}
+	fn_add(d, ONE, d);
+	if (bn_is_zero(d)) {
+		bn_clean(d);
+		error_print();
+		return -1;
+	}
+	fn_inv(d, d);
+	fn_to_mont(d, d);
+	bn_to_bytes(d, sk->d_inv);
+	bn_clean(d);
 
-	while (outlen) {
-		PUTU32(counter_be, counter);
-		counter++;
+	sk->public_key = key->public_key;
+	sm2_compute_z(z, &key->public_key, id);
+	sm3_init(&sk->sm3_ctx);
+	sm3_update(&sk->sm3_ctx, z, 32);
+	return 1;
+}
 
-		sm3_init(&ctx);
-		sm3_update(&ctx, in, inlen);
-		sm3_update(&ctx, counter_be, sizeof(counter_be));
-		sm3_finish(&ctx, dgst);
+void sm2_sign_key_cleanup(SM2_SIGN_KEY *sk)
+{
+	if (sk) {
+		memset(sk, 0, sizeof(SM2_SIGN_KEY));
+	}
+}
+
+int sm2_verify_key_init(SM2_VERIFY_KEY *vk, const SM2_KEY *key, const char *id)
+{
+	point_t _P, *P = &_P;
 
-		len = outlen < SM3_DIGEST_SIZE ? outlen : SM3_DIGEST_SIZE;
-		memcpy(out, dgst, len);
-		out += len;
-		outlen -= len;
+	if (!vk || !key || !id || strlen(id) > SM2_MAX_ID_SIZE) {
+		error_print();
+		return -1;
 	}
+	if (sm2_point_is_on_curve(&key->public_key) != 1) {
+		error_print();
+		return -1;
+	}
+
+	memcpy(&vk->public_key, &key->public_key, sizeof(SM2_POINT));
+	sm2_compute_z(vk->z, &vk->public_key, id);
+	sm3_init(&vk->sm3_ctx);
+	sm3_update(&vk->sm3_ctx, vk->z, 32);
 
-	memset(&ctx, 0, sizeof(SM3_CTX));
-	memset(dgst, 0, sizeof(dgst));
+	point_from_bytes(P, (const uint8_t *)&vk->public_key);
+	point_comb_table((affine_point_t *)vk->comb, P, SM2_VERIFY_KEY_COMB_TEETH,
+		SM2_VERIFY_KEY_COMB_BLOCKS, SM2_VERIFY_KEY_COMB_SPACING);
+	return 1;
+}
+#endif
+
+int sm2_do_verify_with_key(const SM2_VERIFY_KEY *vk, const uint8_t dgst[32], const SM2_SIGNATURE *sig)
+{
+	point_t _R, *R = &_R;
+	bignum_t r;
+	bignum_t s;
+	bignum_t e;
+	bignum_t x;
+	bignum_t t;
+
+	if (!vk || !dgst || !sig) {
+		error_print();
+		return -1;
+	}
+
+	bn_from_bytes(r, sig->r);
+	bn_from_bytes(s, sig->s);
+	if (bn_is_zero(r)
+		|| bn_cmp(r, SM2_N) >= 0
+		|| bn_is_zero(s)
+		|| bn_cmp(s, SM2_N) >= 0) {
+		error_print();
+		return -1;
+	}
+
+	// t = r + s (mod n), t != 0
+	fn_add(t, r, s);
+	if (bn_is_zero(t)) {
+		error_print();
+		return -1;
+	}
+
+	// (x, y) = s * G + t * P
+	point_mul_sum_comb(R, t, (const affine_point_t *)vk->comb, s);
+	if (point_is_at_infinity(R)) {
+		return 0;
+	}
+	point_get_xy(R, x, NULL);
+
+	// r' = e + x (mod n)
+	bn_from_bytes(e, dgst);
+	fn_add(e, e, x);
+	return bn_cmp(e, r) == 0 ? 1 : 0;
+}
+
+void sm2_verify_key_cleanup(SM2_VERIFY_KEY *vk)
+{
+	if (vk) {
+		memset(vk, 0, sizeof(SM2_VERIFY_KEY));
+	}
+}
+
+int sm2_point_from_signature(SM2_POINT *point, const SM2_SIGNATURE *sig)
+{
+	return -1;
+}
+
+int sm2_kdf(const uint8_t *in, size_t inlen, size_t outlen, uint8_t *out)
+{
+	sm3_kdf(in, inlen, outlen, out);
 	return 1;
 }
 
@@ -1665,3 +2917,209 @@ int sm2_ecdh(const SM2_KEY *key, const SM2_POINT *peer_public, SM2_POINT *out)
 	point_to_bytes(P, (uint8_t *)out);
 	return 1;
 }
+
+#define SM2_KEYGEN_BATCH_SIZE	64
+
+/*
+ * Public keys are made with the fixed-base comb, 4 lanes at a time, and left
+ * in Jacobian form until one batch inversion per SM2_KEYGEN_BATCH_SIZE keys.
+ */
+int sm2_keygen_batch(SM2_KEY *keys, size_t n)
+{
+	bignum_t k[SM2_KEYGEN_BATCH_SIZE];
+	point_t P[SM2_KEYGEN_BATCH_SIZE];
+	affine_point_t A[SM2_KEYGEN_BATCH_SIZE];
+	size_t i, m, l;
+
+	if (!keys && n) {
+		error_print();
+		return -1;
+	}
+
+	for (i = 0; i < n; i += m) {
+		m = (n - i < SM2_KEYGEN_BATCH_SIZE) ? n - i : SM2_KEYGEN_BATCH_SIZE;
+
+		// pad to whole groups of 4 with k = 1
+		for (l = 0; l < m; l++) {
+			do {
+				bn_rand_range(k[l], SM2_N);
+			} while (bn_is_zero(k[l]));
+		}
+		for (; l % 4; l++) {
+			bn_set_one(k[l]);
+		}
+		for (l = 0; l < m; l += 4) {
+			point_mul_generator_x4(P + l, k + l);
+		}
+		point_batch_to_affine(A, P, m);
+
+		for (l = 0; l < m; l++) {
+			bn_to_bytes(k[l], keys[i + l].private_key);
+			bn_to_bytes(A[l].x, keys[i + l].public_key.x);
+			bn_to_bytes(A[l].y, keys[i + l].public_key.y);
+		}
+	}
+
+	memset(k, 0, sizeof(k));
+	return 1;
+}
+
+/*
+ * Multi-buffer versions work in groups of 4 lanes, a short last group is
+ * padded with dummy lanes whose results are dropped.
+ */
+#define SM2_MB_LANES	4
+
+/*
+ * The (1 + d)^-1 of a group share one inversion. A lane that has to choose
+ * another k is finished by sm2_do_sign_with_inv(). Every d is checked to be
+ * in [1, n - 2] before any signature is written.
+ *
+ * The products are chained with fn_mont_mul(), so prod[l] carries a factor
+ * R^-l (R = 2^256) and its inverse R^l. Scaling the inverse once by R makes
+ * every step of the way back yield (1 + d)^-1 in Montgomery form, which is
+ * what the signing step wants.
+ */
+int sm2_do_sign_mb(const SM2_KEY *keys, const uint8_t (*dgsts)[32], SM2_SIGNATURE *sigs, size_t n)
+{
+	int ret = -1;
+	bignum_t d_inv[SM2_MB_LANES];
+	bignum_t prod[SM2_MB_LANES];
+	bignum_t k[SM2_MB_LANES];
+	bignum_t inv;
+	bignum_t e;
+	bignum_t r;
+	bignum_t s;
+	point_t P[SM2_MB_LANES];
+	affine_point_t A[SM2_MB_LANES];
+	size_t i, m;
+	int l;
+
+	if ((!keys || !dgsts || !sigs) && n) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		bn_from_bytes(inv, keys[i].private_key);
+		fn_add(s, ONE, inv);
+		if (bn_is_zero(inv) || bn_cmp(inv, SM2_N) >= 0 || bn_is_zero(s)) {
+			error_print();
+			goto end;
+		}
+	}
+
+	for (i = 0; i < n; i += m) {
+		m = (n - i < SM2_MB_LANES) ? n - i : SM2_MB_LANES;
+
+		// d_inv[l] = (1 + d)^-1 * R with one inversion for the group
+		for (l = 0; l < SM2_MB_LANES; l++) {
+			if ((size_t)l < m) {
+				bn_from_bytes(d_inv[l], keys[i + l].private_key);
+				fn_add(d_inv[l], ONE, d_inv[l]);
+			} else {
+				bn_set_one(d_inv[l]);
+			}
+			if (l) {
+				fn_mont_mul(prod[l], prod[l - 1], d_inv[l]);
+			} else {
+				bn_copy(prod[0], d_inv[0]);
+			}
+		}
+		fn_inv(inv, prod[SM2_MB_LANES - 1]);
+		fn_mont_mul(inv, inv, SM2_N_R2);
+		for (l = SM2_MB_LANES - 1; l > 0; l--) {
+			fn_mont_mul(prod[l], inv, prod[l - 1]);
+			fn_mont_mul(inv, inv, d_inv[l]);
+			bn_copy(d_inv[l], prod[l]);
+		}
+		bn_copy(d_inv[0], inv);
+
+		// (x, y) = k * G
+		for (l = 0; l < SM2_MB_LANES; l++) {
+			do {
+				fn_rand(k[l]);
+			} while (bn_is_zero(k[l]));
+		}
+		point_mul_generator_x4(P, k);
+		point_batch_to_affine(A, P, SM2_MB_LANES);
+
+		for (l = 0; (size_t)l < m; l++) {
+			// r = e + x (mod n), retry if r == 0 or r + k == n
+			bn_from_bytes(e, dgsts[i + l]);
+			fn_add(r, e, A[l].x);
+			bn_add(s, r, k[l]);
+			if (bn_is_zero(r) || bn_cmp(s, SM2_N) == 0) {
+				sm2_do_sign_with_inv(d_inv[l], dgsts[i + l], &sigs[i + l]);
+				continue;
+			}
+
+			// s = ((1 + d)^-1 * (k + r) - r) mod n
+			fn_add(k[l], k[l], r);
+			fn_mont_mul(s, d_inv[l], k[l]);
+			fn_sub(s, s, r);
+			bn_to_bytes(r, sigs[i + l].r);
+			bn_to_bytes(s, sigs[i + l].s);
+		}
+	}
+	ret = 1;
+
+end:
+	memset(d_inv, 0, sizeof(d_inv));
+	memset(prod, 0, sizeof(prod));
+	memset(k, 0, sizeof(k));
+	memset(P, 0, sizeof(P));
+	memset(A, 0, sizeof(A));
+	bn_clean(inv);
+	bn_clean(e);
+	bn_clean(r);
+	bn_clean(s);
+	return ret;
+}
+
+int sm2_ecdh_mb(const SM2_KEY *keys, const SM2_POINT *peers, SM2_POINT *outs, size_t n)
+{
+	bignum_t d[SM2_MB_LANES];
+	point_t P[SM2_MB_LANES];
+	size_t i, m;
+	int l;
+
+	if ((!keys || !peers || !outs) && n) {
+		error_print();
+		return -1;
+	}
+	// d in [1, n - 1], peers on the curve
+	for (i = 0; i < n; i++) {
+		bn_from_bytes(d[0], keys[i].private_key);
+		if (bn_is_zero(d[0]) || bn_cmp(d[0], SM2_N) >= 0) {
+			bn_clean(d[0]);
+			error_print();
+			return -1;
+		}
+		point_from_bytes(&P[0], (const uint8_t *)&peers[i]);
+		if (!point_is_on_curve(&P[0])) {
+			bn_clean(d[0]);
+			error_print();
+			return -1;
+		}
+	}
+
+	for (i = 0; i < n; i += m) {
+		m = (n - i < SM2_MB_LANES) ? n - i : SM2_MB_LANES;
+		for (l = 0; l < SM2_MB_LANES; l++) {
+			if ((size_t)l < m) {
+				bn_from_bytes(d[l], keys[i + l].private_key);
+				point_from_bytes(&P[l], (const uint8_t *)&peers[i + l]);
+			} else {
+				bn_set_one(d[l]);
+				point_copy(&P[l], &P[0]);
+			}
+		}
+		point_mul_x4(P, d, P);
+		for (l = 0; (size_t)l < m; l++) {
+			point_to_bytes(&P[l], (uint8_t *)&outs[i + l]);
+		}
+	}
+
+	memset(d, 0, sizeof(d));
+	return 1;
+}
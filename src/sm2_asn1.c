@@ -127,12 +127,14 @@ int sm2_signature_from_der(SM2_SIGNATURE *sig, const uint8_t **in, size_t *inlen
 		|| datalen > 0) {
 		return -1;
 	}
-	if (rlen != 32 || slen != 32) {
+	// INTEGER drops leading zero bytes of r and s
+	if (rlen > 32 || slen > 32) {
 		return -2;
 	}
 
-	memcpy(sig->r, r, 32);
-	memcpy(sig->s, s, 32);
+	memset(sig, 0, sizeof(SM2_SIGNATURE));
+	memcpy(sig->r + 32 - rlen, r, rlen);
+	memcpy(sig->s + 32 - slen, s, slen);
 	return 1;
 }
 
@@ -172,15 +174,17 @@ int sm2_ciphertext_from_der(SM2_CIPHERTEXT *a, const uint8_t **in, size_t *inlen
 		|| datalen > 0) {
 		return -1;
 	}
-	if (xlen != 32
-		|| ylen != 32
+	// INTEGER drops leading zero bytes of x and y
+	if (xlen > 32
+		|| ylen > 32
 		|| hashlen != 32
 		|| clen < 1) {
 		return -1;
 	}
 
-	memcpy(a->point.x, x, 32);
-	memcpy(a->point.y, y, 32);
+	memset(&a->point, 0, sizeof(SM2_POINT));
+	memcpy(a->point.x + 32 - xlen, x, xlen);
+	memcpy(a->point.y + 32 - ylen, y, ylen);
 	memcpy(a->hash, hash, 32);
 	memcpy(a->ciphertext, c, clen);
 	a->ciphertext_size = (uint32_t)clen;
@@ -0,0 +1,671 @@
+﻿/*
+ * Copyright (c) 2014 - 2020 The GmSSL Project.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgment:
+ *    "This product includes software developed by the GmSSL Project.
+ *    (http://gmssl.org/)"
+ *
+ * 4. The name "GmSSL Project" must not be used to endorse or promote
+ *    products derived from this software without prior written
+ *    permission. For written permission, please contact
+ *    guanzhi1980@gmail.com.
+ *
+ * 5. Products derived from this software may not be called "GmSSL"
+ *    nor may "GmSSL" appear in their names without prior written
+ *    permission of the GmSSL Project.
+ *
+ * 6. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by the GmSSL Project
+ *    (http://gmssl.org/)"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE GmSSL PROJECT ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE GmSSL PROJECT OR
+ * ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * 4-lane AVX2 backend for SM2 point multiplication, used by the sm2_*_mb
+ * batch functions in sm2_algo.c. Each 64-bit lane holds one 29-bit limb of
+ * an independent field element, 9 limbs per element, and values are kept
+ * in the Montgomery domain with R = 2^261. Values are only partially
+ * reduced: limbs are below 2^29 and the element is below 2^257.
+ *
+ * This file is compiled with -mavx2 and only called after cpu_has_avx2().
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+
+#define FE_MASK		0x1fffffff
+
+typedef struct {
+	__m256i v[9];
+} fe4_t;
+
+typedef struct {
+	fe4_t X;
+	fe4_t Y;
+	fe4_t Z;
+} point4_t;
+
+static const uint32_t FE_P[9] = {
+	0x1fffffff, 0x1fffffff, 0x0000003f, 0x1ffffe00, 0x1fffffff,
+	0x1fffffff, 0x1fffffff, 0x1fdfffff, 0x00ffffff,
+};
+
+static const uint32_t FE_2P[9] = {
+	0x1ffffffe, 0x1fffffff, 0x0000007f, 0x1ffffc00, 0x1fffffff,
+	0x1fffffff, 0x1fffffff, 0x1fbfffff, 0x01ffffff,
+};
+
+// 4p with every limb at least as large as a reduced limb, for subtraction
+static const uint32_t FE_SUB_4P[9] = {
+	0x3ffffffc, 0x3ffffffe, 0x200000fe, 0x3ffff7ff, 0x3ffffffe,
+	0x3ffffffe, 0x3ffffffe, 0x3f7ffffe, 0x03fffffe,
+};
+
+// R^2 mod p
+static const uint32_t FE_R2[9] = {
+	0x00000c00, 0x00004000, 0x1fff0000, 0x0017ffff, 0x00400000,
+	0x02000000, 0x00000000, 0x00000001, 0x00000010,
+};
+
+// R mod p, i.e. 1 in the Montgomery domain
+static const uint32_t FE_MONT_ONE[9] = {
+	0x00000020, 0x00000000, 0x1ffff800, 0x00003fff, 0x00000000,
+	0x00000000, 0x00000000, 0x04000000, 0x00000000,
+};
+
+static void fe4_set_const(fe4_t *r, const uint32_t c[9])
+{
+	int i;
+	for (i = 0; i < 9; i++) {
+		r->v[i] = _mm256_set1_epi64x(c[i]);
+	}
+}
+
+static void fe4_set_zero(fe4_t *r)
+{
+	int i;
+	for (i = 0; i < 9; i++) {
+		r->v[i] = _mm256_setzero_si256();
+	}
+}
+
+static void fe4_blend(fe4_t *r, const fe4_t *a, const fe4_t *b, __m256i mask)
+{
+	int i;
+	for (i = 0; i < 9; i++) {
+		r->v[i] = _mm256_blendv_epi8(a->v[i], b->v[i], mask);
+	}
+}
+
+static void fe4_carry(fe4_t *a)
+{
+	const __m256i mask = _mm256_set1_epi64x(FE_MASK);
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		a->v[i + 1] = _mm256_add_epi64(a->v[i + 1], _mm256_srli_epi64(a->v[i], 29));
+		a->v[i] = _mm256_and_si256(a->v[i], mask);
+	}
+}
+
+/* a < 2^261 with carried limbs to a < 2^257, by 2^256 = 2^224 + 2^96 - 2^64 + 1 (mod p) */
+static void fe4_reduce(fe4_t *a)
+{
+	__m256i q = _mm256_srli_epi64(a->v[8], 24);
+
+	a->v[8] = _mm256_and_si256(a->v[8], _mm256_set1_epi64x(0xffffff));
+	a->v[0] = _mm256_add_epi64(a->v[0], q);
+	a->v[2] = _mm256_add_epi64(a->v[2], _mm256_mul_epu32(q, _mm256_set1_epi64x(0x1fffffc0)));
+	a->v[3] = _mm256_add_epi64(a->v[3], _mm256_mul_epu32(q, _mm256_set1_epi64x(0x1ff)));
+	a->v[7] = _mm256_add_epi64(a->v[7], _mm256_slli_epi64(q, 21));
+	fe4_carry(a);
+}
+
+static void fe4_add(fe4_t *r, const fe4_t *a, const fe4_t *b)
+{
+	int i;
+	for (i = 0; i < 9; i++) {
+		r->v[i] = _mm256_add_epi64(a->v[i], b->v[i]);
+	}
+	fe4_carry(r);
+	fe4_reduce(r);
+}
+
+static void fe4_sub(fe4_t *r, const fe4_t *a, const fe4_t *b)
+{
+	int i;
+	for (i = 0; i < 9; i++) {
+		r->v[i] = _mm256_sub_epi64(_mm256_add_epi64(a->v[i],
+			_mm256_set1_epi64x(FE_SUB_4P[i])), b->v[i]);
+	}
+	fe4_carry(r);
+	fe4_reduce(r);
+}
+
+static void fe4_neg(fe4_t *r, const fe4_t *a)
+{
+	fe4_t zero;
+	fe4_set_zero(&zero);
+	fe4_sub(r, &zero, a);
+}
+
+static void fe4_div2(fe4_t *r, const fe4_t *a)
+{
+	const __m256i mask = _mm256_set1_epi64x(FE_MASK);
+	__m256i odd = _mm256_sub_epi64(_mm256_setzero_si256(),
+		_mm256_and_si256(a->v[0], _mm256_set1_epi64x(1)));
+	fe4_t t;
+	int i;
+
+	for (i = 0; i < 9; i++) {
+		t.v[i] = _mm256_add_epi64(a->v[i],
+			_mm256_and_si256(_mm256_set1_epi64x(FE_P[i]), odd));
+	}
+	fe4_carry(&t);
+	for (i = 0; i < 8; i++) {
+		r->v[i] = _mm256_or_si256(_mm256_srli_epi64(t.v[i], 1),
+			_mm256_and_si256(_mm256_slli_epi64(t.v[i + 1], 28), mask));
+	}
+	r->v[8] = _mm256_srli_epi64(t.v[8], 1);
+}
+
+/* r = c / R (mod p) from the 17 product columns in c[0..16] */
+static void fe4_mont_reduce(fe4_t *r, __m256i c[18])
+{
+	const __m256i mask = _mm256_set1_epi64x(FE_MASK);
+	__m256i m;
+	int i, j;
+
+	// -p^-1 = 1 (mod 2^29), so m = c[i] mod 2^29
+	for (i = 0; i < 9; i++) {
+		m = _mm256_and_si256(c[i], mask);
+		// c[i] + m * p[0] = c[i] + m * (2^29 - 1) is a multiple of 2^29
+		c[i + 1] = _mm256_add_epi64(c[i + 1],
+			_mm256_add_epi64(_mm256_srli_epi64(c[i], 29), m));
+		for (j = 1; j < 9; j++) {
+			c[i + j] = _mm256_add_epi64(c[i + j],
+				_mm256_mul_epu32(m, _mm256_set1_epi64x(FE_P[j])));
+		}
+	}
+	for (i = 9; i < 17; i++) {
+		c[i + 1] = _mm256_add_epi64(c[i + 1], _mm256_srli_epi64(c[i], 29));
+		c[i] = _mm256_and_si256(c[i], mask);
+	}
+	for (i = 0; i < 9; i++) {
+		r->v[i] = c[9 + i];
+	}
+}
+
+static void fe4_mul(fe4_t *r, const fe4_t *a, const fe4_t *b)
+{
+	__m256i c[18];
+	int i, j;
+
+	for (i = 0; i < 18; i++) {
+		c[i] = _mm256_setzero_si256();
+	}
+	for (i = 0; i < 9; i++) {
+		for (j = 0; j < 9; j++) {
+			c[i + j] = _mm256_add_epi64(c[i + j], _mm256_mul_epu32(a->v[i], b->v[j]));
+		}
+	}
+	fe4_mont_reduce(r, c);
+}
+
+static void fe4_sqr(fe4_t *r, const fe4_t *a)
+{
+	__m256i c[18];
+	__m256i a2;
+	int i, j;
+
+	for (i = 0; i < 18; i++) {
+		c[i] = _mm256_setzero_si256();
+	}
+	for (i = 0; i < 9; i++) {
+		c[2 * i] = _mm256_add_epi64(c[2 * i], _mm256_mul_epu32(a->v[i], a->v[i]));
+		a2 = _mm256_slli_epi64(a->v[i], 1);
+		for (j = i + 1; j < 9; j++) {
+			c[i + j] = _mm256_add_epi64(c[i + j], _mm256_mul_epu32(a2, a->v[j]));
+		}
+	}
+	fe4_mont_reduce(r, c);
+}
+
+/* per-lane mask of a == 0 (mod p), a is 0, p or 2p */
+static __m256i fe4_is_zero(const fe4_t *a)
+{
+	__m256i z = _mm256_set1_epi64x(-1);
+	__m256i e1 = z;
+	__m256i e2 = z;
+	int i;
+
+	for (i = 0; i < 9; i++) {
+		z = _mm256_and_si256(z, _mm256_cmpeq_epi64(a->v[i], _mm256_setzero_si256()));
+		e1 = _mm256_and_si256(e1, _mm256_cmpeq_epi64(a->v[i], _mm256_set1_epi64x(FE_P[i])));
+		e2 = _mm256_and_si256(e2, _mm256_cmpeq_epi64(a->v[i], _mm256_set1_epi64x(FE_2P[i])));
+	}
+	return _mm256_or_si256(z, _mm256_or_si256(e1, e2));
+}
+
+static void fe4_inv(fe4_t *r, const fe4_t *a)
+{
+	fe4_t a1;
+	fe4_t a2;
+	fe4_t a3;
+	fe4_t a4;
+	fe4_t a5;
+	int i;
+
+	fe4_sqr(&a1, a);
+	fe4_mul(&a2, &a1, a);
+	fe4_sqr(&a3, &a2);
+	fe4_sqr(&a3, &a3);
+	fe4_mul(&a3, &a3, &a2);
+	fe4_sqr(&a4, &a3);
+	fe4_sqr(&a4, &a4);
+	fe4_sqr(&a4, &a4);
+	fe4_sqr(&a4, &a4);
+	fe4_mul(&a4, &a4, &a3);
+	fe4_sqr(&a5, &a4);
+	for (i = 1; i < 8; i++)
+		fe4_sqr(&a5, &a5);
+	fe4_mul(&a5, &a5, &a4);
+	for (i = 0; i < 8; i++)
+		fe4_sqr(&a5, &a5);
+	fe4_mul(&a5, &a5, &a4);
+	for (i = 0; i < 4; i++)
+		fe4_sqr(&a5, &a5);
+	fe4_mul(&a5, &a5, &a3);
+	fe4_sqr(&a5, &a5);
+	fe4_sqr(&a5, &a5);
+	fe4_mul(&a5, &a5, &a2);
+	fe4_sqr(&a5, &a5);
+	fe4_mul(&a5, &a5, a);
+	fe4_sqr(&a4, &a5);
+	fe4_mul(&a3, &a4, &a1);
+	fe4_sqr(&a5, &a4);
+	for (i = 1; i< 31; i++)
+		fe4_sqr(&a5, &a5);
+	fe4_mul(&a4, &a5, &a4);
+	fe4_sqr(&a4, &a4);
+	fe4_mul(&a4, &a4, a);
+	fe4_mul(&a3, &a4, &a2);
+	for (i = 0; i < 33; i++)
+		fe4_sqr(&a5, &a5);
+	fe4_mul(&a2, &a5, &a3);
+	fe4_mul(&a3, &a2, &a3);
+	for (i = 0; i < 32; i++)
+		fe4_sqr(&a5, &a5);
+	fe4_mul(&a2, &a5, &a3);
+	fe4_mul(&a3, &a2, &a3);
+	fe4_mul(&a4, &a2, &a4);
+	for (i = 0; i < 32; i++)
+		fe4_sqr(&a5, &a5);
+	fe4_mul(&a2, &a5, &a3);
+	fe4_mul(&a3, &a2, &a3);
+	fe4_mul(&a4, &a2, &a4);
+	for (i = 0; i < 32; i++)
+		fe4_sqr(&a5, &a5);
+	fe4_mul(&a2, &a5, &a3);
+	fe4_mul(&a3, &a2, &a3);
+	fe4_mul(&a4, &a2, &a4);
+	for (i = 0; i < 32; i++)
+		fe4_sqr(&a5, &a5);
+	fe4_mul(&a2, &a5, &a3);
+	fe4_mul(&a3, &a2, &a3);
+	fe4_mul(&a4, &a2, &a4);
+	for (i = 0; i < 32; i++)
+		fe4_sqr(&a5, &a5);
+	fe4_mul(r, &a4, &a5);
+
+}
+
+/* r = w * R (mod p), w[k] holds 64-bit word k of each lane's value < 2^256 */
+static void fe4_from_words(fe4_t *r, const __m256i w[4])
+{
+	const __m256i mask = _mm256_set1_epi64x(FE_MASK);
+	fe4_t t, r2;
+
+	t.v[0] = _mm256_and_si256(w[0], mask);
+	t.v[1] = _mm256_and_si256(_mm256_srli_epi64(w[0], 29), mask);
+	t.v[2] = _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(w[0], 58), _mm256_slli_epi64(w[1], 6)), mask);
+	t.v[3] = _mm256_and_si256(_mm256_srli_epi64(w[1], 23), mask);
+	t.v[4] = _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(w[1], 52), _mm256_slli_epi64(w[2], 12)), mask);
+	t.v[5] = _mm256_and_si256(_mm256_srli_epi64(w[2], 17), mask);
+	t.v[6] = _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(w[2], 46), _mm256_slli_epi64(w[3], 18)), mask);
+	t.v[7] = _mm256_and_si256(_mm256_srli_epi64(w[3], 11), mask);
+	t.v[8] = _mm256_srli_epi64(w[3], 40);
+
+	fe4_set_const(&r2, FE_R2);
+	fe4_mul(r, &t, &r2);
+}
+
+/* out[lane] = a / R (mod p), fully reduced 64-bit words */
+static void fe4_to_words(uint64_t out[4][4], const fe4_t *a)
+{
+	static const uint64_t p[4] = {
+		0xffffffffffffffff, 0xffffffff00000000, 0xffffffffffffffff, 0xfffffffeffffffff,
+	};
+	uint64_t l[9][4];
+	uint64_t w[5], t[5], borrow, mask;
+	fe4_t one, r;
+	int i, j, k;
+
+	fe4_set_zero(&one);
+	one.v[0] = _mm256_set1_epi64x(1);
+	fe4_mul(&r, a, &one);
+	for (i = 0; i < 9; i++) {
+		_mm256_storeu_si256((__m256i *)l[i], r.v[i]);
+	}
+
+	for (j = 0; j < 4; j++) {
+		w[0] = l[0][j] | l[1][j] << 29 | l[2][j] << 58;
+		w[1] = l[2][j] >> 6 | l[3][j] << 23 | l[4][j] << 52;
+		w[2] = l[4][j] >> 12 | l[5][j] << 17 | l[6][j] << 46;
+		w[3] = l[6][j] >> 18 | l[7][j] << 11 | l[8][j] << 40;
+		w[4] = l[8][j] >> 24;
+
+		// w < 2^257 < 3p, subtract p twice when there is no borrow
+		for (k = 0; k < 2; k++) {
+			borrow = 0;
+			for (i = 0; i < 5; i++) {
+				uint64_t pi = i < 4 ? p[i] : 0;
+				t[i] = w[i] - pi - borrow;
+				borrow = (w[i] < pi) | ((w[i] - pi) < borrow);
+			}
+			mask = borrow - 1;
+			for (i = 0; i < 5; i++) {
+				w[i] = (t[i] & mask) | (w[i] & ~mask);
+			}
+		}
+		for (i = 0; i < 4; i++) {
+			out[j][i] = w[i];
+		}
+	}
+}
+
+static void point4_dbl(point4_t *R, const point4_t *P)
+{
+	fe4_t T1, T2, T3, X3, Y3, Z3;
+
+	fe4_sqr(&T1, &P->Z);
+	fe4_sub(&T2, &P->X, &T1);
+	fe4_add(&T1, &P->X, &T1);
+	fe4_mul(&T2, &T2, &T1);
+	fe4_add(&T1, &T2, &T2);
+	fe4_add(&T2, &T1, &T2);
+	fe4_add(&Y3, &P->Y, &P->Y);
+	fe4_mul(&Z3, &Y3, &P->Z);
+	fe4_sqr(&Y3, &Y3);
+	fe4_mul(&T3, &Y3, &P->X);
+	fe4_sqr(&Y3, &Y3);
+	fe4_div2(&Y3, &Y3);
+	fe4_sqr(&X3, &T2);
+	fe4_add(&T1, &T3, &T3);
+	fe4_sub(&X3, &X3, &T1);
+	fe4_sub(&T1, &T3, &X3);
+	fe4_mul(&T1, &T1, &T2);
+	fe4_sub(&R->Y, &T1, &Y3);
+	R->X = X3;
+	R->Z = Z3;
+}
+
+/*
+ * R = P + (x2, y2) per lane, where lanes in inf hold the point at infinity
+ * and lanes in skip add nothing. Returns the lanes where P = +-(x2, y2),
+ * which this formula does not handle.
+ */
+static __m256i point4_add_affine(point4_t *R, const point4_t *P,
+	const fe4_t *x2, const fe4_t *y2, __m256i inf, __m256i skip)
+{
+	fe4_t T1, T2, T3, T4, one;
+	point4_t S;
+	__m256i exc;
+
+	fe4_sqr(&T1, &P->Z);
+	fe4_mul(&T2, &T1, &P->Z);
+	fe4_mul(&T1, &T1, x2);
+	fe4_mul(&T2, &T2, y2);
+	fe4_sub(&T1, &T1, &P->X);
+	fe4_sub(&T2, &T2, &P->Y);
+
+	exc = _mm256_andnot_si256(_mm256_or_si256(inf, skip), fe4_is_zero(&T1));
+
+	fe4_mul(&S.Z, &P->Z, &T1);
+	fe4_sqr(&T3, &T1);
+	fe4_mul(&T4, &T3, &T1);
+	fe4_mul(&T3, &T3, &P->X);
+	fe4_add(&T1, &T3, &T3);
+	fe4_sqr(&S.X, &T2);
+	fe4_sub(&S.X, &S.X, &T1);
+	fe4_sub(&S.X, &S.X, &T4);
+	fe4_sub(&T3, &T3, &S.X);
+	fe4_mul(&T3, &T3, &T2);
+	fe4_mul(&T4, &T4, &P->Y);
+	fe4_sub(&S.Y, &T3, &T4);
+
+	fe4_set_const(&one, FE_MONT_ONE);
+	fe4_blend(&S.X, &S.X, x2, inf);
+	fe4_blend(&S.Y, &S.Y, y2, inf);
+	fe4_blend(&S.Z, &S.Z, &one, inf);
+	fe4_blend(&R->X, &S.X, &P->X, skip);
+	fe4_blend(&R->Y, &S.Y, &P->Y, skip);
+	fe4_blend(&R->Z, &S.Z, &P->Z, skip);
+	return exc;
+}
+
+static void point4_to_words(uint64_t R[4][12], const point4_t *P, __m256i inf)
+{
+	uint64_t X[4][4], Y[4][4], Z[4][4];
+	uint64_t is_inf[4];
+	int i, j;
+
+	fe4_to_words(X, &P->X);
+	fe4_to_words(Y, &P->Y);
+	fe4_to_words(Z, &P->Z);
+	_mm256_storeu_si256((__m256i *)is_inf, inf);
+
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			R[i][j] = X[i][j];
+			R[i][4 + j] = Y[i][j];
+			R[i][8 + j] = Z[i][j] & ~is_inf[i];
+		}
+		// infinity as (1, 1, 0)
+		R[i][0] = (R[i][0] & ~is_inf[i]) | (1 & is_inf[i]);
+		R[i][4] = (R[i][4] & ~is_inf[i]) | (1 & is_inf[i]);
+		for (j = 1; j < 4; j++) {
+			R[i][j] &= ~is_inf[i];
+			R[i][4 + j] &= ~is_inf[i];
+		}
+	}
+}
+
+static __m256i load_lanes(const uint8_t *d)
+{
+	return _mm256_set_epi64x(d[3], d[2], d[1], d[0]);
+}
+
+/*
+ * Comb multiplication of 4 scalars by a fixed base, with the table layout of
+ * SM2_COMB_TABLE. digits holds spacing * blocks groups of 4 lane digits in
+ * processing order. Returns 1, or 0 if a lane hit an exceptional addition.
+ */
+int sm2_avx2_comb_x4(uint64_t R[4][12], const uint64_t *table, int points,
+	int blocks, int spacing, const uint8_t *digits)
+{
+	point4_t Q;
+	fe4_t x, y;
+	__m256i xw[4], yw[4];
+	__m256i inf = _mm256_set1_epi64x(-1);
+	__m256i exc = _mm256_setzero_si256();
+	__m256i d, skip, mask;
+	const uint64_t *ent;
+	int step, i, e, k;
+
+	fe4_set_const(&Q.X, FE_MONT_ONE);
+	fe4_set_const(&Q.Y, FE_MONT_ONE);
+	fe4_set_zero(&Q.Z);
+
+	for (step = 0; step < spacing; step++) {
+		if (step) {
+			point4_dbl(&Q, &Q);
+		}
+		for (i = 0; i < blocks; i++, digits += 4) {
+			d = load_lanes(digits);
+			for (k = 0; k < 4; k++) {
+				xw[k] = _mm256_setzero_si256();
+				yw[k] = _mm256_setzero_si256();
+			}
+			// read every entry of the block
+			for (e = 0; e < points; e++) {
+				mask = _mm256_cmpeq_epi64(d, _mm256_set1_epi64x(e + 1));
+				ent = table + (i * points + e) * 8;
+				for (k = 0; k < 4; k++) {
+					xw[k] = _mm256_or_si256(xw[k], _mm256_and_si256(_mm256_set1_epi64x(ent[k]), mask));
+					yw[k] = _mm256_or_si256(yw[k], _mm256_and_si256(_mm256_set1_epi64x(ent[4 + k]), mask));
+				}
+			}
+			fe4_from_words(&x, xw);
+			fe4_from_words(&y, yw);
+
+			skip = _mm256_cmpeq_epi64(d, _mm256_setzero_si256());
+			exc = _mm256_or_si256(exc, point4_add_affine(&Q, &Q, &x, &y, inf, skip));
+			inf = _mm256_and_si256(inf, skip);
+		}
+	}
+
+	point4_to_words(R, &Q, inf);
+	return _mm256_testz_si256(exc, exc);
+}
+
+#define SM2_AVX2_MAX_TABLE	16
+
+/*
+ * R[i] = k[i] * P[i] with Booth digits in [-table_size, table_size], most
+ * significant first, ndigits groups of 4 lane digits of window bits each.
+ * P[i] are affine points on the curve. Returns 1, or 0 if a lane hit an
+ * exceptional addition.
+ */
+int sm2_avx2_mul_x4(uint64_t R[4][12], const uint64_t P[4][8],
+	const int8_t *digits, int ndigits, int window)
+{
+	int table_size = 1 << (window - 1);
+	point4_t T[SM2_AVX2_MAX_TABLE];
+	fe4_t tx[SM2_AVX2_MAX_TABLE];
+	fe4_t ty[SM2_AVX2_MAX_TABLE];
+	fe4_t prod[SM2_AVX2_MAX_TABLE];
+	fe4_t inv, zinv, zinv2, x, y, ny;
+	point4_t Q;
+	__m256i w[4];
+	__m256i inf = _mm256_set1_epi64x(-1);
+	__m256i exc = _mm256_setzero_si256();
+	__m256i zero = _mm256_setzero_si256();
+	__m256i d, s, skip, mask;
+	int i, j;
+
+	if (table_size > SM2_AVX2_MAX_TABLE) {
+		return 0;
+	}
+
+	// T[j] = (j + 1) * P
+	for (j = 0; j < 4; j++) {
+		w[j] = _mm256_set_epi64x(P[3][j], P[2][j], P[1][j], P[0][j]);
+	}
+	fe4_from_words(&x, w);
+	for (j = 0; j < 4; j++) {
+		w[j] = _mm256_set_epi64x(P[3][4 + j], P[2][4 + j], P[1][4 + j], P[0][4 + j]);
+	}
+	fe4_from_words(&y, w);
+	T[0].X = x;
+	T[0].Y = y;
+	fe4_set_const(&T[0].Z, FE_MONT_ONE);
+	point4_dbl(&T[1], &T[0]);
+	for (j = 2; j < table_size; j++) {
+		point4_add_affine(&T[j], &T[j - 1], &x, &y, zero, zero);
+	}
+
+	// to affine with one inversion per lane
+	prod[0] = T[0].Z;
+	for (j = 1; j < table_size; j++) {
+		fe4_mul(&prod[j], &prod[j - 1], &T[j].Z);
+	}
+	fe4_inv(&inv, &prod[table_size - 1]);
+	for (j = table_size - 1; j >= 0; j--) {
+		if (j) {
+			fe4_mul(&zinv, &inv, &prod[j - 1]);
+			fe4_mul(&inv, &inv, &T[j].Z);
+		} else {
+			zinv = inv;
+		}
+		fe4_sqr(&zinv2, &zinv);
+		fe4_mul(&tx[j], &T[j].X, &zinv2);
+		fe4_mul(&zinv2, &zinv2, &zinv);
+		fe4_mul(&ty[j], &T[j].Y, &zinv2);
+	}
+
+	fe4_set_const(&Q.X, FE_MONT_ONE);
+	fe4_set_const(&Q.Y, FE_MONT_ONE);
+	fe4_set_zero(&Q.Z);
+
+	for (i = 0; i < ndigits; i++, digits += 4) {
+		if (i) {
+			for (j = 0; j < window; j++) {
+				point4_dbl(&Q, &Q);
+			}
+		}
+
+		d = _mm256_set_epi64x(digits[3], digits[2], digits[1], digits[0]);
+		s = _mm256_cmpgt_epi64(zero, d);
+		d = _mm256_sub_epi64(_mm256_xor_si256(d, s), s);
+
+		fe4_set_zero(&x);
+		fe4_set_zero(&y);
+		for (j = 0; j < table_size; j++) {
+			mask = _mm256_cmpeq_epi64(d, _mm256_set1_epi64x(j + 1));
+			fe4_blend(&x, &x, &tx[j], mask);
+			fe4_blend(&y, &y, &ty[j], mask);
+		}
+		fe4_neg(&ny, &y);
+		fe4_blend(&y, &y, &ny, s);
+
+		skip = _mm256_cmpeq_epi64(d, zero);
+		exc = _mm256_or_si256(exc, point4_add_affine(&Q, &Q, &x, &y, inf, skip));
+		inf = _mm256_and_si256(inf, skip);
+	}
+
+	point4_to_words(R, &Q, inf);
+	memset(T, 0, sizeof(T));
+	memset(tx, 0, sizeof(tx));
+	memset(ty, 0, sizeof(ty));
+	return _mm256_testz_si256(exc, exc);
+}
@@ -0,0 +1,98 @@
+﻿/*
+ * Copyright (c) 2014 - 2020 The GmSSL Project.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgment:
+ *    "This product includes software developed by the GmSSL Project.
+ *    (http://gmssl.org/)"
+ *
+ * 4. The name "GmSSL Project" must not be used to endorse or promote
+ *    products derived from this software without prior written
+ *    permission. For written permission, please contact
+ *    guanzhi1980@gmail.com.
+ *
+ * 5. Products derived from this software may not be called "GmSSL"
+ *    nor may "GmSSL" appear in their names without prior written
+ *    permission of the GmSSL Project.
+ *
+ * 6. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by the GmSSL Project
+ *    (http://gmssl.org/)"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE GmSSL PROJECT ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE GmSSL PROJECT OR
+ * ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Build-time generator of the SM2 generator comb table used by
+ * point_mul_generator(). Prints sm2_comb_table.h to stdout.
+ *
+ *	sm2_comb_gen > sm2_comb_table.h
+ *
+ * The table layout is selected by SM2_COMB_TEETH and SM2_COMB_BLOCKS, which
+ * must be the same when building this tool and src/sm2_algo.c.
+ */
+
+#define SM2_COMB_GEN
+#include "sm2_algo.c"
+
+
+static void print_affine(FILE *fp, const affine_point_t *P)
+{
+	int i;
+
+	fprintf(fp, "\t\t{{");
+	for (i = 0; i < 4; i++)
+		fprintf(fp, "0x%08x%08x%s", (uint32_t)(P->x[i] >> 32), (uint32_t)P->x[i], i < 3 ? ", " : "");
+	fprintf(fp, "}, {");
+	for (i = 0; i < 4; i++)
+		fprintf(fp, "0x%08x%08x%s", (uint32_t)(P->y[i] >> 32), (uint32_t)P->y[i], i < 3 ? ", " : "");
+	fprintf(fp, "}},\n");
+}
+
+int main(void)
+{
+	int i, m;
+
+	point_comb_table(&SM2_COMB_TABLE[0][0], SM2_G,
+		SM2_COMB_TEETH, SM2_COMB_BLOCKS, SM2_COMB_SPACING);
+
+	printf("/* generated by sm2_comb_gen, do not edit */\n\n");
+	printf("#define SM2_COMB_TABLE_TEETH\t%d\n", SM2_COMB_TEETH);
+	printf("#define SM2_COMB_TABLE_BLOCKS\t%d\n\n", SM2_COMB_BLOCKS);
+	printf("static const affine_point_t SM2_COMB_TABLE[%d][%d] = {\n",
+		SM2_COMB_BLOCKS, SM2_COMB_POINTS);
+	for (i = 0; i < SM2_COMB_BLOCKS; i++) {
+		printf("\t{\n");
+		for (m = 0; m < SM2_COMB_POINTS; m++) {
+			print_affine(stdout, &SM2_COMB_TABLE[i][m]);
+		}
+		printf("\t},\n");
+	}
+	printf("};\n");
+
+	return 0;
+}
@@ -52,8 +52,12 @@
 #include <stdlib.h>
 #include <gmssl/sm2.h>
 #include <gmssl/sm3.h>
+#include <gmssl/asn1.h>
 #include <gmssl/error.h>
 #include "endian.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 
 #define SM2_SIGNATURE_MAX_DER_SIZE 77
@@ -101,6 +105,166 @@ int sm2_verify(const SM2_KEY *key, const uint8_t dgst[32], const uint8_t *der, s
 	return ret;
 }
 
+int sm2_verify_with_key(const SM2_VERIFY_KEY *vk, const uint8_t *msg, size_t msglen,
+	const uint8_t *der, size_t derlen)
+{
+	SM3_CTX sm3_ctx;
+	SM2_SIGNATURE sig;
+	uint8_t dgst[32];
+	const uint8_t *p = der;
+	size_t len = derlen;
+
+	if (!vk || (!msg && msglen) || !der || !derlen) {
+		error_print();
+		return -1;
+	}
+	if (sm2_signature_from_der(&sig, &p, &len) < 0
+		|| len > 0) {
+		error_print();
+		return -1;
+	}
+
+	// e = SM3(Z || M), starting from the cached state after Z
+	memcpy(&sm3_ctx, &vk->sm3_ctx, sizeof(SM3_CTX));
+	sm3_update(&sm3_ctx, msg, msglen);
+	sm3_finish(&sm3_ctx, dgst);
+
+	return sm2_do_verify_with_key(vk, dgst, &sig);
+}
+
+#define SM2_VERIFY_MAX_THREADS 16
+
+#ifdef HAVE_PTHREAD
+typedef struct {
+	const SM2_KEY *keys;
+	const uint8_t (*dgsts)[32];
+	const SM2_SIGNATURE *sigs;
+	size_t n;
+	int *results;
+	int ret;
+} SM2_VERIFY_BATCH_JOB;
+
+static void *sm2_verify_batch_thread(void *arg)
+{
+	SM2_VERIFY_BATCH_JOB *job = (SM2_VERIFY_BATCH_JOB *)arg;
+	job->ret = sm2_verify_batch(job->keys, job->dgsts, job->sigs, job->n, job->results);
+	return NULL;
+}
+#endif
+
+int sm2_verify_batch_mt(const SM2_KEY *keys, const uint8_t (*dgsts)[32],
+	const SM2_SIGNATURE *sigs, size_t n, int *results, int num_threads)
+{
+#ifdef HAVE_PTHREAD
+	SM2_VERIFY_BATCH_JOB jobs[SM2_VERIFY_MAX_THREADS];
+	pthread_t threads[SM2_VERIFY_MAX_THREADS];
+	size_t per_thread;
+	size_t off = 0;
+	int started = 0;
+	int ret;
+	int i;
+
+	if (!keys || !dgsts || !sigs || !results) {
+		error_print();
+		return -1;
+	}
+	if (num_threads > SM2_VERIFY_MAX_THREADS) {
+		num_threads = SM2_VERIFY_MAX_THREADS;
+	}
+	if (num_threads <= 1 || n < 2) {
+		return sm2_verify_batch(keys, dgsts, sigs, n, results);
+	}
+
+	// the calling thread takes the last share
+	per_thread = (n + num_threads - 1) / num_threads;
+	for (i = 0; i < num_threads - 1 && off + per_thread < n; i++) {
+		jobs[i].keys = keys + off;
+		jobs[i].dgsts = dgsts + off;
+		jobs[i].sigs = sigs + off;
+		jobs[i].n = per_thread;
+		jobs[i].results = results + off;
+		if (pthread_create(&threads[i], NULL, sm2_verify_batch_thread, &jobs[i]) != 0) {
+			break;
+		}
+		off += per_thread;
+		started++;
+	}
+	ret = sm2_verify_batch(keys + off, dgsts + off, sigs + off, n - off, results + off);
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+		if (jobs[i].ret != 1 && ret != -1)
+			ret = jobs[i].ret;
+	}
+	return ret;
+#else
+	(void)num_threads;
+	return sm2_verify_batch(keys, dgsts, sigs, n, results);
+#endif
+}
+
+#define SM2_KEYGEN_MAX_THREADS 16
+
+#ifdef HAVE_PTHREAD
+typedef struct {
+	SM2_KEY *keys;
+	size_t n;
+	int ret;
+} SM2_KEYGEN_BATCH_JOB;
+
+static void *sm2_keygen_batch_thread(void *arg)
+{
+	SM2_KEYGEN_BATCH_JOB *job = (SM2_KEYGEN_BATCH_JOB *)arg;
+	job->ret = sm2_keygen_batch(job->keys, job->n);
+	return NULL;
+}
+#endif
+
+int sm2_keygen_batch_mt(SM2_KEY *keys, size_t n, int num_threads)
+{
+#ifdef HAVE_PTHREAD
+	SM2_KEYGEN_BATCH_JOB jobs[SM2_KEYGEN_MAX_THREADS];
+	pthread_t threads[SM2_KEYGEN_MAX_THREADS];
+	size_t per_thread;
+	size_t off = 0;
+	int started = 0;
+	int ret;
+	int i;
+
+	if (!keys && n) {
+		error_print();
+		return -1;
+	}
+	if (num_threads > SM2_KEYGEN_MAX_THREADS) {
+		num_threads = SM2_KEYGEN_MAX_THREADS;
+	}
+	if (num_threads <= 1 || n < 2) {
+		return sm2_keygen_batch(keys, n);
+	}
+
+	// the calling thread takes the last share
+	per_thread = (n + num_threads - 1) / num_threads;
+	for (i = 0; i < num_threads - 1 && off + per_thread < n; i++) {
+		jobs[i].keys = keys + off;
+		jobs[i].n = per_thread;
+		if (pthread_create(&threads[i], NULL, sm2_keygen_batch_thread, &jobs[i]) != 0) {
+			break;
+		}
+		off += per_thread;
+		started++;
+	}
+	ret = sm2_keygen_batch(keys + off, n - off);
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+		if (jobs[i].ret != 1)
+			ret = -1;
+	}
+	return ret;
+#else
+	(void)num_threads;
+	return sm2_keygen_batch(keys, n);
+#endif
+}
+
 //FIXME: 由于每次加密的时候密文编码长度不同，因此这个函数应该避免在out == NULL时输出一个长度！
 int sm2_encrypt(const SM2_KEY *key, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
 {
@@ -125,6 +289,395 @@ int sm2_decrypt(const SM2_KEY *key, const uint8_t *in, size_t inlen, uint8_t *ou
 	return 1;
 }
 
+// SM2_ENC_CTX states, the part of the DER to be read or written next
+#define SM2_ENC_PREFIX	0
+#define SM2_ENC_C2	1
+#define SM2_ENC_SUFFIX	2
+#define SM2_ENC_DONE	3
+
+// set up the KDF and C3 states from (x2, y2) = k * P
+static void sm2_enc_ctx_set_point(SM2_ENC_CTX *ctx, const SM2_POINT *P)
+{
+	sm3_kdf_init(&ctx->kdf_ctx);
+	sm3_kdf_update(&ctx->kdf_ctx, P->x, 32);
+	sm3_kdf_update(&ctx->kdf_ctx, P->y, 32);
+	sm3_init(&ctx->sm3_ctx);
+	sm3_update(&ctx->sm3_ctx, P->x, 32);
+	memcpy(ctx->y2, P->y, 32);
+}
+
+// out = in xor KDF output, continuing from the last call
+static void sm2_enc_ctx_xor(SM2_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out)
+{
+	uint8_t key_stream[256];
+	size_t len, i;
+
+	while (inlen) {
+		len = inlen < sizeof(key_stream) ? inlen : sizeof(key_stream);
+		sm3_kdf_generate(&ctx->kdf_ctx, key_stream, len);
+		for (i = 0; i < len; i++) {
+			out[i] = in[i] ^ key_stream[i];
+		}
+		in += len;
+		out += len;
+		inlen -= len;
+	}
+	memset(key_stream, 0, sizeof(key_stream));
+}
+
+int sm2_encrypt_init(SM2_ENC_CTX *ctx, const SM2_KEY *key, size_t inlen, int order, size_t *prefixlen)
+{
+	SM2_KEY eph;
+	SM2_POINT P;
+	uint8_t hash[32] = {0};
+	uint8_t *p;
+	size_t len = 0;
+
+	if (!ctx || !key || !inlen || (order != SM2_C1C3C2 && order != SM2_C1C2C3)) {
+		error_print();
+		return -1;
+	}
+	memset(ctx, 0, sizeof(SM2_ENC_CTX));
+	ctx->order = order;
+	ctx->c2_len = inlen;
+
+	// C1 = k * G, (x2, y2) = k * P
+	if (sm2_keygen(&eph) != 1
+		|| sm2_point_mul(&P, eph.private_key, &key->public_key) != 1) {
+		memset(&eph, 0, sizeof(SM2_KEY));
+		error_print();
+		return -1;
+	}
+	memset(eph.private_key, 0, 32);
+	sm2_enc_ctx_set_point(ctx, &P);
+	memset(&P, 0, sizeof(SM2_POINT));
+
+	// the prefix, with C3 filled in by sm2_encrypt_finish() for SM2_C1C3C2
+	asn1_integer_to_der(eph.public_key.x, 32, NULL, &len);
+	asn1_integer_to_der(eph.public_key.y, 32, NULL, &len);
+	if (order == SM2_C1C3C2)
+		asn1_octet_string_to_der(hash, 32, NULL, &len);
+	else	len += 34;
+	asn1_header_to_der(ASN1_TAG_OCTET_STRING, inlen, NULL, &len);
+	len += inlen;
+
+	p = ctx->buf;
+	asn1_sequence_header_to_der(len, &p, &ctx->buf_len);
+	asn1_integer_to_der(eph.public_key.x, 32, &p, &ctx->buf_len);
+	asn1_integer_to_der(eph.public_key.y, 32, &p, &ctx->buf_len);
+	if (order == SM2_C1C3C2)
+		asn1_octet_string_to_der(hash, 32, &p, &ctx->buf_len);
+	asn1_header_to_der(ASN1_TAG_OCTET_STRING, inlen, &p, &ctx->buf_len);
+
+	ctx->state = SM2_ENC_PREFIX;
+	if (prefixlen) {
+		*prefixlen = ctx->buf_len;
+	}
+	return 1;
+}
+
+int sm2_encrypt_update(SM2_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
+{
+	if (!ctx || (!in && inlen) || !out || !outlen) {
+		error_print();
+		return -1;
+	}
+	if (ctx->state > SM2_ENC_C2 || inlen > ctx->c2_len - ctx->c2_done) {
+		error_print();
+		return -1;
+	}
+	*outlen = 0;
+
+	if (ctx->state == SM2_ENC_PREFIX && ctx->order == SM2_C1C2C3) {
+		memcpy(out, ctx->buf, ctx->buf_len);
+		out += ctx->buf_len;
+		*outlen += ctx->buf_len;
+		ctx->state = SM2_ENC_C2;
+	}
+
+	// C2 = M xor t, C3 over M
+	sm3_update(&ctx->sm3_ctx, in, inlen);
+	sm2_enc_ctx_xor(ctx, in, inlen, out);
+	ctx->c2_done += inlen;
+	*outlen += inlen;
+	return 1;
+}
+
+int sm2_encrypt_finish(SM2_ENC_CTX *ctx, uint8_t *out, size_t *outlen)
+{
+	uint8_t hash[32];
+	size_t len = 0;
+
+	if (!ctx || !out || !outlen) {
+		error_print();
+		return -1;
+	}
+	if (ctx->c2_len == 0 || ctx->c2_done != ctx->c2_len) {
+		error_print();
+		return -1;
+	}
+
+	// C3 = Hash(x2 || M || y2)
+	sm3_update(&ctx->sm3_ctx, ctx->y2, 32);
+	sm3_finish(&ctx->sm3_ctx, hash);
+
+	*outlen = 0;
+	if (ctx->order == SM2_C1C3C2) {
+		// the hash value ends where the C2 header starts
+		asn1_header_to_der(ASN1_TAG_OCTET_STRING, ctx->c2_len, NULL, &len);
+		memcpy(ctx->buf + ctx->buf_len - len - 32, hash, 32);
+		memcpy(out, ctx->buf, ctx->buf_len);
+		*outlen = ctx->buf_len;
+	} else {
+		asn1_octet_string_to_der(hash, 32, &out, outlen);
+	}
+
+	memset(ctx, 0, sizeof(SM2_ENC_CTX));
+	memset(hash, 0, sizeof(hash));
+	return 1;
+}
+
+int sm2_decrypt_init(SM2_ENC_CTX *ctx, const SM2_KEY *key, int order)
+{
+	if (!ctx || !key || (order != SM2_C1C3C2 && order != SM2_C1C2C3)) {
+		error_print();
+		return -1;
+	}
+	memset(ctx, 0, sizeof(SM2_ENC_CTX));
+	ctx->key = key;
+	ctx->order = order;
+	ctx->state = SM2_ENC_PREFIX;
+	return 1;
+}
+
+/*
+ * Read a DER tag and length from possibly incomplete input. Returns 1 with the
+ * header size in *hdrlen, 0 if more input is needed and -1 on error.
+ */
+static int sm2_der_header(int tag, const uint8_t *in, size_t inlen, size_t *len, size_t *hdrlen)
+{
+	size_t n, i;
+
+	if (inlen < 2) {
+		return 0;
+	}
+	if (in[0] != tag) {
+		error_print();
+		return -1;
+	}
+	if (in[1] < 128) {
+		*len = in[1];
+		*hdrlen = 2;
+		return 1;
+	}
+	n = in[1] & 0x7f;
+	if (n < 1 || n > 4) {
+		error_print();
+		return -1;
+	}
+	if (inlen < 2 + n) {
+		return 0;
+	}
+	// DER: no leading zero octets and no long form below 128
+	if (in[2] == 0) {
+		error_print();
+		return -1;
+	}
+	for (*len = 0, i = 0; i < n; i++) {
+		*len = (*len << 8) | in[2 + i];
+	}
+	if (*len < 128) {
+		error_print();
+		return -1;
+	}
+	*hdrlen = 2 + n;
+	return 1;
+}
+
+/*
+ * Parse the prefix in ctx->buf. Returns 1 when complete, then (x2, y2) is
+ * derived, 0 if more input is needed and -1 on error.
+ */
+static int sm2_decrypt_prefix(SM2_ENC_CTX *ctx)
+{
+	const uint8_t *p = ctx->buf;
+	size_t left = ctx->buf_len;
+	size_t seq_len, seq_hdrlen, len, hdrlen, i;
+	uint8_t c1[2][32];
+	SM2_POINT C1;
+	int ret;
+
+	if ((ret = sm2_der_header(ASN1_TAG_SEQUENCE, p, left, &seq_len, &seq_hdrlen)) != 1) {
+		return ret;
+	}
+	p += seq_hdrlen;
+	left -= seq_hdrlen;
+
+	// x and y, at most 32 bytes after an optional 0x00
+	for (i = 0; i < 2; i++) {
+		if ((ret = sm2_der_header(ASN1_TAG_INTEGER, p, left, &len, &hdrlen)) != 1) {
+			return ret;
+		}
+		if (len < 1 || len > 33) {
+			error_print();
+			return -1;
+		}
+		if (left < hdrlen + len) {
+			return 0;
+		}
+		if (len == 33 && p[hdrlen] != 0) {
+			error_print();
+			return -1;
+		}
+		memset(c1[i], 0, 32);
+		if (len == 33)
+			memcpy(c1[i], p + hdrlen + 1, 32);
+		else	memcpy(c1[i] + 32 - len, p + hdrlen, len);
+		p += hdrlen + len;
+		left -= hdrlen + len;
+	}
+
+	if (ctx->order == SM2_C1C3C2) {
+		if ((ret = sm2_der_header(ASN1_TAG_OCTET_STRING, p, left, &len, &hdrlen)) != 1) {
+			return ret;
+		}
+		if (len != 32) {
+			error_print();
+			return -1;
+		}
+		if (left < hdrlen + 32) {
+			return 0;
+		}
+		memcpy(ctx->hash, p + hdrlen, 32);
+		p += hdrlen + 32;
+		left -= hdrlen + 32;
+	}
+	if ((ret = sm2_der_header(ASN1_TAG_OCTET_STRING, p, left, &ctx->c2_len, &hdrlen)) != 1) {
+		return ret;
+	}
+
+	// the input is read one byte at a time, so the prefix is all of ctx->buf
+	if (ctx->c2_len < 1
+		|| seq_len != ctx->buf_len - seq_hdrlen + ctx->c2_len
+			+ (ctx->order == SM2_C1C2C3 ? 34 : 0)) {
+		error_print();
+		return -1;
+	}
+
+	// (x2, y2) = d * C1
+	memcpy(C1.x, c1[0], 32);
+	memcpy(C1.y, c1[1], 32);
+	if (sm2_point_is_on_curve(&C1) != 1
+		|| sm2_point_mul(&C1, ctx->key->private_key, &C1) != 1) {
+		error_print();
+		return -1;
+	}
+	sm2_enc_ctx_set_point(ctx, &C1);
+	memset(&C1, 0, sizeof(SM2_POINT));
+	return 1;
+}
+
+int sm2_decrypt_update(SM2_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
+{
+	size_t len;
+	int ret;
+
+	if (!ctx || (!in && inlen) || !out || !outlen) {
+		error_print();
+		return -1;
+	}
+	*outlen = 0;
+
+	while (inlen) {
+		switch (ctx->state) {
+		case SM2_ENC_PREFIX:
+			if (ctx->buf_len >= sizeof(ctx->buf)) {
+				error_print();
+				return -1;
+			}
+			ctx->buf[ctx->buf_len++] = *in++;
+			inlen--;
+			if ((ret = sm2_decrypt_prefix(ctx)) < 0) {
+				error_print();
+				return -1;
+			}
+			if (ret == 1) {
+				ctx->buf_len = 0;
+				ctx->state = SM2_ENC_C2;
+			}
+			break;
+
+		case SM2_ENC_C2:
+			// M = C2 xor t, u over M
+			len = ctx->c2_len - ctx->c2_done;
+			if (len > inlen)
+				len = inlen;
+			sm2_enc_ctx_xor(ctx, in, len, out);
+			sm3_update(&ctx->sm3_ctx, out, len);
+			ctx->c2_done += len;
+			in += len;
+			inlen -= len;
+			out += len;
+			*outlen += len;
+			if (ctx->c2_done == ctx->c2_len) {
+				ctx->state = ctx->order == SM2_C1C2C3 ? SM2_ENC_SUFFIX : SM2_ENC_DONE;
+			}
+			break;
+
+		case SM2_ENC_SUFFIX:
+			len = 34 - ctx->buf_len;
+			if (len > inlen)
+				len = inlen;
+			memcpy(ctx->buf + ctx->buf_len, in, len);
+			ctx->buf_len += len;
+			in += len;
+			inlen -= len;
+			if (ctx->buf_len == 34) {
+				if (ctx->buf[0] != ASN1_TAG_OCTET_STRING || ctx->buf[1] != 32) {
+					error_print();
+					return -1;
+				}
+				memcpy(ctx->hash, ctx->buf + 2, 32);
+				ctx->state = SM2_ENC_DONE;
+			}
+			break;
+
+		default:
+			error_print();
+			return -1;
+		}
+	}
+	return 1;
+}
+
+int sm2_decrypt_finish(SM2_ENC_CTX *ctx)
+{
+	uint8_t hash[32];
+	int ret = 1;
+
+	if (!ctx) {
+		error_print();
+		return -1;
+	}
+	if (ctx->state != SM2_ENC_DONE) {
+		memset(ctx, 0, sizeof(SM2_ENC_CTX));
+		error_print();
+		return -1;
+	}
+
+	// u = Hash(x2 || M || y2)
+	sm3_update(&ctx->sm3_ctx, ctx->y2, 32);
+	sm3_finish(&ctx->sm3_ctx, hash);
+	if (memcmp(hash, ctx->hash, 32) != 0) {
+		error_print();
+		ret = -1;
+	}
+
+	memset(ctx, 0, sizeof(SM2_ENC_CTX));
+	memset(hash, 0, sizeof(hash));
+	return ret;
+}
+
 extern void sm3_compress_blocks(uint32_t digest[8], const uint8_t *data, size_t blocks);
 
 int sm2_compute_z(uint8_t z[32], const SM2_POINT *pub, const char *id)
@@ -218,7 +771,24 @@ int sm2_sign_init(SM2_SIGN_CTX *ctx, const SM2_KEY *key, const char *id)
 
 	sm3_init(&ctx->sm3_ctx);
 	sm3_update(&ctx->sm3_ctx, z, 32);
+	memcpy(&ctx->z_ctx, &ctx->sm3_ctx, sizeof(SM3_CTX));
 	memcpy(&ctx->key, key, sizeof(SM2_KEY));
+	ctx->sign_key = NULL;
+	return 1;
+}
+
+int sm2_sign_init_with_key(SM2_SIGN_CTX *ctx, const SM2_SIGN_KEY *sign_key)
+{
+	if (!ctx || !sign_key) {
+		error_print();
+		return -1;
+	}
+	memcpy(&ctx->sm3_ctx, &sign_key->sm3_ctx, sizeof(SM3_CTX));
+	memcpy(&ctx->z_ctx, &sign_key->sm3_ctx, sizeof(SM3_CTX));
+	// the private key stays out of the ctx, sm2_sign_finish() signs with sign_key
+	memset(&ctx->key, 0, sizeof(SM2_KEY));
+	ctx->key.public_key = sign_key->public_key;
+	ctx->sign_key = sign_key;
 	return 1;
 }
 
@@ -232,13 +802,31 @@ int sm2_sign_finish(SM2_SIGN_CTX *ctx, uint8_t *sig, size_t *siglen)
 {
 	uint8_t dgst[32];
 	sm3_finish(&ctx->sm3_ctx, dgst);
+	if (ctx->sign_key) {
+		SM2_SIGNATURE signature;
+		uint8_t *p = sig;
+		size_t len = 0;
+
+		if (sm2_do_sign_with_key(ctx->sign_key, dgst, &signature) != 1
+			|| sm2_signature_to_der(&signature, &p, &len) != 1) {
+			error_print();
+			return -1;
+		}
+		*siglen = len;
+		return 1;
+	}
 	sm2_sign(&ctx->key, dgst, sig, siglen);
 	return 1;
 }
 
-int sm2_sign_resume(SM2_SIGN_CTX *ctx)
+int sm2_sign_reset(SM2_SIGN_CTX *ctx)
 {
-	return 0;
+	if (!ctx) {
+		error_print();
+		return -1;
+	}
+	memcpy(&ctx->sm3_ctx, &ctx->z_ctx, sizeof(SM3_CTX));
+	return 1;
 }
 
 int sm2_verify_init(SM2_SIGN_CTX *ctx, const SM2_KEY *key, const char *id)
@@ -250,7 +838,9 @@ int sm2_verify_init(SM2_SIGN_CTX *ctx, const SM2_KEY *key, const char *id)
 	sm2_compute_z(z, &key->public_key, id);
 	sm3_init(&ctx->sm3_ctx);
 	sm3_update(&ctx->sm3_ctx, z, 32);
+	memcpy(&ctx->z_ctx, &ctx->sm3_ctx, sizeof(SM3_CTX));
 	memcpy(&ctx->key, key, sizeof(SM2_KEY));
+	ctx->sign_key = NULL;
 	return 1;
 }
 
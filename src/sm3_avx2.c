@@ -0,0 +1,168 @@
+﻿/*
+ * Copyright (c) 2014 - 2021 The GmSSL Project.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgment:
+ *    "This product includes software developed by the GmSSL Project.
+ *    (http://gmssl.org/)"
+ *
+ * 4. The name "GmSSL Project" must not be used to endorse or promote
+ *    products derived from this software without prior written
+ *    permission. For written permission, please contact
+ *    guanzhi1980@gmail.com.
+ *
+ * 5. Products derived from this software may not be called "GmSSL"
+ *    nor may "GmSSL" appear in their names without prior written
+ *    permission of the GmSSL Project.
+ *
+ * 6. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by the GmSSL Project
+ *    (http://gmssl.org/)"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE GmSSL PROJECT ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE GmSSL PROJECT OR
+ * ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * 8-lane AVX2 SM3 compression, one block of an independent message per
+ * 32-bit lane, used by sm3_digest_multi() and the KDF. The state is kept
+ * word-major, state[j][l] is word j of lane l, so it is loaded without
+ * shuffles and lanes can be refilled one by one between calls.
+ *
+ * This file is compiled with -mavx2 and only called after cpu_has_avx2().
+ */
+
+#include <stdint.h>
+#include <immintrin.h>
+
+
+extern const uint32_t K[64]; // sm3.c, T_j <<< j
+
+#define ADD(a, b)	_mm256_add_epi32(a, b)
+#define XOR(a, b)	_mm256_xor_si256(a, b)
+#define XOR3(a, b, c)	XOR(XOR(a, b), c)
+#define ROL(x, n)	_mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+#define P0(x)		XOR3(x, ROL(x, 9), ROL(x, 17))
+#define P1(x)		XOR3(x, ROL(x, 15), ROL(x, 23))
+
+#define FF00(x, y, z)	XOR3(x, y, z)
+#define FF16(x, y, z)	_mm256_or_si256(_mm256_and_si256(x, _mm256_or_si256(y, z)), _mm256_and_si256(y, z))
+#define GG00(x, y, z)	XOR3(x, y, z)
+#define GG16(x, y, z)	XOR(_mm256_and_si256(XOR(y, z), x), z)
+
+#define R(A, B, C, D, E, F, G, H, xx)					\
+	A12 = ROL(A, 12);						\
+	SS1 = ROL(ADD(ADD(A12, E), _mm256_set1_epi32(K[j])), 7);	\
+	SS2 = XOR(SS1, A12);						\
+	TT1 = ADD(ADD(FF##xx(A, B, C), D), ADD(SS2, XOR(W[j], W[j + 4])));	\
+	TT2 = ADD(ADD(GG##xx(E, F, G), H), ADD(SS1, W[j]));		\
+	B = ROL(B, 9);							\
+	H = TT1;							\
+	F = ROL(F, 19);							\
+	D = P0(TT2);							\
+	j++
+
+#define R8(A, B, C, D, E, F, G, H, xx)				\
+	R(A, B, C, D, E, F, G, H, xx);				\
+	R(H, A, B, C, D, E, F, G, xx);				\
+	R(G, H, A, B, C, D, E, F, xx);				\
+	R(F, G, H, A, B, C, D, E, xx);				\
+	R(E, F, G, H, A, B, C, D, xx);				\
+	R(D, E, F, G, H, A, B, C, xx);				\
+	R(C, D, E, F, G, H, A, B, xx);				\
+	R(B, C, D, E, F, G, H, A, xx)
+
+// W[j] = big-endian word j + off of every lane, an 8x8 transpose
+static void load_words_x8(__m256i W[8], const uint8_t *blocks[8], int off)
+{
+	const __m256i bswap = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i r[8], t[8], u[8];
+	int l;
+
+	for (l = 0; l < 8; l++) {
+		r[l] = _mm256_loadu_si256((const __m256i *)(blocks[l] + off * 4));
+	}
+	for (l = 0; l < 8; l += 2) {
+		t[l] = _mm256_unpacklo_epi32(r[l], r[l + 1]);
+		t[l + 1] = _mm256_unpackhi_epi32(r[l], r[l + 1]);
+	}
+	for (l = 0; l < 8; l += 4) {
+		u[l] = _mm256_unpacklo_epi64(t[l], t[l + 2]);
+		u[l + 1] = _mm256_unpackhi_epi64(t[l], t[l + 2]);
+		u[l + 2] = _mm256_unpacklo_epi64(t[l + 1], t[l + 3]);
+		u[l + 3] = _mm256_unpackhi_epi64(t[l + 1], t[l + 3]);
+	}
+	for (l = 0; l < 4; l++) {
+		W[l] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[l], u[l + 4], 0x20), bswap);
+		W[l + 4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u[l], u[l + 4], 0x31), bswap);
+	}
+}
+
+void sm3_avx2_compress_x8(uint32_t state[8][8], const uint8_t *blocks[8])
+{
+	__m256i A, B, C, D, E, F, G, H;
+	__m256i A12, SS1, SS2, TT1, TT2;
+	__m256i W[68];
+	int j;
+
+	load_words_x8(W, blocks, 0);
+	load_words_x8(W + 8, blocks, 8);
+	for (j = 16; j < 68; j++) {
+		W[j] = XOR3(P1(XOR3(W[j - 16], W[j - 9], ROL(W[j - 3], 15))),
+			ROL(W[j - 13], 7), W[j - 6]);
+	}
+
+	A = _mm256_loadu_si256((const __m256i *)state[0]);
+	B = _mm256_loadu_si256((const __m256i *)state[1]);
+	C = _mm256_loadu_si256((const __m256i *)state[2]);
+	D = _mm256_loadu_si256((const __m256i *)state[3]);
+	E = _mm256_loadu_si256((const __m256i *)state[4]);
+	F = _mm256_loadu_si256((const __m256i *)state[5]);
+	G = _mm256_loadu_si256((const __m256i *)state[6]);
+	H = _mm256_loadu_si256((const __m256i *)state[7]);
+
+	j = 0;
+	R8(A, B, C, D, E, F, G, H, 00);
+	R8(A, B, C, D, E, F, G, H, 00);
+	R8(A, B, C, D, E, F, G, H, 16);
+	R8(A, B, C, D, E, F, G, H, 16);
+	R8(A, B, C, D, E, F, G, H, 16);
+	R8(A, B, C, D, E, F, G, H, 16);
+	R8(A, B, C, D, E, F, G, H, 16);
+	R8(A, B, C, D, E, F, G, H, 16);
+
+	_mm256_storeu_si256((__m256i *)state[0], XOR(A, _mm256_loadu_si256((const __m256i *)state[0])));
+	_mm256_storeu_si256((__m256i *)state[1], XOR(B, _mm256_loadu_si256((const __m256i *)state[1])));
+	_mm256_storeu_si256((__m256i *)state[2], XOR(C, _mm256_loadu_si256((const __m256i *)state[2])));
+	_mm256_storeu_si256((__m256i *)state[3], XOR(D, _mm256_loadu_si256((const __m256i *)state[3])));
+	_mm256_storeu_si256((__m256i *)state[4], XOR(E, _mm256_loadu_si256((const __m256i *)state[4])));
+	_mm256_storeu_si256((__m256i *)state[5], XOR(F, _mm256_loadu_si256((const __m256i *)state[5])));
+	_mm256_storeu_si256((__m256i *)state[6], XOR(G, _mm256_loadu_si256((const __m256i *)state[6])));
+	_mm256_storeu_si256((__m256i *)state[7], XOR(H, _mm256_loadu_si256((const __m256i *)state[7])));
+}
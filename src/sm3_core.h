@@ -0,0 +1,326 @@
+﻿/*
+ * Copyright (c) 2014 - 2020 The GmSSL Project.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgment:
+ *    "This product includes software developed by the GmSSL Project.
+ *    (http://gmssl.org/)"
+ *
+ * 4. The name "GmSSL Project" must not be used to endorse or promote
+ *    products derived from this software without prior written
+ *    permission. For written permission, please contact
+ *    guanzhi1980@gmail.com.
+ *
+ * 5. Products derived from this software may not be called "GmSSL"
+ *    nor may "GmSSL" appear in their names without prior written
+ *    permission of the GmSSL Project.
+ *
+ * 6. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by the GmSSL Project
+ *    (http://gmssl.org/)"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE GmSSL PROJECT ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE GmSSL PROJECT OR
+ * ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GMSSL_SM3_CORE_H
+#define GMSSL_SM3_CORE_H
+
+
+#include <stdint.h>
+#include <stddef.h>
+#include "endian.h"
+
+
+/*
+ * Single stream SM3 compression shared by sm3.c and the BMI2 build in
+ * sm3_bmi2.c. The rounds are fully unrolled, T_j <<< j is an immediate,
+ * and the message schedule is kept in a 16 word window that is expanded
+ * one word per round, so W[j + 16] is computed while round j runs instead
+ * of in a separate pass over W[68] and W'[64].
+ */
+
+#define K0	0x79cc4519U
+#define K1	0xf3988a32U
+#define K2	0xe7311465U
+#define K3	0xce6228cbU
+#define K4	0x9cc45197U
+#define K5	0x3988a32fU
+#define K6	0x7311465eU
+#define K7	0xe6228cbcU
+#define K8	0xcc451979U
+#define K9	0x988a32f3U
+#define K10	0x311465e7U
+#define K11	0x6228cbceU
+#define K12	0xc451979cU
+#define K13	0x88a32f39U
+#define K14	0x11465e73U
+#define K15	0x228cbce6U
+#define K16	0x9d8a7a87U
+#define K17	0x3b14f50fU
+#define K18	0x7629ea1eU
+#define K19	0xec53d43cU
+#define K20	0xd8a7a879U
+#define K21	0xb14f50f3U
+#define K22	0x629ea1e7U
+#define K23	0xc53d43ceU
+#define K24	0x8a7a879dU
+#define K25	0x14f50f3bU
+#define K26	0x29ea1e76U
+#define K27	0x53d43cecU
+#define K28	0xa7a879d8U
+#define K29	0x4f50f3b1U
+#define K30	0x9ea1e762U
+#define K31	0x3d43cec5U
+#define K32	0x7a879d8aU
+#define K33	0xf50f3b14U
+#define K34	0xea1e7629U
+#define K35	0xd43cec53U
+#define K36	0xa879d8a7U
+#define K37	0x50f3b14fU
+#define K38	0xa1e7629eU
+#define K39	0x43cec53dU
+#define K40	0x879d8a7aU
+#define K41	0x0f3b14f5U
+#define K42	0x1e7629eaU
+#define K43	0x3cec53d4U
+#define K44	0x79d8a7a8U
+#define K45	0xf3b14f50U
+#define K46	0xe7629ea1U
+#define K47	0xcec53d43U
+#define K48	0x9d8a7a87U
+#define K49	0x3b14f50fU
+#define K50	0x7629ea1eU
+#define K51	0xec53d43cU
+#define K52	0xd8a7a879U
+#define K53	0xb14f50f3U
+#define K54	0x629ea1e7U
+#define K55	0xc53d43ceU
+#define K56	0x8a7a879dU
+#define K57	0x14f50f3bU
+#define K58	0x29ea1e76U
+#define K59	0x53d43cecU
+#define K60	0xa7a879d8U
+#define K61	0x4f50f3b1U
+#define K62	0x9ea1e762U
+#define K63	0x3d43cec5U
+
+#define P0(x) ((x) ^ ROL32((x), 9) ^ ROL32((x),17))
+#define P1(x) ((x) ^ ROL32((x),15) ^ ROL32((x),23))
+
+#define FF00(x,y,z)  ((x) ^ (y) ^ (z))
+#define FF16(x,y,z)  (((x)&(y)) | ((x)&(z)) | ((y)&(z)))
+#define GG00(x,y,z)  ((x) ^ (y) ^ (z))
+#define GG16(x,y,z)  ((((y)^(z)) & (x)) ^ (z))
+
+/* W[j + 16] from W[j], W[j + 3], W[j + 7], W[j + 10], W[j + 13] */
+#define EXPAND(W0, W3, W7, W10, W13) \
+	(P1((W0) ^ (W7) ^ ROL32((W13), 15)) ^ ROL32((W3), 7) ^ (W10))
+
+/*
+ * The registers are renamed instead of moved: the new A is written to D
+ * and the new E to H, and the next round is called with (D, A, B, C) and
+ * (H, E, F, G).
+ */
+#define ROUND(A, B, C, D, E, F, G, H, xx, Tj, Wj, Wj_)			\
+	do {								\
+		uint32_t A12 = ROL32(A, 12);				\
+		uint32_t SS1 = ROL32(A12 + E + (Tj), 7);		\
+		uint32_t TT1 = FF##xx(A, B, C) + D + (SS1 ^ A12) + (Wj_);	\
+		uint32_t TT2 = GG##xx(E, F, G) + H + SS1 + (Wj);	\
+		B = ROL32(B, 9);					\
+		D = TT1;						\
+		F = ROL32(F, 19);					\
+		H = P0(TT2);						\
+	} while (0)
+
+#define R00(A, B, C, D, E, F, G, H, Tj, Wj, Wj_) ROUND(A, B, C, D, E, F, G, H, 00, Tj, Wj, Wj_)
+#define R16(A, B, C, D, E, F, G, H, Tj, Wj, Wj_) ROUND(A, B, C, D, E, F, G, H, 16, Tj, Wj, Wj_)
+
+static inline void sm3_compress_blocks_unrolled(uint32_t digest[8], const uint8_t *data, size_t blocks)
+{
+	uint32_t A, B, C, D, E, F, G, H;
+	uint32_t W00, W01, W02, W03, W04, W05, W06, W07;
+	uint32_t W08, W09, W10, W11, W12, W13, W14, W15;
+
+	while (blocks--) {
+		A = digest[0];
+		B = digest[1];
+		C = digest[2];
+		D = digest[3];
+		E = digest[4];
+		F = digest[5];
+		G = digest[6];
+		H = digest[7];
+
+		W00 = GETU32(data +  0);
+		W01 = GETU32(data +  4);
+		W02 = GETU32(data +  8);
+		W03 = GETU32(data + 12);
+		W04 = GETU32(data + 16);
+		W05 = GETU32(data + 20);
+		W06 = GETU32(data + 24);
+		W07 = GETU32(data + 28);
+		W08 = GETU32(data + 32);
+		W09 = GETU32(data + 36);
+		W10 = GETU32(data + 40);
+		W11 = GETU32(data + 44);
+		W12 = GETU32(data + 48);
+		W13 = GETU32(data + 52);
+		W14 = GETU32(data + 56);
+		W15 = GETU32(data + 60);
+
+		R00(A, B, C, D, E, F, G, H, K0, W00, W00 ^ W04);
+		W00 = EXPAND(W00, W03, W07, W10, W13);
+		R00(D, A, B, C, H, E, F, G, K1, W01, W01 ^ W05);
+		W01 = EXPAND(W01, W04, W08, W11, W14);
+		R00(C, D, A, B, G, H, E, F, K2, W02, W02 ^ W06);
+		W02 = EXPAND(W02, W05, W09, W12, W15);
+		R00(B, C, D, A, F, G, H, E, K3, W03, W03 ^ W07);
+		W03 = EXPAND(W03, W06, W10, W13, W00);
+		R00(A, B, C, D, E, F, G, H, K4, W04, W04 ^ W08);
+		W04 = EXPAND(W04, W07, W11, W14, W01);
+		R00(D, A, B, C, H, E, F, G, K5, W05, W05 ^ W09);
+		W05 = EXPAND(W05, W08, W12, W15, W02);
+		R00(C, D, A, B, G, H, E, F, K6, W06, W06 ^ W10);
+		W06 = EXPAND(W06, W09, W13, W00, W03);
+		R00(B, C, D, A, F, G, H, E, K7, W07, W07 ^ W11);
+		W07 = EXPAND(W07, W10, W14, W01, W04);
+		R00(A, B, C, D, E, F, G, H, K8, W08, W08 ^ W12);
+		W08 = EXPAND(W08, W11, W15, W02, W05);
+		R00(D, A, B, C, H, E, F, G, K9, W09, W09 ^ W13);
+		W09 = EXPAND(W09, W12, W00, W03, W06);
+		R00(C, D, A, B, G, H, E, F, K10, W10, W10 ^ W14);
+		W10 = EXPAND(W10, W13, W01, W04, W07);
+		R00(B, C, D, A, F, G, H, E, K11, W11, W11 ^ W15);
+		W11 = EXPAND(W11, W14, W02, W05, W08);
+		R00(A, B, C, D, E, F, G, H, K12, W12, W12 ^ W00);
+		W12 = EXPAND(W12, W15, W03, W06, W09);
+		R00(D, A, B, C, H, E, F, G, K13, W13, W13 ^ W01);
+		W13 = EXPAND(W13, W00, W04, W07, W10);
+		R00(C, D, A, B, G, H, E, F, K14, W14, W14 ^ W02);
+		W14 = EXPAND(W14, W01, W05, W08, W11);
+		R00(B, C, D, A, F, G, H, E, K15, W15, W15 ^ W03);
+		W15 = EXPAND(W15, W02, W06, W09, W12);
+		R16(A, B, C, D, E, F, G, H, K16, W00, W00 ^ W04);
+		W00 = EXPAND(W00, W03, W07, W10, W13);
+		R16(D, A, B, C, H, E, F, G, K17, W01, W01 ^ W05);
+		W01 = EXPAND(W01, W04, W08, W11, W14);
+		R16(C, D, A, B, G, H, E, F, K18, W02, W02 ^ W06);
+		W02 = EXPAND(W02, W05, W09, W12, W15);
+		R16(B, C, D, A, F, G, H, E, K19, W03, W03 ^ W07);
+		W03 = EXPAND(W03, W06, W10, W13, W00);
+		R16(A, B, C, D, E, F, G, H, K20, W04, W04 ^ W08);
+		W04 = EXPAND(W04, W07, W11, W14, W01);
+		R16(D, A, B, C, H, E, F, G, K21, W05, W05 ^ W09);
+		W05 = EXPAND(W05, W08, W12, W15, W02);
+		R16(C, D, A, B, G, H, E, F, K22, W06, W06 ^ W10);
+		W06 = EXPAND(W06, W09, W13, W00, W03);
+		R16(B, C, D, A, F, G, H, E, K23, W07, W07 ^ W11);
+		W07 = EXPAND(W07, W10, W14, W01, W04);
+		R16(A, B, C, D, E, F, G, H, K24, W08, W08 ^ W12);
+		W08 = EXPAND(W08, W11, W15, W02, W05);
+		R16(D, A, B, C, H, E, F, G, K25, W09, W09 ^ W13);
+		W09 = EXPAND(W09, W12, W00, W03, W06);
+		R16(C, D, A, B, G, H, E, F, K26, W10, W10 ^ W14);
+		W10 = EXPAND(W10, W13, W01, W04, W07);
+		R16(B, C, D, A, F, G, H, E, K27, W11, W11 ^ W15);
+		W11 = EXPAND(W11, W14, W02, W05, W08);
+		R16(A, B, C, D, E, F, G, H, K28, W12, W12 ^ W00);
+		W12 = EXPAND(W12, W15, W03, W06, W09);
+		R16(D, A, B, C, H, E, F, G, K29, W13, W13 ^ W01);
+		W13 = EXPAND(W13, W00, W04, W07, W10);
+		R16(C, D, A, B, G, H, E, F, K30, W14, W14 ^ W02);
+		W14 = EXPAND(W14, W01, W05, W08, W11);
+		R16(B, C, D, A, F, G, H, E, K31, W15, W15 ^ W03);
+		W15 = EXPAND(W15, W02, W06, W09, W12);
+		R16(A, B, C, D, E, F, G, H, K32, W00, W00 ^ W04);
+		W00 = EXPAND(W00, W03, W07, W10, W13);
+		R16(D, A, B, C, H, E, F, G, K33, W01, W01 ^ W05);
+		W01 = EXPAND(W01, W04, W08, W11, W14);
+		R16(C, D, A, B, G, H, E, F, K34, W02, W02 ^ W06);
+		W02 = EXPAND(W02, W05, W09, W12, W15);
+		R16(B, C, D, A, F, G, H, E, K35, W03, W03 ^ W07);
+		W03 = EXPAND(W03, W06, W10, W13, W00);
+		R16(A, B, C, D, E, F, G, H, K36, W04, W04 ^ W08);
+		W04 = EXPAND(W04, W07, W11, W14, W01);
+		R16(D, A, B, C, H, E, F, G, K37, W05, W05 ^ W09);
+		W05 = EXPAND(W05, W08, W12, W15, W02);
+		R16(C, D, A, B, G, H, E, F, K38, W06, W06 ^ W10);
+		W06 = EXPAND(W06, W09, W13, W00, W03);
+		R16(B, C, D, A, F, G, H, E, K39, W07, W07 ^ W11);
+		W07 = EXPAND(W07, W10, W14, W01, W04);
+		R16(A, B, C, D, E, F, G, H, K40, W08, W08 ^ W12);
+		W08 = EXPAND(W08, W11, W15, W02, W05);
+		R16(D, A, B, C, H, E, F, G, K41, W09, W09 ^ W13);
+		W09 = EXPAND(W09, W12, W00, W03, W06);
+		R16(C, D, A, B, G, H, E, F, K42, W10, W10 ^ W14);
+		W10 = EXPAND(W10, W13, W01, W04, W07);
+		R16(B, C, D, A, F, G, H, E, K43, W11, W11 ^ W15);
+		W11 = EXPAND(W11, W14, W02, W05, W08);
+		R16(A, B, C, D, E, F, G, H, K44, W12, W12 ^ W00);
+		W12 = EXPAND(W12, W15, W03, W06, W09);
+		R16(D, A, B, C, H, E, F, G, K45, W13, W13 ^ W01);
+		W13 = EXPAND(W13, W00, W04, W07, W10);
+		R16(C, D, A, B, G, H, E, F, K46, W14, W14 ^ W02);
+		W14 = EXPAND(W14, W01, W05, W08, W11);
+		R16(B, C, D, A, F, G, H, E, K47, W15, W15 ^ W03);
+		W15 = EXPAND(W15, W02, W06, W09, W12);
+		R16(A, B, C, D, E, F, G, H, K48, W00, W00 ^ W04);
+		W00 = EXPAND(W00, W03, W07, W10, W13);
+		R16(D, A, B, C, H, E, F, G, K49, W01, W01 ^ W05);
+		W01 = EXPAND(W01, W04, W08, W11, W14);
+		R16(C, D, A, B, G, H, E, F, K50, W02, W02 ^ W06);
+		W02 = EXPAND(W02, W05, W09, W12, W15);
+		R16(B, C, D, A, F, G, H, E, K51, W03, W03 ^ W07);
+		W03 = EXPAND(W03, W06, W10, W13, W00);
+		R16(A, B, C, D, E, F, G, H, K52, W04, W04 ^ W08);
+		R16(D, A, B, C, H, E, F, G, K53, W05, W05 ^ W09);
+		R16(C, D, A, B, G, H, E, F, K54, W06, W06 ^ W10);
+		R16(B, C, D, A, F, G, H, E, K55, W07, W07 ^ W11);
+		R16(A, B, C, D, E, F, G, H, K56, W08, W08 ^ W12);
+		R16(D, A, B, C, H, E, F, G, K57, W09, W09 ^ W13);
+		R16(C, D, A, B, G, H, E, F, K58, W10, W10 ^ W14);
+		R16(B, C, D, A, F, G, H, E, K59, W11, W11 ^ W15);
+		R16(A, B, C, D, E, F, G, H, K60, W12, W12 ^ W00);
+		R16(D, A, B, C, H, E, F, G, K61, W13, W13 ^ W01);
+		R16(C, D, A, B, G, H, E, F, K62, W14, W14 ^ W02);
+		R16(B, C, D, A, F, G, H, E, K63, W15, W15 ^ W03);
+
+		digest[0] ^= A;
+		digest[1] ^= B;
+		digest[2] ^= C;
+		digest[3] ^= D;
+		digest[4] ^= E;
+		digest[5] ^= F;
+		digest[6] ^= G;
+		digest[7] ^= H;
+
+		data += 64;
+	}
+}
+
+#endif
@@ -72,26 +72,57 @@
 #define IPAD	0x36
 #define OPAD	0x5C
 
-void sm3_hmac_init(SM3_HMAC_CTX *ctx, const uint8_t *key, size_t key_len)
+extern void sm3_compress_blocks(uint32_t digest[8], const uint8_t *data, size_t blocks);
+
+void sm3_hmac_set_key(SM3_HMAC_KEY *hmac_key, const uint8_t *key, size_t key_len)
 {
+	static const uint32_t sm3_iv[8] = {
+		0x7380166F, 0x4914B2B9, 0x172442D7, 0xDA8A0600,
+		0xA96F30BC, 0x163138AA, 0xE38DEE4D, 0xB0FB0E4E,
+	};
+	uint8_t block[SM3_BLOCK_SIZE];
 	int i;
 
 	if (key_len <= SM3_BLOCK_SIZE) {
-		memcpy(ctx->key, key, key_len);
-		memset(ctx->key + key_len, 0, SM3_BLOCK_SIZE - key_len);
+		memcpy(block, key, key_len);
+		memset(block + key_len, 0, SM3_BLOCK_SIZE - key_len);
 	} else {
-		sm3_init(&ctx->sm3_ctx);
-		sm3_update(&ctx->sm3_ctx, key, key_len);
-		sm3_finish(&ctx->sm3_ctx, ctx->key);
-		memset(ctx->key + SM3_DIGEST_SIZE, 0,
-			SM3_BLOCK_SIZE - SM3_DIGEST_SIZE);
+		sm3_digest(key, key_len, block);
+		memset(block + SM3_DIGEST_SIZE, 0, SM3_BLOCK_SIZE - SM3_DIGEST_SIZE);
+	}
+
+	for (i = 0; i < SM3_BLOCK_SIZE; i++) {
+		block[i] ^= IPAD;
 	}
+	memcpy(hmac_key->ipad_digest, sm3_iv, sizeof(sm3_iv));
+	sm3_compress_blocks(hmac_key->ipad_digest, block, 1);
+
 	for (i = 0; i < SM3_BLOCK_SIZE; i++) {
-		ctx->key[i] ^= IPAD;
+		block[i] ^= (IPAD ^ OPAD);
 	}
+	memcpy(hmac_key->opad_digest, sm3_iv, sizeof(sm3_iv));
+	sm3_compress_blocks(hmac_key->opad_digest, block, 1);
 
-	sm3_init(&ctx->sm3_ctx);
-	sm3_update(&ctx->sm3_ctx, ctx->key, SM3_BLOCK_SIZE);
+	memset(block, 0, sizeof(block));
+}
+
+void sm3_hmac_init(SM3_HMAC_CTX *ctx, const uint8_t *key, size_t key_len)
+{
+	sm3_hmac_set_key(&ctx->key, key, key_len);
+	sm3_hmac_reset(ctx);
+}
+
+void sm3_hmac_init_with_key(SM3_HMAC_CTX *ctx, const SM3_HMAC_KEY *hmac_key)
+{
+	ctx->key = *hmac_key;
+	sm3_hmac_reset(ctx);
+}
+
+void sm3_hmac_reset(SM3_HMAC_CTX *ctx)
+{
+	memcpy(ctx->sm3_ctx.digest, ctx->key.ipad_digest, sizeof(ctx->key.ipad_digest));
+	ctx->sm3_ctx.nblocks = 1;
+	ctx->sm3_ctx.num = 0;
 }
 
 void sm3_hmac_update(SM3_HMAC_CTX *ctx, const uint8_t *data, size_t data_len)
@@ -101,24 +132,25 @@ void sm3_hmac_update(SM3_HMAC_CTX *ctx, const uint8_t *data, size_t data_len)
 
 void sm3_hmac_finish(SM3_HMAC_CTX *ctx, uint8_t mac[SM3_HMAC_SIZE])
 {
-	int i;
-	for (i = 0; i < SM3_BLOCK_SIZE; i++) {
-		ctx->key[i] ^= (IPAD ^ OPAD);
-	}
 	sm3_finish(&ctx->sm3_ctx, mac);
-	sm3_init(&ctx->sm3_ctx);
-	sm3_update(&ctx->sm3_ctx, ctx->key, SM3_BLOCK_SIZE);
+
+	memcpy(ctx->sm3_ctx.digest, ctx->key.opad_digest, sizeof(ctx->key.opad_digest));
+	ctx->sm3_ctx.nblocks = 1;
+	ctx->sm3_ctx.num = 0;
 	sm3_update(&ctx->sm3_ctx, mac, SM3_DIGEST_SIZE);
 	sm3_finish(&ctx->sm3_ctx, mac);
-	memset(ctx, 0, sizeof(*ctx));
+
+	// the key stays for sm3_hmac_reset()
+	memset(&ctx->sm3_ctx, 0, sizeof(ctx->sm3_ctx));
 }
 
-void sm3_hmac(const uint8_t *data, size_t data_len,
-	const uint8_t *key, size_t key_len,
+void sm3_hmac(const uint8_t *key, size_t key_len,
+	const uint8_t *data, size_t data_len,
 	uint8_t mac[SM3_HMAC_SIZE])
 {
 	SM3_HMAC_CTX ctx;
 	sm3_hmac_init(&ctx, key, key_len);
 	sm3_hmac_update(&ctx, data, data_len);
 	sm3_hmac_finish(&ctx, mac);
+	memset(&ctx, 0, sizeof(ctx));
 }
@@ -0,0 +1,199 @@
+﻿/*
+ * Copyright (c) 2014 - 2021 The GmSSL Project.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgment:
+ *    "This product includes software developed by the GmSSL Project.
+ *    (http://gmssl.org/)"
+ *
+ * 4. The name "GmSSL Project" must not be used to endorse or promote
+ *    products derived from this software without prior written
+ *    permission. For written permission, please contact
+ *    guanzhi1980@gmail.com.
+ *
+ * 5. Products derived from this software may not be called "GmSSL"
+ *    nor may "GmSSL" appear in their names without prior written
+ *    permission of the GmSSL Project.
+ *
+ * 6. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by the GmSSL Project
+ *    (http://gmssl.org/)"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE GmSSL PROJECT ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE GmSSL PROJECT OR
+ * ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <string.h>
+#include <gmssl/sm3.h>
+#include "endian.h"
+#include "cpu.h"
+
+
+extern void sm3_compress_blocks(uint32_t digest[8], const uint8_t *data, size_t blocks);
+
+/*
+ * KDF(Z, klen) = SM3(Z || 1) || SM3(Z || 2) || ..., truncated to klen bytes
+ * (GB/T 32918.3 5.4.3). Z is absorbed once. Every counter block then only
+ * needs the padded tail of Z || ct compressed from that state, and the tail
+ * is prepared once with the counter patched in per block. Runs of 8 blocks
+ * go through the multi-buffer compression when the CPU has AVX2.
+ */
+
+void sm3_kdf_init(SM3_KDF_CTX *ctx)
+{
+	memset(ctx, 0, sizeof(SM3_KDF_CTX));
+	sm3_init(&ctx->sm3_ctx);
+	ctx->counter = 1;
+	ctx->out_used = SM3_DIGEST_SIZE;
+}
+
+void sm3_kdf_update(SM3_KDF_CTX *ctx, const uint8_t *data, size_t datalen)
+{
+	sm3_update(&ctx->sm3_ctx, data, datalen);
+}
+
+// padded Z tail || ct, with ct at offset sm3_ctx.num
+static void sm3_kdf_prepare_tail(SM3_KDF_CTX *ctx)
+{
+	size_t num = ctx->sm3_ctx.num;
+	uint64_t nbits = (ctx->sm3_ctx.nblocks * SM3_BLOCK_SIZE + num + 4) * 8;
+
+	ctx->tail_blocks = (num + 4 + 1 + 8 <= SM3_BLOCK_SIZE) ? 1 : 2;
+	memset(ctx->tail, 0, sizeof(ctx->tail));
+	memcpy(ctx->tail, ctx->sm3_ctx.block, num);
+	ctx->tail[num + 4] = 0x80;
+	PUTU32(ctx->tail + ctx->tail_blocks * SM3_BLOCK_SIZE - 8, (uint32_t)(nbits >> 32));
+	PUTU32(ctx->tail + ctx->tail_blocks * SM3_BLOCK_SIZE - 4, (uint32_t)nbits);
+}
+
+#ifdef HAVE_AVX2
+void sm3_avx2_compress_x8(uint32_t state[8][8], const uint8_t *blocks[8]);
+
+// 8 counter blocks, one per lane, all from the state after Z
+static void sm3_kdf_blocks_x8(SM3_KDF_CTX *ctx, uint8_t *out)
+{
+	uint8_t tails[8][SM3_BLOCK_SIZE * 2];
+	const uint8_t *blocks[8];
+	uint32_t state[8][8];
+	size_t i;
+	int j, l;
+
+	for (l = 0; l < 8; l++) {
+		memcpy(tails[l], ctx->tail, ctx->tail_blocks * SM3_BLOCK_SIZE);
+		PUTU32(tails[l] + ctx->sm3_ctx.num, ctx->counter);
+		ctx->counter++;
+		for (j = 0; j < 8; j++) {
+			state[j][l] = ctx->sm3_ctx.digest[j];
+		}
+	}
+	for (i = 0; i < ctx->tail_blocks; i++) {
+		for (l = 0; l < 8; l++) {
+			blocks[l] = tails[l] + i * SM3_BLOCK_SIZE;
+		}
+		sm3_avx2_compress_x8(state, blocks);
+	}
+	for (l = 0; l < 8; l++) {
+		for (j = 0; j < 8; j++) {
+			PUTU32(out + l * SM3_DIGEST_SIZE + j * 4, state[j][l]);
+		}
+	}
+	memset(tails, 0, sizeof(tails));
+	memset(state, 0, sizeof(state));
+}
+#endif
+
+// out = SM3(Z || ct) for nblocks counters from ctx->counter
+static void sm3_kdf_blocks(SM3_KDF_CTX *ctx, uint8_t *out, size_t nblocks)
+{
+	uint32_t digest[SM3_STATE_WORDS];
+	size_t i;
+	int j;
+
+#ifdef HAVE_AVX2
+	if (nblocks >= 8 && cpu_has_avx2()) {
+		for (; nblocks >= 8; nblocks -= 8) {
+			sm3_kdf_blocks_x8(ctx, out);
+			out += 8 * SM3_DIGEST_SIZE;
+		}
+	}
+#endif
+	for (i = 0; i < nblocks; i++) {
+		memcpy(digest, ctx->sm3_ctx.digest, sizeof(digest));
+		PUTU32(ctx->tail + ctx->sm3_ctx.num, ctx->counter);
+		ctx->counter++;
+		sm3_compress_blocks(digest, ctx->tail, ctx->tail_blocks);
+		for (j = 0; j < SM3_STATE_WORDS; j++) {
+			PUTU32(out + j * 4, digest[j]);
+		}
+		out += SM3_DIGEST_SIZE;
+	}
+	memset(digest, 0, sizeof(digest));
+}
+
+void sm3_kdf_generate(SM3_KDF_CTX *ctx, uint8_t *out, size_t outlen)
+{
+	size_t len, nblocks;
+
+	if (!ctx->tail_blocks) {
+		sm3_kdf_prepare_tail(ctx);
+	}
+
+	// the rest of the last block
+	len = SM3_DIGEST_SIZE - ctx->out_used;
+	if (len > outlen)
+		len = outlen;
+	memcpy(out, ctx->out + ctx->out_used, len);
+	ctx->out_used += len;
+	out += len;
+	outlen -= len;
+
+	nblocks = outlen / SM3_DIGEST_SIZE;
+	sm3_kdf_blocks(ctx, out, nblocks);
+	out += nblocks * SM3_DIGEST_SIZE;
+	outlen -= nblocks * SM3_DIGEST_SIZE;
+
+	if (outlen) {
+		sm3_kdf_blocks(ctx, ctx->out, 1);
+		memcpy(out, ctx->out, outlen);
+		ctx->out_used = outlen;
+	}
+}
+
+void sm3_kdf_cleanup(SM3_KDF_CTX *ctx)
+{
+	memset(ctx, 0, sizeof(SM3_KDF_CTX));
+}
+
+void sm3_kdf(const uint8_t *in, size_t inlen, size_t outlen, uint8_t *out)
+{
+	SM3_KDF_CTX ctx;
+
+	sm3_kdf_init(&ctx);
+	sm3_kdf_update(&ctx, in, inlen);
+	sm3_kdf_generate(&ctx, out, outlen);
+	sm3_kdf_cleanup(&ctx);
+}
@@ -0,0 +1,318 @@
+﻿/*
+ * Copyright (c) 2014 - 2021 The GmSSL Project.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgment:
+ *    "This product includes software developed by the GmSSL Project.
+ *    (http://gmssl.org/)"
+ *
+ * 4. The name "GmSSL Project" must not be used to endorse or promote
+ *    products derived from this software without prior written
+ *    permission. For written permission, please contact
+ *    guanzhi1980@gmail.com.
+ *
+ * 5. Products derived from this software may not be called "GmSSL"
+ *    nor may "GmSSL" appear in their names without prior written
+ *    permission of the GmSSL Project.
+ *
+ * 6. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by the GmSSL Project
+ *    (http://gmssl.org/)"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE GmSSL PROJECT ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE GmSSL PROJECT OR
+ * ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <gmssl/sm3.h>
+#include <gmssl/error.h>
+#include "endian.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+/*
+ * Leaves are hashed in rounds of SM3_TREE_ROUND_LEAVES. Each round is cut
+ * into one slice per thread, every slice goes through sm3_digest_multi(),
+ * and the leaf digests are absorbed into the root in order when all the
+ * threads of the round have joined.
+ */
+#define SM3_TREE_ROUND_LEAVES	1024
+#define SM3_TREE_MAX_THREADS	64
+
+
+int sm3_tree_init(SM3_TREE_CTX *ctx, size_t leaf_size)
+{
+	uint8_t header[10];
+
+	if (!ctx || !leaf_size || leaf_size % SM3_BLOCK_SIZE) {
+		error_print();
+		return -1;
+	}
+	memset(ctx, 0, sizeof(SM3_TREE_CTX));
+	ctx->leaf_size = leaf_size;
+
+	header[0] = 0x01;
+	header[1] = SM3_TREE_VERSION;
+	PUTU64(header + 2, ctx->leaf_size);
+	sm3_init(&ctx->root_ctx);
+	sm3_update(&ctx->root_ctx, header, sizeof(header));
+	sm3_init(&ctx->leaf_ctx);
+	return 1;
+}
+
+static void sm3_tree_add_leaves(SM3_TREE_CTX *ctx, const uint8_t (*leaves)[SM3_DIGEST_SIZE],
+	size_t nleaves)
+{
+	sm3_update(&ctx->root_ctx, leaves[0], nleaves * SM3_DIGEST_SIZE);
+	ctx->nleaves += nleaves;
+	ctx->inlen += ctx->leaf_size * nleaves;
+}
+
+int sm3_tree_update(SM3_TREE_CTX *ctx, const uint8_t *data, size_t datalen)
+{
+	uint8_t leaf[SM3_DIGEST_SIZE];
+	size_t len;
+
+	// leaf_size is 0 before sm3_tree_init() and after sm3_tree_finish()
+	if (!ctx || !ctx->leaf_size || (!data && datalen)) {
+		error_print();
+		return -1;
+	}
+	while (datalen) {
+		len = ctx->leaf_size - ctx->leaf_used;
+		if (len > datalen) {
+			len = datalen;
+		}
+		sm3_update(&ctx->leaf_ctx, data, len);
+		ctx->leaf_used += len;
+		data += len;
+		datalen -= len;
+
+		if (ctx->leaf_used == ctx->leaf_size) {
+			sm3_finish(&ctx->leaf_ctx, leaf);
+			sm3_tree_add_leaves(ctx, &leaf, 1);
+			sm3_init(&ctx->leaf_ctx);
+			ctx->leaf_used = 0;
+		}
+	}
+	return 1;
+}
+
+int sm3_tree_finish(SM3_TREE_CTX *ctx, uint8_t dgst[SM3_DIGEST_SIZE])
+{
+	uint8_t leaf[SM3_DIGEST_SIZE];
+	uint8_t trailer[16];
+
+	if (!ctx || !ctx->leaf_size || !dgst) {
+		error_print();
+		return -1;
+	}
+	if (ctx->leaf_used || !ctx->nleaves) {
+		sm3_finish(&ctx->leaf_ctx, leaf);
+		sm3_update(&ctx->root_ctx, leaf, sizeof(leaf));
+		ctx->nleaves++;
+		ctx->inlen += ctx->leaf_used;
+	}
+	PUTU64(trailer, ctx->nleaves);
+	PUTU64(trailer + 8, ctx->inlen);
+	sm3_update(&ctx->root_ctx, trailer, sizeof(trailer));
+	sm3_finish(&ctx->root_ctx, dgst);
+
+	memset(ctx, 0, sizeof(SM3_TREE_CTX));
+	return 1;
+}
+
+// dgsts[i] = SM3(leaf i) for n full leaves
+static void sm3_tree_hash_leaves(const uint8_t *data, size_t leaf_size, size_t n,
+	uint8_t (*dgsts)[SM3_DIGEST_SIZE])
+{
+	const uint8_t *msgs[64];
+	size_t lens[64];
+	size_t i;
+
+	while (n) {
+		size_t m = n < 64 ? n : 64;
+		for (i = 0; i < m; i++) {
+			msgs[i] = data + leaf_size * i;
+			lens[i] = leaf_size;
+		}
+		sm3_digest_multi(msgs, lens, m, dgsts);
+		data += leaf_size * m;
+		dgsts += m;
+		n -= m;
+	}
+}
+
+#ifdef HAVE_PTHREAD
+typedef struct {
+	const uint8_t *data;
+	size_t leaf_size;
+	size_t n;
+	uint8_t (*dgsts)[SM3_DIGEST_SIZE];
+} SM3_TREE_JOB;
+
+static void *sm3_tree_thread(void *arg)
+{
+	SM3_TREE_JOB *job = (SM3_TREE_JOB *)arg;
+	sm3_tree_hash_leaves(job->data, job->leaf_size, job->n, job->dgsts);
+	return NULL;
+}
+#endif
+
+// n full leaves of one round on up to num_threads threads
+static void sm3_tree_hash_round(const uint8_t *data, size_t leaf_size, size_t n,
+	uint8_t (*dgsts)[SM3_DIGEST_SIZE], int num_threads)
+{
+#ifdef HAVE_PTHREAD
+	SM3_TREE_JOB jobs[SM3_TREE_MAX_THREADS];
+	pthread_t threads[SM3_TREE_MAX_THREADS];
+	size_t per_thread;
+	size_t off = 0;
+	int started = 0;
+	int i;
+
+	if (num_threads <= 1 || n < 2) {
+		sm3_tree_hash_leaves(data, leaf_size, n, dgsts);
+		return;
+	}
+
+	// whole groups of 8 leaves per thread keep the AVX2 lanes busy
+	per_thread = (n + num_threads - 1) / num_threads;
+	per_thread = (per_thread + 7) & ~(size_t)7;
+	// the calling thread takes the last slice
+	for (i = 0; i < num_threads - 1 && off + per_thread < n; i++) {
+		jobs[i].data = data + leaf_size * off;
+		jobs[i].leaf_size = leaf_size;
+		jobs[i].n = per_thread;
+		jobs[i].dgsts = dgsts + off;
+		off += jobs[i].n;
+
+		if (pthread_create(&threads[i], NULL, sm3_tree_thread, &jobs[i]) != 0) {
+			// run the rest in the calling thread
+			off -= jobs[i].n;
+			break;
+		}
+		started++;
+	}
+	sm3_tree_hash_leaves(data + leaf_size * off, leaf_size, n - off, dgsts + off);
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+#else
+	(void)num_threads;
+	sm3_tree_hash_leaves(data, leaf_size, n, dgsts);
+#endif
+}
+
+int sm3_tree_digest(const uint8_t *data, size_t datalen, size_t leaf_size, int num_threads,
+	uint8_t dgst[SM3_DIGEST_SIZE])
+{
+	SM3_TREE_CTX ctx;
+	uint8_t leaves[SM3_TREE_ROUND_LEAVES][SM3_DIGEST_SIZE];
+	size_t n;
+
+	if ((!data && datalen) || !dgst) {
+		error_print();
+		return -1;
+	}
+	if (sm3_tree_init(&ctx, leaf_size) != 1) {
+		error_print();
+		return -1;
+	}
+	if (num_threads > SM3_TREE_MAX_THREADS) {
+		num_threads = SM3_TREE_MAX_THREADS;
+	}
+
+	while ((n = datalen / leaf_size) > 0) {
+		if (n > SM3_TREE_ROUND_LEAVES) {
+			n = SM3_TREE_ROUND_LEAVES;
+		}
+		sm3_tree_hash_round(data, leaf_size, n, leaves, num_threads);
+		sm3_tree_add_leaves(&ctx, leaves, n);
+		data += leaf_size * n;
+		datalen -= leaf_size * n;
+	}
+	sm3_tree_update(&ctx, data, datalen);
+	sm3_tree_finish(&ctx, dgst);
+	return 1;
+}
+
+int sm3_tree_digest_file(FILE *fp, size_t leaf_size, int num_threads, uint8_t dgst[SM3_DIGEST_SIZE])
+{
+	SM3_TREE_CTX ctx;
+	uint8_t buf[4096];
+	size_t len;
+
+	if (!fp || !dgst) {
+		error_print();
+		return -1;
+	}
+
+#ifdef HAVE_MMAP
+	{
+		struct stat st;
+		void *p;
+		int ret;
+
+		// regular files that fit in the address space are hashed in place
+		if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)
+			&& st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX
+			&& ftello(fp) == 0
+			&& (p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fileno(fp), 0)) != MAP_FAILED) {
+			ret = sm3_tree_digest(p, (size_t)st.st_size, leaf_size, num_threads, dgst);
+			munmap(p, (size_t)st.st_size);
+			return ret;
+		}
+	}
+#else
+	(void)num_threads;
+#endif
+
+	if (sm3_tree_init(&ctx, leaf_size) != 1) {
+		error_print();
+		return -1;
+	}
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		sm3_tree_update(&ctx, buf, len);
+	}
+	if (ferror(fp)) {
+		memset(&ctx, 0, sizeof(ctx));
+		error_print();
+		return -1;
+	}
+	sm3_tree_finish(&ctx, dgst);
+	return 1;
+}
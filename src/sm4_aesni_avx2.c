@@ -0,0 +1,211 @@
+﻿/*
+ * Copyright (c) 2014 - 2020 The GmSSL Project.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. All advertising materials mentioning features or use of this
+ *    software must display the following acknowledgment:
+ *    "This product includes software developed by the GmSSL Project.
+ *    (http://gmssl.org/)"
+ *
+ * 4. The name "GmSSL Project" must not be used to endorse or promote
+ *    products derived from this software without prior written
+ *    permission. For written permission, please contact
+ *    guanzhi1980@gmail.com.
+ *
+ * 5. Products derived from this software may not be called "GmSSL"
+ *    nor may "GmSSL" appear in their names without prior written
+ *    permission of the GmSSL Project.
+ *
+ * 6. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by the GmSSL Project
+ *    (http://gmssl.org/)"
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE GmSSL PROJECT ``AS IS'' AND ANY
+ * EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE GmSSL PROJECT OR
+ * ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * SM4 with AES-NI and AVX2, 8 or 16 blocks at a time.
+ *
+ * The SM4 S-box is affine-equivalent to the AES S-box: both are an
+ * inversion in GF(2^8) between two affine maps, and the two fields are
+ * isomorphic. So S(x) = post(SubBytes(pre(x))), where pre and post are
+ * affine maps over GF(2)^8 done as two 4-bit pshufb lookups each, and
+ * SubBytes is aesenclast with a zero round key. aesenclast also applies
+ * ShiftRows, which is undone in the byte shuffles of the L transform.
+ *
+ * The blocks are transposed so that each ymm holds one word of 8 blocks.
+ * Nothing depends on secret-indexed memory, unlike the T-table rounds of
+ * sm4_enc.c.
+ */
+
+#include <immintrin.h>
+#include <gmssl/sm4.h>
+
+
+#define SM4_PRE_LO	\
+	0x3e, 0xb2, 0x0e, 0x82, 0xbb, 0x37, 0x8b, 0x07, 0xa1, 0x2d, 0x91, 0x1d, 0x24, 0xa8, 0x14, 0x98
+#define SM4_PRE_HI	\
+	0x00, 0xdc, 0x2e, 0xf2, 0xc5, 0x19, 0xeb, 0x37, 0x08, 0xd4, 0x26, 0xfa, 0xcd, 0x11, 0xe3, 0x3f
+#define SM4_POST_LO	\
+	0x6c, 0xd4, 0xa6, 0x1e, 0x52, 0xea, 0x98, 0x20, 0x0b, 0xb3, 0xc1, 0x79, 0x35, 0x8d, 0xff, 0x47
+#define SM4_POST_HI	\
+	0x00, 0xe0, 0x50, 0xb0, 0x9d, 0x7d, 0xcd, 0x2d, 0xc0, 0x20, 0x90, 0x70, 0x5d, 0xbd, 0x0d, 0xed
+
+// inverse ShiftRows followed by a left rotation of each 32-bit word by 0, 8, 16, 24
+#define SM4_ROL0	0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3
+#define SM4_ROL8	7, 0, 13, 10, 11, 4, 1, 14, 15, 8, 5, 2, 3, 12, 9, 6
+#define SM4_ROL16	10, 7, 0, 13, 14, 11, 4, 1, 2, 15, 8, 5, 6, 3, 12, 9
+#define SM4_ROL24	13, 10, 7, 0, 1, 14, 11, 4, 5, 2, 15, 8, 9, 6, 3, 12
+
+#define SM4_BSWAP32	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+
+#define SET2(a)		_mm256_setr_epi8(a, a)
+
+
+static inline __m256i aesenclast_x2(__m256i x)
+{
+	__m128i lo = _mm256_castsi256_si128(x);
+	__m128i hi = _mm256_extracti128_si256(x, 1);
+	lo = _mm_aesenclast_si128(lo, _mm_setzero_si128());
+	hi = _mm_aesenclast_si128(hi, _mm_setzero_si128());
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+// L(S(x)) on 8 words
+static inline __m256i sm4_t(__m256i x)
+{
+	const __m256i m0f = _mm256_set1_epi8(0x0f);
+	__m256i y, r0, r8, r16, r24;
+
+	y = _mm256_xor_si256(
+		_mm256_shuffle_epi8(SET2(SM4_PRE_LO), _mm256_and_si256(x, m0f)),
+		_mm256_shuffle_epi8(SET2(SM4_PRE_HI), _mm256_and_si256(_mm256_srli_epi16(x, 4), m0f)));
+	y = aesenclast_x2(y);
+	y = _mm256_xor_si256(
+		_mm256_shuffle_epi8(SET2(SM4_POST_LO), _mm256_and_si256(y, m0f)),
+		_mm256_shuffle_epi8(SET2(SM4_POST_HI), _mm256_and_si256(_mm256_srli_epi16(y, 4), m0f)));
+
+	// L(x) = x ^ (x <<< 24) ^ ((x ^ (x <<< 8) ^ (x <<< 16)) <<< 2)
+	r0 = _mm256_shuffle_epi8(y, SET2(SM4_ROL0));
+	r8 = _mm256_shuffle_epi8(y, SET2(SM4_ROL8));
+	r16 = _mm256_shuffle_epi8(y, SET2(SM4_ROL16));
+	r24 = _mm256_shuffle_epi8(y, SET2(SM4_ROL24));
+	r8 = _mm256_xor_si256(_mm256_xor_si256(r0, r8), r16);
+	r8 = _mm256_or_si256(_mm256_slli_epi32(r8, 2), _mm256_srli_epi32(r8, 30));
+	return _mm256_xor_si256(_mm256_xor_si256(r0, r24), r8);
+}
+
+// 4x4 transpose of 32-bit words in each 128-bit lane
+#define TRANSPOSE(x0, x1, x2, x3, t0, t1, t2, t3)	\
+	t0 = _mm256_unpacklo_epi32(x0, x1);		\
+	t1 = _mm256_unpacklo_epi32(x2, x3);		\
+	t2 = _mm256_unpackhi_epi32(x0, x1);		\
+	t3 = _mm256_unpackhi_epi32(x2, x3);		\
+	x0 = _mm256_unpacklo_epi64(t0, t1);		\
+	x1 = _mm256_unpackhi_epi64(t0, t1);		\
+	x2 = _mm256_unpacklo_epi64(t2, t3);		\
+	x3 = _mm256_unpackhi_epi64(t2, t3)
+
+// _mm256_loadu2_m128i and _mm256_storeu2_m128i are missing before GCC 10
+#define LOADU2(hi, lo)							\
+	_mm256_inserti128_si256(_mm256_castsi128_si256(			\
+		_mm_loadu_si128((const __m128i *)(lo))),		\
+		_mm_loadu_si128((const __m128i *)(hi)), 1)
+
+#define STOREU2(hi, lo, x)						\
+	_mm_storeu_si128((__m128i *)(lo), _mm256_castsi256_si128(x));	\
+	_mm_storeu_si128((__m128i *)(hi), _mm256_extracti128_si256(x, 1))
+
+// blocks i and i + 4 share a ymm, lane 0 and lane 1
+#define LOAD8(x0, x1, x2, x3, in)					\
+	x0 = LOADU2((in) + 64, (in));					\
+	x1 = LOADU2((in) + 80, (in) + 16);				\
+	x2 = LOADU2((in) + 96, (in) + 32);				\
+	x3 = LOADU2((in) + 112, (in) + 48);				\
+	x0 = _mm256_shuffle_epi8(x0, bswap);				\
+	x1 = _mm256_shuffle_epi8(x1, bswap);				\
+	x2 = _mm256_shuffle_epi8(x2, bswap);				\
+	x3 = _mm256_shuffle_epi8(x3, bswap);				\
+	TRANSPOSE(x0, x1, x2, x3, t0, t1, t2, t3)
+
+// the output is (x3, x2, x1, x0)
+#define STORE8(x0, x1, x2, x3, out)					\
+	TRANSPOSE(x3, x2, x1, x0, t0, t1, t2, t3);			\
+	x0 = _mm256_shuffle_epi8(x0, bswap);				\
+	x1 = _mm256_shuffle_epi8(x1, bswap);				\
+	x2 = _mm256_shuffle_epi8(x2, bswap);				\
+	x3 = _mm256_shuffle_epi8(x3, bswap);				\
+	STOREU2((out) + 64, (out), x3);					\
+	STOREU2((out) + 80, (out) + 16, x2);				\
+	STOREU2((out) + 96, (out) + 32, x1);				\
+	STOREU2((out) + 112, (out) + 48, x0)
+
+#define ROUND(x0, x1, x2, x3, i)					\
+	k = _mm256_set1_epi32((int)rk[i]);				\
+	x0 = _mm256_xor_si256(x0, sm4_t(_mm256_xor_si256(		\
+		_mm256_xor_si256(x1, x2), _mm256_xor_si256(x3, k))))
+
+#define ROUND2(x0, x1, x2, x3, y0, y1, y2, y3, i)			\
+	k = _mm256_set1_epi32((int)rk[i]);				\
+	x0 = _mm256_xor_si256(x0, sm4_t(_mm256_xor_si256(		\
+		_mm256_xor_si256(x1, x2), _mm256_xor_si256(x3, k))));	\
+	y0 = _mm256_xor_si256(y0, sm4_t(_mm256_xor_si256(		\
+		_mm256_xor_si256(y1, y2), _mm256_xor_si256(y3, k))))
+
+void sm4_aesni_avx2_encrypt_x8(const uint32_t rk[32], const uint8_t in[16 * 8], uint8_t out[16 * 8])
+{
+	const __m256i bswap = SET2(SM4_BSWAP32);
+	__m256i x0, x1, x2, x3, t0, t1, t2, t3, k;
+	int i;
+
+	LOAD8(x0, x1, x2, x3, in);
+	for (i = 0; i < 32; i += 4) {
+		ROUND(x0, x1, x2, x3, i);
+		ROUND(x1, x2, x3, x0, i + 1);
+		ROUND(x2, x3, x0, x1, i + 2);
+		ROUND(x3, x0, x1, x2, i + 3);
+	}
+	STORE8(x0, x1, x2, x3, out);
+}
+
+// two independent groups of 8 keep the aesenclast and pshufb ports busy
+void sm4_aesni_avx2_encrypt_x16(const uint32_t rk[32], const uint8_t in[16 * 16], uint8_t out[16 * 16])
+{
+	const __m256i bswap = SET2(SM4_BSWAP32);
+	__m256i x0, x1, x2, x3, y0, y1, y2, y3, t0, t1, t2, t3, k;
+	int i;
+
+	LOAD8(x0, x1, x2, x3, in);
+	LOAD8(y0, y1, y2, y3, in + 128);
+	for (i = 0; i < 32; i += 4) {
+		ROUND2(x0, x1, x2, x3, y0, y1, y2, y3, i);
+		ROUND2(x1, x2, x3, x0, y1, y2, y3, y0, i + 1);
+		ROUND2(x2, x3, x0, x1, y2, y3, y0, y1, i + 2);
+		ROUND2(x3, x0, x1, x2, y3, y0, y1, y2, i + 3);
+	}
+	STORE8(x0, x1, x2, x3, out);
+	STORE8(y0, y1, y2, y3, out + 128);
+}
@@ -47,9 +47,11 @@
  * ====================================================================
  */
 
+#include <string.h>
 #include <gmssl/sm4.h>
 #include "endian.h"
 #include "sm4_lcl.h"
+#include "cpu.h"
 
 
 #define L32(x)							\
@@ -98,30 +100,109 @@ void sm4_encrypt(const SM4_KEY *key, const unsigned char in[16], unsigned char o
 	PUTU32(out + 12, x2);
 }
 
-/* caller make sure counter not overflow */
-void sm4_ctr32_encrypt_blocks(const unsigned char *in, unsigned char *out,
-	size_t blocks, const SM4_KEY *key, const unsigned char iv[16])
+/*
+ * Four blocks interleaved: the rounds of one block are a serial chain of
+ * table loads, so independent blocks fill the idle issue slots.
+ */
+#undef ROUND
+#define ROUND(x0, x1, x2, x3, x4, i)				\
+	ROUND_TBOX(a##x0, a##x1, a##x2, a##x3, a##x4, i);	\
+	ROUND_TBOX(b##x0, b##x1, b##x2, b##x3, b##x4, i);	\
+	ROUND_TBOX(c##x0, c##x1, c##x2, c##x3, c##x4, i);	\
+	ROUND_TBOX(d##x0, d##x1, d##x2, d##x3, d##x4, i)
+
+#define LOAD(x0, x1, x2, x3, in)				\
+	x0 = GETU32((in)     );					\
+	x1 = GETU32((in) +  4);					\
+	x2 = GETU32((in) +  8);					\
+	x3 = GETU32((in) + 12)
+
+#define STORE(x0, x4, x3, x2, out)				\
+	PUTU32((out)     , x0);					\
+	PUTU32((out) +  4, x4);					\
+	PUTU32((out) +  8, x3);					\
+	PUTU32((out) + 12, x2)
+
+static void sm4_encrypt_blocks_generic(const SM4_KEY *key, const uint8_t *in, uint8_t *out, size_t nblocks)
 {
 	const uint32_t *rk = key->rk;
-	unsigned int c0 = GETU32(iv     );
-	unsigned int c1 = GETU32(iv +  4);
-	unsigned int c2 = GETU32(iv +  8);
-	unsigned int c3 = GETU32(iv + 12);
-	uint32_t x0, x1, x2, x3, x4;
+	uint32_t ax0, ax1, ax2, ax3, ax4;
+	uint32_t bx0, bx1, bx2, bx3, bx4;
+	uint32_t cx0, cx1, cx2, cx3, cx4;
+	uint32_t dx0, dx1, dx2, dx3, dx4;
 	uint32_t t0, t1;
 
-	while (blocks--) {
-		x0 = c0;
-		x1 = c1;
-		x2 = c2;
-		x3 = c3;
+	for (; nblocks >= 4; nblocks -= 4) {
+		LOAD(ax0, ax1, ax2, ax3, in);
+		LOAD(bx0, bx1, bx2, bx3, in + 16);
+		LOAD(cx0, cx1, cx2, cx3, in + 32);
+		LOAD(dx0, dx1, dx2, dx3, in + 48);
 		ROUNDS(x0, x1, x2, x3, x4);
-		PUTU32(out     , GETU32(in     ) ^ x0);
-		PUTU32(out +  4, GETU32(in +  4) ^ x4);
-		PUTU32(out +  8, GETU32(in +  8) ^ x3);
-		PUTU32(out + 12, GETU32(in + 12) ^ x2);
+		STORE(ax0, ax4, ax3, ax2, out);
+		STORE(bx0, bx4, bx3, bx2, out + 16);
+		STORE(cx0, cx4, cx3, cx2, out + 32);
+		STORE(dx0, dx4, dx3, dx2, out + 48);
+		in += 64;
+		out += 64;
+	}
+	while (nblocks--) {
+		sm4_encrypt(key, in, out);
 		in += 16;
 		out += 16;
-		c3++;
 	}
 }
+
+#undef ROUND
+#define ROUND ROUND_TBOX
+
+#ifdef HAVE_AESNI
+void sm4_aesni_avx2_encrypt_x8(const uint32_t rk[32], const uint8_t in[16 * 8], uint8_t out[16 * 8]);
+void sm4_aesni_avx2_encrypt_x16(const uint32_t rk[32], const uint8_t in[16 * 16], uint8_t out[16 * 16]);
+
+// a short tail still goes through the constant-time kernel, padded to 8 blocks
+static void sm4_encrypt_blocks_aesni_avx2(const SM4_KEY *key, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+	uint8_t buf[16 * 8];
+
+	for (; nblocks >= 16; nblocks -= 16) {
+		sm4_aesni_avx2_encrypt_x16(key->rk, in, out);
+		in += 16 * 16;
+		out += 16 * 16;
+	}
+	if (nblocks >= 8) {
+		sm4_aesni_avx2_encrypt_x8(key->rk, in, out);
+		in += 16 * 8;
+		out += 16 * 8;
+		nblocks -= 8;
+	}
+	if (nblocks) {
+		memcpy(buf, in, 16 * nblocks);
+		sm4_aesni_avx2_encrypt_x8(key->rk, buf, buf);
+		memcpy(out, buf, 16 * nblocks);
+		memset(buf, 0, sizeof(buf));
+	}
+}
+#endif
+
+static void sm4_encrypt_blocks_init(const SM4_KEY *key, const uint8_t *in, uint8_t *out, size_t nblocks);
+
+static void (*sm4_encrypt_blocks_func)(const SM4_KEY *key, const uint8_t *in, uint8_t *out, size_t nblocks)
+	= sm4_encrypt_blocks_init;
+
+// The first call picks the backend, later calls go straight to it.
+static void sm4_encrypt_blocks_init(const SM4_KEY *key, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+	void (*func)(const SM4_KEY *key, const uint8_t *in, uint8_t *out, size_t nblocks) = sm4_encrypt_blocks_generic;
+#ifdef HAVE_AESNI
+	if (cpu_has_avx2() && cpu_has_aesni()) {
+		func = sm4_encrypt_blocks_aesni_avx2;
+	}
+#endif
+	cpu_func_store(&sm4_encrypt_blocks_func, func);
+	func(key, in, out, nblocks);
+}
+
+void sm4_encrypt_blocks(const SM4_KEY *key, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+	cpu_func_load(&sm4_encrypt_blocks_func)(key, in, out, nblocks);
+}
@@ -50,6 +50,7 @@
 #include <gmssl/error.h>
 #include <gmssl/gcm.h>
 #include "mem.h"
+#include "endian.h"
 
 void sm4_cbc_encrypt(const SM4_KEY *key, const uint8_t iv[16],
 	const uint8_t *in, size_t nblocks, uint8_t *out)
@@ -63,16 +64,45 @@ void sm4_cbc_encrypt(const SM4_KEY *key, const uint8_t iv[16],
 	}
 }
 
+// blocks handed to sm4_encrypt_blocks() at a time
+#define SM4_BATCH_BLOCKS	16
+
+/*
+ * Every plaintext block depends only on two ciphertext blocks, so the
+ * whole input goes through the multi-block kernel. When out overlaps in
+ * (in place, or shifted left as when a record strips its IV) the blocks
+ * are decrypted in batches and each batch is read before it is written.
+ */
 void sm4_cbc_decrypt(const SM4_KEY *key, const uint8_t iv[16],
 	const uint8_t *in, size_t nblocks, uint8_t *out)
 {
-	while (nblocks--) {
-		sm4_encrypt(key, in, out);
+	uint8_t buf[16 * SM4_BATCH_BLOCKS];
+	uint8_t prev[16];
+
+	if (!nblocks) {
+		return;
+	}
+	if (out + 16 * nblocks <= in || in + 16 * nblocks <= out) {
+		sm4_encrypt_blocks(key, in, out, nblocks);
 		memxor(out, iv, 16);
-		iv = in;
-		in += 16;
-		out += 16;
+		memxor(out + 16, in, 16 * (nblocks - 1));
+		return;
 	}
+
+	memcpy(prev, iv, 16);
+	while (nblocks) {
+		size_t n = nblocks < SM4_BATCH_BLOCKS ? nblocks : SM4_BATCH_BLOCKS;
+
+		sm4_encrypt_blocks(key, in, buf, n);
+		memxor(buf, prev, 16);
+		memxor(buf + 16, in, 16 * (n - 1));
+		memcpy(prev, in + 16 * (n - 1), 16);
+		memcpy(out, buf, 16 * n);
+		in += 16 * n;
+		out += 16 * n;
+		nblocks -= n;
+	}
+	memset(buf, 0, sizeof(buf));
 }
 
 int sm4_cbc_padding_encrypt(const SM4_KEY *key, const uint8_t iv[16],
@@ -129,108 +159,190 @@ int sm4_cbc_padding_decrypt(const SM4_KEY *key, const uint8_t iv[16],
 	return 1;
 }
 
-static void ctr_incr(uint8_t a[16])
-{
-	int i;
-	for (i = 15; i > 0; i--) {
-		a[i]++;
-		if (a[i]) break;
-	}
-}
-
-void sm4_ctr_encrypt(const SM4_KEY *key, uint8_t ctr[16], const uint8_t *in, size_t inlen, uint8_t *out)
+/*
+ * CTR keystream SM4_BATCH_BLOCKS counter blocks at a time: the blocks are
+ * built from the 96-bit prefix and the low 32-bit word, encrypted in one
+ * sm4_encrypt_blocks() call and XORed in 64-bit words. When the low word
+ * wraps, ctr32 keeps the prefix (GCM inc32), otherwise the carry goes on
+ * through the whole 128-bit counter. in == out is fine and a partial last
+ * block still consumes one counter value.
+ */
+static void sm4_ctr_encrypt_ex(const SM4_KEY *key, uint8_t ctr[16], int ctr32,
+	const uint8_t *in, size_t inlen, uint8_t *out)
 {
-	uint8_t block[16];
-	size_t len;
+	uint8_t buf[16 * SM4_BATCH_BLOCKS];
+	uint32_t c = GETU32(ctr + 12);
+	size_t len, n, i;
+	int j;
 
 	while (inlen) {
-		len = inlen < 16 ? inlen : 16;
-		sm4_encrypt(key, ctr, block);
-		gmssl_memxor(out, in, block, len);
-		ctr_incr(ctr);
+		len = inlen < sizeof(buf) ? inlen : sizeof(buf);
+		n = (len + 15) / 16;
+		for (i = 0; i < n; i++) {
+			memcpy(buf + 16 * i, ctr, 12);
+			PUTU32(buf + 16 * i + 12, c);
+			if (!++c && !ctr32) {
+				for (j = 11; j >= 0 && !++ctr[j]; j--) {
+				}
+			}
+		}
+		sm4_encrypt_blocks(key, buf, buf, n);
+		gmssl_memxor(out, in, buf, len);
 		in += len;
 		out += len;
 		inlen -= len;
 	}
+	PUTU32(ctr + 12, c);
+	memset(buf, 0, sizeof(buf));
 }
 
-int sm4_gcm_encrypt(const SM4_KEY *key, const uint8_t *iv, size_t ivlen,
-	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
-	uint8_t *out, const size_t taglen, uint8_t *tag)
+void sm4_ctr_encrypt(const SM4_KEY *key, uint8_t ctr[16], const uint8_t *in, size_t inlen, uint8_t *out)
+{
+	sm4_ctr_encrypt_ex(key, ctr, 0, in, inlen, out);
+}
+
+void sm4_ctr32_encrypt(const SM4_KEY *key, uint8_t ctr[16], const uint8_t *in, size_t inlen, uint8_t *out)
+{
+	sm4_ctr_encrypt_ex(key, ctr, 1, in, inlen, out);
+}
+
+void sm4_gcm_set_key(SM4_GCM_KEY *key, const uint8_t raw_key[16])
 {
-	const uint8_t *pin = in;
-	uint8_t *pout = out;
-	size_t left = inlen;
 	uint8_t H[16] = {0};
-	uint8_t Y[16];
-	uint8_t T[16];
 
-	sm4_encrypt(key, H, H);
+	sm4_set_encrypt_key(&key->sm4_key, raw_key);
+	sm4_encrypt_blocks(&key->sm4_key, H, H, 1);
+	ghash_set_key(&key->ghash_key, H);
+	memset(H, 0, sizeof(H));
+}
+
+// J0 in Y, E_K(J0) in T, Y left at inc32(J0)
+static void sm4_gcm_init_counter(const SM4_GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	uint8_t Y[16], uint8_t T[16])
+{
+	uint32_t ctr32;
 
 	if (ivlen == 12) {
 		memcpy(Y, iv, 12);
 		Y[12] = Y[13] = Y[14] = 0;
 		Y[15] = 1;
 	} else {
-		ghash(H, NULL, 0, iv, ivlen, Y);
+		ghash_with_key(&key->ghash_key, NULL, 0, iv, ivlen, Y);
 	}
+	sm4_encrypt_blocks(&key->sm4_key, Y, T, 1);
+	ctr32 = GETU32(Y + 12) + 1;
+	PUTU32(Y + 12, ctr32);
+}
 
-	sm4_encrypt(key, Y, T);
+/*
+ * One pass over the data: every SM4_BATCH_BLOCKS chunk is run through the
+ * CTR kernel and then hashed while it is still in L1, instead of a CTR
+ * pass over the whole message followed by a GHASH pass. Decryption hashes
+ * the chunk before decrypting it, so in == out works both ways.
+ */
+int sm4_gcm_encrypt_with_key(const SM4_GCM_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	uint8_t *out, size_t taglen, uint8_t *tag)
+{
+	uint8_t Y[16];
+	uint8_t T[16];
+	uint8_t X[16] = {0};
+	uint8_t L[16];
+	size_t len;
 
-	while (left) {
-		uint8_t block[16];
-		size_t len = left < 16 ? left : 16;
-		ctr_incr(Y);
-		sm4_encrypt(key, Y, block);
-		gmssl_memxor(pout, pin, block, len);
-		pin += len;
-		pout += len;
-		left -= len;
+	if (taglen > 16) {
+		error_print();
+		return -1;
 	}
+	PUTU64(L, (uint64_t)aadlen << 3);
+	PUTU64(L + 8, (uint64_t)inlen << 3);
+
+	sm4_gcm_init_counter(key, iv, ivlen, Y, T);
+	ghash_blocks_padded(&key->ghash_key, X, aad, aadlen);
 
-	ghash(H, aad, aadlen, out, inlen, H);
-	gmssl_memxor(tag, T, H, taglen);
+	while (inlen) {
+		len = inlen < 16 * SM4_BATCH_BLOCKS ? inlen : 16 * SM4_BATCH_BLOCKS;
+		sm4_ctr32_encrypt(&key->sm4_key, Y, in, len, out);
+		ghash_blocks_padded(&key->ghash_key, X, out, len);
+		in += len;
+		out += len;
+		inlen -= len;
+	}
+
+	ghash_blocks(&key->ghash_key, X, L, 1);
+	gmssl_memxor(tag, T, X, taglen);
 	return 1;
 }
 
-int sm4_gcm_decrypt(const SM4_KEY *key, const uint8_t *iv, size_t ivlen,
+int sm4_gcm_decrypt_with_key(const SM4_GCM_KEY *key, const uint8_t *iv, size_t ivlen,
 	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
 	const uint8_t *tag, size_t taglen, uint8_t *out)
 {
-	const uint8_t *pin = in;
-	uint8_t *pout = out;
-	size_t left = inlen;
-	uint8_t H[16] = {0};
 	uint8_t Y[16];
 	uint8_t T[16];
+	uint8_t X[16] = {0};
+	uint8_t L[16];
+	uint8_t *p = out;
+	size_t left = inlen;
+	size_t len;
 
-	sm4_encrypt(key, H, H);
-
-	if (ivlen == 12) {
-		memcpy(Y, iv, 12);
-		Y[12] = Y[13] = Y[14] = 0;
-		Y[15] = 1;
-	} else {
-		ghash(H, NULL, 0, iv, ivlen, Y);
-	}
-
-	ghash(H, aad, aadlen, in, inlen, H);
-	sm4_encrypt(key, Y, T);
-	gmssl_memxor(T, T, H, taglen);
-	if (memcmp(T, tag, taglen) != 0) {
+	if (taglen > 16) {
 		error_print();
 		return -1;
 	}
+	PUTU64(L, (uint64_t)aadlen << 3);
+	PUTU64(L + 8, (uint64_t)inlen << 3);
+
+	sm4_gcm_init_counter(key, iv, ivlen, Y, T);
+	ghash_blocks_padded(&key->ghash_key, X, aad, aadlen);
 
 	while (left) {
-		uint8_t block[16];
-		size_t len = left < 16 ? left : 16;
-		ctr_incr(Y);
-		sm4_encrypt(key, Y, block);
-		gmssl_memxor(pout, pin, block, len);
-		pin += len;
-		pout += len;
+		len = left < 16 * SM4_BATCH_BLOCKS ? left : 16 * SM4_BATCH_BLOCKS;
+		ghash_blocks_padded(&key->ghash_key, X, in, len);
+		sm4_ctr32_encrypt(&key->sm4_key, Y, in, len, p);
+		in += len;
+		p += len;
 		left -= len;
 	}
+
+	ghash_blocks(&key->ghash_key, X, L, 1);
+	gmssl_memxor(T, T, X, taglen);
+	if (gmssl_memcmp(T, tag, taglen) != 0) {
+		memset(out, 0, inlen);
+		error_print();
+		return -1;
+	}
 	return 1;
 }
+
+int sm4_gcm_encrypt(const SM4_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	uint8_t *out, const size_t taglen, uint8_t *tag)
+{
+	SM4_GCM_KEY gcm_key;
+	uint8_t H[16] = {0};
+	int ret;
+
+	gcm_key.sm4_key = *key;
+	sm4_encrypt_blocks(key, H, H, 1);
+	ghash_set_key(&gcm_key.ghash_key, H);
+	ret = sm4_gcm_encrypt_with_key(&gcm_key, iv, ivlen, aad, aadlen, in, inlen, out, taglen, tag);
+	memset(&gcm_key, 0, sizeof(gcm_key));
+	return ret;
+}
+
+int sm4_gcm_decrypt(const SM4_KEY *key, const uint8_t *iv, size_t ivlen,
+	const uint8_t *aad, size_t aadlen, const uint8_t *in, size_t inlen,
+	const uint8_t *tag, size_t taglen, uint8_t *out)
+{
+	SM4_GCM_KEY gcm_key;
+	uint8_t H[16] = {0};
+	int ret;
+
+	gcm_key.sm4_key = *key;
+	sm4_encrypt_blocks(key, H, H, 1);
+	ghash_set_key(&gcm_key.ghash_key, H);
+	ret = sm4_gcm_decrypt_with_key(&gcm_key, iv, ivlen, aad, aadlen, in, inlen, tag, taglen, out);
+	memset(&gcm_key, 0, sizeof(gcm_key));
+	return ret;
+}
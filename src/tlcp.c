@@ -412,8 +412,8 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	sm3_hmac_init(&conn->client_write_mac_ctx, conn->key_block, 32);
-	sm3_hmac_init(&conn->server_write_mac_ctx, conn->key_block + 32, 32);
+	sm3_hmac_set_key(&conn->client_write_mac_key, conn->key_block, 32);
+	sm3_hmac_set_key(&conn->server_write_mac_key, conn->key_block + 32, 32);
 	sm4_set_encrypt_key(&conn->client_write_enc_key, conn->key_block + 64);
 	sm4_set_decrypt_key(&conn->server_write_enc_key, conn->key_block + 80);
 	format_bytes(stderr, 0, 0, "pre_master_secret : ", pre_master_secret, 48);
@@ -487,7 +487,7 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 	tls_record_print(stderr, finished, finishedlen, 0, 0);
 	sm3_update(&sm3_ctx, finished + 5, finishedlen - 5);
 
-	if (tls_record_encrypt(&conn->client_write_mac_ctx, &conn->client_write_enc_key,
+	if (tls_record_encrypt(&conn->client_write_mac_key, &conn->client_write_enc_key,
 		conn->client_seq_num, finished, finishedlen, record, &recordlen) != 1) {
 		error_print();
 		return -1;
@@ -516,7 +516,7 @@ int tlcp_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	if (tls_record_decrypt(&conn->server_write_mac_ctx, &conn->server_write_enc_key,
+	if (tls_record_decrypt(&conn->server_write_mac_key, &conn->server_write_enc_key,
 		conn->server_seq_num, record, recordlen, finished, &finishedlen) != 1) {
 		error_print();
 		return -1;
@@ -841,8 +841,8 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		error_print();
 		return -1;
 	}
-	sm3_hmac_init(&conn->client_write_mac_ctx, conn->key_block, 32);
-	sm3_hmac_init(&conn->server_write_mac_ctx, conn->key_block + 32, 32);
+	sm3_hmac_set_key(&conn->client_write_mac_key, conn->key_block, 32);
+	sm3_hmac_set_key(&conn->server_write_mac_key, conn->key_block + 32, 32);
 	sm4_set_decrypt_key(&conn->client_write_enc_key, conn->key_block + 64);
 	sm4_set_encrypt_key(&conn->server_write_enc_key, conn->key_block + 80);
 	format_bytes(stderr, 0, 0, "pre_master_secret : ", pre_master_secret, 48);
@@ -872,7 +872,7 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		error_print();
 		return -1;
 	}
-	if (tls_record_decrypt(&conn->client_write_mac_ctx, &conn->client_write_enc_key,
+	if (tls_record_decrypt(&conn->client_write_mac_key, &conn->client_write_enc_key,
 		conn->client_seq_num, record, recordlen, finished, &finishedlen) != 1) {
 		error_print();
 		return -1;
@@ -920,7 +920,7 @@ int tlcp_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 	tls_record_print(stderr, finished, finishedlen, 0, 0);
-	if (tls_record_encrypt(&conn->server_write_mac_ctx, &conn->server_write_enc_key,
+	if (tls_record_encrypt(&conn->server_write_mac_key, &conn->server_write_enc_key,
 		conn->server_seq_num, finished, finishedlen, record, &recordlen) != 1) {
 		error_print();
 		return -1;
@@ -322,7 +322,7 @@ int tls_record_length(const uint8_t *record)
 }
 
 
-int tls_cbc_encrypt(const SM3_HMAC_CTX *inited_hmac_ctx, const SM4_KEY *enc_key,
+int tls_cbc_encrypt(const SM3_HMAC_KEY *hmac_key, const SM4_KEY *enc_key,
 	const uint8_t seq_num[8], const uint8_t header[5],
 	const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
 {
@@ -332,7 +332,7 @@ int tls_cbc_encrypt(const SM3_HMAC_CTX *inited_hmac_ctx, const SM4_KEY *enc_key,
 	int rem, padding_len;
 	int i;
 
-	if (!inited_hmac_ctx || !enc_key || !seq_num || !header || (!in && inlen) || !out || !outlen) {
+	if (!hmac_key || !enc_key || !seq_num || !header || (!in && inlen) || !out || !outlen) {
 		error_print();
 		return -1;
 	}
@@ -345,11 +345,12 @@ int tls_cbc_encrypt(const SM3_HMAC_CTX *inited_hmac_ctx, const SM4_KEY *enc_key,
 	memcpy(last_blocks, in + inlen - rem, rem);
 	mac = last_blocks + rem;
 
-	memcpy(&hmac_ctx, inited_hmac_ctx, sizeof(SM3_HMAC_CTX));
+	sm3_hmac_init_with_key(&hmac_ctx, hmac_key);
 	sm3_hmac_update(&hmac_ctx, seq_num, 8);
 	sm3_hmac_update(&hmac_ctx, header, 5);
 	sm3_hmac_update(&hmac_ctx, in, inlen);
 	sm3_hmac_finish(&hmac_ctx, mac);
+	memset(&hmac_ctx, 0, sizeof(hmac_ctx));
 
 	padding = mac + 32;
 	padding_len = 16 - rem - 1;
@@ -374,7 +375,7 @@ int tls_cbc_encrypt(const SM3_HMAC_CTX *inited_hmac_ctx, const SM4_KEY *enc_key,
 	return 1;
 }
 
-int tls_cbc_decrypt(const SM3_HMAC_CTX *inited_hmac_ctx, const SM4_KEY *dec_key,
+int tls_cbc_decrypt(const SM3_HMAC_KEY *hmac_key, const SM4_KEY *dec_key,
 	const uint8_t seq_num[8], const uint8_t enced_header[5],
 	const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
 {
@@ -387,7 +388,7 @@ int tls_cbc_decrypt(const SM3_HMAC_CTX *inited_hmac_ctx, const SM4_KEY *dec_key,
 	uint8_t hmac[32];
 	int i;
 
-	if (!inited_hmac_ctx || !dec_key || !seq_num || !enced_header || !in || !inlen || !out || !outlen) {
+	if (!hmac_key || !dec_key || !seq_num || !enced_header || !in || !inlen || !out || !outlen) {
 		error_print();
 		return -1;
 	}
@@ -425,11 +426,12 @@ int tls_cbc_decrypt(const SM3_HMAC_CTX *inited_hmac_ctx, const SM4_KEY *dec_key,
 	header[4] = (*outlen);
 	mac = padding - 32;
 
-	memcpy(&hmac_ctx, inited_hmac_ctx, sizeof(SM3_HMAC_CTX));
+	sm3_hmac_init_with_key(&hmac_ctx, hmac_key);
 	sm3_hmac_update(&hmac_ctx, seq_num, 8);
 	sm3_hmac_update(&hmac_ctx, header, 5);
 	sm3_hmac_update(&hmac_ctx, out, *outlen);
 	sm3_hmac_finish(&hmac_ctx, hmac);
+	memset(&hmac_ctx, 0, sizeof(hmac_ctx));
 	if (memcmp(mac, hmac, sizeof(hmac)) != 0) { //FIXME: const time memcmp!
 		error_puts("tls ciphertext mac check failure");
 		return -1;
@@ -438,11 +440,11 @@ int tls_cbc_decrypt(const SM3_HMAC_CTX *inited_hmac_ctx, const SM4_KEY *dec_key,
 }
 
 // 这个函数应该是处理的，这个函数是不应该用的，通常我们在加密的时候，header ，明文数据是分离的，但是输出的record是一个
-int tls_record_encrypt(const SM3_HMAC_CTX *hmac_ctx, const SM4_KEY *cbc_key,
+int tls_record_encrypt(const SM3_HMAC_KEY *hmac_key, const SM4_KEY *cbc_key,
 	const uint8_t seq_num[8], const uint8_t *in, size_t inlen,
 	uint8_t *out, size_t *outlen)
 {
-	if (tls_cbc_encrypt(hmac_ctx, cbc_key, seq_num, in,
+	if (tls_cbc_encrypt(hmac_key, cbc_key, seq_num, in,
 		in + 5, inlen - 5,
 		out + 5, outlen) != 1) {
 		error_print();
@@ -458,11 +460,11 @@ int tls_record_encrypt(const SM3_HMAC_CTX *hmac_ctx, const SM4_KEY *cbc_key,
 	return 1;
 }
 
-int tls_record_decrypt(const SM3_HMAC_CTX *hmac_ctx, const SM4_KEY *cbc_key,
+int tls_record_decrypt(const SM3_HMAC_KEY *hmac_key, const SM4_KEY *cbc_key,
 	const uint8_t seq_num[8], const uint8_t *in, size_t inlen,
 	uint8_t *out, size_t *outlen)
 {
-	if (tls_cbc_decrypt(hmac_ctx, cbc_key, seq_num, in,
+	if (tls_cbc_decrypt(hmac_key, cbc_key, seq_num, in,
 		in + 5, inlen - 5,
 		out + 5, outlen) != 1) {
 		error_print();
@@ -496,7 +498,6 @@ int tls_prf(const uint8_t *secret, size_t secretlen, const char *label,
 	const uint8_t *more, size_t morelen,
 	size_t outlen, uint8_t *out)
 {
-	SM3_HMAC_CTX inited_hmac_ctx;
 	SM3_HMAC_CTX hmac_ctx;
 	uint8_t A[32];
 	uint8_t hmac[32];
@@ -508,15 +509,13 @@ int tls_prf(const uint8_t *secret, size_t secretlen, const char *label,
 		return -1;
 	}
 
-	sm3_hmac_init(&inited_hmac_ctx, secret, secretlen);
-
-	memcpy(&hmac_ctx, &inited_hmac_ctx, sizeof(SM3_HMAC_CTX));
+	sm3_hmac_init(&hmac_ctx, secret, secretlen);
 	sm3_hmac_update(&hmac_ctx, (uint8_t *)label, strlen(label));
 	sm3_hmac_update(&hmac_ctx, seed, seedlen);
 	sm3_hmac_update(&hmac_ctx, more, morelen);
 	sm3_hmac_finish(&hmac_ctx, A);
 
-	memcpy(&hmac_ctx, &inited_hmac_ctx, sizeof(SM3_HMAC_CTX));
+	sm3_hmac_reset(&hmac_ctx);
 	sm3_hmac_update(&hmac_ctx, A, sizeof(A));
 	sm3_hmac_update(&hmac_ctx, (uint8_t *)label, strlen(label));
 	sm3_hmac_update(&hmac_ctx, seed, seedlen);
@@ -529,11 +528,11 @@ int tls_prf(const uint8_t *secret, size_t secretlen, const char *label,
 	outlen -= len;
 
 	while (outlen) {
-		memcpy(&hmac_ctx, &inited_hmac_ctx, sizeof(SM3_HMAC_CTX));
+		sm3_hmac_reset(&hmac_ctx);
 		sm3_hmac_update(&hmac_ctx, A, sizeof(A));
 		sm3_hmac_finish(&hmac_ctx, A);
 
-		memcpy(&hmac_ctx, &inited_hmac_ctx, sizeof(SM3_HMAC_CTX));
+		sm3_hmac_reset(&hmac_ctx);
 		sm3_hmac_update(&hmac_ctx, A, sizeof(A));
 		sm3_hmac_update(&hmac_ctx, (uint8_t *)label, strlen(label));
 		sm3_hmac_update(&hmac_ctx, seed, seedlen);
@@ -545,6 +544,7 @@ int tls_prf(const uint8_t *secret, size_t secretlen, const char *label,
 		out += len;
 		outlen -= len;
 	}
+	memset(&hmac_ctx, 0, sizeof(hmac_ctx));
 	return 1;
 }
 
@@ -1525,7 +1525,7 @@ int tls_compression_methods_has_null_compression(const uint8_t *meths, size_t me
 // FIXME: 设定支持的最大输入长度
 int tls_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen)
 {
-	const SM3_HMAC_CTX *hmac_ctx;
+	const SM3_HMAC_KEY *hmac_key;
 	const SM4_KEY *enc_key;
 	uint8_t *seq_num;
 	uint8_t mrec[1600];
@@ -1536,11 +1536,11 @@ int tls_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen)
 	// FIXME: 检查datalen的长度
 
 	if (conn->is_client) {
-		hmac_ctx = &conn->client_write_mac_ctx;
+		hmac_key = &conn->client_write_mac_key;
 		enc_key = &conn->client_write_enc_key;
 		seq_num = conn->client_seq_num;
 	} else {
-		hmac_ctx = &conn->server_write_mac_ctx;
+		hmac_key = &conn->server_write_mac_key;
 		enc_key = &conn->server_write_enc_key;
 		seq_num = conn->server_seq_num;
 	}
@@ -1548,7 +1548,7 @@ int tls_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen)
 	tls_trace(">>>> ApplicationData\n");
 	if (tls_record_set_version(mrec, conn->version) != 1
 		|| tls_record_set_application_data(mrec, &mlen, data, datalen) != 1
-		|| tls_record_encrypt(hmac_ctx, enc_key, seq_num, mrec, mlen, crec, &clen) != 1
+		|| tls_record_encrypt(hmac_key, enc_key, seq_num, mrec, mlen, crec, &clen) != 1
 		|| tls_seq_num_incr(seq_num) != 1
 		|| tls_record_send(crec, clen, conn->sock) != 1) {
 		error_print();
@@ -1560,7 +1560,7 @@ int tls_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen)
 
 int tls_recv(TLS_CONNECT *conn, uint8_t *data, size_t *datalen)
 {
-	const SM3_HMAC_CTX *hmac_ctx;
+	const SM3_HMAC_KEY *hmac_key;
 	const SM4_KEY *dec_key;
 	uint8_t *seq_num;
 	uint8_t mrec[1600];
@@ -1569,11 +1569,11 @@ int tls_recv(TLS_CONNECT *conn, uint8_t *data, size_t *datalen)
 	size_t clen = sizeof(crec);
 
 	if (conn->is_client) {
-		hmac_ctx = &conn->server_write_mac_ctx;
+		hmac_key = &conn->server_write_mac_key;
 		dec_key = &conn->server_write_enc_key;
 		seq_num = conn->server_seq_num;
 	} else {
-		hmac_ctx = &conn->client_write_mac_ctx;
+		hmac_key = &conn->client_write_mac_key;
 		dec_key = &conn->client_write_enc_key;
 		seq_num = conn->client_seq_num;
 	}
@@ -1581,7 +1581,7 @@ int tls_recv(TLS_CONNECT *conn, uint8_t *data, size_t *datalen)
 	tls_trace("<<<< ApplicationData\n");
 	if (tls_record_recv(crec, &clen, conn->sock) != 1
 		// FIXME: 检查版本号
-		|| tls_record_decrypt(hmac_ctx, dec_key, seq_num, crec, clen, mrec, &mlen) != 1
+		|| tls_record_decrypt(hmac_key, dec_key, seq_num, crec, clen, mrec, &mlen) != 1
 		|| tls_seq_num_incr(seq_num) != 1) {
 		error_print();
 		return -1;
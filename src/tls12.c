@@ -391,8 +391,8 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		server_random, 32,
 		client_random, 32,
 		96, conn->key_block);
-	sm3_hmac_init(&conn->client_write_mac_ctx, conn->key_block, 32);
-	sm3_hmac_init(&conn->server_write_mac_ctx, conn->key_block + 32, 32);
+	sm3_hmac_set_key(&conn->client_write_mac_key, conn->key_block, 32);
+	sm3_hmac_set_key(&conn->server_write_mac_key, conn->key_block + 32, 32);
 	sm4_set_encrypt_key(&conn->client_write_enc_key, conn->key_block + 64);
 	sm4_set_decrypt_key(&conn->server_write_enc_key, conn->key_block + 80);
 	tls_secrets_print(stderr, pre_master_secret, 32, client_random, server_random,
@@ -517,7 +517,7 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 	tls_record_print(stderr, finished, finishedlen, 0, 0);
 	sm3_update(&sm3_ctx, finished + 5, finishedlen - 5);
 
-	if (tls_record_encrypt(&conn->client_write_mac_ctx, &conn->client_write_enc_key,
+	if (tls_record_encrypt(&conn->client_write_mac_key, &conn->client_write_enc_key,
 		conn->client_seq_num, finished, finishedlen, record, &recordlen) != 1) {
 		error_print();
 		return -1;
@@ -544,7 +544,7 @@ int tls12_connect(TLS_CONNECT *conn, const char *hostname, int port,
 		error_print();
 		return -1;
 	}
-	if (tls_record_decrypt(&conn->server_write_mac_ctx, &conn->server_write_enc_key,
+	if (tls_record_decrypt(&conn->server_write_mac_key, &conn->server_write_enc_key,
 		conn->server_seq_num, record, recordlen, finished, &finishedlen) != 1) {
 		error_print();
 		return -1;
@@ -866,8 +866,8 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 	tls_prf(conn->master_secret, 48, "key expansion",
 		server_random, 32, client_random, 32,
 		96, conn->key_block);
-	sm3_hmac_init(&conn->client_write_mac_ctx, conn->key_block, 32);
-	sm3_hmac_init(&conn->server_write_mac_ctx, conn->key_block + 32, 32);
+	sm3_hmac_set_key(&conn->client_write_mac_key, conn->key_block, 32);
+	sm3_hmac_set_key(&conn->server_write_mac_key, conn->key_block + 32, 32);
 	sm4_set_decrypt_key(&conn->client_write_enc_key, conn->key_block + 64);
 	sm4_set_encrypt_key(&conn->server_write_enc_key, conn->key_block + 80);
 	tls_secrets_print(stderr, pre_master_secret, 32, client_random, server_random,
@@ -911,7 +911,7 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 		error_print();
 		return -1;
 	}
-	if (tls_record_decrypt(&conn->client_write_mac_ctx, &conn->client_write_enc_key,
+	if (tls_record_decrypt(&conn->client_write_mac_key, &conn->client_write_enc_key,
 		conn->client_seq_num, record, recordlen, finished, &finishedlen) != 1) {
 		error_print();
 		return -1;
@@ -955,7 +955,7 @@ int tls12_accept(TLS_CONNECT *conn, int port,
 		return -1;
 	}
 	tls_record_print(stderr, finished, finishedlen, 0, 0);
-	if (tls_record_encrypt(&conn->server_write_mac_ctx, &conn->server_write_enc_key,
+	if (tls_record_encrypt(&conn->server_write_mac_key, &conn->server_write_enc_key,
 		conn->server_seq_num, finished, finishedlen, record, &recordlen) != 1) {
 		error_print();
 		return -1;
@@ -86,7 +86,7 @@ struct {
 	opaque encrypted_record[TLSCiphertext.length];
 } TLSCiphertext;
 */
-int tls13_gcm_encrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
+int tls13_gcm_encrypt(const GCM_KEY *key, const uint8_t iv[12],
 	const uint8_t seq_num[8], int record_type,
 	const uint8_t *in, size_t inlen, size_t padding_len, // TLSInnerPlaintext.content
 	uint8_t *out, size_t *outlen) // TLSCiphertext.encrypted_record
@@ -94,7 +94,6 @@ int tls13_gcm_encrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
 	uint8_t nonce[12];
 	uint8_t aad[5];
 	uint8_t *gmac;
-	uint8_t *mbuf = malloc(inlen + 256); // FIXME: update gcm_encrypt API		
 	size_t mlen, clen;
 
 	// nonce = (zeros|seq_num) xor (iv)
@@ -102,10 +101,10 @@ int tls13_gcm_encrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
 	memcpy(nonce + 3, seq_num, 8);
 	gmssl_memxor(nonce, nonce, iv, 12);
 
-	// TLSInnerPlaintext
-	memcpy(mbuf, in, inlen);
-	mbuf[inlen] = record_type;
-	memset(mbuf + inlen + 1, 0, padding_len);
+	// TLSInnerPlaintext, built in out and encrypted in place
+	memmove(out, in, inlen);
+	out[inlen] = record_type;
+	memset(out + inlen + 1, 0, padding_len);
 	mlen = inlen + 1 + padding_len;
 	clen = mlen + GHASH_SIZE;
 
@@ -117,14 +116,15 @@ int tls13_gcm_encrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
 	aad[4] = clen;
 
 	gmac = out + mlen;
-	if (gcm_encrypt(key, nonce, sizeof(nonce), aad, sizeof(aad), mbuf, mlen, out, 16, gmac) != 1) {
+	if (gcm_encrypt_with_key(key, nonce, sizeof(nonce), aad, sizeof(aad), out, mlen, out, 16, gmac) != 1) {
 		error_print();
 		return -1;
 	}
+	*outlen = clen;
 	return 1;
 }
 
-int tls13_gcm_decrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
+int tls13_gcm_decrypt(const GCM_KEY *key, const uint8_t iv[12],
 	const uint8_t seq_num[8], const uint8_t *in, size_t inlen,
 	int *record_type, uint8_t *out, size_t *outlen)
 {
@@ -153,7 +153,7 @@ int tls13_gcm_decrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
 	mlen = inlen - GHASH_SIZE;
 	gmac = in + mlen;
 
-	if (gcm_decrypt(key, iv, 12, aad, 5, in, mlen, gmac, GHASH_SIZE, out) != 1) {
+	if (gcm_decrypt_with_key(key, nonce, sizeof(nonce), aad, sizeof(aad), in, mlen, gmac, GHASH_SIZE, out) != 1) {
 		error_print();
 		return -1;
 	}
@@ -173,7 +173,7 @@ int tls13_gcm_decrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
 	return 1;
 }
 
-int tls13_record_encrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
+int tls13_record_encrypt(const GCM_KEY *key, const uint8_t iv[12],
 	const uint8_t seq_num[8], const uint8_t *record, size_t recordlen, size_t padding_len,
 	uint8_t *enced_record, size_t *enced_recordlen)
 {
@@ -194,7 +194,7 @@ int tls13_record_encrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
 	return 1;
 }
 
-int tls13_record_decrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
+int tls13_record_decrypt(const GCM_KEY *key, const uint8_t iv[12],
 	const uint8_t seq_num[8], const uint8_t *enced_record, size_t enced_recordlen,
 	uint8_t *record, size_t *recordlen)
 {
@@ -218,7 +218,7 @@ int tls13_record_decrypt(const BLOCK_CIPHER_KEY *key, const uint8_t iv[12],
 
 int tls13_send(TLS_CONNECT *conn, const uint8_t *data, size_t datalen, size_t padding_len)
 {
-	const BLOCK_CIPHER_KEY *key;
+	const GCM_KEY *key;
 	const uint8_t *iv;
 	uint8_t *seq_num;
 	uint8_t *record = conn->record;
@@ -261,7 +261,7 @@ int tls13_recv(TLS_CONNECT *conn, uint8_t *data, size_t *datalen)
 	int record_type;
 	uint8_t *record = conn->record;
 	size_t recordlen;
-	const BLOCK_CIPHER_KEY *key;
+	const GCM_KEY *key;
 	const uint8_t *iv;
 	uint8_t *seq_num;
 
@@ -1382,8 +1382,8 @@ int tls13_connect(TLS_CONNECT *conn, const char *hostname, int port, FILE *serve
 	tls13_hkdf_expand_label(digest, server_handshake_traffic_secret, "key", NULL, 0, 16, server_write_key);
 	tls13_hkdf_expand_label(digest, client_handshake_traffic_secret, "iv", NULL, 0, 12, conn->client_write_iv);
 	tls13_hkdf_expand_label(digest, server_handshake_traffic_secret, "iv", NULL, 0, 12, conn->server_write_iv);
-	block_cipher_set_encrypt_key(&conn->client_write_key, cipher, client_write_key);
-	block_cipher_set_encrypt_key(&conn->server_write_key, cipher, server_write_key);
+	gcm_set_key(&conn->client_write_key, cipher, client_write_key);
+	gcm_set_key(&conn->server_write_key, cipher, server_write_key);
 
 	// 3. recv {EncryptedExtensions}
 	if (tls12_record_recv(enced_record, &enced_recordlen, conn->sock) != 1) {
@@ -1538,7 +1538,7 @@ int tls13_connect(TLS_CONNECT *conn, const char *hostname, int port, FILE *serve
 	// update server_write_key, server_write_iv
 	/* 12 */ tls13_derive_secret(master_secret, "s ap traffic", &dgst_ctx, server_application_traffic_secret);
 	tls13_hkdf_expand_label(digest, server_application_traffic_secret, "key", NULL, 0, 16, server_write_key);
-	block_cipher_set_encrypt_key(&conn->server_write_key, cipher, server_write_key);
+	gcm_set_key(&conn->server_write_key, cipher, server_write_key);
 	tls13_hkdf_expand_label(digest, server_application_traffic_secret, "iv", NULL, 0, 12, conn->server_write_iv);
 
 
@@ -1629,7 +1629,7 @@ int tls13_connect(TLS_CONNECT *conn, const char *hostname, int port, FILE *serve
 
 	/* 11 */ tls13_derive_secret(master_secret, "c ap traffic", &dgst_ctx, client_application_traffic_secret);
 	tls13_hkdf_expand_label(digest, client_application_traffic_secret, "key", NULL, 0, 16, client_write_key);
-	block_cipher_set_encrypt_key(&conn->client_write_key, cipher, client_write_key);
+	gcm_set_key(&conn->client_write_key, cipher, client_write_key);
 	tls13_hkdf_expand_label(digest, client_application_traffic_secret, "iv", NULL, 0, 12, conn->client_write_iv);
 
 	tls_trace("++++ Connection established\n");
@@ -1803,12 +1803,12 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 
 	// generate client_write_key, client_write_iv
 	tls13_hkdf_expand_label(digest, client_handshake_traffic_secret, "key", NULL, 0, 16, client_write_key);
-	block_cipher_set_encrypt_key(&conn->client_write_key, cipher, client_write_key);
+	gcm_set_key(&conn->client_write_key, cipher, client_write_key);
 	tls13_hkdf_expand_label(digest, client_handshake_traffic_secret, "iv", NULL, 0, 12, conn->client_write_iv);
 
 	// generate server_write_key, server_write_iv
 	tls13_hkdf_expand_label(digest, server_handshake_traffic_secret, "key", NULL, 0, 16, server_write_key);
-	block_cipher_set_encrypt_key(&conn->server_write_key, cipher, server_write_key);
+	gcm_set_key(&conn->server_write_key, cipher, server_write_key);
 	tls13_hkdf_expand_label(digest, server_handshake_traffic_secret, "iv", NULL, 0, 12, conn->server_write_iv);
 
 
@@ -1962,7 +1962,7 @@ int tls13_accept(TLS_CONNECT *conn, int port,
 	// update server_write_key, server_write_iv
 	/* 12 */ tls13_derive_secret(master_secret, "s ap traffic", &dgst_ctx, server_application_traffic_secret);
 	tls13_hkdf_expand_label(digest, server_application_traffic_secret, "key", NULL, 0, 16, server_write_key);
-	block_cipher_set_encrypt_key(&conn->server_write_key, cipher, server_write_key);
+	gcm_set_key(&conn->server_write_key, cipher, server_write_key);
 	tls13_hkdf_expand_label(digest, server_application_traffic_secret, "iv", NULL, 0, 12, conn->server_write_iv);
 
 
@@ -64,6 +64,92 @@ const char *digests[] = {
 	"sha512-256",
 };
 
+// checkpoint after every split point and resume in a fresh context
+static int test_digest_ctx_serialize(void)
+{
+	const char *names[] = {
+		"sm3", "sha224", "sha256", "sha384", "sha512", "sha512-224", "sha512-256",
+	};
+	uint8_t data[300];
+	uint8_t buf[DIGEST_CTX_SERIALIZE_MAX_SIZE];
+	uint8_t dgst[64], dgst2[64];
+	size_t dgstlen, i, split;
+
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t)i;
+	}
+
+	for (i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+		const DIGEST *algor = digest_from_name(names[i]);
+		digest(algor, data, sizeof(data), dgst, &dgstlen);
+
+		for (split = 0; split <= sizeof(data); split += 37) {
+			DIGEST_CTX ctx;
+			uint8_t *p = buf;
+			const uint8_t *cp = buf;
+			size_t len = 0;
+
+			digest_init(&ctx, algor);
+			digest_update(&ctx, data, split);
+			if (digest_ctx_serialize(&ctx, &p, &len) != 1
+				|| len > sizeof(buf)) {
+				printf("%s() %s failed\n", __FUNCTION__, names[i]);
+				return -1;
+			}
+			memset(&ctx, 0, sizeof(ctx));
+
+			if (digest_ctx_deserialize(&ctx, &cp, &len) != 1
+				|| len != 0
+				|| ctx.digest != algor) {
+				printf("%s() %s failed\n", __FUNCTION__, names[i]);
+				return -1;
+			}
+			digest_update(&ctx, data + split, sizeof(data) - split);
+			digest_finish(&ctx, dgst2, &dgstlen);
+			if (memcmp(dgst, dgst2, dgstlen) != 0) {
+				printf("%s() %s split %zu failed\n", __FUNCTION__, names[i], split);
+				return -1;
+			}
+		}
+	}
+
+	// truncated, bad version and unsupported algorithms are rejected
+	{
+		DIGEST_CTX ctx;
+		uint8_t *p = buf;
+		const uint8_t *cp;
+		size_t len = 0;
+
+		digest_init(&ctx, DIGEST_sm3());
+		digest_update(&ctx, data, 10);
+		digest_ctx_serialize(&ctx, &p, &len);
+
+		cp = buf;
+		len--;
+		if (digest_ctx_deserialize(&ctx, &cp, &len) == 1) {
+			printf("%s() truncated input accepted\n", __FUNCTION__);
+			return -1;
+		}
+		buf[0]++;
+		cp = buf;
+		len++;
+		if (digest_ctx_deserialize(&ctx, &cp, &len) == 1) {
+			printf("%s() bad version accepted\n", __FUNCTION__);
+			return -1;
+		}
+
+		digest_init(&ctx, DIGEST_md5());
+		len = 0;
+		if (digest_ctx_serialize(&ctx, NULL, &len) == 1) {
+			printf("%s() md5 accepted\n", __FUNCTION__);
+			return -1;
+		}
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
 int main(void)
 {
 	uint8_t dgst[64];
@@ -81,5 +167,8 @@ int main(void)
 		printf("\n");
 	}
 
+	if (test_digest_ctx_serialize() != 1) {
+		return 1;
+	}
 	return 0;
 }
@@ -128,6 +128,7 @@ int test_ghash(void)
 	uint8_t T[16];
 	uint8_t out[16];
 	size_t Hlen, Alen, Clen, Tlen;
+	int err = 0;
 	int i;
 
 	printf("%s\n", __FUNCTION__);
@@ -140,6 +141,9 @@ int test_ghash(void)
 		ghash(H, A, Alen, C, Clen, out);
 
 		printf("  test %d %s\n", i + 1, memcmp(out ,T, Tlen) == 0 ? "ok" : "error");
+		if (memcmp(out, T, Tlen) != 0) {
+			err++;
+		}
 		/*
 		format_print(stdout, 0, 2, "H = %s\n", ghash_tests[i].H);
 		format_print(stdout, 0, 2, "A = %s\n", ghash_tests[i].A);
@@ -148,12 +152,86 @@ int test_ghash(void)
 		format_print(stdout, 0, 2, "             = %s\n\n", ghash_tests[i].T);
 		*/
 	}
+	return err ? -1 : 1;
+}
+
+// AAD and ciphertext fed in uneven pieces must give ghash() of the whole
+static int test_ghash_ctx(void)
+{
+	const size_t steps[] = { 1, 3, 16, 7, 33, 128, 5 };
+	GHASH_CTX ctx;
+	GHASH_KEY key;
+	uint8_t H[16];
+	uint8_t A[77];
+	uint8_t C[1000];
+	uint8_t out[16];
+	uint8_t ref[16];
+	size_t aadlen, clen, off, len;
+	int i, j;
+
+	for (i = 0; i < sizeof(H); i++) {
+		H[i] = (uint8_t)(0x5a + 17 * i);
+	}
+	for (i = 0; i < sizeof(A); i++) {
+		A[i] = (uint8_t)(3 * i + 1);
+	}
+	for (i = 0; i < sizeof(C); i++) {
+		C[i] = (uint8_t)(i * i);
+	}
+	ghash_set_key(&key, H);
+
+	for (aadlen = 0; aadlen <= sizeof(A); aadlen += 11) {
+		for (clen = 0; clen <= sizeof(C); clen += 37) {
+			ghash(H, A, aadlen, C, clen, ref);
+
+			ghash_init(&ctx, H);
+			for (off = 0, j = 0; off < aadlen; off += len, j++) {
+				len = steps[j % 7] < aadlen - off ? steps[j % 7] : aadlen - off;
+				if (ghash_update_aad(&ctx, A + off, len) != 1) {
+					error_print();
+					return -1;
+				}
+			}
+			for (off = 0; off < clen; off += len, j++) {
+				len = steps[j % 7] < clen - off ? steps[j % 7] : clen - off;
+				ghash_update(&ctx, C + off, len);
+			}
+			ghash_finish(&ctx, out);
+			if (memcmp(out, ref, 16) != 0) {
+				error_print();
+				return -1;
+			}
+
+			ghash_init_with_key(&ctx, &key);
+			ghash_update_aad(&ctx, A, aadlen);
+			ghash_update(&ctx, C, clen);
+			ghash_finish(&ctx, out);
+			if (memcmp(out, ref, 16) != 0) {
+				error_print();
+				return -1;
+			}
+		}
+	}
+
+	ghash_init_with_key(&ctx, &key);
+	ghash_update(&ctx, C, 16);
+	if (ghash_update_aad(&ctx, A, 16) != -1) {
+		error_print();
+		return -1;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
 	return 1;
 }
 
 
 int main(void)
 {
-	test_ghash();
-	return 1;
+	if (test_ghash() != 1) {
+		return 1;
+	}
+	if (test_ghash_ctx() != 1) {
+		return 1;
+	}
+	return 0;
 }
@@ -122,11 +122,14 @@ struct {
 int test_hmac(const DIGEST *digest, const char *key_hex, const char *data_hex, const char *hmac_hex)
 {
 	HMAC_CTX ctx;
+	HMAC_CTX clone;
+	HMAC_KEY hmac_key;
 	uint8_t key[strlen(key_hex)/2];
 	uint8_t data[strlen(data_hex)/2];
 	uint8_t hmac[strlen(hmac_hex)/2];
 	uint8_t buf[64];
 	size_t len;
+	int i;
 
 	hex2bin(key_hex, strlen(key_hex), key);
 	hex2bin(data_hex, strlen(data_hex), data);
@@ -140,19 +143,48 @@ int test_hmac(const DIGEST *digest, const char *key_hex, const char *data_hex, c
 		printf("failed\n");
 		return 0;
 	}
+
+	// a clone of a context that owns its key
+	hmac_init(&ctx, digest, key, sizeof(key));
+	hmac_update(&ctx, data, 1);
+	hmac_ctx_clone(&clone, &ctx);
+	memset(&ctx, 0, sizeof(ctx));
+	hmac_update(&clone, data + 1, sizeof(data) - 1);
+	hmac_finish(&clone, buf, &len);
+
+	if (len != sizeof(hmac) || memcmp(buf, hmac, sizeof(hmac)) != 0) {
+		printf("hmac_ctx_clone failed\n");
+		return 0;
+	}
+
+	// two messages from one key schedule
+	hmac_set_key(&hmac_key, digest, key, sizeof(key));
+	for (i = 0; i < 2; i++) {
+		hmac_init_with_key(&ctx, &hmac_key);
+		hmac_update(&ctx, data, sizeof(data));
+		hmac_finish(&ctx, buf, &len);
+
+		if (len != sizeof(hmac) || memcmp(buf, hmac, sizeof(hmac)) != 0) {
+			printf("hmac_init_with_key failed\n");
+			return 0;
+		}
+	}
+	hmac_key_cleanup(&hmac_key);
+
 	printf("ok\n");
 	return 1;
 }
 
 int main(void)
 {
+	int err = 0;
 	int i;
 	for (i = 0; i < sizeof(hmac_tests)/sizeof(hmac_tests[0]); i++) {
-		test_hmac(DIGEST_sha224(), hmac_tests[i].key, hmac_tests[i].data, hmac_tests[i].hmac_sha224);
-		test_hmac(DIGEST_sha256(), hmac_tests[i].key, hmac_tests[i].data, hmac_tests[i].hmac_sha256);
-		test_hmac(DIGEST_sha384(), hmac_tests[i].key, hmac_tests[i].data, hmac_tests[i].hmac_sha384);
-		test_hmac(DIGEST_sha512(), hmac_tests[i].key, hmac_tests[i].data, hmac_tests[i].hmac_sha512);
+		err += !test_hmac(DIGEST_sha224(), hmac_tests[i].key, hmac_tests[i].data, hmac_tests[i].hmac_sha224);
+		err += !test_hmac(DIGEST_sha256(), hmac_tests[i].key, hmac_tests[i].data, hmac_tests[i].hmac_sha256);
+		err += !test_hmac(DIGEST_sha384(), hmac_tests[i].key, hmac_tests[i].data, hmac_tests[i].hmac_sha384);
+		err += !test_hmac(DIGEST_sha512(), hmac_tests[i].key, hmac_tests[i].data, hmac_tests[i].hmac_sha512);
 	};
 
-	return 0;
+	return err;
 };
@@ -134,8 +134,137 @@ void test(void)
 	printf("\n");
 }
 
+struct {
+	char *pass;
+	char *salt;
+	int iter;
+	int dklen;
+	char *dk;
+} pbkdf2_hmac_sm3_tests[] = {
+	{
+		"password",
+		"salt",
+		1,
+		32,
+		"4612f922a1fdcefaf4312fc6f8f3322b489cbf24f2ea361b44c2bd8fa2c6dcb0",
+	},
+	{
+		"password",
+		"salt",
+		10000,
+		16,
+		"738c8c432372d98a73350bc252209e4c",
+	},
+	{
+		"passwordPASSWORDpassword",
+		"saltSALTsaltSALTsaltSALTsaltSALTsalt",
+		4096,
+		80,
+		"3b6282ac8519f059e465abff0ea37b0dbfe6c672a76e6b805312d53900db6307"
+		"32ccc1a88fa5512a6e8bbd7e48d336632a254dd72a4ced777cd6fa094665db77"
+		"f64dcc35208fc0950b9745e424a665f6",
+	},
+};
+
+#define NUM_SM3_TESTS (sizeof(pbkdf2_hmac_sm3_tests)/sizeof(pbkdf2_hmac_sm3_tests[0]))
+
+static int test_pbkdf2_sm3(void)
+{
+	uint8_t key[80];
+	uint8_t buf[80];
+	size_t i;
+
+	for (i = 0; i < NUM_SM3_TESTS; i++) {
+		hex2bin(pbkdf2_hmac_sm3_tests[i].dk, strlen(pbkdf2_hmac_sm3_tests[i].dk), buf);
+
+		if (pbkdf2_genkey(DIGEST_sm3(),
+			pbkdf2_hmac_sm3_tests[i].pass, strlen(pbkdf2_hmac_sm3_tests[i].pass),
+			(uint8_t *)pbkdf2_hmac_sm3_tests[i].salt, strlen(pbkdf2_hmac_sm3_tests[i].salt),
+			pbkdf2_hmac_sm3_tests[i].iter, pbkdf2_hmac_sm3_tests[i].dklen, key) != 1
+			|| memcmp(key, buf, pbkdf2_hmac_sm3_tests[i].dklen) != 0) {
+			printf("%s() test %zu failed\n", __FUNCTION__, i);
+			return -1;
+		}
+
+		memset(key, 0, sizeof(key));
+		if (pbkdf2_genkey_mt(DIGEST_sm3(),
+			pbkdf2_hmac_sm3_tests[i].pass, strlen(pbkdf2_hmac_sm3_tests[i].pass),
+			(uint8_t *)pbkdf2_hmac_sm3_tests[i].salt, strlen(pbkdf2_hmac_sm3_tests[i].salt),
+			pbkdf2_hmac_sm3_tests[i].iter, pbkdf2_hmac_sm3_tests[i].dklen, key, 2) != 1
+			|| memcmp(key, buf, pbkdf2_hmac_sm3_tests[i].dklen) != 0) {
+			printf("%s() test %zu failed\n", __FUNCTION__, i);
+			return -1;
+		}
+	}
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
+// more jobs than lanes, with mixed counts and lengths
+static int test_pbkdf2_batch(void)
+{
+	PBKDF2_JOB jobs[3 * 4];
+	uint8_t keys[3 * 4][80];
+	uint8_t buf[80];
+	size_t n = sizeof(jobs)/sizeof(jobs[0]);
+	size_t i, k;
+
+	for (k = 0; k < 2; k++) {
+		memset(keys, 0, sizeof(keys));
+		for (i = 0; i < n; i++) {
+			jobs[i].pass = pbkdf2_hmac_sm3_tests[i % NUM_SM3_TESTS].pass;
+			jobs[i].passlen = strlen(jobs[i].pass);
+			jobs[i].salt = (uint8_t *)pbkdf2_hmac_sm3_tests[i % NUM_SM3_TESTS].salt;
+			jobs[i].saltlen = strlen((char *)jobs[i].salt);
+			jobs[i].count = pbkdf2_hmac_sm3_tests[i % NUM_SM3_TESTS].iter;
+			jobs[i].outlen = pbkdf2_hmac_sm3_tests[i % NUM_SM3_TESTS].dklen;
+			jobs[i].out = keys[i];
+		}
+		if ((k == 0 ? pbkdf2_genkey_batch(DIGEST_sm3(), jobs, n)
+			: pbkdf2_genkey_batch_mt(DIGEST_sm3(), jobs, n, 3)) != 1) {
+			printf("%s() failed\n", __FUNCTION__);
+			return -1;
+		}
+		for (i = 0; i < n; i++) {
+			hex2bin(pbkdf2_hmac_sm3_tests[i % NUM_SM3_TESTS].dk,
+				strlen(pbkdf2_hmac_sm3_tests[i % NUM_SM3_TESTS].dk), buf);
+			if (memcmp(keys[i], buf, jobs[i].outlen) != 0) {
+				printf("%s() job %zu failed\n", __FUNCTION__, i);
+				return -1;
+			}
+		}
+	}
+
+	// other digests go through pbkdf2_genkey() one by one
+	jobs[0].pass = pbkdf2_hmac_sha1_tests[4].pass;
+	jobs[0].passlen = strlen(jobs[0].pass);
+	jobs[0].salt = (uint8_t *)pbkdf2_hmac_sha1_tests[4].salt;
+	jobs[0].saltlen = strlen((char *)jobs[0].salt);
+	jobs[0].count = pbkdf2_hmac_sha1_tests[4].iter;
+	jobs[0].outlen = pbkdf2_hmac_sha1_tests[4].dklen;
+	jobs[0].out = keys[0];
+	hex2bin(pbkdf2_hmac_sha1_tests[4].dk, strlen(pbkdf2_hmac_sha1_tests[4].dk), buf);
+	if (pbkdf2_genkey_batch(DIGEST_sha1(), jobs, 1) != 1
+		|| memcmp(keys[0], buf, jobs[0].outlen) != 0) {
+		printf("%s() sha1 failed\n", __FUNCTION__);
+		return -1;
+	}
+
+	// an empty password is rejected whatever the digest
+	jobs[0].passlen = 0;
+	if (pbkdf2_genkey_batch(DIGEST_sm3(), jobs, 1) != -1
+		|| pbkdf2_genkey_batch(DIGEST_sha1(), jobs, 1) != -1) {
+		printf("%s() empty password accepted\n", __FUNCTION__);
+		return -1;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 1;
+}
+
 int main(void)
 {
+	int err = 0;
 	int i;
 	uint8_t key[64];
 	uint8_t buf[64];
@@ -151,10 +280,13 @@ int main(void)
 
 		if (memcmp(key, buf, pbkdf2_hmac_sha1_tests[i].dklen) != 0) {
 			printf("%d failed\n", i);
+			err++;
 		} else {
 			printf("%d ok\n", i);
 		}
 	}
 
-	return 1;
+	if (test_pbkdf2_sm3() != 1) err++;
+	if (test_pbkdf2_batch() != 1) err++;
+	return err;
 }
@@ -279,7 +279,7 @@ static int test_pkcs8(void)
 	memcpy(&sm2_buf, &sm2_key, sizeof(sm2_key));
 	//sm2_key_print(stdout, &sm2_key, 0, 0);
 
-	if (sm2_enced_private_key_info_to_der(&sm2_key, "passowrd", &p, &len) != 1) {
+	if (sm2_enced_private_key_info_to_der(&sm2_key, "password", &p, &len) != 1) {
 		error_print();
 		err++;
 		goto end;
@@ -49,7 +49,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <gmssl/sm2.h>
+#include <gmssl/error.h>
 
 
 // SM2还需要大量的测试覆盖
@@ -123,6 +125,131 @@ static int test_sm2_do_encrypt(void)
 	return r;
 }
 
+static int test_sm2_encrypt_stream(void)
+{
+	SM2_KEY key;
+	SM2_ENC_CTX ctx;
+	uint8_t msg[5000];
+	uint8_t der[5000 + 3 * SM2_ENC_PREFIX_MAX_SIZE];
+	uint8_t plain[5000];
+	uint8_t prefix[SM2_ENC_PREFIX_MAX_SIZE];
+	size_t prefixlen, derlen, plainlen, len, off, n;
+	int order, i;
+
+	sm2_keygen(&key);
+	for (i = 0; i < (int)sizeof(msg); i++) {
+		msg[i] = (uint8_t)(i * 7);
+	}
+
+	for (order = SM2_C1C3C2; order <= SM2_C1C2C3; order++) {
+		// encrypt in pieces of 1, 2, 4, ... bytes
+		if (sm2_encrypt_init(&ctx, &key, sizeof(msg), order, &prefixlen) != 1) {
+			error_print();
+			return -1;
+		}
+		derlen = (order == SM2_C1C3C2) ? prefixlen : 0;
+		for (off = 0, n = 1; off < sizeof(msg); off += n, n *= 2) {
+			if (n > sizeof(msg) - off)
+				n = sizeof(msg) - off;
+			if (sm2_encrypt_update(&ctx, msg + off, n, der + derlen, &len) != 1) {
+				error_print();
+				return -1;
+			}
+			derlen += len;
+		}
+		if (sm2_encrypt_finish(&ctx, prefix, &len) != 1) {
+			error_print();
+			return -1;
+		}
+		if (order == SM2_C1C3C2) {
+			if (len != prefixlen) {
+				error_print();
+				return -1;
+			}
+			memcpy(der, prefix, len);
+		} else {
+			memcpy(der + derlen, prefix, len);
+			derlen += len;
+		}
+
+		// decrypt in pieces of 13 bytes
+		if (sm2_decrypt_init(&ctx, &key, order) != 1) {
+			error_print();
+			return -1;
+		}
+		for (off = 0, plainlen = 0; off < derlen; off += n) {
+			n = derlen - off < 13 ? derlen - off : 13;
+			if (sm2_decrypt_update(&ctx, der + off, n, plain + plainlen, &len) != 1) {
+				error_print();
+				return -1;
+			}
+			plainlen += len;
+		}
+		if (sm2_decrypt_finish(&ctx) != 1
+			|| plainlen != sizeof(msg)
+			|| memcmp(plain, msg, sizeof(msg)) != 0) {
+			error_print();
+			return -1;
+		}
+
+		// a changed C2 byte fails C3
+		der[derlen / 2] ^= 1;
+		if (sm2_decrypt_init(&ctx, &key, order) != 1
+			|| sm2_decrypt_update(&ctx, der, derlen, plain, &len) != 1
+			|| sm2_decrypt_finish(&ctx) != -1) {
+			error_print();
+			return -1;
+		}
+		der[derlen / 2] ^= 1;
+
+		// truncated input
+		if (sm2_decrypt_init(&ctx, &key, order) != 1
+			|| sm2_decrypt_update(&ctx, der, derlen - 1, plain, &len) != 1
+			|| sm2_decrypt_finish(&ctx) != -1) {
+			error_print();
+			return -1;
+		}
+	}
+
+	// C1C3C2 is the SM2Cipher of sm2_encrypt()
+	if (sm2_encrypt(&key, msg, 100, der, &derlen) != 1
+		|| sm2_decrypt_init(&ctx, &key, SM2_C1C3C2) != 1
+		|| sm2_decrypt_update(&ctx, der, derlen, plain, &plainlen) != 1
+		|| sm2_decrypt_finish(&ctx) != 1
+		|| plainlen != 100
+		|| memcmp(plain, msg, 100) != 0) {
+		error_print();
+		return -1;
+	}
+	if (sm2_encrypt_init(&ctx, &key, 100, SM2_C1C3C2, &prefixlen) != 1
+		|| sm2_encrypt_update(&ctx, msg, 100, der + prefixlen, &len) != 1
+		|| sm2_encrypt_finish(&ctx, der, &len) != 1
+		|| sm2_decrypt(&key, der, prefixlen + 100, plain, &plainlen) != 1
+		|| plainlen != 100
+		|| memcmp(plain, msg, 100) != 0) {
+		error_print();
+		return -1;
+	}
+
+	// non-minimal DER lengths
+	{
+		const uint8_t bad_len[][4] = {
+			{ 0x30, 0x81, 0x05, 0x02 },
+			{ 0x30, 0x82, 0x00, 0x80 },
+		};
+		for (i = 0; i < 2; i++) {
+			if (sm2_decrypt_init(&ctx, &key, SM2_C1C3C2) != 1
+				|| sm2_decrypt_update(&ctx, bad_len[i], 4, plain, &len) != -1) {
+				error_print();
+				return -1;
+			}
+		}
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
 static int test_sm2_sign(void)
 {
 	SM2_KEY key;
@@ -151,13 +278,510 @@ static int test_sm2_sign(void)
 	return 0;
 }
 
+static int test_sm2_verify_batch(void)
+{
+	SM2_KEY keys[40];
+	uint8_t dgsts[40][32];
+	SM2_SIGNATURE sigs[40];
+	int results[40];
+	int n = 40;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		// only 3 distinct keys, so tables are shared
+		if (i < 3) {
+			sm2_keygen(&keys[i]);
+		} else {
+			keys[i] = keys[i % 3];
+		}
+		memset(dgsts[i], i, 32);
+		sm2_do_sign(&keys[i], dgsts[i], &sigs[i]);
+	}
+	dgsts[5][0] ^= 1;
+	sigs[17].s[31] ^= 1;
+	memset(sigs[23].r, 0xff, 32);
+	memset(sigs[31].s, 0, 32);
+	keys[38] = keys[0];
+	keys[39] = keys[1];
+
+	if (sm2_verify_batch(keys, (const uint8_t (*)[32])dgsts, sigs, n, results) != 0) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		int expect = sm2_do_verify(&keys[i], dgsts[i], &sigs[i]);
+		if (expect < 0)
+			expect = -1;
+		if (results[i] != expect) {
+			fprintf(stderr, "%s %d: sig %d: result %d, expected %d\n", __FILE__, __LINE__, i, results[i], expect);
+			return -1;
+		}
+	}
+
+	memset(results, 0, sizeof(results));
+	if (sm2_verify_batch_mt(keys, (const uint8_t (*)[32])dgsts, sigs, n, results, 4) != 0
+		|| results[0] != 1 || results[5] != 0 || results[23] != -1 || results[39] != 0) {
+		error_print();
+		return -1;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
+static int test_sm2_verify_key(void)
+{
+	const char *ids[] = { SM2_DEFAULT_ID, "alice@example.com" };
+	SM2_KEY key;
+	SM2_VERIFY_KEY vk;
+	SM2_SIGN_CTX ctx;
+	SM2_SIGNATURE sig;
+	uint8_t msg[100];
+	uint8_t dgst[32];
+	uint8_t der[SM2_MAX_SIGNATURE_SIZE];
+	size_t derlen;
+	int i, j;
+
+	sm2_keygen(&key);
+
+	for (i = 0; i < sizeof(ids)/sizeof(ids[0]); i++) {
+		if (sm2_verify_key_init(&vk, &key, ids[i]) != 1) {
+			error_print();
+			return -1;
+		}
+		for (j = 0; j < 10; j++) {
+			memset(msg, j, sizeof(msg));
+			derlen = sizeof(der);
+			sm2_sign_init(&ctx, &key, ids[i]);
+			sm2_sign_update(&ctx, msg, j * 10);
+			sm2_sign_finish(&ctx, der, &derlen);
+
+			if (sm2_verify_with_key(&vk, msg, j * 10, der, derlen) != 1) {
+				error_print();
+				return -1;
+			}
+			msg[0] ^= 1;
+			if (j > 0 && sm2_verify_with_key(&vk, msg, j * 10, der, derlen) != 0) {
+				error_print();
+				return -1;
+			}
+		}
+		sm2_verify_key_cleanup(&vk);
+	}
+
+	if (sm2_verify_key_init(&vk, &key, SM2_DEFAULT_ID) != 1) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < 20; i++) {
+		memset(dgst, i, sizeof(dgst));
+		sm2_do_sign(&key, dgst, &sig);
+		if (i % 2) {
+			sig.s[i] ^= 0x80;
+		}
+		if (sm2_do_verify_with_key(&vk, dgst, &sig) != sm2_do_verify(&key, dgst, &sig)) {
+			error_print();
+			return -1;
+		}
+	}
+	sm2_verify_key_cleanup(&vk);
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
+static int test_sm2_sign_key(void)
+{
+	SM2_KEY key;
+	SM2_SIGN_KEY sk;
+	SM2_SIGN_CTX sign_ctx;
+	SM2_SIGN_CTX verify_ctx;
+	SM2_SIGNATURE sig;
+	uint8_t msg[64];
+	uint8_t dgst[32];
+	uint8_t der[SM2_MAX_SIGNATURE_SIZE];
+	size_t derlen;
+	int i;
+
+	sm2_keygen(&key);
+	if (sm2_sign_key_init(&sk, &key, "alice@example.com") != 1
+		|| sm2_sign_init_with_key(&sign_ctx, &sk) != 1
+		|| sm2_verify_init(&verify_ctx, &key, "alice@example.com") != 1) {
+		error_print();
+		return -1;
+	}
+
+	for (i = 0; i < 10; i++) {
+		memset(msg, i, sizeof(msg));
+		sm2_sign_reset(&sign_ctx);
+		sm2_sign_update(&sign_ctx, msg, i * 6);
+		derlen = sizeof(der);
+		if (sm2_sign_finish(&sign_ctx, der, &derlen) != 1) {
+			error_print();
+			return -1;
+		}
+
+		sm2_sign_reset(&verify_ctx);
+		sm2_verify_update(&verify_ctx, msg, i * 6);
+		if (sm2_verify_finish(&verify_ctx, der, derlen) != 1) {
+			error_print();
+			return -1;
+		}
+
+		memset(dgst, i, sizeof(dgst));
+		if (sm2_do_sign_with_key(&sk, dgst, &sig) != 1
+			|| sm2_do_verify(&key, dgst, &sig) != 1) {
+			error_print();
+			return -1;
+		}
+	}
+	sm2_sign_key_cleanup(&sk);
+
+	// d >= n is rejected, not reduced
+	memset(key.private_key, 0xff, sizeof(key.private_key));
+	if (sm2_sign_key_init(&sk, &key, SM2_DEFAULT_ID) != -1) {
+		error_print();
+		return -1;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
+static int test_sm2_presign_pool(void)
+{
+	SM2_KEY key;
+	SM2_SIGN_KEY sk;
+	SM2_PRESIGN_POOL pool;
+	SM2_SIGNATURE sig;
+	uint8_t dgst[32];
+	int i;
+
+	sm2_keygen(&key);
+	sm2_sign_key_init(&sk, &key, SM2_DEFAULT_ID);
+	if (sm2_presign_pool_init(&pool, 16) != 1
+		|| sm2_presign_count(&pool) != 0
+		|| !sm2_presign_needs_refill(&pool)) {
+		error_print();
+		return -1;
+	}
+	if (sm2_presign_fill(&pool, 10) != 10
+		|| sm2_presign_fill(&pool, 0) != SM2_PRESIGN_POOL_SIZE - 10
+		|| sm2_presign_fill(&pool, 0) != 0
+		|| sm2_presign_count(&pool) != SM2_PRESIGN_POOL_SIZE
+		|| sm2_presign_needs_refill(&pool)) {
+		error_print();
+		return -1;
+	}
+
+	// drain the pool and keep signing from the online fallback
+	for (i = 0; i < SM2_PRESIGN_POOL_SIZE + 4; i++) {
+		memset(dgst, i, sizeof(dgst));
+		if (sm2_do_sign_with_pool(&sk, &pool, dgst, &sig) != 1
+			|| sm2_do_verify(&key, dgst, &sig) != 1) {
+			error_print();
+			return -1;
+		}
+		if (i == SM2_PRESIGN_POOL_SIZE - 16 && !sm2_presign_needs_refill(&pool)) {
+			error_print();
+			return -1;
+		}
+	}
+	if (sm2_presign_count(&pool) != 0) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < SM2_PRESIGN_POOL_SIZE; i++) {
+		uint8_t zeros[32] = {0};
+		if (memcmp(pool.slots[i].k, zeros, 32) != 0) {
+			error_print();
+			return -1;
+		}
+	}
+
+	// refill after wrap-around
+	if (sm2_presign_fill(&pool, 0) != SM2_PRESIGN_POOL_SIZE
+		|| sm2_do_sign_with_pool(&sk, &pool, dgst, &sig) != 1
+		|| sm2_do_verify(&key, dgst, &sig) != 1) {
+		error_print();
+		return -1;
+	}
+	sm2_presign_pool_cleanup(&pool);
+	sm2_sign_key_cleanup(&sk);
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
+static int test_sm2_mb(void)
+{
+	SM2_KEY keys[7];
+	SM2_POINT peers[7];
+	SM2_POINT outs[7];
+	SM2_POINT P;
+	uint8_t dgsts[7][32];
+	SM2_SIGNATURE sigs[7];
+	int n = 7;
+	int i;
+
+	if (sm2_keygen_batch(keys, n) != 1) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		sm2_point_mul_generator(&P, keys[i].private_key);
+		if (memcmp(&P, &keys[i].public_key, sizeof(SM2_POINT)) != 0) {
+			fprintf(stderr, "%s %d: key %d: wrong public key\n", __FILE__, __LINE__, i);
+			return -1;
+		}
+		memset(dgsts[i], i, 32);
+		peers[i] = keys[(i + 1) % n].public_key;
+	}
+
+	if (sm2_do_sign_mb(keys, (const uint8_t (*)[32])dgsts, sigs, n) != 1) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (sm2_do_verify(&keys[i], dgsts[i], &sigs[i]) != 1) {
+			fprintf(stderr, "%s %d: sig %d: verify failed\n", __FILE__, __LINE__, i);
+			return -1;
+		}
+	}
+
+	if (sm2_ecdh_mb(keys, peers, outs, n) != 1) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		sm2_ecdh(&keys[i], &peers[i], &P);
+		if (memcmp(&P, &outs[i], sizeof(SM2_POINT)) != 0) {
+			fprintf(stderr, "%s %d: ecdh %d: wrong result\n", __FILE__, __LINE__, i);
+			return -1;
+		}
+	}
+	memset(&peers[3], 0, sizeof(SM2_POINT));
+	if (sm2_ecdh_mb(keys, peers, outs, n) != -1) {
+		error_print();
+		return -1;
+	}
+	memset(keys[5].private_key, 0, 32);
+	if (sm2_do_sign_mb(keys, (const uint8_t (*)[32])dgsts, sigs, n) != -1
+		|| sm2_ecdh_mb(keys, outs, outs, n) != -1) {
+		error_print();
+		return -1;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
+static int test_sm2_keygen_batch(void)
+{
+	SM2_KEY keys[70];
+	SM2_POINT P;
+	int n = 70;
+	int i;
+
+	// more than one batch, last one not a multiple of 4
+	if (sm2_keygen_batch(keys, n) != 1) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		sm2_point_mul_generator(&P, keys[i].private_key);
+		if (memcmp(&P, &keys[i].public_key, sizeof(SM2_POINT)) != 0) {
+			fprintf(stderr, "%s %d: key %d: wrong public key\n", __FILE__, __LINE__, i);
+			return -1;
+		}
+	}
+
+	memset(keys, 0, sizeof(keys));
+	if (sm2_keygen_batch_mt(keys, n, 3) != 1) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		sm2_point_mul_generator(&P, keys[i].private_key);
+		if (memcmp(&P, &keys[i].public_key, sizeof(SM2_POINT)) != 0) {
+			fprintf(stderr, "%s %d: key %d: wrong public key\n", __FILE__, __LINE__, i);
+			return -1;
+		}
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
+static int speed_sm2(void)
+{
+	SM2_KEY key;
+	SM2_SIGNATURE sig;
+	SM2_POINT P;
+	uint8_t dgst[32] = {0};
+	clock_t begin, end;
+	int count = 200;
+	int i;
+
+	sm2_keygen(&key);
+
+	begin = clock();
+	for (i = 0; i < count; i++) {
+		sm2_do_sign(&key, dgst, &sig);
+	}
+	end = clock();
+	printf("sm2_do_sign   : %8.0f ops/s\n", count / ((double)(end - begin) / CLOCKS_PER_SEC));
+
+	{
+		SM2_SIGN_KEY sk;
+
+		sm2_sign_key_init(&sk, &key, SM2_DEFAULT_ID);
+		begin = clock();
+		for (i = 0; i < count; i++) {
+			sm2_do_sign_with_key(&sk, dgst, &sig);
+		}
+		end = clock();
+		printf("sm2_do_sign_with_key: %0.0f ops/s\n", count / ((double)(end - begin) / CLOCKS_PER_SEC));
+
+		{
+			SM2_PRESIGN_POOL pool;
+			clock_t online = 0;
+
+			sm2_presign_pool_init(&pool, 0);
+			for (i = 0; i < count; i += SM2_PRESIGN_POOL_SIZE) {
+				int j;
+				sm2_presign_fill(&pool, 0);
+				begin = clock();
+				for (j = 0; j < SM2_PRESIGN_POOL_SIZE; j++) {
+					sm2_do_sign_with_pool(&sk, &pool, dgst, &sig);
+				}
+				online += clock() - begin;
+			}
+			printf("sm2_do_sign_with_pool (online): %0.0f ops/s\n", i / ((double)online / CLOCKS_PER_SEC));
+			sm2_presign_pool_cleanup(&pool);
+		}
+		sm2_sign_key_cleanup(&sk);
+	}
+
+	begin = clock();
+	for (i = 0; i < count; i++) {
+		if (sm2_do_verify(&key, dgst, &sig) != 1) {
+			fprintf(stderr, "%s %d: error\n", __FILE__, __LINE__);
+			return -1;
+		}
+	}
+	end = clock();
+	printf("sm2_do_verify : %8.0f ops/s\n", count / ((double)(end - begin) / CLOCKS_PER_SEC));
+
+	{
+		SM2_KEY keys[50];
+		uint8_t dgsts[50][32] = {{0}};
+		SM2_SIGNATURE sigs[50];
+		int results[50];
+
+		for (i = 0; i < 50; i++) {
+			keys[i] = key;
+			sigs[i] = sig;
+		}
+		begin = clock();
+		for (i = 0; i < count; i += 50) {
+			if (sm2_verify_batch(keys, (const uint8_t (*)[32])dgsts, sigs, 50, results) != 1) {
+				fprintf(stderr, "%s %d: error\n", __FILE__, __LINE__);
+				return -1;
+			}
+		}
+		end = clock();
+		printf("sm2_verify_batch: %6.0f ops/s\n", count / ((double)(end - begin) / CLOCKS_PER_SEC));
+	}
+
+	{
+		SM2_VERIFY_KEY vk;
+
+		sm2_verify_key_init(&vk, &key, SM2_DEFAULT_ID);
+		begin = clock();
+		for (i = 0; i < count; i++) {
+			if (sm2_do_verify_with_key(&vk, dgst, &sig) != 1) {
+				fprintf(stderr, "%s %d: error\n", __FILE__, __LINE__);
+				return -1;
+			}
+		}
+		end = clock();
+		printf("sm2_do_verify_with_key: %0.0f ops/s\n", count / ((double)(end - begin) / CLOCKS_PER_SEC));
+		sm2_verify_key_cleanup(&vk);
+	}
+
+	begin = clock();
+	for (i = 0; i < count; i++) {
+		sm2_keygen(&key);
+	}
+	end = clock();
+	printf("sm2_keygen    : %8.0f ops/s\n", count / ((double)(end - begin) / CLOCKS_PER_SEC));
+
+	begin = clock();
+	for (i = 0; i < count; i++) {
+		sm2_ecdh(&key, &key.public_key, &P);
+	}
+	end = clock();
+	printf("sm2_ecdh      : %8.0f ops/s\n", count / ((double)(end - begin) / CLOCKS_PER_SEC));
+
+	{
+		SM2_KEY keys[8];
+		SM2_POINT peers[8];
+		SM2_POINT outs[8];
+		uint8_t dgsts[8][32] = {{0}};
+		SM2_SIGNATURE sigs[8];
+
+		sm2_keygen_batch(keys, 8);
+
+		{
+			SM2_KEY batch[64];
+
+			begin = clock();
+			for (i = 0; i < count; i += 64) {
+				sm2_keygen_batch(batch, 64);
+			}
+			end = clock();
+			printf("sm2_keygen_batch: %6.0f ops/s\n", i / ((double)(end - begin) / CLOCKS_PER_SEC));
+		}
+
+		begin = clock();
+		for (i = 0; i < count; i += 8) {
+			sm2_do_sign_mb(keys, (const uint8_t (*)[32])dgsts, sigs, 8);
+		}
+		end = clock();
+		printf("sm2_do_sign_mb: %8.0f ops/s\n", i / ((double)(end - begin) / CLOCKS_PER_SEC));
+
+		for (i = 0; i < 8; i++) {
+			peers[i] = keys[i].public_key;
+		}
+		begin = clock();
+		for (i = 0; i < count; i += 8) {
+			sm2_ecdh_mb(keys, peers, outs, 8);
+		}
+		end = clock();
+		printf("sm2_ecdh_mb   : %8.0f ops/s\n", i / ((double)(end - begin) / CLOCKS_PER_SEC));
+	}
+
+	return 0;
+}
+
 int main(void)
 {
-	sm2_algo_selftest();
+	int err = 0;
+
+	err += sm2_algo_selftest();
 
 	//test_sm2_point();
 	//test_sm2_sign();
 	test_sm2_do_encrypt();
+	err += test_sm2_encrypt_stream();
+	err += test_sm2_verify_batch();
+	err += test_sm2_verify_key();
+	err += test_sm2_sign_key();
+	err += test_sm2_presign_pool();
+	err += test_sm2_mb();
+	err += test_sm2_keygen_batch();
+	err += speed_sm2();
 
-	return 0;
+	return err ? 1 : 0;
 }
@@ -175,11 +175,269 @@ static char *dgsthex[] = {
 	"C3B02E500A8B60B77DEDCF6F4C11BEF8D56E5CDE708C72065654FD7B2167915A",
 };
 
+// KDF(Z, klen) computed by hashing Z || ct from the start for every block
+static void sm3_kdf_ref(const uint8_t *z, size_t zlen, size_t outlen, uint8_t *out)
+{
+	SM3_CTX ctx;
+	uint8_t ct[4];
+	uint8_t dgst[32];
+	uint32_t counter = 1;
+	size_t len;
+
+	while (outlen) {
+		ct[0] = (uint8_t)(counter >> 24);
+		ct[1] = (uint8_t)(counter >> 16);
+		ct[2] = (uint8_t)(counter >> 8);
+		ct[3] = (uint8_t)counter;
+		counter++;
+		sm3_init(&ctx);
+		sm3_update(&ctx, z, zlen);
+		sm3_update(&ctx, ct, 4);
+		sm3_finish(&ctx, dgst);
+		len = outlen < 32 ? outlen : 32;
+		memcpy(out, dgst, len);
+		out += len;
+		outlen -= len;
+	}
+}
+
+static int test_sm3_kdf(void)
+{
+	SM3_KDF_CTX ctx;
+	uint8_t z[200];
+	uint8_t out[300];
+	uint8_t ref[300];
+	size_t zlen, off, n;
+	size_t outlens[] = { 1, 31, 32, 33, 64, 100, 300 };
+	size_t i;
+
+	for (i = 0; i < sizeof(z); i++) {
+		z[i] = (uint8_t)i;
+	}
+
+	// Z tails of every length around the one and two block boundaries
+	for (zlen = 0; zlen <= sizeof(z); zlen++) {
+		for (i = 0; i < sizeof(outlens)/sizeof(outlens[0]); i++) {
+			sm3_kdf_ref(z, zlen, outlens[i], ref);
+			sm3_kdf(z, zlen, outlens[i], out);
+			if (memcmp(out, ref, outlens[i]) != 0) {
+				printf("sm3_kdf error with zlen = %zu, outlen = %zu\n", zlen, outlens[i]);
+				return -1;
+			}
+		}
+	}
+
+	// output in pieces of 1, 2, 3, ... bytes
+	sm3_kdf_ref(z, 64, sizeof(ref), ref);
+	sm3_kdf_init(&ctx);
+	sm3_kdf_update(&ctx, z, 10);
+	sm3_kdf_update(&ctx, z + 10, 54);
+	for (off = 0, n = 1; off < sizeof(out); off += n, n++) {
+		if (n > sizeof(out) - off)
+			n = sizeof(out) - off;
+		sm3_kdf_generate(&ctx, out + off, n);
+	}
+	sm3_kdf_cleanup(&ctx);
+	if (memcmp(out, ref, sizeof(out)) != 0) {
+		printf("sm3_kdf_generate error\n");
+		return -1;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
+static int test_sm3_digest_multi(void)
+{
+	uint8_t buf[2100];
+	const uint8_t *msgs[41];
+	size_t lens[41];
+	uint8_t dgsts[41][32];
+	uint8_t dgst[32];
+	size_t i;
+
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = (uint8_t)(i * 31);
+	}
+	// lengths around the padding boundaries, mixed with long ones
+	for (i = 0; i < 41; i++) {
+		msgs[i] = buf + i;
+		lens[i] = (i % 3 == 0) ? 1000 + i * 20 : (i * 7) % 130;
+	}
+
+	sm3_digest_multi(msgs, lens, 41, dgsts);
+	for (i = 0; i < 41; i++) {
+		sm3_digest(msgs[i], lens[i], dgst);
+		if (memcmp(dgst, dgsts[i], 32) != 0) {
+			printf("sm3_digest_multi error on message %zu, length %zu\n", i, lens[i]);
+			return -1;
+		}
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
+// many blocks per sm3_compress_blocks() call against one block per call
+static int test_sm3_update_blocks(void)
+{
+	uint8_t buf[4133];
+	uint8_t dgst[32];
+	char dgsthex[65];
+	SM3_CTX ctx;
+	size_t i;
+
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = (uint8_t)(i * 7 + 3);
+	}
+
+	sm3_digest(buf, sizeof(buf), dgst);
+	for (i = 0; i < 32; i++) {
+		sprintf(dgsthex + i * 2, "%02x", dgst[i]);
+	}
+	if (strcmp(dgsthex, "1e9dfed0fb40946427511e03a734a53b5d60a9d94538144a5af3837cfdf64f76") != 0) {
+		printf("%s() error: %s\n", __FUNCTION__, dgsthex);
+		return -1;
+	}
+
+	sm3_init(&ctx);
+	for (i = 0; i < sizeof(buf); i += 61) {
+		sm3_update(&ctx, buf + i, sizeof(buf) - i < 61 ? sizeof(buf) - i : 61);
+	}
+	sm3_finish(&ctx, dgst);
+	for (i = 0; i < 32; i++) {
+		sprintf(dgsthex + i * 2, "%02x", dgst[i]);
+	}
+	if (strcmp(dgsthex, "1e9dfed0fb40946427511e03a734a53b5d60a9d94538144a5af3837cfdf64f76") != 0) {
+		printf("%s() error: %s\n", __FUNCTION__, dgsthex);
+		return -1;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
+// known answers from an independent implementation of the version 1 layout
+static int test_sm3_tree(void)
+{
+	struct {
+		size_t len;
+		size_t leaf_size;
+		char *dgsthex;
+	} tests[] = {
+		{ 64 * 1030 + 5, 64, "189479465893655eaafa6aa0e02fcab5d7322f804a4e3a077e13a9714e6bc1c5" },
+		{ 0, 64, "430c21beca15242a5853c0703be1a3ace189aae06b990e39397789e5c02bcee0" },
+		{ 1000, 128, "41935e545cc1810cc5092da40d6776f6f68ca4cb0214ba60b55bf833036e4aa2" },
+	};
+	static uint8_t buf[64 * 1030 + 5];
+	uint8_t dgst[32];
+	uint8_t dgstbuf[32];
+	size_t dgstlen;
+	SM3_TREE_CTX ctx;
+	size_t i, j;
+	int num_threads;
+
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = (uint8_t)(i * 7 + 3);
+	}
+
+	for (i = 0; i < sizeof(tests)/sizeof(tests[0]); i++) {
+		hex_to_bytes(tests[i].dgsthex, 64, dgstbuf, &dgstlen);
+
+		for (num_threads = 1; num_threads <= 3; num_threads++) {
+			if (sm3_tree_digest(buf, tests[i].len, tests[i].leaf_size, num_threads, dgst) != 1
+				|| memcmp(dgst, dgstbuf, 32) != 0) {
+				printf("%s() error: test %zu, %d threads\n", __FUNCTION__, i, num_threads);
+				return -1;
+			}
+		}
+
+		sm3_tree_init(&ctx, tests[i].leaf_size);
+		for (j = 0; j < tests[i].len; j += 37) {
+			sm3_tree_update(&ctx, buf + j, tests[i].len - j < 37 ? tests[i].len - j : 37);
+		}
+		sm3_tree_finish(&ctx, dgst);
+		if (memcmp(dgst, dgstbuf, 32) != 0) {
+			printf("%s() error: test %zu, streaming\n", __FUNCTION__, i);
+			return -1;
+		}
+	}
+
+	if (sm3_tree_init(&ctx, 100) != -1) {
+		printf("%s() error: leaf size not a multiple of the block size\n", __FUNCTION__);
+		return -1;
+	}
+
+	// ctx was zeroed by the last sm3_tree_finish()
+	if (sm3_tree_update(&ctx, buf, 1) != -1
+		|| sm3_tree_finish(&ctx, dgst) != -1) {
+		printf("%s() error: finished ctx accepted\n", __FUNCTION__);
+		return -1;
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
+static int test_sm3_hmac(void)
+{
+	struct {
+		size_t keylen;
+		char *machex;
+	} tests[] = {
+		{ 16, "41cf711498563539a61a971c3476d60fcad9b009dd5902b69868208010f1ce0a" },
+		{ 64, "ec5a59ce7414919e68508e19c4558e6da32d42812ebb4ee8fb8149f7b70ea4fa" },
+		{ 100, "61d2dcc1a3871e5581b9f6206c022785f16d8ae0b818949d976685599d5b9243" },
+	};
+	uint8_t key[100];
+	uint8_t msg[150];
+	uint8_t macbuf[32];
+	size_t maclen;
+	uint8_t mac[32];
+	SM3_HMAC_KEY hmac_key;
+	SM3_HMAC_CTX ctx;
+	size_t i, j;
+
+	for (i = 0; i < sizeof(key); i++) {
+		key[i] = (uint8_t)i;
+	}
+	for (i = 0; i < sizeof(msg); i++) {
+		msg[i] = "abc"[i % 3];
+	}
+
+	for (i = 0; i < sizeof(tests)/sizeof(tests[0]); i++) {
+		hex_to_bytes(tests[i].machex, 64, macbuf, &maclen);
+
+		sm3_hmac(key, tests[i].keylen, msg, sizeof(msg), mac);
+		if (memcmp(mac, macbuf, 32) != 0) {
+			printf("%s() error: sm3_hmac, key length %zu\n", __FUNCTION__, tests[i].keylen);
+			return -1;
+		}
+
+		// the same context twice through sm3_hmac_reset()
+		sm3_hmac_set_key(&hmac_key, key, tests[i].keylen);
+		sm3_hmac_init_with_key(&ctx, &hmac_key);
+		for (j = 0; j < 2; j++) {
+			sm3_hmac_update(&ctx, msg, 7);
+			sm3_hmac_update(&ctx, msg + 7, sizeof(msg) - 7);
+			sm3_hmac_finish(&ctx, mac);
+			if (memcmp(mac, macbuf, 32) != 0) {
+				printf("%s() error: reset %zu, key length %zu\n", __FUNCTION__, j, tests[i].keylen);
+				return -1;
+			}
+			sm3_hmac_reset(&ctx);
+		}
+	}
+
+	printf("%s() ok\n", __FUNCTION__);
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	int err = 0;
 	char *p;
-	uint8_t testbuf[sizeof(testhex)/2];
+	uint8_t testbuf[1024];
 	uint8_t dgstbuf[32];
 	size_t testbuflen, dgstbuflen;
 	uint8_t dgst[32];
@@ -206,5 +464,21 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (test_sm3_kdf() != 0) {
+		err++;
+	}
+	if (test_sm3_digest_multi() != 0) {
+		err++;
+	}
+	if (test_sm3_update_blocks() != 0) {
+		err++;
+	}
+	if (test_sm3_tree() != 0) {
+		err++;
+	}
+	if (test_sm3_hmac() != 0) {
+		err++;
+	}
+
 	return err;
 }
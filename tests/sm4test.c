@@ -49,6 +49,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <gmssl/sm4.h>
 
 # ifdef SM4_AVX2
@@ -91,8 +92,11 @@ static int test_ecb(int avx)
 		sm4_avx2_ecb_encrypt_blocks(in, out2, sizeof(in)/SM4_BLOCK_SIZE, &key);
 		break;
 # endif
+	case 0:
+		sm4_encrypt_blocks(&key, in, out2, sizeof(in)/SM4_BLOCK_SIZE);
+		break;
 	default:
-		printf("avx shuold be in {2}\n");
+		printf("avx shuold be in {0, 2}\n");
 		return 0;
 	}
 
@@ -146,8 +150,7 @@ static int test_ctr32(int avx)
 		break;
 # endif
 	case 0:
-		// do we need this?		
-		//sm4_ctr32_encrypt_blocks(in, out2, sizeof(in)/16, &key, ctr2);
+		sm4_ctr_encrypt(&key, ctr2, in, sizeof(in), out2);
 		break;
 	default:
 		printf("avx should be in {0, 2}\n");
@@ -161,6 +164,236 @@ static int test_ctr32(int avx)
 }
 
 
+/* the low 32-bit word wraps after two blocks, the last block is partial */
+static int test_ctr_wrap(void)
+{
+	SM4_KEY key;
+	unsigned char user_key[16] = {0};
+	unsigned char iv[16] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0xff, 0xff, 0xff, 0xff, 0xfe,
+	};
+	/* counters 2 and 3 of each mode after the wrap */
+	unsigned char ctr128[16] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0b, 0x00, 0x00, 0x00, 0x00, 0x00,
+	};
+	unsigned char ctr32[16] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0xff, 0x00, 0x00, 0x00, 0x00,
+	};
+	unsigned char in[16 * 4 + 5];
+	unsigned char out[sizeof(in)];
+	unsigned char block[16];
+	unsigned char ctr[16];
+	int i;
+
+	for (i = 0; i < sizeof(in); i++) {
+		in[i] = (unsigned char)i;
+	}
+	sm4_set_encrypt_key(&key, user_key);
+
+	memcpy(ctr, iv, 16);
+	memcpy(out, in, sizeof(in));
+	sm4_ctr_encrypt(&key, ctr, out, sizeof(out), out);
+	sm4_encrypt(&key, ctr128, block);
+	xor_block(block, in + 32);
+	if (memcmp(out + 32, block, 16) != 0) {
+		return 0;
+	}
+	ctr128[15] = 3;
+	if (memcmp(ctr, ctr128, 16) != 0) {
+		return 0;
+	}
+
+	memcpy(ctr, iv, 16);
+	sm4_ctr32_encrypt(&key, ctr, in, sizeof(in), out);
+	sm4_encrypt(&key, ctr32, block);
+	xor_block(block, in + 32);
+	if (memcmp(out + 32, block, 16) != 0) {
+		return 0;
+	}
+	ctr32[15] = 3;
+	if (memcmp(ctr, ctr32, 16) != 0) {
+		return 0;
+	}
+	return 1;
+}
+
+/* separate, in place and shifted left over the IV, as in tls_cbc_decrypt */
+static int test_cbc_decrypt(void)
+{
+	SM4_KEY enc_key;
+	SM4_KEY dec_key;
+	unsigned char user_key[16] = {0};
+	unsigned char iv[16];
+	unsigned char in[16 * 37];
+	unsigned char enced[16 + sizeof(in)];
+	unsigned char buf[16 + sizeof(in)];
+	int i;
+
+	for (i = 0; i < sizeof(in); i++) {
+		in[i] = (unsigned char)(i * 7);
+	}
+	for (i = 0; i < sizeof(iv); i++) {
+		iv[i] = (unsigned char)(0xa0 + i);
+	}
+	sm4_set_encrypt_key(&enc_key, user_key);
+	sm4_set_decrypt_key(&dec_key, user_key);
+
+	memcpy(enced, iv, 16);
+	sm4_cbc_encrypt(&enc_key, iv, in, sizeof(in)/16, enced + 16);
+
+	sm4_cbc_decrypt(&dec_key, iv, enced + 16, sizeof(in)/16, buf);
+	if (memcmp(buf, in, sizeof(in)) != 0) {
+		return 0;
+	}
+	memcpy(buf, enced, sizeof(enced));
+	sm4_cbc_decrypt(&dec_key, iv, buf + 16, sizeof(in)/16, buf + 16);
+	if (memcmp(buf + 16, in, sizeof(in)) != 0) {
+		return 0;
+	}
+	memcpy(buf, enced, sizeof(enced));
+	sm4_cbc_decrypt(&dec_key, iv, buf + 16, sizeof(in)/16, buf);
+	if (memcmp(buf, in, sizeof(in)) != 0) {
+		return 0;
+	}
+	return 1;
+}
+
+/* RFC 8998 A.1, then a longer message in place and a forged tag */
+static int test_gcm(void)
+{
+	SM4_GCM_KEY gcm_key;
+	SM4_KEY key;
+	unsigned char user_key[16] = {
+		0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+		0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10,
+	};
+	unsigned char iv[12] = {
+		0x00, 0x00, 0x12, 0x34, 0x56, 0x78, 0x00, 0x00,
+		0x00, 0x00, 0xab, 0xcd,
+	};
+	unsigned char aad[20] = {
+		0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+		0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+		0xab, 0xad, 0xda, 0xd2,
+	};
+	unsigned char plaintext[64] = {
+		0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
+		0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+		0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc,
+		0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd,
+		0xee, 0xee, 0xee, 0xee, 0xee, 0xee, 0xee, 0xee,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0xee, 0xee, 0xee, 0xee, 0xee, 0xee, 0xee, 0xee,
+		0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
+	};
+	unsigned char ciphertext[64] = {
+		0x17, 0xf3, 0x99, 0xf0, 0x8c, 0x67, 0xd5, 0xee,
+		0x19, 0xd0, 0xdc, 0x99, 0x69, 0xc4, 0xbb, 0x7d,
+		0x5f, 0xd4, 0x6f, 0xd3, 0x75, 0x64, 0x89, 0x06,
+		0x91, 0x57, 0xb2, 0x82, 0xbb, 0x20, 0x07, 0x35,
+		0xd8, 0x27, 0x10, 0xca, 0x5c, 0x22, 0xf0, 0xcc,
+		0xfa, 0x7c, 0xbf, 0x93, 0xd4, 0x96, 0xac, 0x15,
+		0xa5, 0x68, 0x34, 0xcb, 0xcf, 0x98, 0xc3, 0x97,
+		0xb4, 0x02, 0x4a, 0x26, 0x91, 0x23, 0x3b, 0x8d,
+	};
+	unsigned char tag[16] = {
+		0x83, 0xde, 0x35, 0x41, 0xe4, 0xc2, 0xb5, 0x81,
+		0x77, 0xe0, 0x65, 0xa9, 0xbf, 0x7b, 0x62, 0xec,
+	};
+	unsigned char in[16 * 37 + 5];
+	unsigned char enced[sizeof(in)];
+	unsigned char buf[sizeof(in)];
+	unsigned char mac[16];
+	int i;
+
+	sm4_gcm_set_key(&gcm_key, user_key);
+	sm4_gcm_encrypt_with_key(&gcm_key, iv, sizeof(iv), aad, sizeof(aad),
+		plaintext, sizeof(plaintext), buf, sizeof(mac), mac);
+	if (memcmp(buf, ciphertext, sizeof(ciphertext)) != 0
+		|| memcmp(mac, tag, sizeof(tag)) != 0) {
+		return 0;
+	}
+
+	for (i = 0; i < sizeof(in); i++) {
+		in[i] = (unsigned char)(i * 7);
+	}
+	sm4_set_encrypt_key(&key, user_key);
+	sm4_gcm_encrypt(&key, iv, sizeof(iv), aad, sizeof(aad), in, sizeof(in), enced, sizeof(mac), mac);
+
+	memcpy(buf, enced, sizeof(enced));
+	if (sm4_gcm_decrypt_with_key(&gcm_key, iv, sizeof(iv), aad, sizeof(aad),
+		buf, sizeof(buf), mac, sizeof(mac), buf) != 1
+		|| memcmp(buf, in, sizeof(in)) != 0) {
+		return 0;
+	}
+	mac[15] ^= 1;
+	if (sm4_gcm_decrypt_with_key(&gcm_key, iv, sizeof(iv), aad, sizeof(aad),
+		enced, sizeof(enced), mac, sizeof(mac), buf) != -1) {
+		return 0;
+	}
+	return 1;
+}
+
+static void speed_sm4(void)
+{
+	SM4_KEY key;
+	SM4_GCM_KEY gcm_key;
+	unsigned char user_key[16] = {0};
+	unsigned char iv[16] = {0};
+	unsigned char tag[16];
+	unsigned char *buf;
+	size_t len = 16384;
+	int count = 200;
+	clock_t begin, end;
+	int i;
+
+	if (!(buf = calloc(1, len))) {
+		return;
+	}
+	sm4_set_encrypt_key(&key, user_key);
+
+	begin = clock();
+	for (i = 0; i < count; i++) {
+		sm4_encrypt_blocks(&key, buf, buf, len/16);
+	}
+	end = clock();
+	printf("sm4_encrypt_blocks: %8.1f MB/s\n", (double)len * count / 1000000 / ((double)(end - begin) / CLOCKS_PER_SEC));
+
+	begin = clock();
+	for (i = 0; i < count; i++) {
+		sm4_cbc_decrypt(&key, iv, buf, len/16, buf);
+	}
+	end = clock();
+	printf("sm4_cbc_decrypt   : %8.1f MB/s\n", (double)len * count / 1000000 / ((double)(end - begin) / CLOCKS_PER_SEC));
+
+	begin = clock();
+	for (i = 0; i < count; i++) {
+		sm4_ctr_encrypt(&key, iv, buf, len, buf);
+	}
+	end = clock();
+	printf("sm4_ctr_encrypt   : %8.1f MB/s\n", (double)len * count / 1000000 / ((double)(end - begin) / CLOCKS_PER_SEC));
+
+	begin = clock();
+	for (i = 0; i < count; i++) {
+		sm4_cbc_encrypt(&key, iv, buf, len/16, buf);
+	}
+	end = clock();
+	printf("sm4_cbc_encrypt   : %8.1f MB/s\n", (double)len * count / 1000000 / ((double)(end - begin) / CLOCKS_PER_SEC));
+
+	sm4_gcm_set_key(&gcm_key, user_key);
+	begin = clock();
+	for (i = 0; i < count; i++) {
+		sm4_gcm_encrypt_with_key(&gcm_key, iv, 12, NULL, 0, buf, len, buf, sizeof(tag), tag);
+	}
+	end = clock();
+	printf("sm4_gcm_encrypt   : %8.1f MB/s\n", (double)len * count / 1000000 / ((double)(end - begin) / CLOCKS_PER_SEC));
+
+	free(buf);
+}
+
 /*
 static int test_ede(void)
 {
@@ -268,6 +501,13 @@ int main(int argc, char **argv)
 	}
 	printf("sm4 encrypt 1000000 times pass!\n");
 
+	/* test ecb */
+	if (!test_ecb(0)) {
+		printf("sm4 ecb not pass!\n");
+		err++;
+	} else
+		printf("sm4 ecb pass!\n");
+
 	/* test ctr32 */
 	if (!test_ctr32(0)) {
 		printf("sm4 ctr32 not pass!\n");
@@ -275,6 +515,27 @@ int main(int argc, char **argv)
 	} else
 		printf("sm4 ctr32 pass!\n");
 
+	/* test ctr counter wrap */
+	if (!test_ctr_wrap()) {
+		printf("sm4 ctr wrap not pass!\n");
+		err++;
+	} else
+		printf("sm4 ctr wrap pass!\n");
+
+	/* test cbc decrypt */
+	if (!test_cbc_decrypt()) {
+		printf("sm4 cbc decrypt not pass!\n");
+		err++;
+	} else
+		printf("sm4 cbc decrypt pass!\n");
+
+	/* test gcm */
+	if (!test_gcm()) {
+		printf("sm4 gcm not pass!\n");
+		err++;
+	} else
+		printf("sm4 gcm pass!\n");
+
 	/* test ede */
 /*
 	if (!test_ede()) {
@@ -301,6 +562,8 @@ int main(int argc, char **argv)
 		printf("sm4 ctr32 in avx2 pass!\n");
 # endif
 
+	speed_sm4();
+
 	if (err == 0)
 		printf("sm4 all test vectors pass!\n");
 	else
@@ -103,7 +103,7 @@ static int test_tls_encode(void)
 static int test_tls_cbc(void)
 {
 	uint8_t key[32];
-	SM3_HMAC_CTX hmac_ctx;
+	SM3_HMAC_KEY hmac_key;
 	SM4_KEY sm4_key;
 	uint8_t seq_num[8] = { 0,0,0,0,0,0,0,1 };
 	uint8_t header[5];
@@ -113,19 +113,19 @@ static int test_tls_cbc(void)
 	size_t len;
 	size_t buflen;
 
-	sm3_hmac_init(&hmac_ctx, key, 32);
+	sm3_hmac_set_key(&hmac_key, key, 32);
 	sm4_set_encrypt_key(&sm4_key, key);
 
-	tls_cbc_encrypt(&hmac_ctx, &sm4_key, seq_num, header, in, sizeof(in), out, &len);
+	tls_cbc_encrypt(&hmac_key, &sm4_key, seq_num, header, in, sizeof(in), out, &len);
 
 	printf("%zu\n", len);
 	print_der(out, len);
 	printf("\n");
 
-	sm3_hmac_init(&hmac_ctx, key, 32);
+	sm3_hmac_set_key(&hmac_key, key, 32);
 	sm4_set_decrypt_key(&sm4_key, key);
 
-	tls_cbc_decrypt(&hmac_ctx, &sm4_key, seq_num, header, out, len, buf, &buflen);
+	tls_cbc_decrypt(&hmac_key, &sm4_key, seq_num, header, out, len, buf, &buflen);
 
 	printf("%s\n", buf);
 
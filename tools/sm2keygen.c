@@ -59,6 +59,55 @@
 #include <unistd.h>
 #endif
 
+#define KEYGEN_BATCH_SIZE 256
+
+// write <outdir>/<i>.pem and <outdir>/<i>_pub.pem for i = 0 .. count - 1
+static int keygen_to_dir(const char *pass, int count, const char *outdir)
+{
+	SM2_KEY keys[KEYGEN_BATCH_SIZE];
+	char path[1024];
+	FILE *fp;
+	int ret = -1;
+	int i, j, n;
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < KEYGEN_BATCH_SIZE ? count - i : KEYGEN_BATCH_SIZE;
+		if (sm2_keygen_batch(keys, n) != 1) {
+			error_print();
+			goto end;
+		}
+		for (j = 0; j < n; j++) {
+			snprintf(path, sizeof(path), "%s/%d.pem", outdir, i + j);
+			if (!(fp = fopen(path, "w"))) {
+				fprintf(stderr, "error: open '%s' failure\n", path);
+				goto end;
+			}
+			if (sm2_enced_private_key_info_to_pem(&keys[j], pass, fp) != 1) {
+				fclose(fp);
+				error_print();
+				goto end;
+			}
+			fclose(fp);
+
+			snprintf(path, sizeof(path), "%s/%d_pub.pem", outdir, i + j);
+			if (!(fp = fopen(path, "w"))) {
+				fprintf(stderr, "error: open '%s' failure\n", path);
+				goto end;
+			}
+			if (sm2_public_key_info_to_pem(&keys[j], fp) != 1) {
+				fclose(fp);
+				error_print();
+				goto end;
+			}
+			fclose(fp);
+		}
+	}
+	ret = 0;
+end:
+	memset(keys, 0, sizeof(keys));
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	char *prog = argv[0];
@@ -68,6 +117,8 @@ int main(int argc, char **argv)
 	char *puboutfile = NULL;
 	FILE *outfp = stdout;
 	FILE *puboutfp = stdout;
+	char *outdir = NULL;
+	int count = 0;
 	SM2_KEY key;
 
 	argc--;
@@ -77,6 +128,7 @@ int main(int argc, char **argv)
 		if (!strcmp(*argv, "-help")) {
 help:
 			fprintf(stderr, "usage: %s [-pass passphrase] [-out pem] [-pubout pem]\n", prog);
+			fprintf(stderr, "       %s [-pass passphrase] -count num -outdir dir\n", prog);
 			return -1;
 
 		} else if (!strcmp(*argv, "-pass")) {
@@ -91,6 +143,18 @@ help:
 			if (--argc < 1) goto bad;
 			puboutfile = *(++argv);
 
+		} else if (!strcmp(*argv, "-count")) {
+			if (--argc < 1) goto bad;
+			count = atoi(*(++argv));
+			if (count <= 0) {
+				fprintf(stderr, "%s: invalid '-count' value\n", prog);
+				return -1;
+			}
+
+		} else if (!strcmp(*argv, "-outdir")) {
+			if (--argc < 1) goto bad;
+			outdir = *(++argv);
+
 		} else {
 			fprintf(stderr, "%s: illegal option '%s'\n", prog, *argv);
 			goto help;
@@ -116,6 +180,14 @@ help:
 #endif
 	}
 
+	if (count || outdir) {
+		if (!count || !outdir || outfile || puboutfile) {
+			fprintf(stderr, "%s: '-count' and '-outdir' go together, without '-out' or '-pubout'\n", prog);
+			goto help;
+		}
+		return keygen_to_dir(pass, count, outdir);
+	}
+
 	if (outfile) {
 		if (!(outfp = fopen(outfile, "w"))) {
 			error_print();
@@ -72,6 +72,9 @@ int main(int argc, char **argv)
 	char *id = SM2_DEFAULT_ID;
 	char *infile = NULL;
 	char *outfile = NULL;
+	int tree = 0;
+	size_t leaf_size = SM3_TREE_DEFAULT_LEAF_SIZE;
+	int num_threads = 1;
 	FILE *keyfp = NULL;
 	FILE *infp = stdin;
 	FILE *outfp = stdout;
@@ -88,7 +91,8 @@ int main(int argc, char **argv)
 	while (argc > 0) {
 		if (!strcmp(*argv, "-help")) {
 help:
-			fprintf(stderr, "usage: %s -key pem [-pass password] [-id str] [-in file] [-out file]\n", prog);
+			fprintf(stderr, "usage: %s -key pem [-pass password] [-id str] [-tree [-leaf-size bytes] [-threads num]] [-in file] [-out file]\n", prog);
+			fprintf(stderr, "  -tree  sign the SM3 tree hash root of the input instead of the input\n");
 			return -1;
 
 		} else if (!strcmp(*argv, "-key")) {
@@ -103,6 +107,25 @@ help:
 			if (--argc < 1) goto bad;
 			id = *(++argv);
 
+		} else if (!strcmp(*argv, "-tree")) {
+			tree = 1;
+
+		} else if (!strcmp(*argv, "-leaf-size")) {
+			if (--argc < 1) goto bad;
+			leaf_size = (size_t)strtoul(*(++argv), NULL, 10);
+			if (!leaf_size || leaf_size % SM3_BLOCK_SIZE) {
+				fprintf(stderr, "%s: '-leaf-size' must be a multiple of %d\n", prog, SM3_BLOCK_SIZE);
+				goto help;
+			}
+
+		} else if (!strcmp(*argv, "-threads")) {
+			if (--argc < 1) goto bad;
+			num_threads = atoi(*(++argv));
+			if (num_threads < 1) {
+				fprintf(stderr, "%s: invalid '-threads' value\n", prog);
+				goto help;
+			}
+
 		} else if (!strcmp(*argv, "-in")) {
 			if (--argc < 1) goto bad;
 			infile = *(++argv);
@@ -158,8 +181,18 @@ help:
 
 	sm2_sign_init(&sign_ctx, &key, id);
 
-	while ((len = fread(buf, 1, sizeof(buf), infp)) > 0) {
-		sm2_sign_update(&sign_ctx, buf, len);
+	if (tree) {
+		uint8_t root[32];
+
+		if (sm3_tree_digest_file(infp, leaf_size, num_threads, root) != 1) {
+			error_print();
+			return -1;
+		}
+		sm2_sign_update(&sign_ctx, root, sizeof(root));
+	} else {
+		while ((len = fread(buf, 1, sizeof(buf), infp)) > 0) {
+			sm2_sign_update(&sign_ctx, buf, len);
+		}
 	}
 	sm2_sign_finish(&sign_ctx, sig, &siglen);
 
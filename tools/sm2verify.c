@@ -69,6 +69,9 @@ int main(int argc, char **argv)
 	char *certfile = NULL;
 	char *infile = NULL;
 	char *sigfile = NULL;
+	int tree = 0;
+	size_t leaf_size = SM3_TREE_DEFAULT_LEAF_SIZE;
+	int num_threads = 1;
 	FILE *pubkeyfp = NULL;
 	FILE *certfp = NULL;
 	FILE *infp = stdin;
@@ -88,7 +91,7 @@ int main(int argc, char **argv)
 	while (argc > 1) {
 		if (!strcmp(*argv, "-help")) {
 help:
-			fprintf(stderr, "usage: %s {-pubkey pem | -cert pem} [-id str] [-in file] -sig file\n", prog);
+			fprintf(stderr, "usage: %s {-pubkey pem | -cert pem} [-id str] [-tree [-leaf-size bytes] [-threads num]] [-in file] -sig file\n", prog);
 			return -1;
 
 		} else if (!strcmp(*argv, "-pubkey")) {
@@ -103,6 +106,25 @@ help:
 			if (--argc < 1) goto bad;
 			id = *(++argv);
 
+		} else if (!strcmp(*argv, "-tree")) {
+			tree = 1;
+
+		} else if (!strcmp(*argv, "-leaf-size")) {
+			if (--argc < 1) goto bad;
+			leaf_size = (size_t)strtoul(*(++argv), NULL, 10);
+			if (!leaf_size || leaf_size % SM3_BLOCK_SIZE) {
+				fprintf(stderr, "%s: '-leaf-size' must be a multiple of %d\n", prog, SM3_BLOCK_SIZE);
+				goto help;
+			}
+
+		} else if (!strcmp(*argv, "-threads")) {
+			if (--argc < 1) goto bad;
+			num_threads = atoi(*(++argv));
+			if (num_threads < 1) {
+				fprintf(stderr, "%s: invalid '-threads' value\n", prog);
+				goto help;
+			}
+
 		} else if (!strcmp(*argv, "-in")) {
 			if (--argc < 1) goto bad;
 			infile = *(++argv);
@@ -148,7 +170,7 @@ help:
 	}
 
 	if (infile) {
-		if (!(infp = fopen(infile, "r"))) {
+		if (!(infp = fopen(infile, "rb"))) {
 			error_print();
 			return -1;
 		}
@@ -168,8 +190,18 @@ help:
 	}
 
 	sm2_verify_init(&verify_ctx, &key, id);
-	while ((len = fread(buf, 1, sizeof(buf), infp)) > 0) {
-		sm2_verify_update(&verify_ctx, buf, len);
+	if (tree) {
+		uint8_t root[32];
+
+		if (sm3_tree_digest_file(infp, leaf_size, num_threads, root) != 1) {
+			error_print();
+			return -1;
+		}
+		sm2_verify_update(&verify_ctx, root, sizeof(root));
+	} else {
+		while ((len = fread(buf, 1, sizeof(buf), infp)) > 0) {
+			sm2_verify_update(&verify_ctx, buf, len);
+		}
 	}
 
 	if ((ret = sm2_verify_finish(&verify_ctx, sig, siglen)) < 0) {
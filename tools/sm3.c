@@ -60,6 +60,9 @@ int main(int argc, char **argv)
 	char *pubkeyfile = NULL;
 	char *infile = NULL;
 	char *id = NULL;
+	int tree = 0;
+	size_t leaf_size = SM3_TREE_DEFAULT_LEAF_SIZE;
+	int num_threads = 1;
 	FILE *pubkeyfp = NULL;
 	FILE *infp = stdin;
 	SM3_CTX sm3_ctx;
@@ -74,8 +77,10 @@ int main(int argc, char **argv)
 	while (argc > 0) {
 		if (!strcmp(*argv, "-help")) {
 help:
-			fprintf(stderr, "usage: %s [-pubkey pem [-id str]] [-in file]\n", prog);
+			fprintf(stderr, "usage: %s [-pubkey pem [-id str]] [-tree [-leaf-size bytes] [-threads num]] [-in file]\n", prog);
 			fprintf(stderr, "usage: echo -n \"abc\" | %s\n", prog);
+			fprintf(stderr, "  -tree  print the SM3 tree hash root (version %d) instead of SM3,\n", SM3_TREE_VERSION);
+			fprintf(stderr, "         with -pubkey print SM3(Z || root) as signed by 'sm2sign -tree'\n");
 			return -1;
 
 		} else if (!strcmp(*argv, "-pubkey")) {
@@ -86,6 +91,25 @@ help:
 			if (--argc < 1) goto bad;
 			id = *(++argv);
 
+		} else if (!strcmp(*argv, "-tree")) {
+			tree = 1;
+
+		} else if (!strcmp(*argv, "-leaf-size")) {
+			if (--argc < 1) goto bad;
+			leaf_size = (size_t)strtoul(*(++argv), NULL, 10);
+			if (!leaf_size || leaf_size % SM3_BLOCK_SIZE) {
+				fprintf(stderr, "%s: '-leaf-size' must be a multiple of %d\n", prog, SM3_BLOCK_SIZE);
+				return -1;
+			}
+
+		} else if (!strcmp(*argv, "-threads")) {
+			if (--argc < 1) goto bad;
+			num_threads = atoi(*(++argv));
+			if (num_threads < 1) {
+				fprintf(stderr, "%s: invalid '-threads' value\n", prog);
+				return -1;
+			}
+
 		} else if (!strcmp(*argv, "-in")) {
 			if (--argc < 1) goto bad;
 			infile = *(++argv);
@@ -128,16 +152,27 @@ help:
 	}
 
 	if (infile) {
-		if (!(infp = fopen(infile, "r"))) {
+		if (!(infp = fopen(infile, "rb"))) {
 			error_print();
 			return -1;
 		}
 	}
-	while ((len = fread(buf, 1, sizeof(buf), infp)) > 0) {
-		sm3_update(&sm3_ctx, buf, len);
+	if (tree) {
+		if (sm3_tree_digest_file(infp, leaf_size, num_threads, dgst) != 1) {
+			error_print();
+			return -1;
+		}
+		if (pubkeyfile) {
+			sm3_update(&sm3_ctx, dgst, sizeof(dgst));
+			sm3_finish(&sm3_ctx, dgst);
+		}
+	} else {
+		while ((len = fread(buf, 1, sizeof(buf), infp)) > 0) {
+			sm3_update(&sm3_ctx, buf, len);
+		}
+		sm3_finish(&sm3_ctx, dgst);
 	}
 
-	sm3_finish(&sm3_ctx, dgst);
 	for (i = 0; i < sizeof(dgst); i++) {
 		printf("%02x", dgst[i]);
 	}